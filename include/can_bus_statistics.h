@@ -0,0 +1,315 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+
+#include "can_interface.h"
+
+/**
+ * @brief Counts traffic per ID in both directions and estimates bus load. Wraps an ICAN: frames sent through it are
+ * counted as TX, and it registers itself with the wrapped ICAN to see every received frame as RX. Uses a fixed-size
+ * table and never allocates, so it can be left on in production.
+ *
+ * Frames must be recorded from one context at a time. The backends dispatch RX from Tick(), so this holds as long as
+ * sends also happen from the Tick() task (put a CANTXQueue in front of this if several tasks transmit).
+ *
+ * @tparam max_ids The maximum number of distinct IDs tracked, frames with IDs beyond this are only counted in the
+ * totals
+ */
+template <size_t max_ids = 64>
+class CANBusStatistics : public ICAN
+{
+public:
+    struct IDStatistics
+    {
+        bool in_use{false};
+        bool extended_id{false};
+        uint32_t id{0};
+        uint32_t tx_frames{0};
+        uint32_t rx_frames{0};
+        uint32_t tx_bytes{0};
+        uint32_t rx_bytes{0};
+        uint32_t expected_period_us{0};  // 0 if unknown, jitter and missed frames are only tracked when set
+        uint32_t last_seen_us{0};
+        uint32_t min_interval_us{0xFFFFFFFF};
+        uint32_t max_interval_us{0};
+        uint32_t max_jitter_us{0};  // largest difference between an interval and the expected period
+        uint32_t missed_frames{0};  // frames that should have arrived inside intervals longer than 1.5 periods
+    };
+
+    /**
+     * @brief Construct a new CANBusStatistics object
+     *
+     * @param can_interface The ICAN to monitor
+     * @param get_micros A function to get the current time in microseconds on the current platform
+     * @param load_window_us The period over which the bus load is averaged
+     */
+    CANBusStatistics(ICAN &can_interface, std::function<uint32_t(void)> get_micros, uint32_t load_window_us = 1000000)
+        : can_interface_{can_interface}, get_micros_{get_micros}, load_window_us_{load_window_us}, rx_monitor_{*this}
+    {
+        window_start_us_ = get_micros_();
+        can_interface_.RegisterRXMessage(rx_monitor_);
+    }
+
+#ifdef ARDUINO
+    CANBusStatistics(ICAN &can_interface, uint32_t load_window_us = 1000000)
+        : CANBusStatistics(can_interface, []() { return micros(); }, load_window_us)
+    {
+    }
+#endif
+
+    void Initialize(BaudRate baud) override
+    {
+        baud_ = baud;
+        can_interface_.Initialize(baud);
+    }
+
+    bool SendMessage(CANMessage &msg) override
+    {
+        bool sent = can_interface_.SendMessage(msg);
+        if (sent)
+        {
+            Record(msg, true);
+        }
+        return sent;
+    }
+
+    void RegisterRXMessage(ICANRXMessage &msg) override { can_interface_.RegisterRXMessage(msg); }
+
+    bool AttachTap(ICANTap &tap) override { return can_interface_.AttachTap(tap); }
+
+    void Tick() override
+    {
+        can_interface_.Tick();
+        UpdateBusLoad(get_micros_());
+    }
+
+    /**
+     * @brief Sets the expected cycle time of an ID (usually GenMsgCycleTime from the DBC) so jitter and missing frames
+     * are tracked for it
+     */
+    void SetExpectedPeriod(uint32_t id, uint32_t period_ms, bool extended_id = false)
+    {
+        IDStatistics *statistics = Find(id, extended_id, true);
+        if (statistics != nullptr)
+        {
+            statistics->expected_period_us = period_ms * 1000;
+        }
+    }
+
+    // Returns nullptr if the ID hasn't been seen
+    const IDStatistics *GetIDStatistics(uint32_t id, bool extended_id = false) const
+    {
+        return const_cast<CANBusStatistics *>(this)->Find(id, extended_id, false);
+    }
+
+    // The table is sparse, check in_use when iterating
+    const std::array<IDStatistics, max_ids> &GetTable() const { return table_; }
+
+    // Fraction of the bus (0 to 1) used during the last complete load window, based on worst-case stuffed frame length
+    float GetBusLoad() const { return bus_load_; }
+    // The highest GetBusLoad() seen since the last Reset()
+    float GetPeakBusLoad() const { return peak_bus_load_; }
+
+    uint32_t GetTotalTXFrames() const { return total_tx_frames_; }
+    uint32_t GetTotalRXFrames() const { return total_rx_frames_; }
+    uint32_t GetTotalMissedFrames() const { return total_missed_frames_; }
+    // Frames whose ID didn't fit in the table
+    uint32_t GetUntrackedFrames() const { return untracked_frames_; }
+
+    // Clears all counters, but keeps the expected periods
+    void Reset()
+    {
+        for (IDStatistics &statistics : table_)
+        {
+            if (statistics.in_use)
+            {
+                IDStatistics cleared{};
+                cleared.in_use = true;
+                cleared.extended_id = statistics.extended_id;
+                cleared.id = statistics.id;
+                cleared.expected_period_us = statistics.expected_period_us;
+                statistics = cleared;
+            }
+        }
+        total_tx_frames_ = 0;
+        total_rx_frames_ = 0;
+        total_missed_frames_ = 0;
+        untracked_frames_ = 0;
+        window_bits_ = 0;
+        window_start_us_ = get_micros_();
+        bus_load_ = 0;
+        peak_bus_load_ = 0;
+    }
+
+private:
+    // Registered with the wrapped ICAN, which hands every received frame to every registered message
+    class RXMonitor : public ICANRXMessage
+    {
+    public:
+        RXMonitor(CANBusStatistics &statistics) : statistics_{statistics} {}
+        uint32_t GetID() override { return 0; }
+        void DecodeSignals(CANMessage message) override { statistics_.Record(message, false); }
+
+    private:
+        CANBusStatistics &statistics_;
+    };
+
+    ICAN &can_interface_;
+    std::function<uint32_t(void)> get_micros_;
+    const uint32_t load_window_us_;
+    RXMonitor rx_monitor_;
+    BaudRate baud_{BaudRate::kBaud500K};
+
+    std::array<IDStatistics, max_ids> table_{};
+    uint32_t total_tx_frames_{0};
+    uint32_t total_rx_frames_{0};
+    uint32_t total_missed_frames_{0};
+    uint32_t untracked_frames_{0};
+
+    uint32_t window_start_us_{0};
+    uint32_t window_bits_{0};
+    float bus_load_{0};
+    float peak_bus_load_{0};
+
+    // Open addressing with linear probing, the table never shrinks
+    IDStatistics *Find(uint32_t id, bool extended_id, bool insert)
+    {
+        size_t index = static_cast<size_t>((id * 2654435761u) >> 16) % max_ids;
+        for (size_t probe = 0; probe < max_ids; probe++)
+        {
+            IDStatistics &statistics = table_[(index + probe) % max_ids];
+            if (!statistics.in_use)
+            {
+                if (!insert)
+                {
+                    return nullptr;
+                }
+                statistics.in_use = true;
+                statistics.id = id;
+                statistics.extended_id = extended_id;
+                return &statistics;
+            }
+            if (statistics.id == id && statistics.extended_id == extended_id)
+            {
+                return &statistics;
+            }
+        }
+        return nullptr;
+    }
+
+    void Record(const CANMessage &msg, bool tx)
+    {
+        uint32_t now = get_micros_();
+        (tx ? total_tx_frames_ : total_rx_frames_)++;
+        window_bits_ += CANWorstCaseFrameBits(msg.len_, msg.extended_id_);
+
+        IDStatistics *statistics = Find(msg.id_, msg.extended_id_, true);
+        if (statistics == nullptr)
+        {
+            untracked_frames_++;
+            return;
+        }
+        if (tx)
+        {
+            statistics->tx_frames++;
+            statistics->tx_bytes += msg.len_;
+        }
+        else
+        {
+            statistics->rx_frames++;
+            statistics->rx_bytes += msg.len_;
+        }
+
+        if (statistics->tx_frames + statistics->rx_frames > 1)
+        {
+            uint32_t interval = now - statistics->last_seen_us;
+            statistics->min_interval_us = std::min(statistics->min_interval_us, interval);
+            statistics->max_interval_us = std::max(statistics->max_interval_us, interval);
+            uint32_t period = statistics->expected_period_us;
+            if (period != 0)
+            {
+                uint32_t jitter = interval > period ? interval - period : period - interval;
+                statistics->max_jitter_us = std::max(statistics->max_jitter_us, jitter);
+                if (interval > period + period / 2)
+                {
+                    // round to the nearest number of periods, one of which is this frame
+                    uint32_t missed = (interval + period / 2) / period - 1;
+                    statistics->missed_frames += missed;
+                    total_missed_frames_ += missed;
+                }
+            }
+        }
+        statistics->last_seen_us = now;
+    }
+
+    void UpdateBusLoad(uint32_t now)
+    {
+        uint32_t elapsed = now - window_start_us_;
+        if (elapsed < load_window_us_)
+        {
+            return;
+        }
+        bus_load_ = static_cast<float>(static_cast<double>(window_bits_) * 1000000.0
+                                       / (static_cast<double>(elapsed) * static_cast<double>(baud_)));
+        peak_bus_load_ = std::max(peak_bus_load_, bus_load_);
+        window_bits_ = 0;
+        window_start_us_ = now;
+    }
+};
+
+/**
+ * @brief Periodically broadcasts a summary of a CANBusStatistics as a diagnostic message:
+ * bus load (0.01 %/bit, bits 0-15), total TX frames (bits 16-31), total RX frames (bits 32-47) and total missed frames
+ * (bits 48-63). The counters wrap at 16 bits.
+ */
+template <size_t max_ids>
+class CANBusStatisticsMessage
+{
+public:
+    /**
+     * @brief Construct a new CANBusStatisticsMessage object
+     *
+     * @param statistics The statistics to report
+     * @param can_interface The ICAN the message will be transmitted on (usually the statistics object itself)
+     * @param id The ID of the diagnostic message
+     * @param period The transmit period in ms
+     * @param timer_group A timer group to add the transmit timer to
+     */
+    CANBusStatisticsMessage(CANBusStatistics<max_ids> &statistics,
+                            ICAN &can_interface,
+                            uint32_t id,
+                            uint32_t period,
+                            VirtualTimerGroup &timer_group)
+        : statistics_{statistics},
+          message_{can_interface,
+                   id,
+                   8,
+                   period,
+                   timer_group,
+                   bus_load_signal_,
+                   tx_frames_signal_,
+                   rx_frames_signal_,
+                   missed_frames_signal_}
+    {
+    }
+
+    void Enable() { message_.Enable(); }
+    void Disable() { message_.Disable(); }
+
+private:
+    CANBusStatistics<max_ids> &statistics_;
+
+    MakeUnsignedCANSignal(float, 0, 16, 0.01, 0) bus_load_signal_{[this]() { return statistics_.GetBusLoad() * 100; }};
+    MakeUnsignedCANSignal(uint16_t, 16, 16, 1, 0) tx_frames_signal_{
+        [this]() { return static_cast<uint16_t>(statistics_.GetTotalTXFrames()); }};
+    MakeUnsignedCANSignal(uint16_t, 32, 16, 1, 0) rx_frames_signal_{
+        [this]() { return static_cast<uint16_t>(statistics_.GetTotalRXFrames()); }};
+    MakeUnsignedCANSignal(uint16_t, 48, 16, 1, 0) missed_frames_signal_{
+        [this]() { return static_cast<uint16_t>(statistics_.GetTotalMissedFrames()); }};
+
+    CANTXMessage<4> message_;
+};
@@ -0,0 +1,908 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "can_log.h"
+#include "can_log_decoder.h"
+#include "crc32.h"
+#include "dbc_database.h"
+#include "dbc_decode_table.h"
+
+/*
+ * Columnar signal file format
+ *
+ * Decoded signals stored column by column, so an analysis tool reading a few signals only touches their bytes. Each
+ * DBC message is a table with its own timestamp column and one column per signal. Rows are cut into chunks of up to
+ * rows_per_chunk rows, and every column of a chunk is compressed on its own. Signals are stored as raw integer values
+ * (so storage is lossless and compresses well), the footer carries the factor and offset to scale them. All integers
+ * are little endian, varints are the LEB128 varints of can_log.h.
+ *
+ * File:
+ *   uint32 magic ("CCF1"), uint32 version (1)
+ *   column chunks, in the order they were written
+ *   footer
+ *   uint64 footer offset, uint32 CRC-32 of the footer, uint32 magic
+ *
+ * Footer:
+ *   varint message count, then per message:
+ *     string name, uint32 ID, uint8 extended ID, varint signal count, then per signal:
+ *       string name, string unit, uint8 flags (bit 0 signed, bit 1 multiplexed), uint32 multiplexor value,
+ *       float64 factor, float64 offset
+ *     varint chunk count, then per chunk:
+ *       varint rows, uint64 minimum timestamp, uint64 maximum timestamp, timestamp column location, then per signal:
+ *         column location, int64 minimum raw value, int64 maximum raw value (uint64 bits for unsigned signals, both 0
+ *         if every row is absent), varint absent rows
+ *   Column location: uint64 offset, uint32 size, uint32 CRC-32 of the column chunk. Strings are a varint length and
+ *   the bytes.
+ *
+ * Column chunk:
+ *   uint8 flags: bit 0 presence bitmap follows, bit 1 delta encoded
+ *   varint rows
+ *   presence bitmap if flagged: bit n of byte n / 8 set if row n has a value (multiplexed signals the row's frame
+ *     didn't carry have none), only rows with a value are stored below
+ *   uint8 bit width
+ *   varint zigzag base
+ *   varint zigzag first value, if delta encoded
+ *   the values bit-packed, least significant bit first: value - base, or if delta encoded, for every value after the
+ *     first, its difference to the previous one - base. All arithmetic wraps at 64 bits.
+ */
+
+static constexpr uint32_t kCANColumnarMagic{0x31464343};  // "CCF1"
+static constexpr uint32_t kCANColumnarVersion{1};
+
+inline void CANColumnarPutVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    uint8_t buffer[10];
+    out.insert(out.end(), buffer, buffer + CANLogPutVarint(buffer, value));
+}
+
+inline void CANColumnarPut32(std::vector<uint8_t> &out, uint32_t value)
+{
+    uint8_t buffer[4];
+    CANLogPut32(buffer, value);
+    out.insert(out.end(), buffer, buffer + 4);
+}
+
+inline void CANColumnarPut64(std::vector<uint8_t> &out, uint64_t value)
+{
+    uint8_t buffer[8];
+    CANLogPut64(buffer, value);
+    out.insert(out.end(), buffer, buffer + 8);
+}
+
+inline uint64_t CANColumnarZigzag(uint64_t value)
+{
+    return (value << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+
+inline uint64_t CANColumnarUnzigzag(uint64_t value) { return (value >> 1) ^ (~(value & 1) + 1); }
+
+inline uint8_t CANColumnarBitWidth(uint64_t value)
+{
+    uint8_t width = 0;
+    while (value != 0)
+    {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+/**
+ * @brief Encodes count integers (two's complement for signed columns) as a column chunk body, choosing between
+ * frame-of-reference and delta encoding, whichever packs into fewer bits
+ *
+ * @param present If not nullptr, a presence bitmap over rows and values holds only the present rows
+ */
+inline void EncodeCANColumn(const uint64_t *values,
+                            size_t count,
+                            size_t rows,
+                            const std::vector<uint8_t> *present,
+                            bool is_signed,
+                            std::vector<uint8_t> &out)
+{
+    // frame of reference: the smallest value as base, compared as signed or unsigned like the signal
+    uint64_t min = count > 0 ? values[0] : 0;
+    uint64_t max = min;
+    for (size_t i = 1; i < count; i++)
+    {
+        bool less = is_signed ? static_cast<int64_t>(values[i]) < static_cast<int64_t>(min) : values[i] < min;
+        bool greater = is_signed ? static_cast<int64_t>(values[i]) > static_cast<int64_t>(max) : values[i] > max;
+        min = less ? values[i] : min;
+        max = greater ? values[i] : max;
+    }
+    uint8_t packed_width = CANColumnarBitWidth(max - min);
+    // delta: differences are always compared as signed, a counter wrapping around is one large negative step
+    int64_t min_delta = 0;
+    int64_t max_delta = 0;
+    for (size_t i = 1; i < count; i++)
+    {
+        int64_t delta = static_cast<int64_t>(values[i] - values[i - 1]);
+        min_delta = i == 1 || delta < min_delta ? delta : min_delta;
+        max_delta = i == 1 || delta > max_delta ? delta : max_delta;
+    }
+    uint8_t delta_width =
+        CANColumnarBitWidth(static_cast<uint64_t>(max_delta) - static_cast<uint64_t>(min_delta));
+    bool delta = count > 1 && static_cast<uint64_t>(delta_width) * (count - 1) + 80 < packed_width * count;
+
+    out.push_back(static_cast<uint8_t>((present != nullptr ? 1 : 0) | (delta ? 2 : 0)));
+    CANColumnarPutVarint(out, rows);
+    if (present != nullptr)
+    {
+        out.insert(out.end(), present->begin(), present->end());
+    }
+    uint8_t width = delta ? delta_width : packed_width;
+    uint64_t base = delta ? static_cast<uint64_t>(min_delta) : min;
+    out.push_back(width);
+    CANColumnarPutVarint(out, CANColumnarZigzag(base));
+    if (delta)
+    {
+        CANColumnarPutVarint(out, CANColumnarZigzag(values[0]));
+    }
+
+    uint64_t buffer = 0;
+    unsigned bits = 0;
+    auto put = [&out, &buffer, &bits](uint64_t value, unsigned value_width)
+    {
+        // value_width is at most 32, so with fewer than 8 bits pending the buffer can't overflow
+        buffer |= value << bits;
+        bits += value_width;
+        while (bits >= 8)
+        {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            bits -= 8;
+        }
+    };
+    for (size_t i = delta ? 1 : 0; i < count && width > 0; i++)
+    {
+        uint64_t value = (delta ? values[i] - values[i - 1] : values[i]) - base;
+        if (width > 32)
+        {
+            put(value & 0xFFFFFFFFu, 32);
+            put(value >> 32, width - 32u);
+        }
+        else
+        {
+            put(value, width);
+        }
+    }
+    if (bits > 0)
+    {
+        out.push_back(static_cast<uint8_t>(buffer));
+    }
+}
+
+/**
+ * @brief Decodes a column chunk body
+ *
+ * @param values Receives one value per row, 0 for absent rows
+ * @param present Receives one entry per row, 1 if the row has a value
+ * @return false if the chunk is malformed
+ */
+inline bool DecodeCANColumn(const uint8_t *data,
+                            size_t size,
+                            std::vector<uint64_t> &values,
+                            std::vector<uint8_t> &present)
+{
+    const uint8_t *in = data;
+    const uint8_t *end = data + size;
+    uint64_t rows;
+    if (size < 1 || !CANLogGetVarint(++in, end, rows) || rows > (1ull << 32))
+    {
+        return false;
+    }
+    uint8_t flags = data[0];
+    present.assign(static_cast<size_t>(rows), 1);
+    size_t count = static_cast<size_t>(rows);
+    if (flags & 1)
+    {
+        size_t bitmap_size = (count + 7) / 8;
+        if (static_cast<size_t>(end - in) < bitmap_size)
+        {
+            return false;
+        }
+        count = 0;
+        for (size_t row = 0; row < rows; row++)
+        {
+            present[row] = (in[row / 8] >> (row % 8)) & 1;
+            count += present[row];
+        }
+        in += bitmap_size;
+    }
+    bool delta = (flags & 2) != 0;
+    uint64_t base;
+    uint64_t value = 0;
+    if (in == end || *in > 64)
+    {
+        return false;
+    }
+    uint8_t width = *in++;
+    if (!CANLogGetVarint(in, end, base) || (delta && !CANLogGetVarint(in, end, value)))
+    {
+        return false;
+    }
+    base = CANColumnarUnzigzag(base);
+    value = CANColumnarUnzigzag(value);
+    size_t packed_count = delta && count > 0 ? count - 1 : count;
+    if (static_cast<uint64_t>(end - in) < (static_cast<uint64_t>(packed_count) * width + 7) / 8)
+    {
+        return false;
+    }
+
+    uint64_t buffer = 0;
+    unsigned bits = 0;
+    auto get = [&in, &buffer, &bits](unsigned value_width)
+    {
+        while (bits < value_width)
+        {
+            buffer |= static_cast<uint64_t>(*in++) << bits;
+            bits += 8;
+        }
+        uint64_t result = buffer & ((1ull << value_width) - 1);
+        buffer >>= value_width;
+        bits -= value_width;
+        return result;
+    };
+    values.assign(static_cast<size_t>(rows), 0);
+    size_t decoded = 0;
+    for (size_t row = 0; row < rows; row++)
+    {
+        if (!present[row])
+        {
+            continue;
+        }
+        uint64_t packed = 0;
+        if (width > 0 && !(delta && decoded == 0))
+        {
+            packed = get(width > 32 ? 32 : width);
+            packed |= width > 32 ? get(width - 32u) << 32 : 0;
+        }
+        if (delta)
+        {
+            value = decoded == 0 ? value : value + packed + base;
+        }
+        else
+        {
+            value = packed + base;
+        }
+        values[row] = value;
+        decoded++;
+    }
+    return true;
+}
+
+/**
+ * @brief Streams decoded frames into the columnar format (see above). Rows are buffered per message and written as a
+ * chunk once rows_per_chunk of them have accumulated, so memory stays bounded however long the log is; only the
+ * footer's chunk index grows. Plugs into CANLogDecoder (pass every CANDecodedFrame to Append) or takes raw frames.
+ */
+class CANColumnarWriter
+{
+public:
+    using Sink = std::function<bool(const uint8_t *data, size_t size)>;
+
+    /**
+     * @param database The DBC the frames are decoded with, it must outlive the writer
+     * @param sink Called with consecutive pieces of the file, returns false on a write error
+     * @param rows_per_chunk The number of rows per message buffered before they are written as a chunk
+     */
+    CANColumnarWriter(const DBCDatabase &database, Sink sink, size_t rows_per_chunk = 16384)
+        : database_(database), table_(database), sink_(sink), rows_per_chunk_(std::max<size_t>(1, rows_per_chunk))
+    {
+        messages_.resize(table_.GetMessageCount());
+        for (size_t i = 0; i < messages_.size(); i++)
+        {
+            messages_[i].columns.resize(table_.GetMessage(static_cast<uint16_t>(i)).signal_count);
+        }
+        std::vector<uint8_t> header;
+        CANColumnarPut32(header, kCANColumnarMagic);
+        CANColumnarPut32(header, kCANColumnarVersion);
+        Write(header);
+    }
+
+    /**
+     * @brief Adds a frame decoded by a CANLogDecoder using the same database
+     */
+    bool Append(const CANDecodedFrame &frame)
+    {
+        uint16_t index = static_cast<uint16_t>(frame.message - database_.messages.data());
+        return AppendPayload(index, frame.timestamp_us, frame.payload);
+    }
+
+    /**
+     * @brief Adds a raw frame, decoding it; frames with an ID that isn't in the DBC are counted and skipped
+     */
+    bool Append(uint64_t timestamp_us, const CANMessage &frame)
+    {
+        uint16_t index = table_.FindMessage(frame.id_, frame.extended_id_);
+        if (index == DBCDecodeTable::kNoMessage)
+        {
+            unknown_frames_++;
+            return !failed_;
+        }
+        uint64_t payload;
+        memcpy(&payload, frame.data_.data(), sizeof(payload));
+        return AppendPayload(index, timestamp_us, payload);
+    }
+
+    /**
+     * @brief Writes the buffered rows and the footer, the writer can't be used afterwards
+     *
+     * @return false if any write failed
+     */
+    bool Close()
+    {
+        if (closed_)
+        {
+            return !failed_;
+        }
+        for (size_t i = 0; i < messages_.size(); i++)
+        {
+            FlushMessage(i);
+        }
+        std::vector<uint8_t> footer;
+        WriteFooter(footer);
+        uint64_t footer_offset = offset_;
+        std::vector<uint8_t> trailer;
+        CANColumnarPut64(trailer, footer_offset);
+        CANColumnarPut32(trailer, CRC32(footer.data(), footer.size()));
+        CANColumnarPut32(trailer, kCANColumnarMagic);
+        Write(footer);
+        Write(trailer);
+        closed_ = true;
+        return !failed_;
+    }
+
+    uint64_t GetRowsWritten() const { return rows_written_; }
+    uint64_t GetChunksWritten() const { return chunks_written_; }
+    uint64_t GetBytesWritten() const { return offset_; }
+    uint64_t GetUnknownFrames() const { return unknown_frames_; }
+
+private:
+    struct ColumnLocation
+    {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t crc;
+    };
+
+    struct ColumnChunk
+    {
+        ColumnLocation location;
+        uint64_t min;
+        uint64_t max;
+        uint64_t absent;
+    };
+
+    struct Chunk
+    {
+        uint64_t rows;
+        uint64_t min_timestamp_us;
+        uint64_t max_timestamp_us;
+        ColumnLocation timestamps;
+        std::vector<ColumnChunk> columns;
+    };
+
+    struct Column
+    {
+        std::vector<uint64_t> values;   // present rows only
+        std::vector<uint8_t> present;  // bitmap over rows
+        bool any_absent{false};
+    };
+
+    struct Message
+    {
+        std::vector<uint64_t> timestamps;
+        std::vector<Column> columns;
+        std::vector<Chunk> chunks;
+    };
+
+    const DBCDatabase &database_;
+    DBCDecodeTable table_;
+    Sink sink_;
+    size_t rows_per_chunk_;
+    std::vector<Message> messages_;
+    std::vector<uint8_t> encoded_;
+    uint64_t offset_{0};
+    uint64_t rows_written_{0};
+    uint64_t chunks_written_{0};
+    uint64_t unknown_frames_{0};
+    bool failed_{false};
+    bool closed_{false};
+
+    bool AppendPayload(uint16_t index, uint64_t timestamp_us, uint64_t payload)
+    {
+        if (closed_ || index >= messages_.size())
+        {
+            return false;
+        }
+        const DBCDecodeMessage &decode_message = table_.GetMessage(index);
+        Message &message = messages_[index];
+        size_t row = message.timestamps.size();
+        message.timestamps.push_back(timestamp_us);
+        const DBCDecodeSignal *signals = &table_.GetSignal(decode_message.first_signal);
+        int64_t multiplexor_value =
+            decode_message.multiplexor >= 0 ? DBCDecodeTable::DecodeRaw(signals[decode_message.multiplexor], payload)
+                                            : 0;
+        for (uint16_t i = 0; i < decode_message.signal_count; i++)
+        {
+            const DBCDecodeSignal &signal = signals[i];
+            Column &column = message.columns[i];
+            if (row % 8 == 0)
+            {
+                column.present.push_back(0);
+            }
+            if ((signal.flags & DBCDecodeSignal::kInvalid) != 0
+                || ((signal.flags & DBCDecodeSignal::kMultiplexed) != 0
+                    && static_cast<int64_t>(signal.multiplexor_value) != multiplexor_value))
+            {
+                column.any_absent = true;
+                continue;
+            }
+            column.present.back() |= static_cast<uint8_t>(1u << (row % 8));
+            column.values.push_back(static_cast<uint64_t>(DBCDecodeTable::DecodeRaw(signal, payload)));
+        }
+        rows_written_++;
+        if (message.timestamps.size() >= rows_per_chunk_)
+        {
+            FlushMessage(index);
+        }
+        return !failed_;
+    }
+
+    void FlushMessage(size_t index)
+    {
+        Message &message = messages_[index];
+        if (message.timestamps.empty())
+        {
+            return;
+        }
+        const DBCDecodeMessage &decode_message = table_.GetMessage(static_cast<uint16_t>(index));
+        Chunk chunk;
+        chunk.rows = message.timestamps.size();
+        chunk.min_timestamp_us = *std::min_element(message.timestamps.begin(), message.timestamps.end());
+        chunk.max_timestamp_us = *std::max_element(message.timestamps.begin(), message.timestamps.end());
+        encoded_.clear();
+        EncodeCANColumn(message.timestamps.data(), message.timestamps.size(), chunk.rows, nullptr, false, encoded_);
+        chunk.timestamps = WriteColumn();
+        for (uint16_t i = 0; i < decode_message.signal_count; i++)
+        {
+            Column &column = message.columns[i];
+            bool is_signed = (table_.GetSignal(decode_message.first_signal + i).flags & DBCDecodeSignal::kSigned) != 0;
+            ColumnChunk column_chunk{};
+            column_chunk.absent = chunk.rows - column.values.size();
+            for (size_t value = 0; value < column.values.size(); value++)
+            {
+                uint64_t raw = column.values[value];
+                bool less = is_signed ? static_cast<int64_t>(raw) < static_cast<int64_t>(column_chunk.min)
+                                      : raw < column_chunk.min;
+                bool greater = is_signed ? static_cast<int64_t>(raw) > static_cast<int64_t>(column_chunk.max)
+                                         : raw > column_chunk.max;
+                column_chunk.min = value == 0 || less ? raw : column_chunk.min;
+                column_chunk.max = value == 0 || greater ? raw : column_chunk.max;
+            }
+            encoded_.clear();
+            EncodeCANColumn(column.values.data(),
+                            column.values.size(),
+                            chunk.rows,
+                            column.any_absent ? &column.present : nullptr,
+                            is_signed,
+                            encoded_);
+            column_chunk.location = WriteColumn();
+            chunk.columns.push_back(column_chunk);
+            column.values.clear();
+            column.present.clear();
+            column.any_absent = false;
+        }
+        message.timestamps.clear();
+        message.chunks.push_back(chunk);
+        chunks_written_++;
+    }
+
+    ColumnLocation WriteColumn()
+    {
+        ColumnLocation location{
+            offset_, static_cast<uint32_t>(encoded_.size()), CRC32(encoded_.data(), encoded_.size())};
+        Write(encoded_);
+        return location;
+    }
+
+    void Write(const std::vector<uint8_t> &data)
+    {
+        if (!failed_ && !data.empty() && !sink_(data.data(), data.size()))
+        {
+            failed_ = true;
+        }
+        offset_ += data.size();
+    }
+
+    static void PutString(std::vector<uint8_t> &out, const std::string &text)
+    {
+        CANColumnarPutVarint(out, text.size());
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    static void PutLocation(std::vector<uint8_t> &out, const ColumnLocation &location)
+    {
+        CANColumnarPut64(out, location.offset);
+        CANColumnarPut32(out, location.size);
+        CANColumnarPut32(out, location.crc);
+    }
+
+    void WriteFooter(std::vector<uint8_t> &footer) const
+    {
+        CANColumnarPutVarint(footer, messages_.size());
+        for (size_t index = 0; index < messages_.size(); index++)
+        {
+            const DBCDecodeMessage &decode_message = table_.GetMessage(static_cast<uint16_t>(index));
+            const DBCMessage &source = *decode_message.source;
+            PutString(footer, source.name);
+            CANColumnarPut32(footer, source.id);
+            footer.push_back(source.extended_id ? 1 : 0);
+            CANColumnarPutVarint(footer, decode_message.signal_count);
+            for (uint16_t i = 0; i < decode_message.signal_count; i++)
+            {
+                const DBCDecodeSignal &signal = table_.GetSignal(decode_message.first_signal + i);
+                PutString(footer, source.signals[i].name);
+                PutString(footer, source.signals[i].unit);
+                footer.push_back(static_cast<uint8_t>(((signal.flags & DBCDecodeSignal::kSigned) != 0 ? 1 : 0)
+                                                      | ((signal.flags & DBCDecodeSignal::kMultiplexed) != 0 ? 2 : 0)));
+                CANColumnarPut32(footer, signal.multiplexor_value);
+                uint64_t bits;
+                memcpy(&bits, &signal.factor, sizeof(bits));
+                CANColumnarPut64(footer, bits);
+                memcpy(&bits, &signal.offset, sizeof(bits));
+                CANColumnarPut64(footer, bits);
+            }
+            const std::vector<Chunk> &chunks = messages_[index].chunks;
+            CANColumnarPutVarint(footer, chunks.size());
+            for (const Chunk &chunk : chunks)
+            {
+                CANColumnarPutVarint(footer, chunk.rows);
+                CANColumnarPut64(footer, chunk.min_timestamp_us);
+                CANColumnarPut64(footer, chunk.max_timestamp_us);
+                PutLocation(footer, chunk.timestamps);
+                for (const ColumnChunk &column : chunk.columns)
+                {
+                    PutLocation(footer, column.location);
+                    CANColumnarPut64(footer, column.min);
+                    CANColumnarPut64(footer, column.max);
+                    CANColumnarPutVarint(footer, column.absent);
+                }
+            }
+        }
+    }
+};
+
+/**
+ * @brief Reads a columnar signal file. The file is memory-mapped and only the footer is parsed on Open, column chunks
+ * are decoded on demand, and chunks outside a requested time range are skipped using the footer's statistics.
+ */
+class CANColumnarReader
+{
+public:
+    struct ColumnChunk
+    {
+        uint64_t offset{0};
+        uint32_t size{0};
+        uint32_t crc{0};
+        int64_t min_raw{0};  // for unsigned signals, the uint64 bits
+        int64_t max_raw{0};
+        uint64_t absent_rows{0};
+    };
+
+    struct Chunk
+    {
+        uint64_t rows{0};
+        uint64_t min_timestamp_us{0};
+        uint64_t max_timestamp_us{0};
+        ColumnChunk timestamps;
+        std::vector<ColumnChunk> columns;  // one per signal
+    };
+
+    struct Signal
+    {
+        std::string name;
+        std::string unit;
+        bool is_signed{false};
+        bool multiplexed{false};
+        uint32_t multiplexor_value{0};
+        double factor{1};
+        double offset{0};
+
+        // The physical value of a raw value, the same as the decoder produced
+        double Scale(uint64_t raw) const
+        {
+            DBCDecodeSignal signal{};
+            signal.factor = factor;
+            signal.offset = offset;
+            signal.flags = static_cast<uint8_t>((is_signed ? DBCDecodeSignal::kSigned : 0)
+                                                | (factor == 1 && offset == 0 ? DBCDecodeSignal::kUnityFactor : 0));
+            return DBCDecodeTable::Scale(signal, static_cast<int64_t>(raw));
+        }
+    };
+
+    struct Message
+    {
+        std::string name;
+        uint32_t id{0};
+        bool extended_id{false};
+        std::vector<Signal> signals;
+        std::vector<Chunk> chunks;
+    };
+
+    /**
+     * @brief Opens a file written by CANColumnarWriter
+     */
+    bool Open(const std::string &path, std::string *error = nullptr)
+    {
+        if (!file_.Open(path, error))
+        {
+            return false;
+        }
+        return Open(file_.GetData(), file_.GetSize(), error);
+    }
+
+    /**
+     * @brief Reads a file already in memory, which must stay valid while the reader is used
+     */
+    bool Open(const uint8_t *data, size_t size, std::string *error = nullptr)
+    {
+        data_ = data;
+        size_ = size;
+        messages_.clear();
+        if (size < 24 || CANLogGet32(data) != kCANColumnarMagic || CANLogGet32(data + size - 4) != kCANColumnarMagic)
+        {
+            return Fail(error, "not a columnar signal file");
+        }
+        if (CANLogGet32(data + 4) != kCANColumnarVersion)
+        {
+            return Fail(error, "unsupported columnar signal file version");
+        }
+        uint64_t footer_offset = CANLogGet64(data + size - 16);
+        if (footer_offset < 8 || footer_offset > size - 16)
+        {
+            return Fail(error, "corrupt footer");
+        }
+        const uint8_t *in = data + footer_offset;
+        const uint8_t *end = data + size - 16;
+        if (CRC32(in, static_cast<size_t>(end - in)) != CANLogGet32(data + size - 8) || !ParseFooter(in, end))
+        {
+            return Fail(error, "corrupt footer");
+        }
+        return true;
+    }
+
+    const std::vector<Message> &GetMessages() const { return messages_; }
+
+    // The message's index, or -1 if there is no message with that name
+    int FindMessage(const std::string &name) const
+    {
+        for (size_t i = 0; i < messages_.size(); i++)
+        {
+            if (messages_[i].name == name)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // The signal's index in its message, or -1 if it has no signal with that name
+    int FindSignal(size_t message, const std::string &name) const
+    {
+        const std::vector<Signal> &signals = messages_[message].signals;
+        for (size_t i = 0; i < signals.size(); i++)
+        {
+            if (signals[i].name == name)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Decodes the timestamps of one chunk of a message
+     *
+     * @return false if the column chunk is corrupt
+     */
+    bool ReadTimestamps(size_t message, size_t chunk, std::vector<uint64_t> &timestamps_us)
+    {
+        return ReadColumn(messages_[message].chunks[chunk].timestamps, timestamps_us, present_);
+    }
+
+    /**
+     * @brief Decodes the raw values of one signal in one chunk of a message
+     *
+     * @param present Receives 1 for rows with a value and 0 for rows of multiplexed signals the frame didn't carry
+     * @return false if the column chunk is corrupt
+     */
+    bool ReadRaw(size_t message, size_t chunk, size_t signal, std::vector<uint64_t> &raw, std::vector<uint8_t> &present)
+    {
+        return ReadColumn(messages_[message].chunks[chunk].columns[signal], raw, present);
+    }
+
+    /**
+     * @brief Reads the physical values of a signal in a time range, skipping chunks outside it without decoding them
+     *
+     * @param timestamps_us Receives the timestamp of every row with a value
+     * @param values Receives the values
+     * @return false if a column chunk is corrupt
+     */
+    bool ReadSignal(size_t message,
+                    size_t signal,
+                    std::vector<uint64_t> &timestamps_us,
+                    std::vector<double> &values,
+                    uint64_t from_us = 0,
+                    uint64_t to_us = std::numeric_limits<uint64_t>::max())
+    {
+        timestamps_us.clear();
+        values.clear();
+        const Message &source = messages_[message];
+        const Signal &signal_info = source.signals[signal];
+        for (size_t chunk = 0; chunk < source.chunks.size(); chunk++)
+        {
+            const Chunk &info = source.chunks[chunk];
+            if (info.max_timestamp_us < from_us || info.min_timestamp_us > to_us
+                || info.columns[signal].absent_rows == info.rows)
+            {
+                continue;
+            }
+            if (!ReadTimestamps(message, chunk, chunk_timestamps_) || !ReadRaw(message, chunk, signal, raw_, present_)
+                || chunk_timestamps_.size() != raw_.size())
+            {
+                return false;
+            }
+            for (size_t row = 0; row < raw_.size(); row++)
+            {
+                if (present_[row] && chunk_timestamps_[row] >= from_us && chunk_timestamps_[row] <= to_us)
+                {
+                    timestamps_us.push_back(chunk_timestamps_[row]);
+                    values.push_back(signal_info.Scale(raw_[row]));
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    CANMappedFile file_;
+    const uint8_t *data_{nullptr};
+    size_t size_{0};
+    std::vector<Message> messages_;
+    std::vector<uint64_t> chunk_timestamps_;
+    std::vector<uint64_t> raw_;
+    std::vector<uint8_t> present_;
+
+    static bool Fail(std::string *error, const char *message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+        return false;
+    }
+
+    bool ReadColumn(const ColumnChunk &column, std::vector<uint64_t> &values, std::vector<uint8_t> &present) const
+    {
+        if (column.offset > size_ || column.size > size_ - column.offset
+            || CRC32(data_ + column.offset, column.size) != column.crc)
+        {
+            return false;
+        }
+        return DecodeCANColumn(data_ + column.offset, column.size, values, present);
+    }
+
+    static bool GetString(const uint8_t *&in, const uint8_t *end, std::string &text)
+    {
+        uint64_t length;
+        if (!CANLogGetVarint(in, end, length) || length > static_cast<uint64_t>(end - in))
+        {
+            return false;
+        }
+        text.assign(reinterpret_cast<const char *>(in), static_cast<size_t>(length));
+        in += length;
+        return true;
+    }
+
+    static bool GetFixed(const uint8_t *&in, const uint8_t *end, size_t size, uint64_t &value)
+    {
+        if (static_cast<size_t>(end - in) < size)
+        {
+            return false;
+        }
+        value = size == 8 ? CANLogGet64(in) : (size == 4 ? CANLogGet32(in) : *in);
+        in += size;
+        return true;
+    }
+
+    static bool GetLocation(const uint8_t *&in, const uint8_t *end, ColumnChunk &column)
+    {
+        uint64_t size = 0;
+        uint64_t crc = 0;
+        bool valid = GetFixed(in, end, 8, column.offset) && GetFixed(in, end, 4, size) && GetFixed(in, end, 4, crc);
+        column.size = static_cast<uint32_t>(size);
+        column.crc = static_cast<uint32_t>(crc);
+        return valid;
+    }
+
+    bool ParseFooter(const uint8_t *in, const uint8_t *end)
+    {
+        uint64_t message_count;
+        if (!CANLogGetVarint(in, end, message_count) || message_count > static_cast<uint64_t>(end - in))
+        {
+            return false;
+        }
+        messages_.resize(static_cast<size_t>(message_count));
+        for (Message &message : messages_)
+        {
+            uint64_t id;
+            uint64_t extended_id;
+            uint64_t signal_count;
+            if (!GetString(in, end, message.name) || !GetFixed(in, end, 4, id) || !GetFixed(in, end, 1, extended_id)
+                || !CANLogGetVarint(in, end, signal_count) || signal_count > static_cast<uint64_t>(end - in))
+            {
+                return false;
+            }
+            message.id = static_cast<uint32_t>(id);
+            message.extended_id = extended_id != 0;
+            message.signals.resize(static_cast<size_t>(signal_count));
+            for (Signal &signal : message.signals)
+            {
+                uint64_t flags;
+                uint64_t multiplexor_value;
+                uint64_t factor;
+                uint64_t offset;
+                if (!GetString(in, end, signal.name) || !GetString(in, end, signal.unit)
+                    || !GetFixed(in, end, 1, flags) || !GetFixed(in, end, 4, multiplexor_value)
+                    || !GetFixed(in, end, 8, factor) || !GetFixed(in, end, 8, offset))
+                {
+                    return false;
+                }
+                signal.is_signed = (flags & 1) != 0;
+                signal.multiplexed = (flags & 2) != 0;
+                signal.multiplexor_value = static_cast<uint32_t>(multiplexor_value);
+                memcpy(&signal.factor, &factor, sizeof(factor));
+                memcpy(&signal.offset, &offset, sizeof(offset));
+            }
+            uint64_t chunk_count;
+            if (!CANLogGetVarint(in, end, chunk_count) || chunk_count > static_cast<uint64_t>(end - in))
+            {
+                return false;
+            }
+            message.chunks.resize(static_cast<size_t>(chunk_count));
+            for (Chunk &chunk : message.chunks)
+            {
+                if (!CANLogGetVarint(in, end, chunk.rows) || !GetFixed(in, end, 8, chunk.min_timestamp_us)
+                    || !GetFixed(in, end, 8, chunk.max_timestamp_us) || !GetLocation(in, end, chunk.timestamps))
+                {
+                    return false;
+                }
+                chunk.columns.resize(message.signals.size());
+                for (ColumnChunk &column : chunk.columns)
+                {
+                    uint64_t min;
+                    uint64_t max;
+                    if (!GetLocation(in, end, column) || !GetFixed(in, end, 8, min) || !GetFixed(in, end, 8, max)
+                        || !CANLogGetVarint(in, end, column.absent_rows))
+                    {
+                        return false;
+                    }
+                    column.min_raw = static_cast<int64_t>(min);
+                    column.max_raw = static_cast<int64_t>(max);
+                }
+            }
+        }
+        return in == end;
+    }
+};
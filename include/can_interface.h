@@ -27,6 +27,8 @@
 #include <Arduino.h>
 #endif
 
+#include "can_profiling.h"
+
 class CANMessage
 {
 public:
@@ -38,10 +40,13 @@ public:
     // default to standard id for backwards compatibility
     CANMessage(uint32_t id, uint8_t len, std::array<uint8_t, 8> data) : CANMessage(id, false, len, data) {}
 
+    CANMessage() : CANMessage(0, false, 0, std::array<uint8_t, 8>{}) {}
+
     uint32_t id_;
     bool extended_id_;
     uint8_t len_;
-    std::array<uint8_t, 8> data_;
+    // Aligned so signals can be encoded/decoded in place through a uint64_t *
+    alignas(uint64_t) std::array<uint8_t, 8> data_;
 };
 
 class PGNCANMessage : public CANMessage
@@ -482,9 +487,7 @@ class ICANTXMessage
 {
 public:
     virtual uint32_t GetID() = 0;
-#if !defined(NATIVE)  // workaround for unit tests
     virtual VirtualTimer &GetTransmitTimer() = 0;
-#endif
     virtual void EncodeAndSend() = 0;
 };
 
@@ -495,6 +498,22 @@ public:
     virtual void DecodeSignals(CANMessage message) = 0;  // Decodes signals if ID matches
 };
 
+/**
+ * @brief Sees raw frames on an ICAN (see ICAN::AttachTap). OnFrame runs in the backend's RX or TX context, so it must be
+ * short and must not block (e.g. copy the frame into a CANRawTap ring for another task).
+ */
+class ICANTap
+{
+public:
+    virtual ~ICANTap() {}
+
+    /**
+     * @param frame The frame
+     * @param transmitted true for a frame this node sent, false for a received one
+     */
+    virtual void OnFrame(const CANMessage &frame, bool transmitted) = 0;
+};
+
 class ICAN
 {
 public:
@@ -506,6 +525,8 @@ public:
         kBaud125k = 125000
     };
 
+    static constexpr uint8_t kMaxTaps{4};
+
     virtual ~ICAN() {}
 
     virtual void Initialize(BaudRate baud) = 0;
@@ -515,8 +536,69 @@ public:
     virtual void RegisterRXMessage(ICANRXMessage &msg) = 0;
 
     virtual void Tick() = 0;
+
+    /**
+     * @brief Attaches a tap that sees every received frame before it is dispatched to the RX messages, and every frame
+     * this node sends. Attach taps before frames start flowing. Wrappers (like CANTXQueue) forward taps to the ICAN they
+     * wrap.
+     *
+     * @return false if kMaxTaps taps are already attached
+     */
+    virtual bool AttachTap(ICANTap &tap)
+    {
+        if (tap_count_ >= kMaxTaps)
+        {
+            return false;
+        }
+        taps_[tap_count_++] = &tap;
+        return true;
+    }
+
+protected:
+    // Backends call this for every frame, it costs a single branch when no tap is attached
+    void TapFrame(const CANMessage &frame, bool transmitted) const
+    {
+        if (tap_count_ != 0)
+        {
+            for (uint8_t i = 0; i < tap_count_; i++)
+            {
+                taps_[i]->OnFrame(frame, transmitted);
+            }
+        }
+    }
+
+private:
+    ICANTap *taps_[kMaxTaps]{};
+    uint8_t tap_count_{0};
 };
 
+/**
+ * @brief The worst-case number of bits a frame occupies on the bus, including stuff bits and the 3 bit interframe space
+ * (from Davis et al., "Controller Area Network (CAN) schedulability analysis: Refuted, revisited and revised")
+ *
+ * @param len The number of data bytes
+ * @param extended_id Whether the frame uses a 29 bit ID
+ */
+constexpr uint32_t CANWorstCaseFrameBits(uint8_t len, bool extended_id)
+{
+    return (extended_id ? 54u : 34u) + 8u * len + 13u + ((extended_id ? 54u : 34u) + 8u * len - 1u) / 4u;
+}
+
+/**
+ * @brief The bits a frame transmits during arbitration, as one number: the frame with the lower key wins. A standard
+ * frame beats an extended frame with the same 11 most significant ID bits, because its RTR bit is dominant where the
+ * extended frame sends a recessive SRR bit.
+ *
+ * @param id The 11 or 29 bit ID
+ * @param extended_id Whether the frame uses a 29 bit ID
+ */
+constexpr uint32_t CANArbitrationKey(uint32_t id, bool extended_id)
+{
+    // base ID (11 bits), RTR/SRR, IDE, ID extension (18 bits)
+    return extended_id ? (((id >> 18) & 0x7FFu) << 20) | (1u << 19) | (1u << 18) | (id & 0x3FFFFu)
+                       : (id & 0x7FFu) << 20;
+}
+
 class MockCAN : public ICAN
 {
 public:
@@ -701,14 +783,15 @@ private:
     VirtualTimer transmit_timer_;
     std::array<ICANSignal *, num_signals> signals_;
 
+    // Signals are encoded straight into the message payload, which the backend copies into its native frame as one word
     void EncodeSignals()
     {
-        uint8_t temp_raw[8]{0};
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message_.data_.data());
+        *raw = 0;
         for (uint8_t i = 0; i < num_signals; i++)
         {
-            signals_.at(i)->EncodeSignal(reinterpret_cast<uint64_t *>(temp_raw));
+            signals_[i]->EncodeSignal(raw);
         }
-        std::copy(std::begin(temp_raw), std::end(temp_raw), message_.data_.begin());
     }
 };
 
@@ -738,9 +821,7 @@ public:
                             Ts &...signal_groups)
         : can_interface_{can_interface},
           message_{id, extended_id, length, std::array<uint8_t, 8>()},
-#if !defined(NATIVE)  // workaround for unit tests
           transmit_timer_{period, [this]() { this->EncodeAndSend(); }, VirtualTimer::Type::kRepeating},
-#endif
           multiplexor_values_to_transmit_{multiplexor_values_to_transmit},
           multiplexor_{&multiplexor},
           signal_groups_{&signal_groups...}
@@ -812,9 +893,7 @@ public:
                                   multiplexor,
                                   signal_groups...)
     {
-#if !defined(NATIVE)  // workaround for unit tests
         timer_group.AddTimer(transmit_timer_);
-#endif
     }
 
     template <typename... Ts>
@@ -883,29 +962,15 @@ public:
 
     uint32_t GetID() override { return message_.id_; }
 
-#if !defined(NATIVE)  // workaround for unit tests
     VirtualTimer &GetTransmitTimer() override { return transmit_timer_; }
-#endif
 
-    void Enable()
-    {
-#if !defined(NATIVE)  // workaround for unit tests
-        transmit_timer_.Enable();
-#endif
-    }
-    void Disable()
-    {
-#if !defined(NATIVE)  // workaround for unit tests
-        transmit_timer_.Disable();
-#endif
-    }
+    void Enable() { transmit_timer_.Enable(); }
+    void Disable() { transmit_timer_.Disable(); }
 
 private:
     ICAN &can_interface_;
     CANMessage message_;
-#if !defined(NATIVE)  // workaround for unit tests
     VirtualTimer transmit_timer_;
-#endif
     std::array<MultiplexorType, num_multiplexors_to_transmit> multiplexor_values_to_transmit_;
     ITypedCANSignal<MultiplexorType> *multiplexor_;
     std::array<IMultiplexedSignalGroup *, num_groups> signal_groups_;
@@ -932,8 +997,9 @@ private:
 
     void EncodeSignals()
     {
-        uint8_t temp_raw[8]{0};
-        multiplexor_->EncodeSignal(reinterpret_cast<uint64_t *>(temp_raw));
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message_.data_.data());
+        *raw = 0;
+        multiplexor_->EncodeSignal(raw);
         uint64_t signal_group_index = GetSignalGroupIndex(*multiplexor_);
         if (has_always_active_signal_group_)
         {
@@ -942,7 +1008,7 @@ private:
             {
                 signal_groups_.at(static_cast<size_t>(always_active_signal_group_index_))
                     ->at(i)
-                    ->EncodeSignal(reinterpret_cast<uint64_t *>(temp_raw));
+                    ->EncodeSignal(raw);
             }
         }
         if (signal_group_index != 0xFFFFFFFFul)  // not invalid value
@@ -951,10 +1017,9 @@ private:
             {
                 signal_groups_.at(static_cast<size_t>(signal_group_index))
                     ->at(i)
-                    ->EncodeSignal(reinterpret_cast<uint64_t *>(temp_raw));
+                    ->EncodeSignal(raw);
             }
         }
-        std::copy(std::begin(temp_raw), std::end(temp_raw), message_.data_.begin());
     }
 };
 
@@ -1032,14 +1097,15 @@ private:
     VirtualTimer transmit_timer_;
     std::array<ICANSignal *, num_signals> signals_;
 
+    // Signals are encoded straight into the message payload, which the backend copies into its native frame as one word
     void EncodeSignals()
     {
-        uint8_t temp_raw[8]{0};
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message_.data_.data());
+        *raw = 0;
         for (uint8_t i = 0; i < num_signals; i++)
         {
-            signals_.at(i)->EncodeSignal(reinterpret_cast<uint64_t *>(temp_raw));
+            signals_[i]->EncodeSignal(raw);
         }
-        std::copy(std::begin(temp_raw), std::end(temp_raw), message_.data_.begin());
     }
 };
 
@@ -1105,18 +1171,22 @@ public:
         {
             return;
         }
+        CAN_PROFILE_START(decode);
         id_ = message.id_;
         raw_message_ = *reinterpret_cast<uint64_t *>(message.data_.data());
         for (uint8_t i = 0; i < num_signals; i++)
         {
             signals_[i]->DecodeSignal(&raw_message_);
         }
+        CAN_PROFILE_RECORD(decode, profile_.decode_cycles);
 
         // DecodeSignals is called only on message received
+        CAN_PROFILE_START(callback);
         if (callback_function_)
         {
             callback_function_();
         }
+        CAN_PROFILE_RECORD(callback, profile_.callback_cycles);
 
         last_receive_time_ = get_millis_();
     }
@@ -1142,6 +1212,10 @@ private:
     uint64_t raw_message_ = 0u;
 
     uint32_t last_receive_time_ = 0;
+
+#ifdef CAN_PROFILING
+    CANMessageProfile profile_{static_cast<uint32_t>(id_)};
+#endif
 };
 
 template <size_t num_groups, typename MultiplexorType>
@@ -1219,6 +1293,7 @@ public:
             return;
         }
 
+        CAN_PROFILE_START(decode);
         raw_message_ = *reinterpret_cast<uint64_t *>(message.data_.data());
 
         if (has_always_active_signal_group_)
@@ -1253,12 +1328,15 @@ public:
                 signal_groups_.at(multiplexor_index)->at(i)->DecodeSignal(&raw_message_);
             }
         }
+        CAN_PROFILE_RECORD(decode, profile_.decode_cycles);
 
         // DecodeSignals is called only on message received
+        CAN_PROFILE_START(callback);
         if (callback_function_)
         {
             callback_function_();
         }
+        CAN_PROFILE_RECORD(callback, profile_.callback_cycles);
 
         last_receive_time_ = get_millis_();
     }
@@ -1285,6 +1363,10 @@ private:
     uint64_t raw_message_ = 0u;
 
     uint32_t last_receive_time_ = 0;
+
+#ifdef CAN_PROFILING
+    CANMessageProfile profile_{static_cast<uint32_t>(id_)};
+#endif
 };
 
 template <size_t num_signals>
@@ -1349,17 +1431,21 @@ public:
         {
             return;
         }
+        CAN_PROFILE_START(decode);
         raw_message_ = *reinterpret_cast<uint64_t *>(message.data_.data());
         for (uint8_t i = 0; i < num_signals; i++)
         {
             signals_[i]->DecodeSignal(&raw_message_);
         }
+        CAN_PROFILE_RECORD(decode, profile_.decode_cycles);
 
         // DecodeSignals is called only on message received
+        CAN_PROFILE_START(callback);
         if (callback_function_)
         {
             callback_function_();
         }
+        CAN_PROFILE_RECORD(callback, profile_.callback_cycles);
 
         last_receive_time_ = get_millis_();
     }
@@ -1382,4 +1468,8 @@ private:
     uint64_t raw_message_ = 0u;
 
     uint32_t last_receive_time_ = 0;
+
+#ifdef CAN_PROFILING
+    CANMessageProfile profile_{static_cast<uint32_t>(id_)};
+#endif
 };
@@ -0,0 +1,799 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef ARDUINO
+#include <stdio.h>
+#endif
+
+#include "can_interface.h"
+#include "crc32.h"
+
+/*
+ * Binary CAN log format
+ *
+ * A log is a sequence of fixed-size blocks (a multiple of 512 bytes, so every block is written as whole SD sectors).
+ * Each block decodes on its own, so a reader can start at any block boundary, and a corrupt block only loses its own
+ * frames. All integers are little endian.
+ *
+ * Block header (kCANLogBlockHeaderSize bytes):
+ *   0  uint32 magic ("CLB1")
+ *   4  uint32 block size in bytes
+ *   8  uint32 sequence number, counting up from 0 for every block the writer produced
+ *   12 uint16 number of records
+ *   14 uint16 number of record bytes following the header, the rest of the block is zero padding
+ *   16 uint64 timestamp of the first record (us)
+ *   24 uint64 timestamp of the last record (us)
+ *   32 uint32 CRC-32 of bytes 0 to 31, then bytes 36 to 39, then the record bytes
+ *   36 uint32 index interval: the number of data blocks between index blocks, 0 if the log has no index
+ *
+ * Record:
+ *   flags byte: bits 0-3 length (0 to 8), bit 4 extended ID, bit 5 payload is a delta
+ *   varint: zigzag-encoded difference to the previous record's timestamp (to the block's first timestamp for the
+ *           first record), in us
+ *   varint: ID
+ *   payload: if not a delta, length bytes. If a delta, a byte with bit n set if payload byte n changed since the
+ *            previous frame with the same ID (and extended flag) in the block, which is guaranteed to have had the
+ *            same length, followed by the changed bytes XORed with their previous values.
+ *
+ * Varints are LEB128: 7 bits per byte, least significant group first, the top bit set on all but the last byte.
+ *
+ * Index block (same size, written after every index interval data blocks, so the index block of data blocks n * i to
+ * n * i + n - 1 is block (n + 1) * i + n of the file):
+ *   0  uint32 magic ("CLX1")
+ *   4  uint32 block size in bytes
+ *   8  uint32 sequence number of the first data block covered
+ *   12 uint16 number of data blocks covered (the index interval)
+ *   14 uint16 number of ID entries
+ *   16 uint64 first timestamp of the first covered block (us)
+ *   24 uint64 last timestamp of the last covered block (us)
+ *   32 uint32 CRC-32 of bytes 0 to 31, then bytes 36 to 39, then the checkpoints and ID entries
+ *   36 uint32 flags: bit 0 set if some IDs didn't fit in the writer's table and are missing from the entries
+ *   40 per covered block, uint64 timestamp of its first record (the time checkpoints)
+ *   then per ID entry, uint32 ID (bit 31 set for an extended ID) and uint64 bitmap of the covered blocks holding it
+ *   (bit n for the nth covered block), in no particular order
+ */
+
+static constexpr uint32_t kCANLogMagic{0x31424C43};       // "CLB1"
+static constexpr uint32_t kCANLogIndexMagic{0x31584C43};  // "CLX1"
+static constexpr size_t kCANLogBlockHeaderSize{40};
+static constexpr size_t kCANLogMaxRecordSize{1 + 10 + 5 + 9};
+
+/**
+ * @brief A frame read from a log
+ */
+struct CANLogRecord
+{
+    uint64_t timestamp_us{0};
+    CANMessage frame;
+};
+
+/**
+ * @brief The header fields of a block
+ */
+struct CANLogBlockInfo
+{
+    uint32_t block_size{0};
+    uint32_t sequence{0};
+    uint16_t record_count{0};
+    uint16_t used_bytes{0};
+    uint64_t first_timestamp_us{0};
+    uint64_t last_timestamp_us{0};
+    uint32_t crc{0};
+};
+
+inline void CANLogPut16(uint8_t *out, uint16_t value)
+{
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+inline void CANLogPut32(uint8_t *out, uint32_t value)
+{
+    CANLogPut16(out, static_cast<uint16_t>(value));
+    CANLogPut16(out + 2, static_cast<uint16_t>(value >> 16));
+}
+
+inline void CANLogPut64(uint8_t *out, uint64_t value)
+{
+    CANLogPut32(out, static_cast<uint32_t>(value));
+    CANLogPut32(out + 4, static_cast<uint32_t>(value >> 32));
+}
+
+inline uint16_t CANLogGet16(const uint8_t *in) { return static_cast<uint16_t>(in[0] | in[1] << 8); }
+
+inline uint32_t CANLogGet32(const uint8_t *in)
+{
+    return CANLogGet16(in) | static_cast<uint32_t>(CANLogGet16(in + 2)) << 16;
+}
+
+inline uint64_t CANLogGet64(const uint8_t *in)
+{
+    return CANLogGet32(in) | static_cast<uint64_t>(CANLogGet32(in + 4)) << 32;
+}
+
+// The CRC of a block's header, every field but the CRC itself, which the block's CRC continues over its contents
+inline uint32_t CANLogHeaderCRC(const uint8_t *block) { return CRC32(block + 36, 4, CRC32(block, 32)); }
+
+// Returns the number of bytes written, at most 10
+inline size_t CANLogPutVarint(uint8_t *out, uint64_t value)
+{
+    size_t size = 0;
+    while (value >= 0x80)
+    {
+        out[size++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+// Returns false if the varint runs past end or is longer than 10 bytes
+inline bool CANLogGetVarint(const uint8_t *&in, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 70 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Reads and checks a block header (magic and sizes, not the CRC)
+ *
+ * @return false if block doesn't start with a plausible header
+ */
+inline bool ReadCANLogBlockHeader(const uint8_t *block, size_t size, CANLogBlockInfo &info)
+{
+    if (size < kCANLogBlockHeaderSize || CANLogGet32(block) != kCANLogMagic)
+    {
+        return false;
+    }
+    info.block_size = CANLogGet32(block + 4);
+    info.sequence = CANLogGet32(block + 8);
+    info.record_count = CANLogGet16(block + 12);
+    info.used_bytes = CANLogGet16(block + 14);
+    info.first_timestamp_us = CANLogGet64(block + 16);
+    info.last_timestamp_us = CANLogGet64(block + 24);
+    info.crc = CANLogGet32(block + 32);
+    return info.block_size >= 512 && info.block_size % 512 == 0
+           && info.used_bytes <= info.block_size - kCANLogBlockHeaderSize;
+}
+
+/**
+ * @brief A parsed index block
+ */
+struct CANLogIndexInfo
+{
+    uint32_t first_sequence{0};
+    uint64_t first_timestamp_us{0};
+    uint64_t last_timestamp_us{0};
+    bool complete{true};                             // false if some IDs are missing from ids
+    std::vector<uint64_t> checkpoints;               // first timestamp of each covered block
+    std::vector<std::pair<uint32_t, uint64_t>> ids;  // (ID | 0x80000000 if extended, block bitmap), sorted by ID
+};
+
+/**
+ * @brief Whether a block is an index block (which readers of the frames skip)
+ */
+inline bool IsCANLogIndexBlock(const uint8_t *block, size_t size)
+{
+    return size >= kCANLogBlockHeaderSize && CANLogGet32(block) == kCANLogIndexMagic;
+}
+
+/**
+ * @brief Parses and checks an index block
+ *
+ * @return false if the block isn't an index block, is truncated or fails its CRC
+ */
+inline bool ReadCANLogIndexBlock(const uint8_t *block, size_t size, CANLogIndexInfo &info)
+{
+    if (!IsCANLogIndexBlock(block, size))
+    {
+        return false;
+    }
+    uint32_t block_size = CANLogGet32(block + 4);
+    uint16_t block_count = CANLogGet16(block + 12);
+    uint16_t id_count = CANLogGet16(block + 14);
+    size_t used = block_count * 8u + id_count * 12u;
+    if (block_size < 512 || size < block_size || block_count > 64 || used > block_size - kCANLogBlockHeaderSize
+        || CRC32(block + kCANLogBlockHeaderSize, used, CANLogHeaderCRC(block)) != CANLogGet32(block + 32))
+    {
+        return false;
+    }
+    info.first_sequence = CANLogGet32(block + 8);
+    info.first_timestamp_us = CANLogGet64(block + 16);
+    info.last_timestamp_us = CANLogGet64(block + 24);
+    info.complete = (CANLogGet32(block + 36) & 1) == 0;
+    const uint8_t *in = block + kCANLogBlockHeaderSize;
+    info.checkpoints.resize(block_count);
+    for (uint16_t i = 0; i < block_count; i++, in += 8)
+    {
+        info.checkpoints[i] = CANLogGet64(in);
+    }
+    info.ids.resize(id_count);
+    for (uint16_t i = 0; i < id_count; i++, in += 12)
+    {
+        info.ids[i] = std::make_pair(CANLogGet32(in), CANLogGet64(in + 4));
+    }
+    std::sort(info.ids.begin(), info.ids.end());
+    return true;
+}
+
+/**
+ * @brief Decodes every record of a block and appends them to records
+ *
+ * @param block The block, at least as long as its header says
+ * @param size The number of bytes available at block
+ * @param records The records are appended to this, nothing is appended if the block is invalid
+ * @param info If not nullptr, set to the block's header fields
+ * @return false if the block is truncated, fails its CRC or has malformed records
+ */
+inline bool DecodeCANLogBlock(const uint8_t *block,
+                              size_t size,
+                              std::vector<CANLogRecord> &records,
+                              CANLogBlockInfo *info = nullptr)
+{
+    CANLogBlockInfo header;
+    if (!ReadCANLogBlockHeader(block, size, header) || size < header.block_size)
+    {
+        return false;
+    }
+    const uint8_t *in = block + kCANLogBlockHeaderSize;
+    const uint8_t *end = in + header.used_bytes;
+    if (CRC32(in, header.used_bytes, CANLogHeaderCRC(block)) != header.crc)
+    {
+        return false;
+    }
+
+    size_t first = records.size();
+    std::unordered_map<uint32_t, std::array<uint8_t, 8>> previous;
+    uint64_t timestamp = header.first_timestamp_us;
+    bool valid = true;
+    for (uint16_t i = 0; i < header.record_count && valid; i++)
+    {
+        uint64_t delta;
+        uint64_t id;
+        uint8_t flags = in < end ? *in++ : 0xFF;
+        uint8_t len = flags & 0xF;
+        valid = len <= 8 && (flags & 0xC0) == 0 && CANLogGetVarint(in, end, delta) && CANLogGetVarint(in, end, id)
+                && id <= 0x1FFFFFFF;
+        if (!valid)
+        {
+            break;
+        }
+        timestamp += (delta >> 1) ^ (~(delta & 1) + 1);
+        CANLogRecord record;
+        record.timestamp_us = timestamp;
+        record.frame.id_ = static_cast<uint32_t>(id);
+        record.frame.extended_id_ = (flags & 0x10) != 0;
+        record.frame.len_ = len;
+        uint32_t key = record.frame.id_ | (record.frame.extended_id_ ? 0x80000000u : 0);
+        if (flags & 0x20)
+        {
+            auto found = previous.find(key);
+            valid = found != previous.end() && in < end;
+            if (!valid)
+            {
+                break;
+            }
+            record.frame.data_ = found->second;
+            uint8_t changed = *in++;
+            for (uint8_t byte = 0; byte < 8 && valid; byte++)
+            {
+                if (changed & (1u << byte))
+                {
+                    valid = byte < len && in < end;
+                    record.frame.data_[byte] ^= valid ? *in++ : 0;
+                }
+            }
+        }
+        else
+        {
+            valid = static_cast<size_t>(end - in) >= len;
+            for (uint8_t byte = 0; byte < len && valid; byte++)
+            {
+                record.frame.data_[byte] = *in++;
+            }
+        }
+        previous[key] = record.frame.data_;
+        records.push_back(record);
+    }
+    if (!valid || in != end)
+    {
+        records.resize(first);
+        return false;
+    }
+    if (info != nullptr)
+    {
+        *info = header;
+    }
+    return true;
+}
+
+/**
+ * @brief Streams frames into the binary log format (see above) without touching the heap. Frames are encoded into one
+ * of num_blocks preallocated blocks; when it is full it is sealed and the next one is filled while the sealed one is
+ * written out.
+ *
+ * Append() and Seal() are the producer side and Flush() the consumer side, they may run in different tasks (e.g. the
+ * RX callback or a raw tap appends, and a low-priority task calls Flush to write to SD). Each side must only be used
+ * from one task at a time.
+ *
+ * Every index_interval data blocks, an index block with the first timestamp of each block and a bitmap of the blocks
+ * each ID appears in is written after them, for CANLogIndexedReader to seek by time and ID. Building it costs one hash
+ * table update per ID per block, and the index block is serialized once per index_interval blocks.
+ *
+ * @tparam block_size The block size, a multiple of 512 up to 32768
+ * @tparam num_blocks The number of blocks in the arena, at least 2
+ * @tparam max_ids The number of IDs per block whose last payload is remembered for delta encoding (others are written
+ * in full), and the number of IDs per index block (an index that runs out lists what fit and is marked incomplete),
+ * must be a power of 2
+ * @tparam index_interval The number of data blocks per index block, more than num_blocks and at most 64, or 0 for no
+ * index
+ */
+template <size_t block_size = 4096, size_t num_blocks = 2, size_t max_ids = 128, size_t index_interval = 32>
+class CANLogWriter
+{
+public:
+    /**
+     * @brief Writes a sealed block to storage, returns false on failure (the block is then retried on the next Flush)
+     */
+    using Sink = std::function<bool(const uint8_t *block, size_t size)>;
+
+    explicit CANLogWriter(Sink sink) : sink_{sink}
+    {
+        static_assert(block_size >= 512 && block_size % 512 == 0 && block_size <= 32768,
+                      "CANLogWriter block_size must be a multiple of 512 up to 32768");
+        static_assert(num_blocks >= 2, "CANLogWriter needs at least 2 blocks");
+        static_assert(max_ids >= 1 && (max_ids & (max_ids - 1)) == 0, "CANLogWriter max_ids must be a power of 2");
+        // the producer only rebuilds the index block after sealing more blocks than the arena holds, which can't
+        // happen before the consumer has written the previous one
+        static_assert(index_interval == 0 || (index_interval > num_blocks && index_interval <= 64),
+                      "CANLogWriter index_interval must be 0 or more than num_blocks and at most 64");
+        static_assert(kCANLogBlockHeaderSize + index_interval * 8 + (index_interval == 0 ? 0 : max_ids * 12)
+                          <= block_size,
+                      "CANLogWriter index blocks must fit index_interval checkpoints and max_ids IDs");
+        for (size_t i = 0; i < num_blocks; i++)
+        {
+            states_[i].store(kFree, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Encodes a frame into the current block
+     *
+     * @return false if the frame was dropped because every block is waiting to be flushed
+     */
+    bool Append(const CANMessage &frame, uint64_t timestamp_us)
+    {
+        if (filling_ && used_ + kCANLogMaxRecordSize > kRecordSpace)
+        {
+            Seal();
+        }
+        if (!filling_ && !StartBlock(timestamp_us))
+        {
+            dropped_frames_++;
+            return false;
+        }
+
+        uint8_t *block = blocks_[producer_block_].data();
+        uint8_t *out = block + kCANLogBlockHeaderSize + used_;
+        uint8_t len = std::min<uint8_t>(frame.len_, 8);
+        uint32_t key = (frame.id_ & 0x1FFFFFFF) | (frame.extended_id_ ? 0x80000000u : 0);
+        IDEntry *entry = FindEntry(key);
+        bool delta = entry != nullptr && entry->generation == generation_ && entry->len == len;
+        if (index_interval != 0 && (entry == nullptr || entry->generation != generation_))
+        {
+            IndexID(key);  // the ID's first frame in this block
+        }
+
+        size_t size = 0;
+        out[size++] = static_cast<uint8_t>(len | (frame.extended_id_ ? 0x10 : 0) | (delta ? 0x20 : 0));
+        int64_t difference = static_cast<int64_t>(timestamp_us - last_timestamp_us_);
+        size += CANLogPutVarint(out + size, (static_cast<uint64_t>(difference) << 1) ^ (difference < 0 ? ~0ull : 0));
+        size += CANLogPutVarint(out + size, key & 0x1FFFFFFF);
+        if (delta)
+        {
+            uint8_t &changed = out[size++];
+            changed = 0;
+            for (uint8_t byte = 0; byte < len; byte++)
+            {
+                uint8_t difference_byte = frame.data_[byte] ^ entry->data[byte];
+                if (difference_byte != 0)
+                {
+                    changed |= static_cast<uint8_t>(1u << byte);
+                    out[size++] = difference_byte;
+                }
+            }
+        }
+        else
+        {
+            memcpy(out + size, frame.data_.data(), len);
+            size += len;
+        }
+        if (entry != nullptr)
+        {
+            entry->key = key;
+            entry->generation = generation_;
+            entry->len = len;
+            memcpy(entry->data, frame.data_.data(), 8);
+        }
+
+        used_ += size;
+        record_count_++;
+        last_timestamp_us_ = timestamp_us;
+        frames_logged_++;
+        bytes_logged_ += size;
+        return true;
+    }
+
+    /**
+     * @brief Closes the block being filled (if it has any frames) so the next Flush writes it, e.g. periodically to
+     * bound how much is lost on power loss, or before shutting down
+     */
+    void Seal()
+    {
+        if (!filling_)
+        {
+            return;
+        }
+        filling_ = false;
+        uint8_t *block = blocks_[producer_block_].data();
+        CANLogPut32(block, kCANLogMagic);
+        CANLogPut32(block + 4, static_cast<uint32_t>(block_size));
+        CANLogPut32(block + 8, sequence_++);
+        CANLogPut16(block + 12, record_count_);
+        CANLogPut16(block + 14, static_cast<uint16_t>(used_));
+        CANLogPut64(block + 16, first_timestamp_us_);
+        CANLogPut64(block + 24, last_timestamp_us_);
+        CANLogPut32(block + 36, static_cast<uint32_t>(index_interval));
+        CANLogPut32(block + 32, CRC32(block + kCANLogBlockHeaderSize, used_, CANLogHeaderCRC(block)));
+        memset(block + kCANLogBlockHeaderSize + used_, 0, kRecordSpace - used_);
+        uint8_t state = kSealed;
+        if (index_interval != 0)
+        {
+            if (index_blocks_ == 0)
+            {
+                index_first_sequence_ = sequence_ - 1;
+            }
+            index_checkpoints_[index_blocks_] = first_timestamp_us_;
+            if (++index_blocks_ == index_interval)
+            {
+                BuildIndexBlock();
+                state = kSealedIndexed;
+            }
+        }
+        states_[producer_block_].store(state, std::memory_order_release);
+        producer_block_ = (producer_block_ + 1) % num_blocks;
+    }
+
+    /**
+     * @brief Writes every sealed block to the sink, in order
+     *
+     * @return The number of blocks written
+     */
+    size_t Flush()
+    {
+        size_t written = 0;
+        while (true)
+        {
+            if (index_pending_)
+            {
+                if (!sink_(index_block_.data(), block_size))
+                {
+                    write_errors_++;
+                    break;
+                }
+                index_pending_ = false;
+                index_blocks_written_++;
+            }
+            uint8_t state = states_[consumer_block_].load(std::memory_order_acquire);
+            if (state == kFree)
+            {
+                break;
+            }
+            if (!sink_(blocks_[consumer_block_].data(), block_size))
+            {
+                write_errors_++;
+                break;
+            }
+            states_[consumer_block_].store(kFree, std::memory_order_release);
+            consumer_block_ = (consumer_block_ + 1) % num_blocks;
+            index_pending_ = state == kSealedIndexed;
+            blocks_written_++;
+            written++;
+        }
+        return written;
+    }
+
+    uint64_t GetFramesLogged() const { return frames_logged_; }
+
+    uint64_t GetDroppedFrames() const { return dropped_frames_; }
+
+    // Record bytes, without headers and padding
+    uint64_t GetBytesLogged() const { return bytes_logged_; }
+
+    // Data blocks, without index blocks
+    uint64_t GetBlocksWritten() const { return blocks_written_; }
+
+    uint64_t GetIndexBlocksWritten() const { return index_blocks_written_; }
+
+    uint64_t GetWriteErrors() const { return write_errors_; }
+
+private:
+    static constexpr size_t kRecordSpace{block_size - kCANLogBlockHeaderSize};
+    static constexpr uint8_t kFree{0};
+    static constexpr uint8_t kSealed{1};
+    static constexpr uint8_t kSealedIndexed{2};  // sealed, and the index block follows it
+
+    struct IDEntry
+    {
+        uint32_t key{0};
+        uint32_t generation{0};  // the block the entry belongs to, entries of earlier blocks are free
+        uint8_t len{0};
+        uint8_t data[8]{};
+    };
+
+    struct IndexEntry
+    {
+        uint32_t key{0};
+        uint32_t generation{0};  // the index block the entry belongs to, entries of earlier ones are free
+        uint64_t blocks{0};
+    };
+
+    Sink sink_;
+    std::array<std::array<uint8_t, block_size>, num_blocks> blocks_{};
+    std::atomic<uint8_t> states_[num_blocks];
+    std::array<IDEntry, max_ids> ids_{};
+    std::array<uint8_t, index_interval == 0 ? 1 : block_size> index_block_{};
+
+    // producer
+    size_t producer_block_{0};
+    bool filling_{false};
+    size_t used_{0};
+    uint16_t record_count_{0};
+    uint32_t sequence_{0};
+    uint32_t generation_{0};
+    uint64_t first_timestamp_us_{0};
+    uint64_t last_timestamp_us_{0};
+    uint64_t frames_logged_{0};
+    uint64_t dropped_frames_{0};
+    uint64_t bytes_logged_{0};
+    // index of the blocks sealed since the last index block
+    std::array<IndexEntry, index_interval == 0 ? 1 : max_ids> index_ids_{};
+    std::array<uint64_t, index_interval == 0 ? 1 : index_interval> index_checkpoints_{};
+    size_t index_blocks_{0};
+    uint32_t index_first_sequence_{0};
+    uint32_t index_generation_{1};
+    bool index_complete_{true};
+
+    // consumer
+    size_t consumer_block_{0};
+    bool index_pending_{false};
+    uint64_t blocks_written_{0};
+    uint64_t index_blocks_written_{0};
+    uint64_t write_errors_{0};
+
+    bool StartBlock(uint64_t timestamp_us)
+    {
+        if (states_[producer_block_].load(std::memory_order_acquire) != kFree)
+        {
+            return false;
+        }
+        filling_ = true;
+        used_ = 0;
+        record_count_ = 0;
+        generation_++;
+        first_timestamp_us_ = timestamp_us;
+        last_timestamp_us_ = timestamp_us;
+        return true;
+    }
+
+    // Marks key as present in the block being filled
+    void IndexID(uint32_t key)
+    {
+        if (index_interval == 0)
+        {
+            return;
+        }
+        size_t index = (key * 2654435761u) & (max_ids - 1);
+        for (size_t probe = 0; probe < max_ids; probe++)
+        {
+            IndexEntry &entry = index_ids_[(index + probe) & (max_ids - 1)];
+            if (entry.generation != index_generation_)
+            {
+                entry.key = key;
+                entry.generation = index_generation_;
+                entry.blocks = 0;
+            }
+            if (entry.key == key)
+            {
+                entry.blocks |= 1ull << index_blocks_;
+                return;
+            }
+        }
+        index_complete_ = false;
+    }
+
+    void BuildIndexBlock()
+    {
+        if (index_interval == 0)
+        {
+            return;
+        }
+        uint8_t *block = index_block_.data();
+        uint8_t *out = block + kCANLogBlockHeaderSize;
+        for (size_t i = 0; i < index_interval; i++, out += 8)
+        {
+            CANLogPut64(out, index_checkpoints_[i]);
+        }
+        uint16_t id_count = 0;
+        for (const IndexEntry &entry : index_ids_)
+        {
+            if (entry.generation == index_generation_)
+            {
+                CANLogPut32(out, entry.key);
+                CANLogPut64(out + 4, entry.blocks);
+                out += 12;
+                id_count++;
+            }
+        }
+        size_t used = static_cast<size_t>(out - (block + kCANLogBlockHeaderSize));
+        CANLogPut32(block, kCANLogIndexMagic);
+        CANLogPut32(block + 4, static_cast<uint32_t>(block_size));
+        CANLogPut32(block + 8, index_first_sequence_);
+        CANLogPut16(block + 12, static_cast<uint16_t>(index_interval));
+        CANLogPut16(block + 14, id_count);
+        CANLogPut64(block + 16, index_checkpoints_[0]);
+        CANLogPut64(block + 24, last_timestamp_us_);
+        CANLogPut32(block + 36, index_complete_ ? 0 : 1);
+        CANLogPut32(block + 32, CRC32(block + kCANLogBlockHeaderSize, used, CANLogHeaderCRC(block)));
+        memset(out, 0, block_size - kCANLogBlockHeaderSize - used);
+        index_blocks_ = 0;
+        index_generation_++;
+        index_complete_ = true;
+    }
+
+    // The entry for key, or a free one for it, or nullptr if the table is full for this block
+    IDEntry *FindEntry(uint32_t key)
+    {
+        size_t index = (key * 2654435761u) & (max_ids - 1);
+        for (size_t probe = 0; probe < max_ids; probe++)
+        {
+            IDEntry &entry = ids_[(index + probe) & (max_ids - 1)];
+            if (entry.generation != generation_ || entry.key == key)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+};
+
+#ifndef ARDUINO
+/**
+ * @brief Reads a binary log file frame by frame. Index blocks are skipped, corrupt blocks are skipped (and counted) and
+ * the reader resynchronizes on the next block boundary. To read only part of a log, see CANLogIndexedReader.
+ */
+class CANLogReader
+{
+public:
+    ~CANLogReader() { Close(); }
+
+    /**
+     * @brief Opens a log
+     *
+     * @return false if the file can't be opened or has no valid block header in its first 64 KiB
+     */
+    bool Open(const std::string &path, std::string *error = nullptr)
+    {
+        Close();
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == nullptr)
+        {
+            SetError(error, "could not open " + path);
+            return false;
+        }
+        // the first valid header gives the block size, a corrupt first block is skipped sector by sector
+        std::vector<uint8_t> sector(512);
+        for (long offset = 0; offset < 65536; offset += 512)
+        {
+            if (fseek(file_, offset, SEEK_SET) != 0 || fread(sector.data(), 1, 512, file_) != 512)
+            {
+                break;
+            }
+            CANLogBlockInfo info;
+            if (ReadCANLogBlockHeader(sector.data(), sector.size(), info))
+            {
+                block_size_ = info.block_size;
+                corrupt_blocks_ = static_cast<uint64_t>(offset) / block_size_;
+                fseek(file_, offset, SEEK_SET);
+                block_.resize(block_size_);
+                return true;
+            }
+        }
+        SetError(error, path + " is not a CAN log");
+        Close();
+        return false;
+    }
+
+    void Close()
+    {
+        if (file_ != nullptr)
+        {
+            fclose(file_);
+            file_ = nullptr;
+        }
+        records_.clear();
+        next_record_ = 0;
+    }
+
+    /**
+     * @brief Reads the next frame
+     *
+     * @return false at the end of the log
+     */
+    bool Next(CANLogRecord &record)
+    {
+        while (next_record_ >= records_.size())
+        {
+            records_.clear();
+            next_record_ = 0;
+            if (file_ == nullptr || fread(block_.data(), 1, block_size_, file_) != block_size_)
+            {
+                return false;
+            }
+            CANLogBlockInfo info;
+            if (IsCANLogIndexBlock(block_.data(), block_.size()))
+            {
+                continue;
+            }
+            if (!DecodeCANLogBlock(block_.data(), block_.size(), records_, &info) || info.block_size != block_size_)
+            {
+                records_.clear();
+                corrupt_blocks_++;
+            }
+        }
+        record = records_[next_record_++];
+        return true;
+    }
+
+    uint32_t GetBlockSize() const { return block_size_; }
+
+    uint64_t GetCorruptBlocks() const { return corrupt_blocks_; }
+
+private:
+    FILE *file_{nullptr};
+    uint32_t block_size_{0};
+    std::vector<uint8_t> block_;
+    std::vector<CANLogRecord> records_;
+    size_t next_record_{0};
+    uint64_t corrupt_blocks_{0};
+
+    static void SetError(std::string *error, const std::string &message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+};
+#endif
@@ -0,0 +1,733 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "can_log.h"
+#include "dbc_database.h"
+#include "dbc_decode_table.h"
+#include "parallel_for.h"
+
+/**
+ * @brief A file mapped read-only into memory (read into a buffer on platforms without mmap)
+ */
+class CANMappedFile
+{
+public:
+    CANMappedFile() = default;
+    CANMappedFile(const CANMappedFile &) = delete;
+    CANMappedFile &operator=(const CANMappedFile &) = delete;
+    ~CANMappedFile() { Close(); }
+
+    bool Open(const std::string &path, std::string *error = nullptr)
+    {
+        Close();
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            SetError(error, "could not open " + path);
+            return false;
+        }
+        size_ = static_cast<size_t>(status.st_size);
+        if (size_ > 0)
+        {
+            void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                close(fd);
+                size_ = 0;
+                SetError(error, "could not map " + path);
+                return false;
+            }
+            // chunks are read front to back, let the kernel read ahead
+            madvise(mapping, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const uint8_t *>(mapping);
+            mapped_ = true;
+        }
+        close(fd);
+        return true;
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            SetError(error, "could not open " + path);
+            return false;
+        }
+        uint8_t buffer[65536];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            buffer_.insert(buffer_.end(), buffer, buffer + read);
+        }
+        fclose(file);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        return true;
+#endif
+    }
+
+    void Close()
+    {
+#ifndef _WIN32
+        if (mapped_)
+        {
+            munmap(const_cast<uint8_t *>(data_), size_);
+        }
+#endif
+        buffer_.clear();
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+    }
+
+    const uint8_t *GetData() const { return data_; }
+    size_t GetSize() const { return size_; }
+
+private:
+    const uint8_t *data_{nullptr};
+    size_t size_{0};
+    bool mapped_{false};
+    std::vector<uint8_t> buffer_;
+
+    static void SetError(std::string *error, const std::string &message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+};
+
+enum class CANLogFormat
+{
+    kUnknown,
+    kCandump,  // candump -l: "(seconds) interface ID#DATA" per line
+    kASC,      // Vector ASC with absolute timestamps
+    kBinary    // the binary format of can_log.h
+};
+
+/**
+ * @brief Guesses the format of a log from its first bytes
+ */
+inline CANLogFormat DetectCANLogFormat(const uint8_t *data, size_t size)
+{
+    CANLogBlockInfo info;
+    for (size_t offset = 0; offset < 65536 && offset + kCANLogBlockHeaderSize <= size; offset += 512)
+    {
+        if (ReadCANLogBlockHeader(data + offset, size - offset, info))
+        {
+            return CANLogFormat::kBinary;
+        }
+    }
+    size_t i = 0;
+    while (i < size && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n'))
+    {
+        i++;
+    }
+    if (i < size && data[i] == '(')
+    {
+        return CANLogFormat::kCandump;
+    }
+    static const char *const kASCStarts[] = {"date ", "base ", "internal events", "Begin Triggerblock"};
+    for (const char *start : kASCStarts)
+    {
+        if (size - i >= strlen(start) && memcmp(data + i, start, strlen(start)) == 0)
+        {
+            return CANLogFormat::kASC;
+        }
+    }
+    return CANLogFormat::kUnknown;
+}
+
+// Parses the hex digits in [begin, end), false if there are none, any other character or too many
+inline bool CANLogParseHex(const char *begin, const char *end, uint32_t &value)
+{
+    value = 0;
+    if (begin == end || end - begin > 8)
+    {
+        return false;
+    }
+    for (const char *p = begin; p < end; p++)
+    {
+        char c = *p;
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = static_cast<uint32_t>(c - '0');
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = static_cast<uint32_t>(c - 'A' + 10);
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = static_cast<uint32_t>(c - 'a' + 10);
+        }
+        else
+        {
+            return false;
+        }
+        value = value << 4 | digit;
+    }
+    return true;
+}
+
+// Parses "seconds[.fraction]" at p into microseconds without going through a double, which would lose precision for
+// epoch timestamps
+inline bool CANLogParseSeconds(const char *&p, const char *end, uint64_t &timestamp_us)
+{
+    const char *start = p;
+    uint64_t seconds = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        seconds = seconds * 10 + static_cast<uint64_t>(*p++ - '0');
+    }
+    if (p == start)
+    {
+        return false;
+    }
+    uint64_t fraction = 0;
+    uint64_t scale = 1000000;
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (scale > 1)
+            {
+                scale /= 10;
+                fraction += static_cast<uint64_t>(*p - '0') * scale;
+            }
+            p++;
+        }
+    }
+    timestamp_us = seconds * 1000000 + fraction;
+    return true;
+}
+
+/**
+ * @brief Parses a candump -l line ("(1700000000.123456) can0 123#DEADBEEF", 8 ID digits for an extended ID,
+ * "123#R" for a remote frame). CAN FD frames ("##") are rejected.
+ *
+ * @param begin The start of the line
+ * @param end The end of the line, excluding the newline
+ */
+inline bool ParseCandumpLine(const char *begin, const char *end, CANLogRecord &record)
+{
+    const char *p = begin;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    if (p == end || *p++ != '(' || !CANLogParseSeconds(p, end, record.timestamp_us) || p == end || *p++ != ')')
+    {
+        return false;
+    }
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    while (p < end && *p != ' ')  // interface
+    {
+        p++;
+    }
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    const char *id = p;
+    while (p < end && *p != '#')
+    {
+        p++;
+    }
+    uint32_t value;
+    if (p == end || !CANLogParseHex(id, p, value))
+    {
+        return false;
+    }
+    record.frame.id_ = value;
+    record.frame.extended_id_ = p - id == 8;
+    record.frame.data_ = {};
+    p++;
+    if (p < end && *p == 'R')
+    {
+        record.frame.len_ = 0;
+        return true;
+    }
+    uint8_t len = 0;
+    while (p + 1 < end && *p != ' ' && *p != '\r')
+    {
+        uint32_t byte;
+        if (len == 8 || !CANLogParseHex(p, p + 2, byte))
+        {
+            return false;
+        }
+        record.frame.data_[len++] = static_cast<uint8_t>(byte);
+        p += 2;
+    }
+    record.frame.len_ = len;
+    return p == end || *p == ' ' || *p == '\r';
+}
+
+/**
+ * @brief Parses a classic CAN frame line of a Vector ASC log ("   1.234567 1  123x  Rx   d 8 01 02 03 04 05 06 07 08
+ * ...", x marking an extended ID). Header lines, events, error frames and CAN FD frames are rejected.
+ *
+ * @param hex_ids false if the log's header says "base dec"
+ */
+inline bool ParseASCLine(const char *begin, const char *end, bool hex_ids, CANLogRecord &record)
+{
+    const char *p = begin;
+    auto skip_spaces = [&p, end]()
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+    };
+    auto token = [&p, end, &skip_spaces](const char *&token_begin)
+    {
+        skip_spaces();
+        token_begin = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        {
+            p++;
+        }
+        return p - token_begin;
+    };
+    skip_spaces();
+    if (!CANLogParseSeconds(p, end, record.timestamp_us))
+    {
+        return false;
+    }
+    const char *text;
+    if (token(text) == 0 || *text < '0' || *text > '9')  // channel
+    {
+        return false;
+    }
+    ptrdiff_t length = token(text);
+    if (length == 0)
+    {
+        return false;
+    }
+    record.frame.extended_id_ = text[length - 1] == 'x';
+    const char *id_end = text + length - (record.frame.extended_id_ ? 1 : 0);
+    uint32_t id = 0;
+    if (hex_ids)
+    {
+        if (!CANLogParseHex(text, id_end, id))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        for (const char *digit = text; digit < id_end; digit++)
+        {
+            if (*digit < '0' || *digit > '9')
+            {
+                return false;
+            }
+            id = id * 10 + static_cast<uint32_t>(*digit - '0');
+        }
+    }
+    record.frame.id_ = id;
+    const char *direction;
+    if (token(direction) != 2 || (memcmp(direction, "Rx", 2) != 0 && memcmp(direction, "Tx", 2) != 0))
+    {
+        return false;
+    }
+    const char *type;
+    if (token(type) != 1 || (*type != 'd' && *type != 'r'))
+    {
+        return false;
+    }
+    const char *dlc;
+    if (token(dlc) != 1 || *dlc < '0' || *dlc > '8')
+    {
+        return false;
+    }
+    record.frame.data_ = {};
+    record.frame.len_ = *type == 'r' ? 0 : static_cast<uint8_t>(*dlc - '0');
+    for (uint8_t i = 0; i < record.frame.len_; i++)
+    {
+        const char *byte_text;
+        uint32_t byte;
+        if (token(byte_text) != 2 || !CANLogParseHex(byte_text, byte_text + 2, byte))
+        {
+            return false;
+        }
+        record.frame.data_[i] = static_cast<uint8_t>(byte);
+    }
+    return true;
+}
+
+/**
+ * @brief A frame decoded against a DBC
+ */
+struct CANDecodedFrame
+{
+    uint64_t timestamp_us;
+    const DBCMessage *message;
+    // One value per signal of message, in the order of message->signals. Multiplexed signals that aren't selected by
+    // the frame's multiplexor value are NaN.
+    const double *values;
+    uint64_t payload;  // the frame's data bytes in memory order, for consumers that need raw values
+};
+
+/**
+ * @brief Decodes whole log files against a DBC on all cores for offline analysis. The log (candump -l, Vector ASC or
+ * the binary format of can_log.h) is memory-mapped and split into chunks at line or block boundaries; a batch of
+ * chunks is decoded in parallel on a work-stealing pool with a DBCDecodeTable, and the decoded frames of the batch are
+ * merged in timestamp order and handed to a consumer on the calling thread before the next batch starts, so memory use
+ * is bounded by the batch size rather than the log size.
+ *
+ * Frames are in timestamp order within a batch; across batches the log's own order is kept, which is timestamp order
+ * for every log this library writes. Frames with an ID not in the DBC are counted and skipped.
+ */
+class CANLogDecoder
+{
+public:
+    struct Options
+    {
+        size_t threads{0};            // 0 for one per hardware thread
+        size_t chunk_bytes{4 << 20};  // largest chunk size, rounded to whole lines or blocks
+        size_t chunks_per_batch{0};   // 0 for 4 per thread
+    };
+
+    struct ThreadStats
+    {
+        uint64_t chunks{0};
+        uint64_t frames{0};
+        uint64_t busy_ns{0};  // time spent parsing and decoding chunks
+
+        double GetFramesPerSecond() const { return busy_ns == 0 ? 0 : frames * 1e9 / busy_ns; }
+    };
+
+    struct Stats
+    {
+        uint64_t bytes{0};
+        uint64_t frames{0};             // frames decoded and handed to the consumer
+        uint64_t unknown_frames{0};     // frames with an ID that isn't in the DBC
+        uint64_t malformed_records{0};  // candump lines that don't parse, or binary blocks that fail their CRC
+        uint64_t chunks{0};
+        uint64_t wall_ns{0};
+        uint64_t merge_ns{0};  // time spent merging and in the consumer, on the calling thread
+        std::vector<ThreadStats> threads;
+
+        double GetFramesPerSecond() const { return wall_ns == 0 ? 0 : frames * 1e9 / wall_ns; }
+    };
+
+    using Consumer = std::function<void(const CANDecodedFrame &)>;
+
+    explicit CANLogDecoder(const DBCDatabase &database) : CANLogDecoder(database, Options{}) {}
+
+    CANLogDecoder(const DBCDatabase &database, const Options &options) : options_(options), table_(database) {}
+
+    /**
+     * @brief Decodes a log file, see Decode
+     */
+    bool DecodeFile(const std::string &path, const Consumer &consumer, std::string *error = nullptr)
+    {
+        CANMappedFile file;
+        if (!file.Open(path, error))
+        {
+            return false;
+        }
+        return Decode(file.GetData(), file.GetSize(), consumer, error);
+    }
+
+    /**
+     * @brief Decodes a log in memory, detecting its format
+     *
+     * @param consumer Called on the calling thread for every decoded frame, in timestamp order
+     * @return false if the format isn't recognised
+     */
+    bool Decode(const uint8_t *data, size_t size, const Consumer &consumer, std::string *error = nullptr)
+    {
+        uint64_t start = NowNs();
+        stats_ = Stats{};
+        stats_.bytes = size;
+        size_t threads = options_.threads;
+        if (threads == 0)
+        {
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        // small logs still get a few chunks per thread
+        size_t chunk_bytes = std::min(options_.chunk_bytes, std::max<size_t>(64 << 10, size / (threads * 4)));
+        CANLogFormat format = DetectCANLogFormat(data, size);
+        bool hex_ids = true;
+        std::vector<Range> chunks;
+        if (format == CANLogFormat::kBinary)
+        {
+            SplitBlocks(data, size, chunk_bytes, chunks);
+        }
+        else if (format == CANLogFormat::kCandump || format == CANLogFormat::kASC)
+        {
+            if (format == CANLogFormat::kASC && !ReadASCHeader(data, size, hex_ids, error))
+            {
+                return false;
+            }
+            SplitLines(data, size, chunk_bytes, chunks);
+        }
+        else
+        {
+            if (error != nullptr)
+            {
+                *error = "unrecognised log format";
+            }
+            return false;
+        }
+
+        size_t batch_size = options_.chunks_per_batch != 0 ? options_.chunks_per_batch : threads * 4;
+        stats_.threads.resize(threads);
+        stats_.chunks = chunks.size();
+        std::vector<ChunkResult> results(std::min(batch_size, chunks.size()));
+        for (size_t first = 0; first < chunks.size(); first += batch_size)
+        {
+            size_t count = std::min(batch_size, chunks.size() - first);
+            WorkStealingParallelFor(count,
+                                    threads,
+                                    [&](size_t index, size_t thread)
+                                    {
+                                        uint64_t chunk_start = NowNs();
+                                        ChunkResult &result = results[index];
+                                        DecodeChunk(data, chunks[first + index], format, hex_ids, result);
+                                        ThreadStats &thread_stats = stats_.threads[thread];
+                                        thread_stats.chunks++;
+                                        thread_stats.frames += result.rows.size();
+                                        thread_stats.busy_ns += NowNs() - chunk_start;
+                                    });
+            uint64_t merge_start = NowNs();
+            Merge(results, count, consumer);
+            stats_.merge_ns += NowNs() - merge_start;
+        }
+        stats_.wall_ns = NowNs() - start;
+        return true;
+    }
+
+    // Statistics of the last Decode call
+    const Stats &GetStats() const { return stats_; }
+
+private:
+    struct Range
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    struct Row
+    {
+        uint64_t timestamp_us;
+        uint32_t message;
+        uint32_t values;  // index of the first value in ChunkResult::values
+        uint64_t payload;
+    };
+
+    struct ChunkResult
+    {
+        std::vector<Row> rows;
+        std::vector<double> values;
+        std::vector<CANLogRecord> records;  // scratch for binary blocks
+        uint64_t unknown_frames;
+        uint64_t malformed_records;
+    };
+
+    Options options_;
+    DBCDecodeTable table_;
+    Stats stats_;
+    size_t block_size_{0};  // of the binary log being decoded
+
+    static uint64_t NowNs()
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+    }
+
+    static bool ReadASCHeader(const uint8_t *data, size_t size, bool &hex_ids, std::string *error)
+    {
+        std::string header{reinterpret_cast<const char *>(data), std::min<size_t>(size, 4096)};
+        hex_ids = header.find("base dec") == std::string::npos;
+        if (header.find("timestamps relative") != std::string::npos)
+        {
+            // each line's time depends on every line before it, which would serialise decoding
+            if (error != nullptr)
+            {
+                *error = "ASC logs with relative timestamps are not supported";
+            }
+            return false;
+        }
+        return true;
+    }
+
+    static void SplitLines(const uint8_t *data, size_t size, size_t chunk_bytes, std::vector<Range> &chunks)
+    {
+        size_t begin = 0;
+        while (begin < size)
+        {
+            size_t end = std::min(size, begin + std::max<size_t>(chunk_bytes, 1));
+            const void *newline = end < size ? memchr(data + end, '\n', size - end) : nullptr;
+            end = newline != nullptr ? static_cast<size_t>(static_cast<const uint8_t *>(newline) - data) + 1 : size;
+            chunks.push_back(Range{begin, end});
+            begin = end;
+        }
+    }
+
+    void SplitBlocks(const uint8_t *data, size_t size, size_t chunk_bytes, std::vector<Range> &chunks)
+    {
+        // like CANLogReader, the first valid header gives the block size and anything before it is corrupt
+        CANLogBlockInfo info;
+        size_t begin = 0;
+        while (!ReadCANLogBlockHeader(data + begin, size - begin, info))
+        {
+            begin += 512;  // DetectCANLogFormat found a header, so this stops
+        }
+        block_size_ = info.block_size;
+        stats_.malformed_records += begin / block_size_;
+        size_t blocks_per_chunk = std::max<size_t>(1, chunk_bytes / block_size_);
+        while (begin < size)
+        {
+            size_t end = std::min(size, begin + blocks_per_chunk * block_size_);
+            chunks.push_back(Range{begin, end});
+            begin = end;
+        }
+    }
+
+    void DecodeChunk(const uint8_t *data, const Range &range, CANLogFormat format, bool hex_ids, ChunkResult &result)
+    {
+        result.rows.clear();
+        result.values.clear();
+        result.unknown_frames = 0;
+        result.malformed_records = 0;
+        if (format == CANLogFormat::kBinary)
+        {
+            for (size_t offset = range.begin; offset < range.end; offset += block_size_)
+            {
+                CANLogBlockInfo info;
+                result.records.clear();
+                if (IsCANLogIndexBlock(data + offset, range.end - offset))
+                {
+                    continue;
+                }
+                if (!DecodeCANLogBlock(data + offset, range.end - offset, result.records, &info)
+                    || info.block_size != block_size_)
+                {
+                    result.malformed_records++;
+                    continue;
+                }
+                for (const CANLogRecord &record : result.records)
+                {
+                    DecodeFrame(record, result);
+                }
+            }
+        }
+        else
+        {
+            const char *p = reinterpret_cast<const char *>(data + range.begin);
+            const char *end = reinterpret_cast<const char *>(data + range.end);
+            while (p < end)
+            {
+                const char *newline = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+                const char *line_end = newline != nullptr ? newline : end;
+                CANLogRecord record;
+                if (format == CANLogFormat::kCandump ? ParseCandumpLine(p, line_end, record)
+                                                     : ParseASCLine(p, line_end, hex_ids, record))
+                {
+                    DecodeFrame(record, result);
+                }
+                else if (format == CANLogFormat::kCandump && line_end > p && *p != '\r')
+                {
+                    // ASC logs are full of non-frame lines (header, events), only count candump lines
+                    result.malformed_records++;
+                }
+                p = line_end + 1;
+            }
+        }
+        // loggers with several sources (e.g. candump of several interfaces) can be slightly out of order
+        std::stable_sort(result.rows.begin(),
+                         result.rows.end(),
+                         [](const Row &a, const Row &b) { return a.timestamp_us < b.timestamp_us; });
+    }
+
+    void DecodeFrame(const CANLogRecord &record, ChunkResult &result) const
+    {
+        uint16_t message = table_.FindMessage(record.frame.id_, record.frame.extended_id_);
+        if (message == DBCDecodeTable::kNoMessage)
+        {
+            result.unknown_frames++;
+            return;
+        }
+        size_t first_value = result.values.size();
+        uint64_t payload;
+        memcpy(&payload, record.frame.data_.data(), sizeof(payload));
+        result.rows.push_back(Row{record.timestamp_us, message, static_cast<uint32_t>(first_value), payload});
+        result.values.resize(first_value + table_.GetMessage(message).signal_count);
+        table_.DecodePayload(message, payload, result.values.data() + first_value);
+    }
+
+    void Merge(std::vector<ChunkResult> &results, size_t count, const Consumer &consumer)
+    {
+        // k-way merge of the chunks' sorted rows, ties go to the earlier chunk so equal timestamps keep file order
+        std::vector<size_t> positions(count, 0);
+        auto later = [&results, &positions](size_t a, size_t b)
+        {
+            uint64_t time_a = results[a].rows[positions[a]].timestamp_us;
+            uint64_t time_b = results[b].rows[positions[b]].timestamp_us;
+            return time_a != time_b ? time_a > time_b : a > b;
+        };
+        std::vector<size_t> heap;
+        for (size_t i = 0; i < count; i++)
+        {
+            stats_.unknown_frames += results[i].unknown_frames;
+            stats_.malformed_records += results[i].malformed_records;
+            if (!results[i].rows.empty())
+            {
+                heap.push_back(i);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            size_t chunk = heap.back();
+            const Row &row = results[chunk].rows[positions[chunk]];
+            CANDecodedFrame frame{row.timestamp_us,
+                                  table_.GetMessage(row.message).source,
+                                  results[chunk].values.data() + row.values,
+                                  row.payload};
+            consumer(frame);
+            stats_.frames++;
+            if (++positions[chunk] < results[chunk].rows.size())
+            {
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            else
+            {
+                heap.pop_back();
+            }
+        }
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "can_log.h"
+
+/**
+ * @brief Reads the parts of a binary log (see can_log.h) around a time range or holding an ID without scanning the
+ * whole file. Open reads only the index blocks the writer left every index interval data blocks, keeping each data
+ * block's first timestamp and each index block's ID bitmaps in memory (a few dozen bytes per data block); a query is
+ * then a binary search over the timestamps, and Read decodes only the blocks it found.
+ *
+ * Data blocks not covered by a valid index block (the last partial interval, a corrupt index block or a log written
+ * without an index) have their headers read at Open instead, and can't be ruled out by ID. The log's frames are assumed
+ * to be in timestamp order, as CANLogWriter writes them when its timestamps are.
+ */
+class CANLogIndexedReader
+{
+public:
+    ~CANLogIndexedReader() { Close(); }
+
+    /**
+     * @brief Opens a log and reads its index
+     *
+     * @return false if the file can't be opened or has no valid data block header in its first 64 KiB
+     */
+    bool Open(const std::string &path, std::string *error = nullptr)
+    {
+        Close();
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == nullptr)
+        {
+            SetError(error, "could not open " + path);
+            return false;
+        }
+        // like CANLogReader, the first valid header gives the block size (and the index interval)
+        std::vector<uint8_t> sector(512);
+        CANLogBlockInfo info;
+        uint64_t first_block = 0;
+        bool found = false;
+        for (long offset = 0; offset < 65536 && !found; offset += 512)
+        {
+            if (fseek(file_, offset, SEEK_SET) != 0 || fread(sector.data(), 1, 512, file_) != 512)
+            {
+                break;
+            }
+            found = ReadCANLogBlockHeader(sector.data(), sector.size(), info);
+            first_block = static_cast<uint64_t>(offset) / 512;
+        }
+        if (!found || fseek(file_, 0, SEEK_END) != 0)
+        {
+            SetError(error, path + " is not a CAN log");
+            Close();
+            return false;
+        }
+        block_size_ = info.block_size;
+        first_block = first_block * 512 / block_size_;
+        uint64_t file_blocks = static_cast<uint64_t>(ftell(file_)) / block_size_;
+        block_.resize(block_size_);
+        uint32_t interval = CANLogGet32(sector.data() + 36);
+        // the interval is only taken from a block whose CRC checks out
+        std::vector<CANLogRecord> records;
+        if (interval == 0 || interval > 64 || !ReadBlock(first_block)
+            || !DecodeCANLogBlock(block_.data(), block_.size(), records))
+        {
+            ScanHeaders(first_block, file_blocks);
+            return true;
+        }
+
+        // the data block with sequence number s is file block s + s / interval, counted from where the log starts
+        uint64_t stride = interval + 1;
+        uint64_t preceding = info.sequence + info.sequence / interval;
+        uint64_t start = first_block >= preceding ? first_block - preceding : first_block;
+        for (uint64_t group_start = start; group_start < file_blocks; group_start += stride)
+        {
+            // the whole stride, so a wrong interval can't skip a data block where the index block should be
+            uint64_t group_end = std::min(file_blocks, group_start + stride);
+            CANLogIndexInfo index;
+            if (group_start + interval >= file_blocks || !ReadBlock(group_start + interval)
+                || !ReadCANLogIndexBlock(block_.data(), block_.size(), index) || index.checkpoints.size() != interval)
+            {
+                ScanHeaders(group_start, group_end);
+                continue;
+            }
+            Group group{blocks_.size(), std::move(index.ids), index.complete};
+            for (uint32_t i = 0; i < interval; i++)
+            {
+                blocks_.push_back(Block{group_start + i, index.checkpoints[i], groups_.size()});
+            }
+            groups_.push_back(std::move(group));
+            indexed_blocks_ += interval;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if (file_ != nullptr)
+        {
+            fclose(file_);
+            file_ = nullptr;
+        }
+        blocks_.clear();
+        groups_.clear();
+        indexed_blocks_ = 0;
+        blocks_read_ = 0;
+        corrupt_blocks_ = 0;
+    }
+
+    /**
+     * @brief Finds the data blocks that may hold frames from from_us to to_us
+     *
+     * @param blocks Receives the blocks' numbers, for ReadBlockRecords
+     */
+    void FindBlocks(uint64_t from_us, uint64_t to_us, std::vector<size_t> &blocks) const
+    {
+        blocks.clear();
+        auto first_after = [this](uint64_t timestamp_us)
+        {
+            return static_cast<size_t>(std::upper_bound(blocks_.begin(),
+                                                        blocks_.end(),
+                                                        timestamp_us,
+                                                        [](uint64_t value, const Block &block)
+                                                        { return value < block.first_timestamp_us; })
+                                       - blocks_.begin());
+        };
+        // the block before the first one starting after from_us may run past it
+        size_t begin = first_after(from_us);
+        begin = begin > 0 ? begin - 1 : 0;
+        size_t end = from_us <= to_us ? first_after(to_us) : begin;
+        for (size_t i = begin; i < end; i++)
+        {
+            blocks.push_back(i);
+        }
+    }
+
+    /**
+     * @brief Finds the data blocks that may hold frames with an ID from from_us to to_us
+     */
+    void FindBlocks(uint64_t from_us, uint64_t to_us, uint32_t id, bool extended_id, std::vector<size_t> &blocks) const
+    {
+        FindBlocks(from_us, to_us, blocks);
+        uint32_t key = Key(id, extended_id);
+        blocks.erase(std::remove_if(blocks.begin(),
+                                    blocks.end(),
+                                    [this, key](size_t block)
+                                    {
+                                        const Block &data_block = blocks_[block];
+                                        if (data_block.group == kNoGroup)
+                                        {
+                                            return false;
+                                        }
+                                        const Group &group = groups_[data_block.group];
+                                        auto found = std::lower_bound(group.ids.begin(),
+                                                                      group.ids.end(),
+                                                                      std::make_pair(key, static_cast<uint64_t>(0)));
+                                        uint64_t bitmap = found != group.ids.end() && found->first == key
+                                                              ? found->second
+                                                              : (group.complete ? 0 : ~0ull);
+                                        return ((bitmap >> (block - group.first_block)) & 1) == 0;
+                                    }),
+                     blocks.end());
+    }
+
+    /**
+     * @brief Decodes a data block found by FindBlocks
+     *
+     * @param records The block's frames are appended to this
+     * @return false if the block can't be read or is corrupt
+     */
+    bool ReadBlockRecords(size_t block, std::vector<CANLogRecord> &records)
+    {
+        if (block >= blocks_.size() || !ReadBlock(blocks_[block].position))
+        {
+            return false;
+        }
+        blocks_read_++;
+        CANLogBlockInfo info;
+        if (!DecodeCANLogBlock(block_.data(), block_.size(), records, &info) || info.block_size != block_size_)
+        {
+            corrupt_blocks_++;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads the frames from from_us to to_us, decoding only the blocks that may hold them
+     *
+     * @param consumer Called as consumer(const CANLogRecord &) for each frame, in log order
+     */
+    template <typename Consumer>
+    void Read(uint64_t from_us, uint64_t to_us, Consumer &&consumer)
+    {
+        std::vector<size_t> blocks;
+        FindBlocks(from_us, to_us, blocks);
+        ReadBlocks(blocks, from_us, to_us, false, 0, consumer);
+    }
+
+    /**
+     * @brief Reads the frames with an ID from from_us to to_us, decoding only the blocks that hold it
+     */
+    template <typename Consumer>
+    void Read(uint64_t from_us, uint64_t to_us, uint32_t id, bool extended_id, Consumer &&consumer)
+    {
+        std::vector<size_t> blocks;
+        FindBlocks(from_us, to_us, id, extended_id, blocks);
+        ReadBlocks(blocks, from_us, to_us, true, Key(id, extended_id), consumer);
+    }
+
+    // Data blocks in the log
+    size_t GetBlockCount() const { return blocks_.size(); }
+    // Data blocks covered by a valid index block
+    size_t GetIndexedBlockCount() const { return indexed_blocks_; }
+    uint32_t GetBlockSize() const { return block_size_; }
+    // Data blocks decoded since Open
+    uint64_t GetBlocksRead() const { return blocks_read_; }
+    uint64_t GetCorruptBlocks() const { return corrupt_blocks_; }
+
+private:
+    static constexpr size_t kNoGroup{~static_cast<size_t>(0)};
+
+    struct Block
+    {
+        uint64_t position;  // in blocks from the start of the file
+        uint64_t first_timestamp_us;
+        size_t group;  // the index block covering it, kNoGroup if none
+    };
+
+    struct Group
+    {
+        size_t first_block;
+        std::vector<std::pair<uint32_t, uint64_t>> ids;
+        bool complete;
+    };
+
+    FILE *file_{nullptr};
+    uint32_t block_size_{0};
+    std::vector<uint8_t> block_;
+    std::vector<Block> blocks_;
+    std::vector<Group> groups_;
+    size_t indexed_blocks_{0};
+    uint64_t blocks_read_{0};
+    uint64_t corrupt_blocks_{0};
+
+    bool ReadBlock(uint64_t position)
+    {
+        return fseek(file_, static_cast<long>(position * block_size_), SEEK_SET) == 0
+               && fread(block_.data(), 1, block_size_, file_) == block_size_;
+    }
+
+    // Adds the data blocks in [begin, end) by their headers
+    void ScanHeaders(uint64_t begin, uint64_t end)
+    {
+        for (uint64_t position = begin; position < end; position++)
+        {
+            CANLogBlockInfo info;
+            if (ReadBlock(position) && ReadCANLogBlockHeader(block_.data(), block_.size(), info))
+            {
+                blocks_.push_back(Block{position, info.first_timestamp_us, kNoGroup});
+            }
+        }
+    }
+
+    static uint32_t Key(uint32_t id, bool extended_id) { return (id & 0x1FFFFFFF) | (extended_id ? 0x80000000u : 0); }
+
+    template <typename Consumer>
+    void ReadBlocks(const std::vector<size_t> &blocks,
+                    uint64_t from_us,
+                    uint64_t to_us,
+                    bool by_id,
+                    uint32_t key,
+                    Consumer &consumer)
+    {
+        std::vector<CANLogRecord> records;
+        for (size_t block : blocks)
+        {
+            records.clear();
+            ReadBlockRecords(block, records);
+            for (const CANLogRecord &record : records)
+            {
+                if (record.timestamp_us >= from_us && record.timestamp_us <= to_us
+                    && (!by_id || Key(record.frame.id_, record.frame.extended_id_) == key))
+                {
+                    consumer(record);
+                }
+            }
+        }
+    }
+
+    static void SetError(std::string *error, const std::string &message)
+    {
+        if (error != nullptr)
+        {
+            *error = message;
+        }
+    }
+};
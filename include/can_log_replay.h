@@ -0,0 +1,311 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "can_interface.h"
+#include "can_log.h"
+#include "can_log_decoder.h"
+
+/**
+ * @brief Reads every frame of a log in memory (candump -l, Vector ASC with absolute timestamps or the binary format of
+ * can_log.h) in timestamp order
+ *
+ * @param filter Frames it returns false for are left out, all frames are kept if it is empty
+ * @param malformed_records If not nullptr, receives the number of candump lines that don't parse and binary blocks that
+ * fail their CRC
+ * @return false if the format isn't recognised
+ */
+inline bool ReadCANLogRecords(const uint8_t *data,
+                              size_t size,
+                              const std::function<bool(uint32_t id, bool extended_id)> &filter,
+                              std::vector<CANLogRecord> &records,
+                              uint64_t *malformed_records = nullptr,
+                              std::string *error = nullptr)
+{
+    uint64_t malformed = 0;
+    auto keep = [&filter, &records](const CANLogRecord &record)
+    {
+        if (!filter || filter(record.frame.id_, record.frame.extended_id_))
+        {
+            records.push_back(record);
+        }
+    };
+    CANLogFormat format = DetectCANLogFormat(data, size);
+    if (format == CANLogFormat::kBinary)
+    {
+        // like CANLogReader, the first valid header gives the block size and anything before it is corrupt
+        CANLogBlockInfo info;
+        size_t offset = 0;
+        while (!ReadCANLogBlockHeader(data + offset, size - offset, info))
+        {
+            offset += 512;
+        }
+        uint32_t block_size = info.block_size;
+        malformed += offset / block_size;
+        std::vector<CANLogRecord> block_records;
+        for (; offset < size; offset += block_size)
+        {
+            block_records.clear();
+            if (IsCANLogIndexBlock(data + offset, size - offset))
+            {
+                continue;
+            }
+            if (!DecodeCANLogBlock(data + offset, size - offset, block_records, &info) || info.block_size != block_size)
+            {
+                malformed++;
+                continue;
+            }
+            for (const CANLogRecord &record : block_records)
+            {
+                keep(record);
+            }
+        }
+    }
+    else if (format == CANLogFormat::kCandump || format == CANLogFormat::kASC)
+    {
+        std::string header{reinterpret_cast<const char *>(data), std::min<size_t>(size, 4096)};
+        bool hex_ids = header.find("base dec") == std::string::npos;
+        if (format == CANLogFormat::kASC && header.find("timestamps relative") != std::string::npos)
+        {
+            if (error != nullptr)
+            {
+                *error = "ASC logs with relative timestamps are not supported";
+            }
+            return false;
+        }
+        const char *p = reinterpret_cast<const char *>(data);
+        const char *end = p + size;
+        while (p < end)
+        {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+            const char *line_end = newline != nullptr ? newline : end;
+            CANLogRecord record;
+            if (format == CANLogFormat::kCandump ? ParseCandumpLine(p, line_end, record)
+                                                 : ParseASCLine(p, line_end, hex_ids, record))
+            {
+                keep(record);
+            }
+            else if (format == CANLogFormat::kCandump && line_end > p && *p != '\r')
+            {
+                malformed++;
+            }
+            p = line_end + 1;
+        }
+    }
+    else
+    {
+        if (error != nullptr)
+        {
+            *error = "unrecognised log format";
+        }
+        return false;
+    }
+    // loggers with several sources (e.g. candump of several interfaces) can be slightly out of order
+    std::stable_sort(records.begin(),
+                     records.end(),
+                     [](const CANLogRecord &a, const CANLogRecord &b) { return a.timestamp_us < b.timestamp_us; });
+    if (malformed_records != nullptr)
+    {
+        *malformed_records = malformed;
+    }
+    return true;
+}
+
+/**
+ * @brief An ICAN that plays a recorded log back into node firmware logic on native, to reproduce problems from the car
+ * on the bench. Register CANRXMessages on it like on a hardware backend; every Tick() hands them the frames that are
+ * due, through the same tap and DecodeSignals loop (and rx_dispatch profiling) as TeensyCAN and ESPCAN, so decode
+ * times measured in replay carry over to the car.
+ *
+ * The log is read into memory when opened (24 bytes per frame), so Tick() does no parsing. Frames are due at their
+ * original spacing, scaled by the speed option, counted from the first Tick(); at speed 0 each Tick() delivers a whole
+ * pass of the log (or max_frames_per_tick frames) as fast as the RX messages take them. Frames sent by the node are
+ * tapped and counted, not looped back.
+ */
+class CANLogReplay : public ICAN
+{
+public:
+    struct Options
+    {
+        double speed{1};                 // 1 for real time, N for N times faster, 0 for as fast as possible
+        uint32_t loops{1};               // passes over the log, 0 to loop forever
+        size_t max_frames_per_tick{0};   // 0 for no limit
+        std::function<bool(uint32_t id, bool extended_id)> filter;  // frames to replay, all if empty
+    };
+
+    struct Stats
+    {
+        uint64_t frames{0};             // frames dispatched to the RX messages
+        uint64_t sent_frames{0};        // frames the node sent
+        uint64_t malformed_records{0};  // in the log, see ReadCANLogRecords
+        uint32_t loops{0};              // completed passes over the log
+        uint64_t max_lag_us{0};         // the latest a frame was delivered after it was due, at real time
+        uint64_t dispatch_ns{0};        // time spent dispatching frames to the RX messages
+
+        double GetFramesPerSecond() const { return dispatch_ns == 0 ? 0 : frames * 1e9 / dispatch_ns; }
+    };
+
+    CANLogReplay() : CANLogReplay(Options{}) {}
+
+    explicit CANLogReplay(const Options &options) : CANLogReplay(options, &SteadyMicros) {}
+
+    /**
+     * @param get_micros A function to get the current time in microseconds, e.g. a VirtualCANBus's or a test's clock
+     */
+    CANLogReplay(const Options &options, std::function<uint64_t(void)> get_micros)
+        : options_(options), get_micros_{get_micros}
+    {
+    }
+
+    /**
+     * @brief Reads a log file to replay, see ReadCANLogRecords
+     */
+    bool Open(const std::string &path, std::string *error = nullptr)
+    {
+        CANMappedFile file;
+        return file.Open(path, error) && Load(file.GetData(), file.GetSize(), error);
+    }
+
+    /**
+     * @brief Reads a log in memory to replay, see ReadCANLogRecords
+     */
+    bool Load(const uint8_t *data, size_t size, std::string *error = nullptr)
+    {
+        records_.clear();
+        stats_ = Stats{};
+        if (!ReadCANLogRecords(data, size, options_.filter, records_, &stats_.malformed_records, error))
+        {
+            return false;
+        }
+        if (!records_.empty())
+        {
+            // the next pass starts one average frame interval after the last frame
+            uint64_t span_us = records_.back().timestamp_us - records_.front().timestamp_us;
+            pass_us_ = std::max<uint64_t>(1, span_us + (records_.size() > 1 ? span_us / (records_.size() - 1) : 0));
+        }
+        Restart();
+        return true;
+    }
+
+    /**
+     * @brief Starts over from the first frame, timed from the next Tick()
+     */
+    void Restart()
+    {
+        started_ = false;
+        next_record_ = 0;
+        pass_ = 0;
+        finished_ = records_.empty();
+        stats_.loops = 0;
+    }
+
+    void Initialize(BaudRate baud __attribute__((unused))) override {}
+
+    bool SendMessage(CANMessage &msg) override
+    {
+        TapFrame(msg, true);
+        stats_.sent_frames++;
+        return true;
+    }
+
+    void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages_.push_back(&msg); }
+
+    // Hands every frame that is due to every registered RX message
+    void Tick() override
+    {
+        if (finished_)
+        {
+            return;
+        }
+        uint64_t now_us = get_micros_();
+        if (!started_)
+        {
+            start_us_ = now_us;
+            started_ = true;
+        }
+        double log_elapsed_us = static_cast<double>(now_us - start_us_) * options_.speed;
+        uint64_t dispatch_start = SteadyNs();
+        size_t delivered = 0;
+        while (!finished_ && (options_.max_frames_per_tick == 0 || delivered < options_.max_frames_per_tick))
+        {
+            const CANLogRecord &record = records_[next_record_];
+            if (options_.speed > 0)
+            {
+                double due_us = static_cast<double>(GetPassOffsetUs() + record.timestamp_us - records_[0].timestamp_us);
+                if (due_us > log_elapsed_us)
+                {
+                    break;
+                }
+                stats_.max_lag_us =
+                    std::max(stats_.max_lag_us, static_cast<uint64_t>((log_elapsed_us - due_us) / options_.speed));
+            }
+            Dispatch(record.frame);
+            stats_.frames++;
+            log_time_us_ = GetPassOffsetUs() + record.timestamp_us;
+            delivered++;
+            if (++next_record_ == records_.size())
+            {
+                next_record_ = 0;
+                pass_++;
+                stats_.loops++;
+                finished_ = options_.loops != 0 && stats_.loops >= options_.loops;
+                if (options_.speed <= 0 && options_.max_frames_per_tick == 0)
+                {
+                    break;  // one pass per Tick, so looping forever still returns
+                }
+            }
+        }
+        stats_.dispatch_ns += SteadyNs() - dispatch_start;
+    }
+
+    size_t GetFrameCount() const { return records_.size(); }
+    // true once every pass has been delivered
+    bool IsFinished() const { return finished_; }
+    // The log timestamp of the last delivered frame, counting on across passes, for RX messages' get_millis at speed 0
+    uint64_t GetLogTimeUs() const { return log_time_us_; }
+    const Stats &GetStats() const { return stats_; }
+
+private:
+    Options options_;
+    std::function<uint64_t(void)> get_micros_;
+    std::vector<CANLogRecord> records_;
+    std::vector<ICANRXMessage *> rx_messages_;
+    Stats stats_;
+    uint64_t pass_us_{1};  // log time from the start of one pass to the start of the next
+    bool started_{false};
+    bool finished_{true};
+    uint64_t start_us_{0};
+    size_t next_record_{0};
+    uint64_t pass_{0};
+    uint64_t log_time_us_{0};
+
+    uint64_t GetPassOffsetUs() const { return pass_ * pass_us_; }
+
+    // the same path as TeensyCAN::ProcessMessage and ESPCAN::Tick
+    void Dispatch(const CANMessage &frame)
+    {
+        CAN_PROFILE_START(rx_dispatch);
+        TapFrame(frame, false);
+        for (size_t i = 0; i < rx_messages_.size(); i++)
+        {
+            rx_messages_[i]->DecodeSignals(frame);
+        }
+        CAN_PROFILE_RECORD(rx_dispatch, CANProfiler::Instance().Driver().rx_dispatch_cycles);
+    }
+
+    static uint64_t SteadyNs()
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+    }
+
+    static uint64_t SteadyMicros() { return SteadyNs() / 1000; }
+};
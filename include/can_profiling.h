@@ -0,0 +1,278 @@
+#pragma once
+
+// Hot-path profiling for the CAN backends and message classes. Everything here compiles away unless CAN_PROFILING is
+// defined (e.g. build_flags = -D CAN_PROFILING), and all recording is lock-free so it is safe from ISRs and tasks.
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#ifdef CAN_PROFILING
+
+// Cycle counter of the current platform, nanoseconds on native
+inline uint32_t CANProfileCycles()
+{
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+    return ARM_DWT_CYCCNT;
+#elif defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCycleCount();
+#else
+    return static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+#endif
+}
+
+inline uint32_t CANProfileCyclesPerMicrosecond()
+{
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+    return F_CPU_ACTUAL / 1000000;
+#elif defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCpuFreqMHz();
+#else
+    return 1000;
+#endif
+}
+
+#define CAN_PROFILE_START(name) uint32_t can_profile_##name##_start = CANProfileCycles()
+#define CAN_PROFILE_RECORD(name, histogram) (histogram).Record(CANProfileCycles() - can_profile_##name##_start)
+#define CAN_PROFILE_HIGH_WATER(high_water, value) (high_water).Record(value)
+#define CAN_PROFILE_STORE(counter, value) (counter).store(value, std::memory_order_relaxed)
+
+#else
+
+#define CAN_PROFILE_START(name)
+#define CAN_PROFILE_RECORD(name, histogram)
+#define CAN_PROFILE_HIGH_WATER(high_water, value)
+#define CAN_PROFILE_STORE(counter, value)
+
+#endif
+
+/**
+ * @brief A log2 histogram of cycle counts. Bucket n holds samples in [2^(n-1), 2^n), bucket 0 holds zeros.
+ */
+class CANProfileHistogram
+{
+public:
+    static constexpr size_t kBuckets{33};
+
+    void Record(uint32_t cycles)
+    {
+        buckets_[Bucket(cycles)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t max = max_.load(std::memory_order_relaxed);
+        while (cycles > max && !max_.compare_exchange_weak(max, cycles, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint32_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+    uint32_t GetMax() const { return max_.load(std::memory_order_relaxed); }
+    uint32_t GetBucket(size_t bucket) const { return buckets_[bucket].load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket that contains the given percentile (0-100) of samples, capped at the max
+    uint32_t GetPercentile(float percentile) const
+    {
+        uint32_t count = GetCount();
+        if (count == 0)
+        {
+            return 0;
+        }
+        uint32_t target = static_cast<uint32_t>(static_cast<float>(count) * percentile / 100.0f);
+        uint32_t seen = 0;
+        for (size_t bucket = 0; bucket < kBuckets; bucket++)
+        {
+            seen += GetBucket(bucket);
+            if (seen > target || seen == count)
+            {
+                uint32_t upper_bound =
+                    bucket == 0 ? 0 : bucket >= 32 ? 0xFFFFFFFF : (static_cast<uint32_t>(1) << bucket) - 1;
+                return std::min(upper_bound, GetMax());
+            }
+        }
+        return GetMax();
+    }
+
+    void Reset()
+    {
+        for (std::atomic<uint32_t> &bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint32_t> buckets_[kBuckets]{};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint32_t> max_{0};
+
+    static size_t Bucket(uint32_t cycles) { return cycles == 0 ? 0 : 32 - static_cast<size_t>(__builtin_clz(cycles)); }
+};
+
+// Keeps the largest value recorded
+class CANProfileHighWater
+{
+public:
+    void Record(uint32_t value)
+    {
+        uint32_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+    uint32_t Get() const { return max_.load(std::memory_order_relaxed); }
+    void Reset() { max_.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> max_{0};
+};
+
+/**
+ * @brief Counters filled in by the hardware backends (aggregated across buses)
+ */
+struct CANDriverProfile
+{
+    CANProfileHistogram rx_dispatch_cycles;  // TeensyCAN::ProcessMessage, or one frame's dispatch in ESPCAN::Tick
+    CANProfileHistogram tick_cycles;         // one ICAN::Tick() call
+    CANProfileHighWater rx_queue_high_water;
+    // Cumulative counters copied from the driver where it provides them (twai_status_info_t on ESP32)
+    std::atomic<uint32_t> rx_missed{0};
+    std::atomic<uint32_t> rx_overruns{0};
+    std::atomic<uint32_t> tx_failed{0};
+    std::atomic<uint32_t> bus_errors{0};
+    std::atomic<uint32_t> arbitration_lost{0};
+};
+
+class CANMessageProfile;
+
+/**
+ * @brief Registry of everything that gets profiled, and the reporter
+ */
+class CANProfiler
+{
+public:
+    static constexpr size_t kMaxMessages{128};
+
+    static CANProfiler &Instance()
+    {
+        static CANProfiler profiler;
+        return profiler;
+    }
+
+    CANDriverProfile &Driver() { return driver_; }
+
+    // Returns false if the registry is full, the message is then not reported
+    bool Register(CANMessageProfile &profile)
+    {
+        for (std::atomic<CANMessageProfile *> &slot : messages_)
+        {
+            CANMessageProfile *expected = nullptr;
+            if (slot.compare_exchange_strong(expected, &profile))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Unregister(CANMessageProfile &profile)
+    {
+        for (std::atomic<CANMessageProfile *> &slot : messages_)
+        {
+            CANMessageProfile *expected = &profile;
+            slot.compare_exchange_strong(expected, nullptr);
+        }
+    }
+
+    CANMessageProfile *GetMessage(size_t index) const { return messages_[index].load(std::memory_order_acquire); }
+
+    inline void Report(FILE *out = stdout) const;
+
+private:
+    CANProfiler() = default;
+
+    CANDriverProfile driver_;
+    std::atomic<CANMessageProfile *> messages_[kMaxMessages]{};
+};
+
+/**
+ * @brief Decode and callback timing of one RX message, registers itself with the CANProfiler while it exists
+ */
+class CANMessageProfile
+{
+public:
+    CANMessageProfile(uint32_t id) : id_{id} { CANProfiler::Instance().Register(*this); }
+    ~CANMessageProfile() { CANProfiler::Instance().Unregister(*this); }
+    CANMessageProfile(const CANMessageProfile &) = delete;
+    CANMessageProfile &operator=(const CANMessageProfile &) = delete;
+
+    uint32_t GetID() const { return id_; }
+
+    CANProfileHistogram decode_cycles;
+    CANProfileHistogram callback_cycles;
+
+private:
+    uint32_t id_;
+};
+
+// Prints one line per histogram, slowest callbacks are easy to spot in the max column
+void CANProfiler::Report(FILE *out) const
+{
+#ifdef CAN_PROFILING
+    const uint32_t cycles_per_us = CANProfileCyclesPerMicrosecond();
+#else
+    const uint32_t cycles_per_us = 1;
+#endif
+    auto print_histogram = [out, cycles_per_us](const char *name, uint32_t id, const CANProfileHistogram &histogram)
+    {
+        if (id == 0xFFFFFFFF)
+        {
+            fprintf(out, "%-22s", name);
+        }
+        else
+        {
+            fprintf(out, "0x%-8" PRIx32 " %-11s", id, name);
+        }
+        fprintf(out,
+                " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10.2f\n",
+                histogram.GetCount(),
+                histogram.GetPercentile(50),
+                histogram.GetPercentile(99),
+                histogram.GetMax(),
+                static_cast<double>(histogram.GetMax()) / cycles_per_us);
+    };
+
+    fprintf(out, "CAN profile (%" PRIu32 " cycles/us, percentiles are bucket upper bounds)\n", cycles_per_us);
+    fprintf(out, "%-22s %10s %10s %10s %10s %10s\n", "", "count", "p50 cyc", "p99 cyc", "max cyc", "max us");
+    print_histogram("rx dispatch", 0xFFFFFFFF, driver_.rx_dispatch_cycles);
+    print_histogram("tick", 0xFFFFFFFF, driver_.tick_cycles);
+    for (size_t i = 0; i < kMaxMessages; i++)
+    {
+        CANMessageProfile *profile = GetMessage(i);
+        if (profile != nullptr)
+        {
+            print_histogram("decode", profile->GetID(), profile->decode_cycles);
+            print_histogram("callback", profile->GetID(), profile->callback_cycles);
+        }
+    }
+    fprintf(out,
+            "rx queue high water %" PRIu32 ", rx missed %" PRIu32 ", rx overruns %" PRIu32 ", tx failed %" PRIu32
+            ", bus errors %" PRIu32 ", arbitration lost %" PRIu32 "\n",
+            driver_.rx_queue_high_water.Get(),
+            driver_.rx_missed.load(std::memory_order_relaxed),
+            driver_.rx_overruns.load(std::memory_order_relaxed),
+            driver_.tx_failed.load(std::memory_order_relaxed),
+            driver_.bus_errors.load(std::memory_order_relaxed),
+            driver_.arbitration_lost.load(std::memory_order_relaxed));
+}
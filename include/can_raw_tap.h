@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+
+#include "can_interface.h"
+#include "can_tx_queue.h"
+
+/**
+ * @brief A raw frame as seen by a CANRawTap
+ */
+struct CANTapFrame
+{
+    enum Flags : uint8_t
+    {
+        kExtendedID = 1 << 0,
+        kTransmitted = 1 << 1,  // sent by this node rather than received
+    };
+
+    uint64_t timestamp_us{0};  // extended to 64 bits from the 32 bit clock by the consumer
+    uint32_t id{0};
+    uint8_t flags{0};
+    uint8_t len{0};
+    std::array<uint8_t, 8> data{};
+
+    CANMessage ToMessage() const { return CANMessage{id, (flags & kExtendedID) != 0, len, data}; }
+};
+
+/**
+ * @brief Copies every frame of an ICAN, with a timestamp, into a lock-free ring that another task drains, for loggers
+ * and gateways that need all traffic without registering an RX message per ID. Frames can be pushed from several
+ * contexts at once (RX dispatch and transmitting tasks), but only one task may Pop or Drain.
+ *
+ * Attach it with can.AttachTap(tap). When the ring is full new frames are dropped and counted.
+ *
+ * @tparam capacity The number of frames the ring holds, must be a power of 2
+ */
+template <size_t capacity = 256>
+class CANRawTap : public ICANTap
+{
+public:
+    /**
+     * @brief Construct a new CANRawTap object
+     *
+     * @param get_micros A function to get the current time in microseconds on the current platform
+     */
+    CANRawTap(std::function<uint32_t(void)> get_micros) : get_micros_{get_micros} {}
+
+#ifdef ARDUINO
+    CANRawTap() : CANRawTap([]() { return micros(); }) {}
+#endif
+
+    void OnFrame(const CANMessage &frame, bool transmitted) override
+    {
+        Entry entry;
+        entry.timestamp_us = get_micros_();
+        entry.id = frame.id_;
+        entry.flags = static_cast<uint8_t>((frame.extended_id_ ? CANTapFrame::kExtendedID : 0)
+                                           | (transmitted ? CANTapFrame::kTransmitted : 0));
+        entry.len = frame.len_;
+        entry.data = frame.data_;
+        if (!ring_.Push(entry))
+        {
+            dropped_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Takes the oldest frame out of the ring, must only be called from the consumer task
+     *
+     * @return false if the ring is empty
+     */
+    bool Pop(CANTapFrame &frame)
+    {
+        Entry entry;
+        if (!ring_.Pop(entry))
+        {
+            return false;
+        }
+        if (!started_)
+        {
+            last_timestamp_us_ = entry.timestamp_us;
+            started_ = true;
+        }
+        // frames from different producers can be slightly out of order, so the difference is signed
+        last_timestamp_us_ += static_cast<int32_t>(entry.timestamp_us - static_cast<uint32_t>(last_timestamp_us_));
+        frame.timestamp_us = last_timestamp_us_;
+        frame.id = entry.id;
+        frame.flags = entry.flags;
+        frame.len = entry.len;
+        frame.data = entry.data;
+        return true;
+    }
+
+    /**
+     * @brief Hands queued frames to consumer, must only be called from the consumer task
+     *
+     * @param consumer Called for each frame, oldest first
+     * @param max_frames The maximum number of frames to hand over in this call
+     * @return The number of frames handed over
+     */
+    size_t Drain(const std::function<void(const CANTapFrame &)> &consumer, size_t max_frames = capacity)
+    {
+        size_t count = 0;
+        CANTapFrame frame;
+        while (count < max_frames && Pop(frame))
+        {
+            consumer(frame);
+            count++;
+        }
+        return count;
+    }
+
+    // Approximate while producers are active
+    size_t GetQueuedCount() const { return ring_.Size(); }
+    uint32_t GetDroppedCount() const { return dropped_count_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry
+    {
+        uint32_t timestamp_us;
+        uint32_t id;
+        uint8_t flags;
+        uint8_t len;
+        std::array<uint8_t, 8> data;
+    };
+
+    std::function<uint32_t(void)> get_micros_;
+    MPSCRing<Entry, capacity> ring_;
+    std::atomic<uint32_t> dropped_count_{0};
+    uint64_t last_timestamp_us_{0};
+    bool started_{false};
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+/**
+ * @brief Puts signals that arrive at different rates (e.g. IMU, wheel speeds and throttle from different messages) on
+ * one fixed-rate time base. Decoded samples go in with Push; Poll emits one row per period with a value for every
+ * signal, held (zero-order hold) or linearly interpolated between the samples around the tick, or NaN if the signal's
+ * newest sample at the tick is older than its staleness limit or it has none yet.
+ *
+ * Memory is fixed (no heap), so it runs on the car as well as in native tools. Samples are kept in a small ring per
+ * signal and the per-tick interpolation runs over flat arrays, which the native build vectorizes.
+ *
+ * Linear interpolation needs the first sample after a tick, so ticks are emitted delay_us after their time; with a
+ * delay of at least the slowest linearly interpolated signal's period every tick is bracketed, with less the newest
+ * sample is held. Samples of a signal must be pushed in time order, Push and Poll must be called from the same task.
+ *
+ * @tparam max_signals The maximum number of signals
+ * @tparam history The number of samples kept per signal, enough to cover delay_us plus one period of the fastest signal
+ */
+template <size_t max_signals = 16, size_t history = 8>
+class CANResampler
+{
+public:
+    enum class Interpolation
+    {
+        kZeroOrderHold,
+        kLinear
+    };
+
+    /**
+     * @param period_us The output period, ticks fall on multiples of it
+     * @param delay_us How long after its time a tick is emitted, to wait for the samples after it
+     */
+    CANResampler(uint32_t period_us, uint32_t delay_us = 0)
+        : period_us_{period_us == 0 ? 1 : period_us}, delay_us_{delay_us}
+    {
+    }
+
+    /**
+     * @brief Adds a signal, which becomes column GetSignalCount() - 1 of the output
+     *
+     * @param max_age_us A tick more than this after the signal's newest sample gets NaN, 0 for no limit
+     * @return The signal's index for Push, or -1 if there are already max_signals
+     */
+    int AddSignal(Interpolation interpolation, uint32_t max_age_us = 0)
+    {
+        if (signal_count_ == max_signals)
+        {
+            return -1;
+        }
+        linear_[signal_count_] = interpolation == Interpolation::kLinear ? 1 : 0;
+        max_age_us_[signal_count_] = max_age_us == 0 ? std::numeric_limits<uint64_t>::max() : max_age_us;
+        return static_cast<int>(signal_count_++);
+    }
+
+    /**
+     * @brief Adds a sample of a signal
+     */
+    void Push(size_t signal, uint64_t timestamp_us, double value)
+    {
+        if (signal >= signal_count_)
+        {
+            return;
+        }
+        Ring &ring = rings_[signal];
+        if (ring.count > 0 && timestamp_us < ring.samples[(ring.first + ring.count - 1) % history].timestamp_us)
+        {
+            dropped_samples_++;  // out of order
+            return;
+        }
+        if (ring.count == history)
+        {
+            // the ring doesn't cover the delay, lose the oldest sample
+            ring.first = (ring.first + 1) % history;
+            ring.count--;
+            dropped_samples_++;
+        }
+        ring.samples[(ring.first + ring.count) % history] = Sample{timestamp_us, value};
+        ring.count++;
+        if (!started_)
+        {
+            next_tick_us_ = (timestamp_us + period_us_ - 1) / period_us_ * period_us_;
+            started_ = true;
+        }
+    }
+
+    /**
+     * @brief Emits every tick due by now_us (ticks up to now_us - delay_us)
+     *
+     * @param consumer Called as consumer(tick_us, values) for each tick, values has one entry per signal
+     * @return The number of ticks emitted
+     */
+    template <typename Consumer>
+    size_t Poll(uint64_t now_us, Consumer &&consumer)
+    {
+        size_t emitted = 0;
+        while (started_ && now_us >= delay_us_ && next_tick_us_ <= now_us - delay_us_)
+        {
+            Interpolate(next_tick_us_);
+            consumer(next_tick_us_, static_cast<const double *>(values_.data()));
+            next_tick_us_ += period_us_;
+            emitted++;
+        }
+        return emitted;
+    }
+
+    size_t GetSignalCount() const { return signal_count_; }
+    uint32_t GetPeriodUs() const { return period_us_; }
+    // Samples dropped for arriving out of order or overflowing their ring
+    uint32_t GetDroppedSamples() const { return dropped_samples_; }
+
+private:
+    struct Sample
+    {
+        uint64_t timestamp_us;
+        double value;
+    };
+
+    struct Ring
+    {
+        std::array<Sample, history> samples{};
+        size_t first{0};
+        size_t count{0};
+    };
+
+    uint32_t period_us_;
+    uint32_t delay_us_;
+    size_t signal_count_{0};
+    bool started_{false};
+    uint64_t next_tick_us_{0};
+    uint32_t dropped_samples_{0};
+    std::array<Ring, max_signals> rings_{};
+    std::array<uint64_t, max_signals> max_age_us_{};
+
+    // per-signal inputs of the interpolation, laid out flat so the loop in Interpolate vectorizes
+    std::array<double, max_signals> linear_{};
+    std::array<double, max_signals> age_us_{};   // tick - previous sample
+    std::array<double, max_signals> span_us_{};  // next sample - previous sample, infinite if there is no next sample
+    std::array<double, max_signals> missing_{};  // NaN if the signal has no usable sample, otherwise 0
+    std::array<double, max_signals> previous_{};
+    std::array<double, max_signals> next_{};
+    std::array<double, max_signals> values_{};
+
+    void Interpolate(uint64_t tick_us)
+    {
+        for (size_t i = 0; i < signal_count_; i++)
+        {
+            // drop samples that no later tick can use, keeping the newest one at or before this tick first
+            Ring &ring = rings_[i];
+            while (ring.count >= 2 && ring.samples[(ring.first + 1) % history].timestamp_us <= tick_us)
+            {
+                ring.first = (ring.first + 1) % history;
+                ring.count--;
+            }
+            const Sample &previous = ring.samples[ring.first];
+            if (ring.count == 0 || previous.timestamp_us > tick_us
+                || tick_us - previous.timestamp_us > max_age_us_[i])
+            {
+                age_us_[i] = 0;
+                span_us_[i] = std::numeric_limits<double>::infinity();
+                previous_[i] = 0;
+                next_[i] = 0;
+                missing_[i] = NAN;
+                continue;
+            }
+            age_us_[i] = static_cast<double>(tick_us - previous.timestamp_us);
+            missing_[i] = 0;
+            previous_[i] = previous.value;
+            if (ring.count >= 2)
+            {
+                const Sample &next = ring.samples[(ring.first + 1) % history];
+                span_us_[i] = static_cast<double>(next.timestamp_us - previous.timestamp_us);
+                next_[i] = next.value;
+            }
+            else
+            {
+                span_us_[i] = std::numeric_limits<double>::infinity();
+                next_[i] = previous.value;
+            }
+        }
+        for (size_t i = 0; i < signal_count_; i++)
+        {
+            // no compares or branches so it vectorizes without -ffast-math: a missing next sample gives a weight of
+            // 0 through the infinite span and adding missing_ turns the value into NaN
+            double weight = linear_[i] * age_us_[i] / span_us_[i];
+            values_[i] = previous_[i] + weight * (next_[i] - previous_[i]) + missing_[i];
+        }
+    }
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "can_interface.h"
+#include "dbc_database.h"
+
+/**
+ * @brief The timing parameters of one message stream, times are in microseconds
+ */
+struct CANStreamTiming
+{
+    uint32_t id{0};
+    bool extended_id{false};
+    uint8_t length{0};
+    double period_us{0};  // minimum time between queuings, 0 if the message is event driven and has no known period
+    double deadline_us{0};  // usually the period
+    double jitter_us{0};    // queuing jitter
+};
+
+/**
+ * @brief The result of the response-time analysis for one stream
+ */
+struct CANStreamResult
+{
+    uint32_t frame_bits{0};  // worst-case length including stuff bits and interframe space
+    double transmission_us{0};
+    double blocking_us{0};  // longest frame of lower priority
+    double response_us{0};  // worst-case response time, infinity if it is unbounded
+    bool schedulable{false};
+    // true if some lower priority stream has a shorter deadline, so the priority order isn't deadline monotonic
+    bool deadline_monotonic_violation{false};
+};
+
+/**
+ * @brief Worst-case response-time analysis for CAN with non-preemptive fixed-priority arbitration, following the
+ * revised analysis of Davis et al., "Controller Area Network (CAN) schedulability analysis: Refuted, revisited and
+ * revised" (2007). Every instance of a stream inside the priority level-m busy period is checked, not just the first,
+ * which the original analysis got wrong.
+ *
+ * Streams without a period are treated as sporadic with an unknown minimum inter-arrival time: they contribute
+ * blocking to higher priority streams but no interference to lower priority ones, and their own response time is that
+ * of a single instance (schedulable if it is bounded, since they have no deadline).
+ *
+ * @param streams The streams on the bus, in any order
+ * @param baud The bus bit rate in bits per second
+ * @return One result per stream, in the same order as streams
+ */
+inline std::vector<CANStreamResult> AnalyzeCANResponseTimes(const std::vector<CANStreamTiming> &streams,
+                                                            uint32_t baud)
+{
+    const double bit_us = 1000000.0 / baud;
+    const double kUnbounded = std::numeric_limits<double>::infinity();
+    const size_t count = streams.size();
+
+    std::vector<CANStreamResult> results(count);
+    std::vector<uint32_t> keys(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        results[i].frame_bits = CANWorstCaseFrameBits(streams[i].length, streams[i].extended_id);
+        results[i].transmission_us = results[i].frame_bits * bit_us;
+        keys[i] = CANArbitrationKey(streams[i].id, streams[i].extended_id);
+    }
+
+    for (size_t m = 0; m < count; m++)
+    {
+        const CANStreamTiming &stream = streams[m];
+        CANStreamResult &result = results[m];
+        const double c_m = result.transmission_us;
+        const bool periodic = stream.period_us > 0;
+
+        // higher priority periodic streams interfere, any lower priority stream can block
+        std::vector<size_t> higher;
+        double higher_utilization = 0;
+        for (size_t k = 0; k < count; k++)
+        {
+            if (k == m)
+            {
+                continue;
+            }
+            if (keys[k] < keys[m])
+            {
+                if (streams[k].period_us > 0)
+                {
+                    higher.push_back(k);
+                    higher_utilization += results[k].transmission_us / streams[k].period_us;
+                }
+            }
+            else
+            {
+                result.blocking_us = std::max(result.blocking_us, results[k].transmission_us);
+                if (periodic && streams[k].period_us > 0 && streams[k].deadline_us < stream.deadline_us)
+                {
+                    result.deadline_monotonic_violation = true;
+                }
+            }
+        }
+        const double b_m = result.blocking_us;
+
+        const double level_utilization = higher_utilization + (periodic ? c_m / stream.period_us : 0);
+        if (level_utilization >= 1)
+        {
+            result.response_us = kUnbounded;
+            result.schedulable = false;
+            continue;
+        }
+
+        // length of the priority level-m busy period, which bounds how many instances have to be checked
+        size_t instances = 1;
+        if (periodic)
+        {
+            double busy = c_m;
+            while (true)
+            {
+                double next = b_m + ceil((busy + stream.jitter_us) / stream.period_us) * c_m;
+                for (size_t k : higher)
+                {
+                    next += ceil((busy + streams[k].jitter_us) / streams[k].period_us) * results[k].transmission_us;
+                }
+                if (next <= busy)
+                {
+                    break;
+                }
+                busy = next;
+            }
+            instances = static_cast<size_t>(ceil((busy + stream.jitter_us) / stream.period_us));
+        }
+
+        result.response_us = 0;
+        result.schedulable = true;
+        for (size_t q = 0; q < instances; q++)
+        {
+            // queuing delay of instance q, a higher priority frame queued up to one bit time after the start of
+            // transmission of instance q still wins arbitration
+            double w = b_m + q * c_m;
+            double response = 0;
+            while (true)
+            {
+                double next = b_m + q * c_m;
+                for (size_t k : higher)
+                {
+                    next += ceil((w + streams[k].jitter_us + bit_us) / streams[k].period_us)
+                            * results[k].transmission_us;
+                }
+                response = stream.jitter_us + next - (periodic ? q * stream.period_us : 0) + c_m;
+                if (next <= w || (periodic && response > stream.deadline_us))
+                {
+                    break;
+                }
+                w = next;
+            }
+            result.response_us = std::max(result.response_us, response);
+            if (periodic && response > stream.deadline_us)
+            {
+                result.schedulable = false;
+                break;
+            }
+        }
+    }
+    return results;
+}
+
+/**
+ * @brief The fraction of the bus (0 to 1) the periodic streams use with worst-case stuffing
+ *
+ * @param streams The streams on the bus
+ * @param baud The bus bit rate in bits per second
+ */
+inline double CANBusUtilization(const std::vector<CANStreamTiming> &streams, uint32_t baud)
+{
+    double utilization = 0;
+    for (const CANStreamTiming &stream : streams)
+    {
+        if (stream.period_us > 0)
+        {
+            utilization +=
+                CANWorstCaseFrameBits(stream.length, stream.extended_id) * 1000000.0 / baud / stream.period_us;
+        }
+    }
+    return utilization;
+}
+
+/**
+ * @brief The stream timing of every message of a DBC that is sent on the bus, with deadlines equal to cycle times
+ *
+ * @param database The DBC
+ * @param sporadic_period_ms The period to use for messages without a cycle time, 0 to leave them event driven
+ * @param messages If not nullptr, filled with the message of each stream
+ */
+inline std::vector<CANStreamTiming> CANStreamTimings(const DBCDatabase &database,
+                                                     uint32_t sporadic_period_ms = 0,
+                                                     std::vector<const DBCMessage *> *messages = nullptr)
+{
+    std::vector<CANStreamTiming> streams;
+    for (const DBCMessage &message : database.messages)
+    {
+        // DBC files often contain a pseudo-message holding signals that aren't sent, it isn't on the bus
+        if (message.name == "VECTOR__INDEPENDENT_SIG_MSG")
+        {
+            continue;
+        }
+        CANStreamTiming stream;
+        stream.id = message.id;
+        stream.extended_id = message.extended_id;
+        stream.length = message.length;
+        uint32_t period_ms = message.cycle_time_ms != 0 ? message.cycle_time_ms : sporadic_period_ms;
+        stream.period_us = period_ms * 1000.0;
+        stream.deadline_us = stream.period_us;
+        streams.push_back(stream);
+        if (messages != nullptr)
+        {
+            messages->push_back(&message);
+        }
+    }
+    return streams;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "can_interface.h"
+
+/**
+ * @brief A bounded, lock-free, multi-producer single-consumer ring (based on Vyukov's sequenced bounded queue). Any
+ * number of tasks may Push concurrently, but only one context may Pop.
+ *
+ * @tparam T The element type, must be default constructible and copy assignable
+ * @tparam capacity The number of slots, must be a power of 2
+ */
+template <typename T, size_t capacity>
+class MPSCRing
+{
+public:
+    MPSCRing()
+    {
+        static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "MPSCRing capacity must be a power of 2");
+        for (size_t i = 0; i < capacity; i++)
+        {
+            slots_[i].sequence.store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Copies an item into the ring, safe to call from multiple producers at once
+     *
+     * @return false if the ring is full
+     */
+    bool Push(const T &item)
+    {
+        uint32_t position = enqueue_position_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = slots_[position & kMask];
+            uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int32_t difference = static_cast<int32_t>(sequence - position);
+            if (difference == 0)
+            {
+                // claim the slot, on failure position is reloaded and we try again
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.item = item;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Takes the oldest item out of the ring, must only be called from the single consumer
+     *
+     * @return false if the ring is empty
+     */
+    bool Pop(T &item)
+    {
+        Slot &slot = slots_[dequeue_position_ & kMask];
+        uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<int32_t>(sequence - (dequeue_position_ + 1)) < 0)
+        {
+            return false;
+        }
+        item = slot.item;
+        slot.sequence.store(dequeue_position_ + static_cast<uint32_t>(capacity), std::memory_order_release);
+        dequeue_position_++;
+        return true;
+    }
+
+    // Approximate when producers are active
+    size_t Size() const
+    {
+        return static_cast<size_t>(enqueue_position_.load(std::memory_order_relaxed) - dequeue_position_);
+    }
+
+private:
+    static constexpr uint32_t kMask{static_cast<uint32_t>(capacity - 1)};
+
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;
+        T item{};
+    };
+
+    Slot slots_[capacity];
+    // Kept on separate cache lines so producers and the consumer don't false-share on native builds
+    alignas(64) std::atomic<uint32_t> enqueue_position_{0};
+    alignas(64) uint32_t dequeue_position_{0};
+};
+
+/**
+ * @brief A thread-safe TX front end for an ICAN. SendMessage can be called from any task: frames are copied into a
+ * lock-free ring and handed to the wrapped ICAN by a single drain context (Tick() or Drain()). RX registration and Tick
+ * are forwarded to the wrapped ICAN.
+ *
+ * @tparam capacity The number of frames that can be queued, must be a power of 2
+ */
+template <size_t capacity = 32>
+class CANTXQueue : public ICAN
+{
+public:
+    /**
+     * @brief Construct a new CANTXQueue object
+     *
+     * @param can_interface The ICAN that frames will be drained into
+     */
+    CANTXQueue(ICAN &can_interface) : can_interface_{can_interface} {}
+
+    void Initialize(BaudRate baud) override { can_interface_.Initialize(baud); }
+
+    // Returns false (and counts a dropped frame) if the queue is full
+    bool SendMessage(CANMessage &msg) override
+    {
+        if (queue_.Push(msg))
+        {
+            return true;
+        }
+        dropped_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void RegisterRXMessage(ICANRXMessage &msg) override { can_interface_.RegisterRXMessage(msg); }
+
+    // Frames are tapped when the wrapped ICAN sends them
+    bool AttachTap(ICANTap &tap) override { return can_interface_.AttachTap(tap); }
+
+    void Tick() override
+    {
+        Drain();
+        can_interface_.Tick();
+    }
+
+    /**
+     * @brief Sends queued frames to the wrapped ICAN. Must only be called from one context. If the driver refuses a
+     * frame it is kept and retried first on the next call, so per-producer ordering is preserved.
+     *
+     * @param max_frames The maximum number of frames to send in this call
+     * @return The number of frames sent
+     */
+    size_t Drain(size_t max_frames = capacity)
+    {
+        size_t sent = 0;
+        while (sent < max_frames)
+        {
+            if (!has_pending_)
+            {
+                if (!queue_.Pop(pending_))
+                {
+                    break;
+                }
+                has_pending_ = true;
+            }
+            if (!can_interface_.SendMessage(pending_))
+            {
+                break;
+            }
+            has_pending_ = false;
+            sent++;
+        }
+        return sent;
+    }
+
+    size_t GetQueuedCount() const { return queue_.Size() + (has_pending_ ? 1 : 0); }
+    uint32_t GetDroppedCount() const { return dropped_count_.load(std::memory_order_relaxed); }
+
+private:
+    ICAN &can_interface_;
+    MPSCRing<CANMessage, capacity> queue_;
+    CANMessage pending_{};
+    bool has_pending_{false};
+    std::atomic<uint32_t> dropped_count_{0};
+};
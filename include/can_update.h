@@ -0,0 +1,1845 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "can_interface.h"
+#include "crc32.h"
+#include "deflate.h"
+
+/*
+ * CAN firmware update protocol
+ *
+ * A host (scripts/esp_can_update.py, or CANUpdateHost) sends an image to a node's CANUpdateDevice on five IDs relative
+ * to the node's update ID U, a standard ID; signals are little endian:
+ *
+ *   U + n << 11  data (host, extended IDs): bits 0-7 the low 8 bits of the block index, whose higher bits are ID bits
+ *                11-28, then the block's 7 bytes of the stream (the last block is zero padded)
+ *   U + 1        info (host): bits 0-7 the message type; type 0 (start) has the image length in bits 8-39, the
+ *                stream's encoding (CANUpdateEncoding) in bits 40-46, whether it carries page CRCs in bit 47 and the
+ *                page of the image it starts at in bits 48-63, type 1 (MD5) the index of a 4 byte word of the MD5
+ *                in bits 8-15 and the word in bits 16-47, type 2 (base MD5) the same for the image a delta stream
+ *                was made against
+ *   U + 2        progress (node, every 100 ms, once it has the MD5 and when an update starts or ends): bits 0-23 a
+ *                block index, bit 24 the length was received, bit 25 the MD5 was received, bit 26 the block was
+ *                written, bits 27-31 the node's capabilities (kCANUpdateCapability*), bits 32-63 its firmware version
+ *   U + 3        ack (node): bits 0-23 the next block the node needs (the base), every block before it has been
+ *                taken; bits 24-25 the pages waiting for the flash writer, bits 26-31 how many times in this update
+ *                the writer has held reception up (wrapping); bits 32-63 which of the following blocks it holds, bit
+ *                n for block base + 1 + n
+ *   U + 4        images (node, before the progress when the MD5 is received, and when it turns a start down): bits
+ *                0-7 the index of a value, bits 8-39 the value, 0-3 the words of the MD5 of the image the node runs, 4
+ *                its size and 5 the pages at the start of the image with the received MD5 it already holds
+ *
+ * The host repeats the MD5 words until the progress shows them received, then the start message until it shows the
+ * length. A node with kCANUpdateCapabilityWindowed then buffers any block up to kCANUpdateWindow - 1 past the
+ * next one it needs, writes blocks in order and acks every kCANUpdateAckInterval new blocks, when a block leaves a gap
+ * before it, when it gets a block it already has and every 10 ms while blocks keep coming. The host keeps
+ * kCANUpdateWindow blocks in flight and resends only the missing ones: CAN delivers frames in order, so a block sent
+ * before one the node has acked and not acked itself was lost. Nodes without the capability only take the next block
+ * they need, and only report progress (block index, written) after each block.
+ *
+ * The stream is the image itself, or with kDeflatePages (for nodes with kCANUpdateCapabilityDeflate) one record per
+ * kCANUpdatePageBytes page of the image: the size of the page's raw deflate stream in 2 bytes, the stream, and zero
+ * padding to the end of the block, so every record starts a block. Pages are compressed on their own so the node only
+ * needs a page of output as the window, and could pick decompression up again at any page. The MD5 is always of the
+ * image.
+ *
+ * kDeltaPages (for nodes with kCANUpdateCapabilityDelta, which report the image they run) has a 4 byte offset into the
+ * running image after each record's size, or kCANUpdateNoDictionary: the page is compressed with the
+ * kCANUpdateDeltaDictionaryBytes of the running image from there (fewer at its end) as a preset dictionary, so the
+ * parts of the new image that haven't changed, even if they moved, cost a few bytes. The host only sends it when the
+ * running image's MD5 and size match the image it made the stream against, and sends that MD5 before the start
+ * message; the node turns the start down unless it matches its own, and the host falls back to a full image.
+ *
+ * Nodes with kCANUpdateCapabilityResume keep the pages they have written across a reset or power cycle, keyed by the
+ * image's MD5, and report how many of the image the host sends they hold. The host then starts the update at the first
+ * page missing: the stream is sent from that page's first byte (or its record), with block indexes counted from there.
+ * A node that doesn't hold the pages turns the start down and reports what it holds, and the host starts over.
+ *
+ * To nodes with kCANUpdateCapabilityPageCRC the host sends each page's CRC-32 (crc32.h) of its image bytes, and sets
+ * bit 47 of the start message: it follows the page's record, before the padding, and a raw stream is cut into records
+ * too, each a page's bytes and its CRC. The node checks a page as it completes, and if it doesn't check out, drops it
+ * and the blocks after it and acks the page's first block again: an ack base lower than the last one asks for the
+ * stream from there. It gives the update up after kCANUpdatePageAttempts bad copies of a page. The MD5 is still checked
+ * at the end.
+ *
+ * Nodes running the same firmware can be updated at once: each is given a group ID G as well (a standard ID, see
+ * CANUpdateDevice), and takes data and info on G + n << 11 and G + 1 as on its own IDs. The host sends the info and the
+ * stream once on G, in a stream every node takes, and each node reports and acks on its own IDs. The host's window
+ * starts at the first block any node needs, and a block one node misses is resent on that node's own data ID, or once
+ * on G if more nodes miss it.
+ */
+
+constexpr uint32_t kCANUpdateBlockBytes{7};
+// The blocks a node buffers from the next one it needs on, and that a host keeps in flight
+constexpr uint32_t kCANUpdateWindow{32};
+// Page buffers between a node's RX path and its flash writer
+constexpr uint32_t kCANUpdateWriteBuffers{2};
+// New blocks a node takes between acks
+constexpr uint32_t kCANUpdateAckInterval{8};
+
+// The unit compressed streams are cut into, a flash sector
+constexpr uint32_t kCANUpdatePageBytes{4096};
+// The largest compressed page record a node takes, more than deflate's worst case for a page
+constexpr uint32_t kCANUpdateMaxRecordBytes{kCANUpdatePageBytes + 64};
+// The window of the running image a delta page is compressed against, and the offset for a page compressed on its own
+constexpr uint32_t kCANUpdateDeltaDictionaryBytes{8192};
+constexpr uint32_t kCANUpdateNoDictionary{0xFFFFFFFF};
+
+// The group ID of a node only updated on its own
+constexpr uint32_t kCANUpdateNoGroup{0xFFFFFFFF};
+
+constexpr uint8_t kCANUpdateCapabilityWindowed{1 << 0};
+constexpr uint8_t kCANUpdateCapabilityDeflate{1 << 1};
+constexpr uint8_t kCANUpdateCapabilityDelta{1 << 2};
+constexpr uint8_t kCANUpdateCapabilityResume{1 << 3};
+constexpr uint8_t kCANUpdateCapabilityPageCRC{1 << 4};
+
+// Copies of a page that fail their CRC before a node gives the update up
+constexpr uint32_t kCANUpdatePageAttempts{3};
+
+enum class CANUpdateEncoding : uint8_t
+{
+    kRaw = 0,
+    kDeflatePages = 1,
+    kDeltaPages = 2
+};
+
+/**
+ * @brief Where CANUpdateDevice writes an image, e.g. the ESP32's OTA partition (see esp_can_update.h)
+ */
+class ICANUpdateTarget
+{
+public:
+    virtual ~ICANUpdateTarget() {}
+
+    /**
+     * @brief Starts writing an image
+     *
+     * @param md5 The image's MD5 as 32 lowercase hex digits
+     */
+    virtual bool Begin(uint32_t size, const char *md5) = 0;
+
+    // Writes the next bytes of the image
+    virtual bool Write(const uint8_t *data, size_t size) = 0;
+
+    // Checks the whole image against its MD5 and makes it the one to boot, false if it doesn't match
+    virtual bool End() = 0;
+
+    // Boots the image End accepted, once the node has reported it written. A target that reboots the node (the ESP32)
+    // lets that report leave the CAN controller first, and doesn't return
+    virtual void Restart() {}
+
+    // Stops writing an image, a target that resumes updates keeps the pages it has written for GetWrittenPages
+    virtual void Abort() = 0;
+
+    /**
+     * @brief Gets the image the node is running, which delta updates are made against
+     *
+     * @param md5 Receives its 16 byte MD5 digest
+     * @return false if the target can't read it, the node then only takes full images
+     */
+    virtual bool GetBase(uint32_t &size, uint8_t *md5)
+    {
+        (void)size;
+        (void)md5;
+        return false;
+    }
+
+    // Reads from the image the node is running
+    virtual bool ReadBase(uint32_t offset, uint8_t *data, size_t size)
+    {
+        (void)offset;
+        (void)data;
+        (void)size;
+        return false;
+    }
+
+    /**
+     * @brief Gets how much of an image the target holds from an update that stopped (the host went away, or the node
+     * was reset), which survives restarts
+     *
+     * @param md5 The image's MD5 as 32 lowercase hex digits
+     * @param pages Receives the kCANUpdatePageBytes pages from the start of the image written and checked, 0 if none
+     * @return false if the target can't resume updates, the node then always starts over
+     */
+    virtual bool GetWrittenPages(const char *md5, uint32_t &pages)
+    {
+        (void)md5;
+        (void)pages;
+        return false;
+    }
+
+    // Starts writing an image after the first pages, which GetWrittenPages reported held, instead of Begin
+    virtual bool Resume(uint32_t size, const char *md5, uint32_t pages)
+    {
+        (void)size;
+        (void)md5;
+        (void)pages;
+        return false;
+    }
+};
+
+/**
+ * @brief The node side of the update protocol described above. It is driven by its RX messages and two timers in the
+ * timer group: the update resets when neither data nor info has arrived for kUpdateTimeout and the writer has no pages
+ * left (a target that resumes updates keeps the pages written for the host to resume after), and pending acks go out
+ * every 10 ms.
+ *
+ * Blocks are taken in the RX callback, so the backend's RX queue should hold a window of frames (e.g. ESPCAN's
+ * rx_queue_size of 32 or more); frames it drops are resent after the next ack. The image they make up is collected in
+ * kCANUpdateWriteBuffers page buffers, which go to the target in the RX callback too, or with SetWriter from a writer
+ * task while reception goes on. When every buffer is waiting for the writer, blocks stay in the window, and the host
+ * stops once it is full, until the 10 ms timer finds room again. The buffers and those for compressed pages are kept in
+ * the object, about 26 KB.
+ */
+class CANUpdateDevice
+{
+public:
+    /**
+     * @param update_id The node's update ID, see the protocol description above
+     * @param target Where the image is written
+     * @param firmware_version Reported in the progress message, e.g. the build's UNIX timestamp
+     * @param get_millis A function to get the current time in milliseconds
+     * @param group_id A standard ID the node shares with others updated along with it, which data and info are also
+     * taken on (group_id and group_id + 1), kCANUpdateNoGroup for none
+     */
+    CANUpdateDevice(uint32_t update_id,
+                    ICAN &can_bus,
+                    VirtualTimerGroup &timer_group,
+                    ICANUpdateTarget &target,
+                    uint32_t firmware_version,
+                    std::function<uint32_t(void)> get_millis,
+                    uint32_t group_id = kCANUpdateNoGroup)
+        : kUpdateId{update_id},
+          kGroupId{group_id},
+          can_interface_{can_bus},
+          timer_group_{timer_group},
+          target_{target},
+          get_millis_{get_millis}
+    {
+        fw_version_ = firmware_version;
+        capabilities_ = kCANUpdateCapabilityWindowed | kCANUpdateCapabilityDeflate | kCANUpdateCapabilityPageCRC;
+        update_data_message_.SetMask(0x7FF);
+        if (kGroupId != kCANUpdateNoGroup)
+        {
+            group_data_message_.SetMask(0x7FF);
+        }
+        timer_group_.AddTimer(100,
+                              [this]()
+                              {
+                                  uint32_t since_data = std::min(update_data_message_.GetTimeSinceLastReceive(),
+                                                                 group_data_message_.GetTimeSinceLastReceive());
+                                  uint32_t since_info = std::min(update_info_message_.GetTimeSinceLastReceive(),
+                                                                 group_info_message_.GetTimeSinceLastReceive());
+                                  // once every block is taken the host only waits for the writer, however long the
+                                  // flash takes
+                                  if (since_data >= kUpdateTimeout && since_info >= kUpdateTimeout
+                                      && GetQueuedPages() == 0 && !finishing_)
+                                  {
+                                      Reset();
+                                  }
+                              });
+        timer_group_.AddTimer(10,
+                              [this]()
+                              {
+                                  if (!update_started_)
+                                  {
+                                      return;
+                                  }
+                                  // blocks held while the writer had no room
+                                  uint32_t next_block = next_block_;
+                                  Drain();
+                                  if (update_started_ && (new_blocks_since_ack_ > 0 || next_block_ != next_block))
+                                  {
+                                      SendAck();
+                                  }
+                              });
+    }
+
+    /**
+     * @brief Moves writes to the target out of the RX callback: notify is called when a page is queued, and the
+     * writer then calls WritePending, e.g. a task waiting for a notification. Beginning, ending and aborting an update
+     * stay with the RX callback and timers, and wait for a write in progress.
+     */
+    void SetWriter(std::function<void(void)> notify) { writer_notify_ = notify; }
+
+    /**
+     * @brief Writes the queued pages to the target, from the writer (see SetWriter)
+     */
+    void WritePending()
+    {
+        std::lock_guard<std::mutex> lock{target_mutex_};
+        uint32_t written = pages_written_.load(std::memory_order_relaxed);
+        while (written != pages_queued_.load(std::memory_order_acquire))
+        {
+            uint32_t buffer = written % kCANUpdateWriteBuffers;
+            if (!write_failed_ && !target_.Write(buffers_[buffer].data(), buffer_sizes_[buffer]))
+            {
+                write_failed_ = true;
+            }
+            pages_written_.store(++written, std::memory_order_release);
+        }
+    }
+
+    bool IsUpdating() const { return update_started_; }
+    // Blocks received that were already written or buffered, or outside the window
+    uint32_t GetStaleBlocks() const { return stale_blocks_; }
+    uint32_t GetAcksSent() const { return acks_sent_; }
+    // Pages waiting for the writer
+    uint32_t GetQueuedPages() const { return pages_queued_ - pages_written_; }
+    // Times reception waited for the writer in the last update
+    uint32_t GetWriteStalls() const { return write_stalls_; }
+    // Pages whose CRC didn't check out, which were asked for again
+    uint32_t GetBadPages() const { return bad_pages_; }
+
+private:
+    const uint32_t kUpdateId;
+    const uint32_t kGroupId;
+    ICAN &can_interface_;
+    VirtualTimerGroup &timer_group_;
+    ICANUpdateTarget &target_;
+    std::function<uint32_t(void)> get_millis_;
+
+    const uint32_t kUpdateTimeout{500};
+
+    enum class MessageType : uint8_t
+    {
+        kUpdateStart = 0,
+        kMd5 = 1,
+        kBaseMd5 = 2
+    };
+    MakeUnsignedCANSignal(MessageType, 0, 8, 1, 0) message_type_{};
+    MakeUnsignedCANSignal(uint32_t, 8, 32, 1, 0) update_length_{};
+    MakeUnsignedCANSignal(CANUpdateEncoding, 40, 7, 1, 0) update_encoding_{};
+    MakeUnsignedCANSignal(bool, 47, 1, 1, 0) update_page_crc_{};
+    MakeUnsignedCANSignal(uint16_t, 48, 16, 1, 0) update_first_page_{};
+    MakeUnsignedCANSignal(uint16_t, 8, 8, 1, 0) update_md5_idx_{};
+    MakeUnsignedCANSignal(uint32_t, 16, 32, 1, 0) update_md5_{};
+    MakeUnsignedCANSignal(uint16_t, 8, 8, 1, 0) base_md5_idx_{};
+    MakeUnsignedCANSignal(uint32_t, 16, 32, 1, 0) base_md5_{};
+
+    MultiplexedSignalGroup<4, MessageType> length_signal_group_{
+        MessageType::kUpdateStart, update_length_, update_encoding_, update_page_crc_, update_first_page_};
+    MultiplexedSignalGroup<2, MessageType> md5_signal_group_{MessageType::kMd5, update_md5_idx_, update_md5_};
+    MultiplexedSignalGroup<2, MessageType> base_md5_signal_group_{MessageType::kBaseMd5, base_md5_idx_, base_md5_};
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) data_block_index_low_{};
+    MakeUnsignedCANSignal(uint64_t, 8, 56, 1, 0) update_data_{};
+
+    MakeUnsignedCANSignal(uint32_t, 0, 24, 1, 0) update_block_idx_{};
+    MakeUnsignedCANSignal(bool, 24, 1, 1, 0) received_len_{};
+    MakeUnsignedCANSignal(bool, 25, 1, 1, 0) received_md5_{};
+    MakeUnsignedCANSignal(bool, 26, 1, 1, 0) written_{};
+    MakeUnsignedCANSignal(uint8_t, 27, 5, 1, 0) capabilities_{};
+    MakeUnsignedCANSignal(uint32_t, 32, 32, 1, 0) fw_version_{};
+
+    MakeUnsignedCANSignal(uint32_t, 0, 24, 1, 0) ack_base_{};
+    MakeUnsignedCANSignal(uint8_t, 24, 2, 1, 0) ack_queued_pages_{};
+    MakeUnsignedCANSignal(uint8_t, 26, 6, 1, 0) ack_write_stalls_{};
+    MakeUnsignedCANSignal(uint32_t, 32, 32, 1, 0) ack_bitmap_{};
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) base_index_{};
+    MakeUnsignedCANSignal(uint32_t, 8, 32, 1, 0) base_value_{};
+
+    CANTXMessage<6> update_progress_message_{can_interface_,
+                                             kUpdateId + 2,
+                                             8,
+                                             100,
+                                             timer_group_,
+                                             update_block_idx_,
+                                             received_len_,
+                                             received_md5_,
+                                             written_,
+                                             capabilities_,
+                                             fw_version_};
+    CANTXMessage<4> update_ack_message_{
+        can_interface_, kUpdateId + 3, 8, 0, ack_base_, ack_queued_pages_, ack_write_stalls_, ack_bitmap_};
+    CANTXMessage<2> update_base_message_{can_interface_, kUpdateId + 4, 5, 0, base_index_, base_value_};
+
+    bool update_started_ = false;
+    std::array<bool, 4> received_md5_arr_ = {false, false, false, false};
+    std::array<uint32_t, 4> md5_arr_{};
+    char md5_cstr_[33]{};
+    std::array<bool, 4> received_base_md5_arr_ = {false, false, false, false};
+    std::array<uint32_t, 4> base_md5_arr_{};
+
+    // the running image, read from the target once an MD5 arrives
+    bool has_base_{false};
+    uint32_t base_size_{0};
+    std::array<uint8_t, 16> base_digest_{};
+
+    uint32_t length_{0};
+    CANUpdateEncoding encoding_{CANUpdateEncoding::kRaw};
+    bool page_crc_{false};
+    uint32_t block_count_{0};  // in the stream, or the most there can be for one cut into records
+    uint32_t bytes_taken_{0};  // of the image, by the write buffers
+    uint32_t next_block_{0};
+    // blocks received from next_block_ on, bit n for block next_block_ + n, and their data by block % kCANUpdateWindow
+    uint32_t received_{0};
+    std::array<std::array<uint8_t, kCANUpdateBlockBytes>, kCANUpdateWindow> window_{};
+    uint32_t new_blocks_since_ack_{0};
+    uint32_t stale_blocks_since_ack_{0};
+    uint32_t stale_blocks_{0};
+    uint32_t acks_sent_{0};
+    uint32_t bad_pages_{0};
+    uint32_t page_attempts_{0};  // bad copies of the page being collected
+
+    // the page record being collected (its CRC included) from its first block on, and the page a compressed one
+    // decompresses to after its dictionary
+    uint32_t record_size_{0};
+    uint32_t record_fill_{0};
+    uint32_t record_block_{0};
+    uint32_t dictionary_offset_{kCANUpdateNoDictionary};
+    std::array<uint8_t, kCANUpdateMaxRecordBytes> record_{};
+    std::array<uint8_t, kCANUpdateDeltaDictionaryBytes + kCANUpdatePageBytes> page_{};
+    Inflater inflater_;
+
+    // the pages on their way to the target: the RX path fills buffer pages_queued_ % kCANUpdateWriteBuffers and queues
+    // it, and the writer writes the queued ones in order
+    std::array<std::array<uint8_t, kCANUpdatePageBytes>, kCANUpdateWriteBuffers> buffers_{};
+    std::array<uint32_t, kCANUpdateWriteBuffers> buffer_sizes_{};
+    uint32_t buffer_fill_{0};
+    std::atomic<uint32_t> pages_queued_{0};
+    std::atomic<uint32_t> pages_written_{0};
+    std::atomic<bool> write_failed_{false};
+    std::mutex target_mutex_;  // held by whoever calls the target
+    std::function<void(void)> writer_notify_;
+    bool finishing_{false};  // every block is taken, the writer has the last pages
+    bool stalled_{false};    // the next block is waiting for room
+    uint32_t write_stalls_{0};
+
+    enum class Take
+    {
+        kTaken,
+        kNoRoom,   // the block has to wait for the writer
+        kBadPage,  // the page it completes is corrupt, the host sends it again
+        kError
+    };
+
+    MultiplexedCANRXMessage<3, MessageType> update_info_message_{can_interface_,
+                                                                 kUpdateId + 1,
+                                                                 get_millis_,
+                                                                 [this]() { ReceiveInfo(); },
+                                                                 message_type_,
+                                                                 length_signal_group_,
+                                                                 md5_signal_group_,
+                                                                 base_md5_signal_group_};
+    CANRXMessage<2> update_data_message_{can_interface_,
+                                         kUpdateId,
+                                         get_millis_,
+                                         [this]() { ReceiveBlock(update_data_message_.GetID()); },
+                                         data_block_index_low_,
+                                         update_data_};
+    // the same on the group ID, if the node has one (without, the IDs never match)
+    MultiplexedCANRXMessage<3, MessageType> group_info_message_{can_interface_,
+                                                                kGroupId != kCANUpdateNoGroup ? kGroupId + 1
+                                                                                              : kCANUpdateNoGroup,
+                                                                get_millis_,
+                                                                [this]() { ReceiveInfo(); },
+                                                                message_type_,
+                                                                length_signal_group_,
+                                                                md5_signal_group_,
+                                                                base_md5_signal_group_};
+    CANRXMessage<2> group_data_message_{can_interface_,
+                                        kGroupId,
+                                        get_millis_,
+                                        [this]() { ReceiveBlock(group_data_message_.GetID()); },
+                                        data_block_index_low_,
+                                        update_data_};
+
+    void ReceiveInfo()
+    {
+        if (message_type_ == MessageType::kMd5)
+        {
+            received_md5_arr_.at(static_cast<uint8_t>(update_md5_idx_) & 3) = true;
+            md5_arr_[static_cast<uint8_t>(update_md5_idx_) & 3] = update_md5_;
+            if (!received_md5_ && received_md5_arr_.at(0) && received_md5_arr_.at(1) && received_md5_arr_.at(2)
+                && received_md5_arr_.at(3))
+            {
+                received_md5_ = true;
+                FormatMD5();
+                ReportImages();
+                update_progress_message_.EncodeAndSend();
+            }
+        }
+        else if (message_type_ == MessageType::kBaseMd5)
+        {
+            received_base_md5_arr_.at(static_cast<uint8_t>(base_md5_idx_) & 3) = true;
+            base_md5_arr_[static_cast<uint8_t>(base_md5_idx_) & 3] = base_md5_;
+        }
+        else if (!update_started_ && message_type_ == MessageType::kUpdateStart
+                 && static_cast<uint32_t>(update_length_) > 0
+                 && (update_encoding_ == CANUpdateEncoding::kRaw
+                     || update_encoding_ == CANUpdateEncoding::kDeflatePages
+                     || update_encoding_ == CANUpdateEncoding::kDeltaPages))
+        {
+            if (update_encoding_ == CANUpdateEncoding::kDeltaPages && !BaseMatches())
+            {
+                // the delta was made against another image, the host falls back to a full one
+                ReportImages();
+                return;
+            }
+            FormatMD5();
+            uint32_t first_page = update_first_page_;
+            bool begun = false;
+            {
+                std::lock_guard<std::mutex> lock{target_mutex_};
+                if (first_page == 0)
+                {
+                    begun = target_.Begin(update_length_, md5_cstr_);
+                }
+                else if (static_cast<uint64_t>(first_page) * kCANUpdatePageBytes < update_length_)
+                {
+                    begun = target_.Resume(update_length_, md5_cstr_, first_page);
+                }
+            }
+            if (!begun && first_page > 0)
+            {
+                // the target doesn't hold the pages before, the host starts over
+                ReportImages();
+                return;
+            }
+            if (begun)
+            {
+                length_ = update_length_;
+                encoding_ = update_encoding_;
+                page_crc_ = update_page_crc_;
+                bytes_taken_ = first_page * kCANUpdatePageBytes;
+                block_count_ = encoding_ == CANUpdateEncoding::kRaw && !page_crc_
+                                   ? (length_ - bytes_taken_ + kCANUpdateBlockBytes - 1) / kCANUpdateBlockBytes
+                                   : 0xFFFFFF;
+                record_size_ = 0;
+                page_attempts_ = 0;
+                buffer_fill_ = 0;
+                write_failed_ = false;
+                finishing_ = false;
+                stalled_ = false;
+                write_stalls_ = 0;
+                next_block_ = 0;
+                received_ = 0;
+                new_blocks_since_ack_ = 0;
+                stale_blocks_since_ack_ = 0;
+                update_block_idx_ = 0;
+                received_len_ = true;
+                update_started_ = true;
+                written_ = false;
+                update_progress_message_.EncodeAndSend();
+            }
+        }
+    }
+
+    void ReceiveBlock(uint32_t id)
+    {
+        if (!update_started_)
+        {
+            return;
+        }
+        // 18 bits of CAN extended ID, not including standard ID
+        uint32_t index = ((id & 0x1FFFF800) >> 3) + data_block_index_low_;
+        uint32_t offset = index - next_block_;
+        if (index < next_block_ || offset >= kCANUpdateWindow || index >= block_count_ || ((received_ >> offset) & 1))
+        {
+            // a resend of a block whose ack was lost, or a block the node can't buffer: the host needs a fresh ack
+            stale_blocks_++;
+            if (stale_blocks_since_ack_++ % kCANUpdateAckInterval == 0)
+            {
+                SendAck();
+            }
+            return;
+        }
+        uint64_t data = update_data_;
+        memcpy(window_[index % kCANUpdateWindow].data(), &data, kCANUpdateBlockBytes);
+        received_ |= 1u << offset;
+        new_blocks_since_ack_++;
+        bool gap = offset > 0 && ((received_ >> (offset - 1)) & 1) == 0;
+
+        Drain();
+        if (update_started_ && !finishing_ && (gap || new_blocks_since_ack_ >= kCANUpdateAckInterval))
+        {
+            SendAck();
+        }
+    }
+
+    // Takes the blocks from next_block_ on that have arrived, while the write buffers have room
+    void Drain()
+    {
+        while ((received_ & 1) != 0 && bytes_taken_ < length_)
+        {
+            Take result = TakeBlock(window_[next_block_ % kCANUpdateWindow].data());
+            if (result == Take::kError)
+            {
+                Fail();
+                return;
+            }
+            if (result == Take::kBadPage)
+            {
+                RequestPage();
+                return;
+            }
+            if (result == Take::kNoRoom)
+            {
+                write_stalls_ += stalled_ ? 0 : 1;
+                stalled_ = true;
+                break;
+            }
+            stalled_ = false;
+            received_ >>= 1;
+            next_block_++;
+        }
+        update_block_idx_ = next_block_;
+        if (bytes_taken_ == length_ && !finishing_)
+        {
+            // the update ends once the writer has the rest of the image written
+            if (buffer_fill_ > 0)
+            {
+                QueuePage();
+            }
+            finishing_ = true;
+            SendAck();
+        }
+        CheckWriter();
+    }
+
+    // Passes the next block of the stream to the write buffers, raw blocks as they are and records through their
+    // page
+    Take TakeBlock(const uint8_t *block)
+    {
+        uint32_t page_size = std::min(kCANUpdatePageBytes, length_ - bytes_taken_);
+        if (encoding_ == CANUpdateEncoding::kRaw && !page_crc_)
+        {
+            uint32_t size = std::min(kCANUpdateBlockBytes, page_size);
+            if (Room() < size)
+            {
+                return Take::kNoRoom;
+            }
+            Stage(block, size);
+            bytes_taken_ += size;
+            return Take::kTaken;
+        }
+        // a raw page's record is the page, a compressed one's starts with its size
+        uint32_t crc_bytes = page_crc_ ? 4 : 0;
+        uint32_t header = encoding_ == CANUpdateEncoding::kDeltaPages
+                              ? 6
+                              : (encoding_ == CANUpdateEncoding::kDeflatePages ? 2 : 0);
+        uint32_t record_size = record_size_;
+        if (record_size == 0)
+        {
+            record_size = (header == 0 ? page_size : static_cast<uint32_t>(block[0] | (block[1] << 8))) + crc_bytes;
+        }
+        // a block that completes a record needs room for its page
+        uint32_t left = record_size_ == 0 ? record_size + header : record_size_ - record_fill_;
+        if (left <= kCANUpdateBlockBytes && Room() < page_size)
+        {
+            return Take::kNoRoom;
+        }
+        uint32_t offset = 0;
+        if (record_size_ == 0)
+        {
+            record_size_ = record_size;
+            record_fill_ = 0;
+            record_block_ = next_block_;
+            offset = header;
+            if (encoding_ == CANUpdateEncoding::kDeltaPages)
+            {
+                dictionary_offset_ = block[2] | (block[3] << 8) | (block[4] << 16)
+                                     | (static_cast<uint32_t>(block[5]) << 24);
+            }
+            if (record_size_ == crc_bytes || record_size_ > record_.size())
+            {
+                return Corrupt();
+            }
+        }
+        uint32_t size = std::min(kCANUpdateBlockBytes - offset, record_size_ - record_fill_);
+        memcpy(record_.data() + record_fill_, block + offset, size);
+        record_fill_ += size;
+        if (record_fill_ < record_size_)
+        {
+            return Take::kTaken;
+        }
+        // the record is complete, the rest of the block is padding
+        record_size_ = 0;
+        uint32_t data_size = record_fill_ - crc_bytes;
+        const uint8_t *page = record_.data();
+        if (header != 0)
+        {
+            size_t dictionary_size = 0;
+            if (encoding_ == CANUpdateEncoding::kDeltaPages && dictionary_offset_ != kCANUpdateNoDictionary)
+            {
+                if (dictionary_offset_ >= base_size_)
+                {
+                    return Corrupt();
+                }
+                dictionary_size = std::min(kCANUpdateDeltaDictionaryBytes, base_size_ - dictionary_offset_);
+                if (!target_.ReadBase(dictionary_offset_, page_.data(), dictionary_size))
+                {
+                    return Take::kError;
+                }
+            }
+            size_t inflated = 0;
+            if (!inflater_.Inflate(
+                    record_.data(), data_size, page_.data(), dictionary_size + page_size, inflated, dictionary_size)
+                || inflated != page_size)
+            {
+                return Corrupt();
+            }
+            page = page_.data() + dictionary_size;
+        }
+        else if (data_size != page_size)
+        {
+            return Corrupt();
+        }
+        if (page_crc_)
+        {
+            const uint8_t *crc = record_.data() + data_size;
+            uint32_t expected = crc[0] | (crc[1] << 8) | (crc[2] << 16) | (static_cast<uint32_t>(crc[3]) << 24);
+            if (CRC32(page, page_size) != expected)
+            {
+                return Take::kBadPage;
+            }
+            page_attempts_ = 0;
+        }
+        Stage(page, page_size);
+        bytes_taken_ += page_size;
+        return Take::kTaken;
+    }
+
+    // A record that doesn't decode is asked for again when pages carry CRCs, and ends the update otherwise
+    Take Corrupt() const { return page_crc_ ? Take::kBadPage : Take::kError; }
+
+    // Drops the page being collected and the blocks after it, and asks for them again from its first block
+    void RequestPage()
+    {
+        bad_pages_++;
+        if (++page_attempts_ >= kCANUpdatePageAttempts)
+        {
+            Fail();
+            return;
+        }
+        record_size_ = 0;
+        next_block_ = record_block_;
+        received_ = 0;
+        update_block_idx_ = next_block_;
+        SendAck();
+    }
+
+    // Bytes the write buffers can take before the writer frees one
+    uint32_t Room() const
+    {
+        uint32_t free = kCANUpdateWriteBuffers - (pages_queued_.load(std::memory_order_relaxed)
+                                                  - pages_written_.load(std::memory_order_acquire));
+        return free * kCANUpdatePageBytes - buffer_fill_;
+    }
+
+    // Copies to the write buffers, which must have room, queueing each one filled
+    void Stage(const uint8_t *data, uint32_t size)
+    {
+        while (size > 0)
+        {
+            uint32_t buffer = pages_queued_.load(std::memory_order_relaxed) % kCANUpdateWriteBuffers;
+            uint32_t count = std::min(size, kCANUpdatePageBytes - buffer_fill_);
+            memcpy(buffers_[buffer].data() + buffer_fill_, data, count);
+            buffer_fill_ += count;
+            data += count;
+            size -= count;
+            if (buffer_fill_ == kCANUpdatePageBytes)
+            {
+                QueuePage();
+            }
+        }
+    }
+
+    // Hands the buffer being filled to the writer, or writes it here without one
+    void QueuePage()
+    {
+        uint32_t queued = pages_queued_.load(std::memory_order_relaxed);
+        buffer_sizes_[queued % kCANUpdateWriteBuffers] = buffer_fill_;
+        buffer_fill_ = 0;
+        pages_queued_.store(queued + 1, std::memory_order_release);
+        if (writer_notify_)
+        {
+            writer_notify_();
+        }
+        else
+        {
+            WritePending();
+        }
+    }
+
+    // Ends the update once the writer has written the last page, or failed to write one
+    void CheckWriter()
+    {
+        if (!update_started_)
+        {
+            return;
+        }
+        if (write_failed_)
+        {
+            Fail();
+        }
+        else if (finishing_ && pages_written_ == pages_queued_)
+        {
+            Finish();
+        }
+    }
+
+    // Reports the running image, if the target can read it, and the pages it holds of the image with the received MD5
+    void ReportImages()
+    {
+        if (!has_base_ && target_.GetBase(base_size_, base_digest_.data()))
+        {
+            has_base_ = true;
+            capabilities_ = static_cast<uint8_t>(capabilities_ | kCANUpdateCapabilityDelta);
+        }
+        if (has_base_)
+        {
+            for (uint8_t i = 0; i < 4; i++)
+            {
+                base_index_ = i;
+                base_value_ = BaseWord(i);
+                update_base_message_.EncodeAndSend();
+            }
+            base_index_ = 4;
+            base_value_ = base_size_;
+            update_base_message_.EncodeAndSend();
+        }
+        uint32_t pages = 0;
+        bool resumable = false;
+        {
+            std::lock_guard<std::mutex> lock{target_mutex_};
+            resumable = target_.GetWrittenPages(md5_cstr_, pages);
+        }
+        if (resumable)
+        {
+            capabilities_ = static_cast<uint8_t>(capabilities_ | kCANUpdateCapabilityResume);
+            base_index_ = 5;
+            base_value_ = pages;
+            update_base_message_.EncodeAndSend();
+        }
+    }
+
+    // The received MD5 as the target takes it, the words are sent little endian, the digest's first byte first
+    void FormatMD5()
+    {
+        for (size_t i = 0; i < 16; i++)
+        {
+            unsigned byte = (md5_arr_[i / 4] >> (8 * (i % 4))) & 0xFF;
+            snprintf(md5_cstr_ + 2 * i, 3, "%02x", byte);
+        }
+    }
+
+    // Whether the host's base MD5 is the running image's
+    bool BaseMatches() const
+    {
+        for (size_t i = 0; i < 4; i++)
+        {
+            if (!received_base_md5_arr_[i] || base_md5_arr_[i] != BaseWord(i))
+            {
+                return false;
+            }
+        }
+        return has_base_;
+    }
+
+    // A word of the running image's MD5, little endian as MD5 words are sent
+    uint32_t BaseWord(size_t i) const
+    {
+        return static_cast<uint32_t>(base_digest_[4 * i]) | (static_cast<uint32_t>(base_digest_[4 * i + 1]) << 8)
+               | (static_cast<uint32_t>(base_digest_[4 * i + 2]) << 16)
+               | (static_cast<uint32_t>(base_digest_[4 * i + 3]) << 24);
+    }
+
+    void SendAck()
+    {
+        ack_base_ = next_block_;
+        ack_queued_pages_ = static_cast<uint8_t>(GetQueuedPages());
+        ack_write_stalls_ = static_cast<uint8_t>(write_stalls_ & 0x3F);
+        ack_bitmap_ = received_ >> 1;
+        update_ack_message_.EncodeAndSend();
+        new_blocks_since_ack_ = 0;
+        stale_blocks_since_ack_ = 0;
+        acks_sent_++;
+    }
+
+    void Finish()
+    {
+        update_block_idx_ = next_block_ - 1;
+        written_ = true;
+        update_started_ = false;
+        finishing_ = false;
+        bool ended = false;
+        {
+            std::lock_guard<std::mutex> lock{target_mutex_};
+            ended = target_.End();
+        }
+        if (!ended)
+        {
+            // tells the host the image was rejected
+            received_len_ = false;
+            written_ = false;
+        }
+        ForgetMD5();
+        update_progress_message_.EncodeAndSend();
+        // only now, the host would see a node that reboots first reset the update
+        if (ended)
+        {
+            target_.Restart();
+        }
+    }
+
+    // Ends an update whose stream is corrupt or can't be written, which the host sees in the progress
+    void Fail()
+    {
+        Abort();
+        update_started_ = false;
+        received_len_ = false;
+        written_ = false;
+        ForgetMD5();
+        update_progress_message_.EncodeAndSend();
+    }
+
+    // The next update starts over from its MD5, and the running image is reported again
+    void ForgetMD5()
+    {
+        received_md5_ = false;
+        received_md5_arr_.fill(false);
+        received_base_md5_arr_.fill(false);
+    }
+
+    // Drops the pages the writer hasn't written, and the update on the target
+    void Abort()
+    {
+        std::lock_guard<std::mutex> lock{target_mutex_};
+        pages_written_.store(pages_queued_.load(std::memory_order_relaxed), std::memory_order_release);
+        buffer_fill_ = 0;
+        finishing_ = false;
+        target_.Abort();
+    }
+
+    void Reset()
+    {
+        if (update_started_)
+        {
+            Abort();
+        }
+        update_started_ = false;
+        received_len_ = false;
+        written_ = false;
+        ForgetMD5();
+        update_block_idx_ = 0;
+        next_block_ = 0;
+        received_ = 0;
+    }
+};
+
+/**
+ * @brief The host side of the update protocol described above, for native tools and tests. Start() it with an image,
+ * then call Tick() often: it repeats the info messages until the node has them, then keeps the node's window full,
+ * sending as many frames as the ICAN takes (a full TX queue paces it at the bus rate) or one every frame_interval_us,
+ * and resends the blocks acks show missing, or every unacked block once no ack has moved the window for
+ * retransmit_timeout_us. The image is sent compressed to nodes that support it, and as a delta against the base image
+ * given to SetBase to nodes running it. Nodes that hold the start of the image from an update that stopped only get
+ * the pages they're missing.
+ *
+ * Given a group of nodes, it sends the stream to all of them at once (see the protocol description), which takes about
+ * as long as one. A node that fails or turns the start down is left out and the others go on; GetNodeState tells which.
+ */
+class CANUpdateHost
+{
+public:
+    enum class State
+    {
+        kIdle,
+        kSendingMD5,
+        kSendingLength,
+        kTransferring,
+        kDone,    // the node wrote the last block and accepted the image
+        kFailed,  // the node rejected the image or reset the update
+    };
+
+    struct Options
+    {
+        uint32_t info_interval_us{20000};        // between repeats of the MD5 and start messages
+        uint32_t retransmit_timeout_us{50000};  // without an ack moving the window, before resending unacked blocks
+        bool compress{true};                     // when the node supports it
+        bool delta{true};                        // when the node supports it and runs the base image
+        bool resume{true};                       // after the pages the node holds, when it supports it
+        bool page_crc{true};                     // checked by the node as each page completes, when it supports it
+        // between data frames, 0 to send as many as the ICAN takes; leaves the rest of the bus to other traffic on
+        // interfaces whose TX queue is deeper than the window
+        uint32_t frame_interval_us{0};
+    };
+
+    CANUpdateHost(ICAN &can_bus, uint32_t update_id, std::function<uint64_t(void)> get_micros)
+        : CANUpdateHost(can_bus, update_id, get_micros, Options{})
+    {
+    }
+
+    /**
+     * @param get_micros A function to get the current time in microseconds
+     */
+    CANUpdateHost(ICAN &can_bus, uint32_t update_id, std::function<uint64_t(void)> get_micros, const Options &options)
+        : CANUpdateHost(can_bus, update_id, std::vector<uint32_t>{update_id}, get_micros, options)
+    {
+    }
+
+    CANUpdateHost(ICAN &can_bus,
+                  uint32_t group_id,
+                  const std::vector<uint32_t> &update_ids,
+                  std::function<uint64_t(void)> get_micros)
+        : CANUpdateHost(can_bus, group_id, update_ids, get_micros, Options{})
+    {
+    }
+
+    /**
+     * @brief Updates several nodes at once
+     *
+     * @param group_id The group ID the nodes' CANUpdateDevices were given
+     * @param update_ids The nodes' update IDs
+     */
+    CANUpdateHost(ICAN &can_bus,
+                  uint32_t group_id,
+                  const std::vector<uint32_t> &update_ids,
+                  std::function<uint64_t(void)> get_micros,
+                  const Options &options)
+        : kGroupId{group_id}, can_interface_{can_bus}, get_micros_{get_micros}, options_(options)
+    {
+        for (uint32_t update_id : update_ids)
+        {
+            nodes_.emplace_back(new Node{*this, update_id});
+        }
+    }
+
+    /**
+     * @brief Sets the image the node is expected to run (e.g. the last one sent to it), which later updates are sent
+     * as deltas against if the node reports running it; it must stay valid until the update is done
+     *
+     * @param md5 The base image's 16 byte MD5 digest, nullptr to send only full images
+     */
+    void SetBase(const uint8_t *base, uint32_t size, const uint8_t *md5)
+    {
+        base_image_ = md5 != nullptr ? base : nullptr;
+        base_image_size_ = size;
+        if (md5 != nullptr)
+        {
+            memcpy(base_image_md5_.data(), md5, base_image_md5_.size());
+        }
+    }
+
+    /**
+     * @brief Starts sending an image, which must stay valid until the update is done
+     *
+     * @param md5 The image's 16 byte MD5 digest
+     */
+    void Start(const uint8_t *image, uint32_t size, const uint8_t *md5)
+    {
+        image_ = image;
+        size_ = size;
+        memcpy(md5_.data(), md5, md5_.size());
+        compressed_.clear();
+        compressed_records_.clear();
+        delta_.clear();
+        delta_records_.clear();
+        if (options_.compress)
+        {
+            BuildPages(image, size, nullptr, 0, compressed_, compressed_records_);
+        }
+        if (options_.delta && base_image_ != nullptr)
+        {
+            BuildPages(image, size, base_image_, base_image_size_, delta_, delta_records_);
+        }
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            static_cast<NodeUpdate &>(*node) = NodeUpdate{};
+        }
+        first_page_ = 0;
+        delta_starts_ = 0;
+        encoding_ = CANUpdateEncoding::kRaw;
+        SetStream(image, size);
+        next_ = 0;
+        seq_ = 0;
+        next_frame_us_ = 0;
+        frames_sent_ = 0;
+        retransmitted_blocks_ = 0;
+        bad_pages_ = 0;
+        write_stalls_ = 0;
+        max_queued_pages_ = 0;
+        last_info_us_ = get_micros_() - options_.info_interval_us;
+        state_ = size > 0 ? State::kSendingMD5 : State::kDone;
+    }
+
+    void Tick()
+    {
+        uint64_t now_us = get_micros_();
+        if (state_ == State::kSendingMD5 || state_ == State::kSendingLength)
+        {
+            if (now_us - last_info_us_ >= options_.info_interval_us)
+            {
+                SendInfo();
+                last_info_us_ = now_us;
+            }
+            return;
+        }
+        if (state_ != State::kTransferring)
+        {
+            return;
+        }
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if (Active(*node) && node->base < next_
+                && now_us - node->last_progress_us >= options_.retransmit_timeout_us)
+            {
+                node->resend = Unacked(*node);
+                node->last_progress_us = now_us;
+            }
+        }
+        while (options_.frame_interval_us == 0 || now_us >= next_frame_us_)
+        {
+            Node *missing = nullptr;
+            for (const std::unique_ptr<Node> &node : nodes_)
+            {
+                if (Active(*node) && node->resend != 0)
+                {
+                    missing = node.get();
+                    break;
+                }
+            }
+            if (missing != nullptr)
+            {
+                if (!Resend(*missing))
+                {
+                    break;
+                }
+            }
+            else if (next_ < block_count_ && next_ - WindowBase() < window_)
+            {
+                if (!SendBlock(next_, nullptr))
+                {
+                    break;
+                }
+                next_++;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    // kDone once every node is, kFailed once every node is done or failed and one has
+    State GetState() const { return state_; }
+    // The state of a node by its index in update_ids, kFailed for one left out
+    State GetNodeState(size_t node) const
+    {
+        return nodes_[node]->failed ? State::kFailed : (nodes_[node]->done ? State::kDone : state_);
+    }
+    // Blocks in the stream, known once the node has reported whether it takes compressed streams
+    uint32_t GetBlockCount() const { return block_count_; }
+    CANUpdateEncoding GetEncoding() const { return encoding_; }
+    // The page of the image the stream starts at, after the pages the node held
+    uint32_t GetFirstPage() const { return first_page_; }
+    // Blocks every node has written
+    uint32_t GetAckedBlocks() const { return WindowBase(); }
+    uint64_t GetFramesSent() const { return frames_sent_; }
+    uint32_t GetRetransmittedBlocks() const { return retransmitted_blocks_; }
+    // Whether the stream carries page CRCs, and the pages nodes found corrupt and asked for again
+    bool UsesPageCRC() const { return page_crc_; }
+    uint32_t GetBadPages() const { return bad_pages_; }
+    // Times the nodes' reception waited for their flash writers, and the most pages one had waiting, from their acks
+    uint32_t GetWriteStalls() const { return write_stalls_; }
+    uint8_t GetMaxQueuedPages() const { return max_queued_pages_; }
+    // From a node's last progress message
+    uint32_t GetFirmwareVersion(size_t node = 0) const { return nodes_[node]->fw_version; }
+    uint8_t GetCapabilities(size_t node = 0) const { return nodes_[node]->capabilities; }
+    // Whether a node reported running the base image
+    bool NodeRunsBase(size_t node = 0) const { return NodeRunsBase(*nodes_[node]); }
+
+private:
+    // Start messages a node may turn a delta down for before the host falls back to a full image
+    static constexpr uint32_t kDeltaStartAttempts{10};
+
+    const uint32_t kGroupId;  // the node's update ID when there is one
+    ICAN &can_interface_;
+    std::function<uint64_t(void)> get_micros_;
+    Options options_;
+
+    // the same signals as CANUpdateDevice, the nodes' messages are decoded into them in turn
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) message_type_{};
+    MakeUnsignedCANSignal(uint32_t, 8, 32, 1, 0) update_length_{};
+    MakeUnsignedCANSignal(CANUpdateEncoding, 40, 7, 1, 0) update_encoding_{};
+    MakeUnsignedCANSignal(bool, 47, 1, 1, 0) update_page_crc_{};
+    MakeUnsignedCANSignal(uint16_t, 48, 16, 1, 0) update_first_page_{};
+    MakeUnsignedCANSignal(uint16_t, 8, 8, 1, 0) update_md5_idx_{};
+    MakeUnsignedCANSignal(uint32_t, 16, 32, 1, 0) update_md5_{};
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) data_block_index_low_{};
+    MakeUnsignedCANSignal(uint64_t, 8, 56, 1, 0) update_data_{};
+
+    MakeUnsignedCANSignal(uint32_t, 0, 24, 1, 0) update_block_idx_{};
+    MakeUnsignedCANSignal(bool, 24, 1, 1, 0) received_len_{};
+    MakeUnsignedCANSignal(bool, 25, 1, 1, 0) received_md5_{};
+    MakeUnsignedCANSignal(bool, 26, 1, 1, 0) written_{};
+    MakeUnsignedCANSignal(uint8_t, 27, 5, 1, 0) progress_capabilities_{};
+    MakeUnsignedCANSignal(uint32_t, 32, 32, 1, 0) fw_version_signal_{};
+
+    MakeUnsignedCANSignal(uint32_t, 0, 24, 1, 0) ack_base_{};
+    MakeUnsignedCANSignal(uint8_t, 24, 2, 1, 0) ack_queued_pages_{};
+    MakeUnsignedCANSignal(uint8_t, 26, 6, 1, 0) ack_write_stalls_{};
+    MakeUnsignedCANSignal(uint32_t, 32, 32, 1, 0) ack_bitmap_{};
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) base_index_{};
+    MakeUnsignedCANSignal(uint32_t, 8, 32, 1, 0) base_value_{};
+
+    // What the host knows of a node's part in an update
+    struct NodeUpdate
+    {
+        bool received_md5{false};
+        bool started{false};  // took the start message
+        bool done{false};
+        bool failed{false};  // rejected the image, reset the update or turned the start down in a group
+        // the node's running image: its MD5 words and size, bit n of running_received for value n
+        std::array<uint32_t, 5> running{};
+        uint8_t running_received{0};
+        uint32_t held_pages{0};  // of the image
+        uint32_t base{0};        // every block before it is written
+        uint32_t acked{0};       // bit n for block base + n
+        uint32_t resend{0};      // bit n for block base + n
+        // the send sequence numbers of the blocks it was sent by block % kCANUpdateWindow, and the highest it is known
+        // to have received
+        std::array<uint64_t, kCANUpdateWindow> send_seq{};
+        uint64_t acked_seq{0};
+        uint64_t last_progress_us{0};
+        uint8_t last_write_stalls{0};  // in its last ack, which wraps
+    };
+
+    // A node, whose messages come in on its own IDs
+    struct Node : NodeUpdate
+    {
+        Node(CANUpdateHost &host, uint32_t id)
+            : update_id{id},
+              progress_message{host.can_interface_,
+                               id + 2,
+                               [&host]() { return static_cast<uint32_t>(host.get_micros_() / 1000); },
+                               [&host, this]() { host.OnProgress(*this); },
+                               host.update_block_idx_,
+                               host.received_len_,
+                               host.received_md5_,
+                               host.written_,
+                               host.progress_capabilities_,
+                               host.fw_version_signal_},
+              ack_message{host.can_interface_,
+                          id + 3,
+                          [&host]() { return static_cast<uint32_t>(host.get_micros_() / 1000); },
+                          [&host, this]() { host.OnAck(*this); },
+                          host.ack_base_,
+                          host.ack_queued_pages_,
+                          host.ack_write_stalls_,
+                          host.ack_bitmap_},
+              base_message{host.can_interface_,
+                           id + 4,
+                           [&host]() { return static_cast<uint32_t>(host.get_micros_() / 1000); },
+                           [&host, this]() { host.OnBase(*this); },
+                           host.base_index_,
+                           host.base_value_}
+        {
+        }
+
+        const uint32_t update_id;
+        // from its last progress message
+        uint32_t fw_version{0};
+        uint8_t capabilities{0};
+        CANRXMessage<6> progress_message;
+        CANRXMessage<4> ack_message;
+        CANRXMessage<2> base_message;
+    };
+
+    const uint8_t *image_{nullptr};
+    uint32_t size_{0};
+    std::vector<uint8_t> compressed_;  // the page records, if compressing
+    const uint8_t *base_image_{nullptr};
+    uint32_t base_image_size_{0};
+    std::array<uint8_t, 16> base_image_md5_{};
+    std::vector<uint8_t> delta_;  // the page records against the base image, if there is one
+    // where each page's record starts in compressed_ and delta_
+    std::vector<uint32_t> compressed_records_;
+    std::vector<uint32_t> delta_records_;
+    // the selected stream with each page's CRC, and where its records start
+    bool page_crc_{false};
+    std::vector<uint8_t> crc_stream_;
+    std::vector<uint32_t> crc_records_;
+    uint32_t first_page_{0};
+    uint32_t delta_starts_{0};
+    CANUpdateEncoding encoding_{CANUpdateEncoding::kRaw};
+    const uint8_t *stream_{nullptr};
+    uint32_t stream_size_{0};
+    std::array<uint8_t, 16> md5_{};
+    State state_{State::kIdle};
+    uint64_t last_info_us_{0};
+
+    uint32_t block_count_{0};
+    uint32_t window_{kCANUpdateWindow};
+    uint32_t next_{0};  // the first block not sent yet
+    uint64_t seq_{0};
+    uint64_t next_frame_us_{0};  // when the next data frame may be sent, with a frame interval
+    uint64_t frames_sent_{0};
+    uint32_t retransmitted_blocks_{0};
+    uint32_t bad_pages_{0};
+    uint32_t write_stalls_{0};
+    uint8_t max_queued_pages_{0};
+
+    std::vector<std::unique_ptr<Node>> nodes_;
+
+    static bool Active(const Node &node) { return !node.done && !node.failed; }
+
+    void SendInfo()
+    {
+        if (state_ == State::kSendingMD5)
+        {
+            SendMD5(1, md5_);
+            return;
+        }
+        if (encoding_ == CANUpdateEncoding::kDeltaPages && ++delta_starts_ > kDeltaStartAttempts)
+        {
+            // the reports of nodes that turned the delta down were lost
+            for (const std::unique_ptr<Node> &node : nodes_)
+            {
+                if (Active(*node) && !node->started)
+                {
+                    TurnedDown(*node, false);
+                }
+            }
+            if (state_ != State::kSendingLength)
+            {
+                return;
+            }
+        }
+        if (encoding_ == CANUpdateEncoding::kDeltaPages)
+        {
+            SendMD5(2, base_image_md5_);
+        }
+        CANMessage message{kGroupId + 1, 8, std::array<uint8_t, 8>{}};
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message.data_.data());
+        message_type_ = 0;
+        update_length_ = size_;
+        update_encoding_ = encoding_;
+        update_page_crc_ = page_crc_;
+        update_first_page_ = static_cast<uint16_t>(first_page_);
+        message_type_.EncodeSignal(raw);
+        update_length_.EncodeSignal(raw);
+        update_encoding_.EncodeSignal(raw);
+        update_page_crc_.EncodeSignal(raw);
+        update_first_page_.EncodeSignal(raw);
+        can_interface_.SendMessage(message);
+    }
+
+    // Sends the words of an MD5 digest in info messages of a type
+    void SendMD5(uint8_t type, const std::array<uint8_t, 16> &md5)
+    {
+        CANMessage message{kGroupId + 1, 6, std::array<uint8_t, 8>{}};
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message.data_.data());
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            *raw = 0;
+            message_type_ = type;
+            update_md5_idx_ = i;
+            update_md5_ = MD5Word(md5, i);
+            message_type_.EncodeSignal(raw);
+            update_md5_idx_.EncodeSignal(raw);
+            update_md5_.EncodeSignal(raw);
+            can_interface_.SendMessage(message);
+        }
+    }
+
+    // A word of an MD5 digest, little endian as they are sent
+    static uint32_t MD5Word(const std::array<uint8_t, 16> &md5, size_t i)
+    {
+        return static_cast<uint32_t>(md5[4 * i]) | (static_cast<uint32_t>(md5[4 * i + 1]) << 8)
+               | (static_cast<uint32_t>(md5[4 * i + 2]) << 16) | (static_cast<uint32_t>(md5[4 * i + 3]) << 24);
+    }
+
+    // Sends a block on the group ID, or on a node's own ID to only that node
+    bool SendBlock(uint32_t block, Node *to)
+    {
+        uint32_t id = to != nullptr ? to->update_id : kGroupId;
+        CANMessage message{id + ((block << 3) & 0x1FFFF800), true, 8, std::array<uint8_t, 8>{}};
+        uint64_t data = 0;
+        memcpy(&data,
+               stream_ + block * kCANUpdateBlockBytes,
+               std::min(kCANUpdateBlockBytes, stream_size_ - block * kCANUpdateBlockBytes));
+        data_block_index_low_ = static_cast<uint8_t>(block & 0xFF);
+        update_data_ = data;
+        uint64_t *raw = reinterpret_cast<uint64_t *>(message.data_.data());
+        data_block_index_low_.EncodeSignal(raw);
+        update_data_.EncodeSignal(raw);
+        if (!can_interface_.SendMessage(message))
+        {
+            return false;
+        }
+        if (options_.frame_interval_us != 0)
+        {
+            // a few frames of credit, so a late Tick keeps the rate without bursting after a stall
+            uint64_t credit_us = 4ull * options_.frame_interval_us;
+            uint64_t now_us = get_micros_();
+            next_frame_us_ = std::max(next_frame_us_, now_us > credit_us ? now_us - credit_us : 0)
+                             + options_.frame_interval_us;
+        }
+        seq_++;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if ((to == nullptr || to == node.get()) && block >= node->base)
+            {
+                node->send_seq[block % kCANUpdateWindow] = seq_;
+            }
+        }
+        frames_sent_++;
+        return true;
+    }
+
+    // Resends the first block a node misses, once on the group ID if more nodes miss it
+    bool Resend(Node &node)
+    {
+        uint32_t offset = 0;
+        while (((node.resend >> offset) & 1) == 0)
+        {
+            offset++;
+        }
+        uint32_t block = node.base + offset;
+        size_t missing = 0;
+        for (const std::unique_ptr<Node> &other : nodes_)
+        {
+            missing += Misses(*other, block) ? 1 : 0;
+        }
+        Node *to = missing > 1 ? nullptr : &node;
+        if (!SendBlock(block, to))
+        {
+            return false;
+        }
+        for (const std::unique_ptr<Node> &other : nodes_)
+        {
+            if ((to == nullptr || to == other.get()) && Misses(*other, block))
+            {
+                other->resend &= ~(1u << (block - other->base));
+            }
+        }
+        retransmitted_blocks_++;
+        return true;
+    }
+
+    // Whether a node is waiting for a block to be resent
+    static bool Misses(const Node &node, uint32_t block)
+    {
+        return Active(node) && block >= node.base && block - node.base < kCANUpdateWindow
+               && ((node.resend >> (block - node.base)) & 1) != 0;
+    }
+
+    void OnProgress(Node &node)
+    {
+        node.fw_version = fw_version_signal_;
+        node.capabilities = progress_capabilities_;
+        if (state_ == State::kSendingMD5 && received_md5_)
+        {
+            // the node reports the image it runs before this progress
+            node.received_md5 = true;
+            for (const std::unique_ptr<Node> &other : nodes_)
+            {
+                if (Active(*other) && !other->received_md5)
+                {
+                    return;
+                }
+            }
+            SelectEncoding(true);
+            state_ = State::kSendingLength;
+            last_info_us_ = get_micros_() - options_.info_interval_us;
+        }
+        // written is still set from an earlier update the node ended, until the new one starts
+        else if (state_ == State::kSendingLength && received_len_ && !written_)
+        {
+            node.started = true;
+            StartTransfer();
+        }
+        else if (state_ == State::kTransferring && Active(node))
+        {
+            if (!received_len_)
+            {
+                node.failed = true;
+                CheckDone();
+                return;
+            }
+            Advance(node, written_ ? update_block_idx_ + 1 : static_cast<uint32_t>(update_block_idx_));
+            if (written_ && update_block_idx_ + 1 == block_count_)
+            {
+                node.done = true;
+                CheckDone();
+            }
+        }
+    }
+
+    // Starts sending blocks once every node has taken the start message
+    void StartTransfer()
+    {
+        bool windowed = true;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if (Active(*node) && !node->started)
+            {
+                return;
+            }
+            windowed = windowed && (node->capabilities & kCANUpdateCapabilityWindowed) != 0;
+        }
+        // a node without the window only takes the block it needs next
+        window_ = windowed ? kCANUpdateWindow : 1;
+        state_ = State::kTransferring;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            node->last_progress_us = get_micros_();
+        }
+        CheckDone();
+    }
+
+    // Ends the update once no node is left updating
+    void CheckDone()
+    {
+        bool failed = false;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if (Active(*node))
+            {
+                return;
+            }
+            failed = failed || node->failed;
+        }
+        state_ = failed ? State::kFailed : State::kDone;
+    }
+
+    void OnAck(Node &node)
+    {
+        if (state_ != State::kTransferring || !Active(node))
+        {
+            return;
+        }
+        uint8_t stalls = ack_write_stalls_;
+        write_stalls_ += (stalls - node.last_write_stalls) & 0x3F;
+        node.last_write_stalls = stalls;
+        max_queued_pages_ = std::max<uint8_t>(max_queued_pages_, ack_queued_pages_);
+        if (page_crc_ && ack_base_ < node.base)
+        {
+            Rewind(node, ack_base_);
+            return;
+        }
+        Advance(node, ack_base_);
+        if (ack_base_ != node.base)
+        {
+            return;  // an older ack
+        }
+        node.acked |= static_cast<uint32_t>(ack_bitmap_) << 1;
+        for (uint32_t offset = 0; offset < kCANUpdateWindow && node.base + offset < next_; offset++)
+        {
+            if (((node.acked >> offset) & 1) != 0)
+            {
+                node.acked_seq = std::max(node.acked_seq, node.send_seq[(node.base + offset) % kCANUpdateWindow]);
+            }
+        }
+        // frames arrive in order, so an unacked block sent before one the node has was lost
+        uint32_t unacked = Unacked(node);
+        for (uint32_t offset = 0; offset < kCANUpdateWindow && node.base + offset < next_; offset++)
+        {
+            if (((unacked >> offset) & 1) != 0
+                && node.send_seq[(node.base + offset) % kCANUpdateWindow] < node.acked_seq)
+            {
+                node.resend |= 1u << offset;
+            }
+        }
+        node.resend &= unacked;
+    }
+
+    void OnBase(Node &node)
+    {
+        uint8_t index = base_index_;
+        if (index == 5)
+        {
+            node.held_pages = base_value_;
+            // a node that turned the resumed start down reports what it holds again
+            if (state_ == State::kSendingLength && !node.failed && first_page_ > node.held_pages)
+            {
+                TurnedDown(node, encoding_ == CANUpdateEncoding::kDeltaPages);
+            }
+            return;
+        }
+        if (index > 4)
+        {
+            return;
+        }
+        node.running[index] = base_value_;
+        node.running_received = static_cast<uint8_t>(node.running_received | (1 << index));
+        // a node that turned the delta down reports the image it runs again
+        if (state_ == State::kSendingLength && !node.failed && encoding_ == CANUpdateEncoding::kDeltaPages
+            && node.running_received == 0x1F && !NodeRunsBase(node))
+        {
+            TurnedDown(node, false);
+        }
+    }
+
+    // A node turned the start down: on its own it gets another stream, in a group it is left out, as the others may
+    // have started
+    void TurnedDown(Node &node, bool allow_delta)
+    {
+        if (nodes_.size() == 1)
+        {
+            SelectEncoding(allow_delta);
+            return;
+        }
+        node.failed = true;
+        StartTransfer();
+    }
+
+    bool NodeRunsBase(const Node &node) const
+    {
+        if (base_image_ == nullptr || node.running_received != 0x1F || node.running[4] != base_image_size_)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < 4; i++)
+        {
+            if (node.running[i] != MD5Word(base_image_md5_, i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Picks the smallest stream every node takes, from the first page none of them misses
+    void SelectEncoding(bool allow_delta)
+    {
+        bool delta = allow_delta && !delta_.empty();
+        bool deflate = !compressed_.empty();
+        bool resume = options_.resume;
+        bool page_crc = options_.page_crc;
+        uint32_t held_pages = 0xFFFF;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if (node->failed)
+            {
+                continue;
+            }
+            delta = delta && (node->capabilities & kCANUpdateCapabilityDelta) != 0 && NodeRunsBase(*node);
+            deflate = deflate && (node->capabilities & kCANUpdateCapabilityDeflate) != 0;
+            resume = resume && (node->capabilities & kCANUpdateCapabilityResume) != 0;
+            page_crc = page_crc && (node->capabilities & kCANUpdateCapabilityPageCRC) != 0;
+            held_pages = std::min(held_pages, node->held_pages);
+        }
+        const std::vector<uint32_t> *records = nullptr;
+        if (delta)
+        {
+            encoding_ = CANUpdateEncoding::kDeltaPages;
+            SetStream(delta_.data(), static_cast<uint32_t>(delta_.size()));
+            records = &delta_records_;
+        }
+        else if (deflate)
+        {
+            encoding_ = CANUpdateEncoding::kDeflatePages;
+            SetStream(compressed_.data(), static_cast<uint32_t>(compressed_.size()));
+            records = &compressed_records_;
+        }
+        else
+        {
+            encoding_ = CANUpdateEncoding::kRaw;
+            SetStream(image_, size_);
+        }
+        page_crc_ = page_crc;
+        if (page_crc_)
+        {
+            AddPageCRCs(records);
+            records = &crc_records_;
+        }
+        // the last page is always sent, the node ends the update with it
+        uint32_t pages = (size_ + kCANUpdatePageBytes - 1) / kCANUpdatePageBytes;
+        first_page_ = resume ? std::min(held_pages, pages - 1) : 0;
+        uint32_t skip = records != nullptr ? (*records)[first_page_] : first_page_ * kCANUpdatePageBytes;
+        SetStream(stream_ + skip, stream_size_ - skip);
+    }
+
+    /**
+     * @brief Builds the page records of a kDeflatePages stream, or of a kDeltaPages one if there is a base. A delta
+     * page is compressed on its own, against the window of the base where the last page matched, and against the one
+     * where a few of its bytes are found near there, and the smallest is kept.
+     *
+     * @param records Receives where each page's record starts in the stream
+     */
+    static void BuildPages(const uint8_t *image,
+                           uint32_t size,
+                           const uint8_t *base,
+                           uint32_t base_size,
+                           std::vector<uint8_t> &stream,
+                           std::vector<uint32_t> &records)
+    {
+        const int64_t kSearchBytes = 32768;
+        const uint32_t kAnchorBytes = 16;
+        const uint32_t kAnchorSpacing = 1024;
+        uint32_t dictionary_size = std::min(kCANUpdateDeltaDictionaryBytes, base_size);
+        int64_t shift = 0;  // where the base held the last page's bytes, relative to the page
+        auto clamp = [base_size](int64_t position)
+        { return std::max<int64_t>(0, std::min<int64_t>(position, base_size)); };
+        std::vector<uint8_t> best;
+        std::vector<uint8_t> candidate;
+        std::vector<uint8_t> input;
+        for (uint32_t offset = 0; offset < size; offset += kCANUpdatePageBytes)
+        {
+            uint32_t page_size = std::min(kCANUpdatePageBytes, size - offset);
+            const uint8_t *page = image + offset;
+            best.clear();
+            Deflate(page, page_size, best);
+            uint32_t best_dictionary = kCANUpdateNoDictionary;
+            if (base != nullptr && dictionary_size > 0)
+            {
+                std::vector<int64_t> shifts{shift};
+                for (uint32_t anchor = 0; anchor + kAnchorBytes <= page_size; anchor += kAnchorSpacing)
+                {
+                    int64_t center = static_cast<int64_t>(offset + anchor) + shift;
+                    const uint8_t *from = base + clamp(center - kSearchBytes);
+                    const uint8_t *to = base + clamp(center + kSearchBytes);
+                    const uint8_t *found = std::search(from, to, page + anchor, page + anchor + kAnchorBytes);
+                    if (found != to)
+                    {
+                        int64_t found_shift = (found - base) - static_cast<int64_t>(offset + anchor);
+                        if (found_shift != shift)
+                        {
+                            shifts.insert(shifts.begin(), found_shift);
+                        }
+                        break;
+                    }
+                }
+                for (int64_t page_shift : shifts)
+                {
+                    // the page's bytes in the middle of the dictionary
+                    int64_t start = static_cast<int64_t>(offset) + page_shift
+                                    - (kCANUpdateDeltaDictionaryBytes - kCANUpdatePageBytes) / 2;
+                    start = clamp(std::min<int64_t>(start, base_size - dictionary_size));
+                    input.assign(base + start, base + start + dictionary_size);
+                    input.insert(input.end(), page, page + page_size);
+                    candidate.clear();
+                    Deflate(input.data(), input.size(), candidate, dictionary_size);
+                    if (candidate.size() < best.size())
+                    {
+                        best.swap(candidate);
+                        best_dictionary = static_cast<uint32_t>(start);
+                        shift = page_shift;
+                    }
+                }
+            }
+            records.push_back(static_cast<uint32_t>(stream.size()));
+            stream.push_back(static_cast<uint8_t>(best.size()));
+            stream.push_back(static_cast<uint8_t>(best.size() >> 8));
+            if (base != nullptr)
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    stream.push_back(static_cast<uint8_t>(best_dictionary >> (8 * i)));
+                }
+            }
+            stream.insert(stream.end(), best.begin(), best.end());
+            stream.resize((stream.size() + kCANUpdateBlockBytes - 1) / kCANUpdateBlockBytes * kCANUpdateBlockBytes);
+        }
+    }
+
+    // Adds each page's CRC to its record in the selected stream, cutting a raw one into records
+    void AddPageCRCs(const std::vector<uint32_t> *records)
+    {
+        crc_stream_.clear();
+        crc_records_.clear();
+        uint32_t header = encoding_ == CANUpdateEncoding::kDeltaPages ? 6 : 2;
+        for (uint32_t page = 0, offset = 0; offset < size_; page++, offset += kCANUpdatePageBytes)
+        {
+            uint32_t page_size = std::min(kCANUpdatePageBytes, size_ - offset);
+            crc_records_.push_back(static_cast<uint32_t>(crc_stream_.size()));
+            if (records == nullptr)
+            {
+                crc_stream_.insert(crc_stream_.end(), image_ + offset, image_ + offset + page_size);
+            }
+            else
+            {
+                const uint8_t *record = stream_ + (*records)[page];
+                crc_stream_.insert(crc_stream_.end(), record, record + header + (record[0] | (record[1] << 8)));
+            }
+            uint32_t crc = CRC32(image_ + offset, page_size);
+            for (int i = 0; i < 4; i++)
+            {
+                crc_stream_.push_back(static_cast<uint8_t>(crc >> (8 * i)));
+            }
+            crc_stream_.resize((crc_stream_.size() + kCANUpdateBlockBytes - 1) / kCANUpdateBlockBytes
+                               * kCANUpdateBlockBytes);
+        }
+        SetStream(crc_stream_.data(), static_cast<uint32_t>(crc_stream_.size()));
+    }
+
+    // A node found a page corrupt and dropped it and the blocks after it: the stream goes again from the page's first
+    // block, which nodes further on drop as blocks they have
+    void Rewind(Node &node, uint32_t base)
+    {
+        node.base = base;
+        node.acked = 0;
+        node.resend = 0;
+        node.last_progress_us = get_micros_();
+        next_ = std::min(next_, base);
+        bad_pages_++;
+    }
+
+    void SetStream(const uint8_t *stream, uint32_t size)
+    {
+        stream_ = stream;
+        stream_size_ = size;
+        block_count_ = (size + kCANUpdateBlockBytes - 1) / kCANUpdateBlockBytes;
+    }
+
+    // Moves a node's window to a new base, it has written every block before it
+    void Advance(Node &node, uint32_t base)
+    {
+        if (base <= node.base || base > next_)
+        {
+            return;
+        }
+        uint32_t shift = base - node.base;
+        node.acked_seq = std::max(node.acked_seq, node.send_seq[(base - 1) % kCANUpdateWindow]);
+        node.acked = shift >= 32 ? 0 : node.acked >> shift;
+        node.resend = shift >= 32 ? 0 : node.resend >> shift;
+        node.base = base;
+        node.last_progress_us = get_micros_();
+    }
+
+    // The sent blocks in a node's window it hasn't acked, bit n for block base + n
+    uint32_t Unacked(const Node &node) const
+    {
+        if (next_ <= node.base)
+        {
+            return 0;  // a node further on than a rewound stream
+        }
+        uint32_t in_flight = std::min(next_ - node.base, kCANUpdateWindow);
+        uint32_t sent = in_flight >= 32 ? ~0u : (1u << in_flight) - 1;
+        return sent & ~node.acked;
+    }
+
+    // The first block a node still needs, which the window starts at
+    uint32_t WindowBase() const
+    {
+        uint32_t base = next_;
+        for (const std::unique_ptr<Node> &node : nodes_)
+        {
+            if (!node->failed)
+            {
+                base = std::min(base, node->base);
+            }
+        }
+        return base;
+    }
+};
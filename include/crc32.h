@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CRC-32 (IEEE 802.3, as used by zlib and Ethernet) using a 16 entry table, small enough for any MCU
+ *
+ * @param data The bytes to checksum
+ * @param size The number of bytes
+ * @param crc The CRC of the preceding bytes when checksumming in pieces, 0 to start
+ */
+inline uint32_t CRC32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    static const uint32_t kTable[16] = {0x00000000,
+                                        0x1DB71064,
+                                        0x3B6E20C8,
+                                        0x26D930AC,
+                                        0x76DC4190,
+                                        0x6B6B51F4,
+                                        0x4DB26158,
+                                        0x5005713C,
+                                        0xEDB88320,
+                                        0xF00F9344,
+                                        0xD6D6A3E8,
+                                        0xCB61B38C,
+                                        0x9B64C2B0,
+                                        0x86D3D2D4,
+                                        0xA00AE278,
+                                        0xBDBDF21C};
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = (crc >> 4) ^ kTable[(crc ^ data[i]) & 0xF];
+        crc = (crc >> 4) ^ kTable[(crc ^ (data[i] >> 4)) & 0xF];
+    }
+    return ~crc;
+}
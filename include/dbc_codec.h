@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cmath>
+#include <limits>
+
+#include "can_interface.h"
+#include "dbc_database.h"
+
+/**
+ * @brief Encodes and decodes a signal described at runtime (by a DBCSignal) the same way a CANSignal with the same
+ * parameters does at compile time: same position and mask generation, same rounding, clamping and float precision, so
+ * payloads match what nodes built from the generated headers produce
+ */
+class DBCSignalCodec
+{
+public:
+    DBCSignalCodec() = default;
+
+    explicit DBCSignalCodec(const DBCSignal &signal)
+        : length_{signal.length},
+          little_endian_{signal.little_endian},
+          is_signed_{signal.is_signed},
+          // CANSignal takes the factor and offset as 32.32 fixed point template parameters, round them the same way
+          factor_{CANTemplateGetFloat(CANTemplateConvertFloat(signal.factor))},
+          offset_{CANTemplateGetFloat(CANTemplateConvertFloat(signal.offset))}
+    {
+        ICANSignal::ByteOrder byte_order =
+            little_endian_ ? ICANSignal::ByteOrder::kLittleEndian : ICANSignal::ByteOrder::kBigEndian;
+        if (length_ == 0 || length_ > 64 || signal.start_bit > 63 || factor_ == 0)
+        {
+            return;
+        }
+        position_ = CANSignal_generate_position(signal.start_bit, length_, byte_order, BigEndianPositionType::kDbc);
+        if (position_ + length_ > 64)
+        {
+            return;
+        }
+        mask_ = CANSignal_generate_mask(position_, length_, byte_order);
+        unity_factor_ = factor_ == 1 && offset_ == 0;
+        max_raw_ = is_signed_ ? ((1ull << (length_ - 1)) - 1) : (length_ == 64 ? ~0ull : (1ull << length_) - 1);
+        min_raw_ = is_signed_ ? ~max_raw_ : 0;
+    }
+
+    // false if the signal doesn't fit in 8 bytes or has a factor of 0, Encode and Decode then do nothing
+    bool IsValid() const { return mask_ != 0; }
+
+    uint64_t GetMask() const { return mask_; }
+
+    /**
+     * @brief ORs the signal into buffer (which should have the signal's bits cleared)
+     */
+    void Encode(double value, uint64_t *buffer) const
+    {
+        if (mask_ == 0)
+        {
+            return;
+        }
+        uint64_t raw = is_signed_ ? static_cast<uint64_t>(ClampSigned(ToRaw<int64_t>(value)))
+                                  : ClampUnsigned(ToRaw<uint64_t>(value));
+        if (little_endian_)
+        {
+            *buffer |= (raw << position_) & mask_;
+        }
+        else
+        {
+            *buffer |= bswap<uint64_t>(raw << (64 - (length_ + position_))) & mask_;
+        }
+    }
+
+    /**
+     * @brief The raw (unscaled) value of the signal in buffer, sign extended if the signal is signed
+     */
+    int64_t DecodeRaw(const uint64_t *buffer) const
+    {
+        if (mask_ == 0)
+        {
+            return 0;
+        }
+        uint64_t aligned = little_endian_ ? (*buffer & mask_) << (64 - (position_ + length_))
+                                          : bswap<uint64_t>(*buffer & mask_) << position_;
+        return is_signed_ ? static_cast<int64_t>(aligned) >> (64 - length_)
+                          : static_cast<int64_t>(aligned >> (64 - length_));
+    }
+
+    /**
+     * @brief The physical value of the signal in buffer
+     */
+    double Decode(const uint64_t *buffer) const
+    {
+        int64_t raw = DecodeRaw(buffer);
+        if (unity_factor_)
+        {
+            return is_signed_ ? static_cast<double>(raw) : static_cast<double>(static_cast<uint64_t>(raw));
+        }
+        float raw_float = is_signed_ ? static_cast<float>(raw) : static_cast<float>(static_cast<uint64_t>(raw));
+        return static_cast<double>(raw_float * factor_ + offset_);
+    }
+
+private:
+    uint8_t position_{0};
+    uint8_t length_{0};
+    bool little_endian_{true};
+    bool is_signed_{false};
+    bool unity_factor_{false};
+    double factor_{1};
+    double offset_{0};
+    uint64_t mask_{0};
+    uint64_t max_raw_{0};
+    uint64_t min_raw_{0};
+
+    template <typename Raw>
+    Raw ToRaw(double value) const
+    {
+        if (unity_factor_)
+        {
+            if (!is_signed_ && value < 0)
+            {
+                value = 0;
+            }
+            return SaturatingCast<Raw>(value);
+        }
+        if (!is_signed_ && (factor_ < 0 ? value > offset_ : value < offset_))
+        {
+            value = offset_;
+        }
+        return SaturatingCast<Raw>(std::round((static_cast<float>(value) - offset_) / factor_));
+    }
+
+    // out of range float to integer conversions are undefined, saturate instead
+    template <typename Raw>
+    static Raw SaturatingCast(double value)
+    {
+        if (value != value || value <= static_cast<double>(std::numeric_limits<Raw>::min()))
+        {
+            return std::numeric_limits<Raw>::min();
+        }
+        if (value >= static_cast<double>(std::numeric_limits<Raw>::max()))
+        {
+            return std::numeric_limits<Raw>::max();
+        }
+        return static_cast<Raw>(value);
+    }
+
+    int64_t ClampSigned(int64_t raw) const
+    {
+        int64_t max = static_cast<int64_t>(max_raw_);
+        int64_t min = static_cast<int64_t>(min_raw_);
+        return raw < min ? min : (raw > max ? max : raw);
+    }
+
+    uint64_t ClampUnsigned(uint64_t raw) const { return raw > max_raw_ ? max_raw_ : raw; }
+};
@@ -0,0 +1,682 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef ARDUINO
+#include <fstream>
+#include <sstream>
+#endif
+
+/**
+ * @brief A signal as described in a DBC file
+ */
+struct DBCSignal
+{
+    enum class Multiplexing : uint8_t
+    {
+        kNone,         // always present
+        kMultiplexor,  // the signal that selects which multiplexed signals are present ("M")
+        kMultiplexed   // only present when the multiplexor equals multiplexor_value ("m<value>")
+    };
+
+    std::string name;
+    uint8_t start_bit{0};  // as written in the DBC (for big endian signals this is the MSB in DBC bit numbering)
+    uint8_t length{0};
+    bool little_endian{true};
+    bool is_signed{false};
+    double factor{1};
+    double offset{0};
+    double minimum{0};
+    double maximum{0};
+    std::string unit;
+    std::vector<std::string> receivers;
+    Multiplexing multiplexing{Multiplexing::kNone};
+    uint32_t multiplexor_value{0};
+    std::vector<std::pair<int64_t, std::string>> value_descriptions;  // VAL_ entries, raw value to name
+    std::string comment;
+};
+
+/**
+ * @brief A message as described in a DBC file
+ */
+struct DBCMessage
+{
+    uint32_t id{0};  // without the extended ID flag DBC files store in bit 31
+    bool extended_id{false};
+    std::string name;
+    uint8_t length{0};
+    std::string sender;
+    uint32_t cycle_time_ms{0};  // GenMsgCycleTime, 0 if the message isn't periodic
+    std::vector<DBCSignal> signals;
+    std::string comment;
+
+    // Returns nullptr if the message has no signal with that name
+    DBCSignal *FindSignal(const std::string &signal_name)
+    {
+        for (DBCSignal &signal : signals)
+        {
+            if (signal.name == signal_name)
+            {
+                return &signal;
+            }
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * @brief The parts of a DBC file the library and tools use: nodes, messages, signals, value descriptions, comments and
+ * message cycle times. Other attributes are dropped, so Write() doesn't reproduce a file exactly.
+ */
+class DBCDatabase
+{
+public:
+    std::vector<std::string> nodes;
+    std::vector<DBCMessage> messages;
+
+    /**
+     * @brief Parses the text of a DBC file, replacing anything previously loaded
+     *
+     * @param text The contents of the DBC file
+     * @param error If not nullptr, set to a description of the problem when parsing fails
+     * @return true if the file was parsed
+     */
+    bool Parse(const std::string &text, std::string *error = nullptr)
+    {
+        nodes.clear();
+        messages.clear();
+        text_ = &text;
+        position_ = 0;
+        line_ = 1;
+        error_ = error;
+        uint32_t default_cycle_time_ms = 0;
+        std::vector<bool> has_cycle_time;
+
+        Token token;
+        while (Next(token))
+        {
+            if (token.type != TokenType::kIdentifier)
+            {
+                continue;
+            }
+            if (token.text == "NS_")
+            {
+                // the new symbols section lists keywords, skip it so they aren't parsed as statements
+                while (Next(token) && !(token.type == TokenType::kIdentifier && token.text == "BS_"))
+                {
+                }
+                SkipPast(":");
+            }
+            else if (token.text == "BU_")
+            {
+                if (!Expect(":"))
+                {
+                    return false;
+                }
+                while (PeekOnLine(token) && token.type == TokenType::kIdentifier)
+                {
+                    Next(token);
+                    nodes.push_back(token.text);
+                }
+            }
+            else if (token.text == "BO_")
+            {
+                if (!ParseMessage())
+                {
+                    return false;
+                }
+                has_cycle_time.push_back(false);
+            }
+            else if (token.text == "SG_")
+            {
+                if (messages.empty())
+                {
+                    return Fail("SG_ before any BO_");
+                }
+                if (!ParseSignal(messages.back()))
+                {
+                    return false;
+                }
+            }
+            else if (token.text == "BA_DEF_DEF_")
+            {
+                Token name;
+                Token value;
+                if (Next(name) && name.text == "GenMsgCycleTime" && Next(value) && value.type == TokenType::kNumber)
+                {
+                    default_cycle_time_ms = static_cast<uint32_t>(value.number);
+                }
+                SkipPast(";");
+            }
+            else if (token.text == "BA_")
+            {
+                Token name;
+                Token object;
+                Token id;
+                Token value;
+                if (Next(name) && name.text == "GenMsgCycleTime" && Next(object) && object.text == "BO_"
+                    && Next(id) && Next(value))
+                {
+                    for (size_t i = 0; i < messages.size(); i++)
+                    {
+                        if (RawID(messages[i]) == static_cast<uint32_t>(id.number))
+                        {
+                            messages[i].cycle_time_ms = static_cast<uint32_t>(value.number);
+                            has_cycle_time[i] = true;
+                        }
+                    }
+                }
+                SkipPast(";");
+            }
+            else if (token.text == "VAL_")
+            {
+                ParseValueDescriptions();
+            }
+            else if (token.text == "CM_")
+            {
+                ParseComment();
+            }
+            else if (token.text == "BA_DEF_"
+                     || token.text == "VAL_TABLE_" || token.text == "SIG_VALTYPE_" || token.text == "BO_TX_BU_"
+                     || token.text == "SIG_GROUP_" || token.text == "EV_" || token.text == "SG_MUL_VAL_")
+            {
+                SkipPast(";");
+            }
+        }
+
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            if (!has_cycle_time[i])
+            {
+                messages[i].cycle_time_ms = default_cycle_time_ms;
+            }
+        }
+        text_ = nullptr;
+        return true;
+    }
+
+#ifndef ARDUINO
+    bool LoadFile(const std::string &path, std::string *error = nullptr)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            if (error != nullptr)
+            {
+                *error = "could not open " + path;
+            }
+            return false;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return Parse(contents.str(), error);
+    }
+#endif
+
+    /**
+     * @brief Writes the database in DBC format, readable by cantools (and so by docs/dbc_to_h.py)
+     */
+    std::string Write() const
+    {
+        std::string out =
+            "VERSION \"\"\n\n\nNS_ :\n\tNS_DESC_\n\tCM_\n\tBA_DEF_\n\tBA_\n\tVAL_\n\tBA_DEF_DEF_\n\nBS_:\n\nBU_:";
+        for (const std::string &node : nodes)
+        {
+            out += " " + node;
+        }
+        out += "\n\n";
+        for (const DBCMessage &message : messages)
+        {
+            out += "\nBO_ " + std::to_string(RawID(message)) + " " + message.name + ": "
+                   + std::to_string(message.length) + " " + message.sender + "\n";
+            for (const DBCSignal &signal : message.signals)
+            {
+                out += " SG_ " + signal.name + " ";
+                if (signal.multiplexing == DBCSignal::Multiplexing::kMultiplexor)
+                {
+                    out += "M ";
+                }
+                else if (signal.multiplexing == DBCSignal::Multiplexing::kMultiplexed)
+                {
+                    out += "m" + std::to_string(signal.multiplexor_value) + " ";
+                }
+                out += ": " + std::to_string(signal.start_bit) + "|" + std::to_string(signal.length) + "@"
+                       + (signal.little_endian ? "1" : "0") + (signal.is_signed ? "-" : "+") + " ("
+                       + FormatNumber(signal.factor) + "," + FormatNumber(signal.offset) + ") ["
+                       + FormatNumber(signal.minimum) + "|" + FormatNumber(signal.maximum) + "] \""
+                       + Escape(signal.unit) + "\" ";
+                if (signal.receivers.empty())
+                {
+                    out += "Vector__XXX";
+                }
+                for (size_t i = 0; i < signal.receivers.size(); i++)
+                {
+                    out += (i == 0 ? "" : ",") + signal.receivers[i];
+                }
+                out += "\n";
+            }
+        }
+        out += "\n\n";
+
+        for (const DBCMessage &message : messages)
+        {
+            if (!message.comment.empty())
+            {
+                out += "CM_ BO_ " + std::to_string(RawID(message)) + " \"" + Escape(message.comment) + "\";\n";
+            }
+            for (const DBCSignal &signal : message.signals)
+            {
+                if (!signal.comment.empty())
+                {
+                    out += "CM_ SG_ " + std::to_string(RawID(message)) + " " + signal.name + " \""
+                           + Escape(signal.comment) + "\";\n";
+                }
+            }
+        }
+        out += "BA_DEF_ BO_  \"GenMsgCycleTime\" INT 0 10000;\n";
+        out += "BA_DEF_DEF_  \"GenMsgCycleTime\" 0;\n";
+        for (const DBCMessage &message : messages)
+        {
+            if (message.cycle_time_ms != 0)
+            {
+                out += "BA_ \"GenMsgCycleTime\" BO_ " + std::to_string(RawID(message)) + " "
+                       + std::to_string(message.cycle_time_ms) + ";\n";
+            }
+        }
+        for (const DBCMessage &message : messages)
+        {
+            for (const DBCSignal &signal : message.signals)
+            {
+                if (signal.value_descriptions.empty())
+                {
+                    continue;
+                }
+                out += "VAL_ " + std::to_string(RawID(message)) + " " + signal.name;
+                for (const std::pair<int64_t, std::string> &value : signal.value_descriptions)
+                {
+                    out += " " + std::to_string(value.first) + " \"" + Escape(value.second) + "\"";
+                }
+                out += " ;\n";
+            }
+        }
+        return out;
+    }
+
+#ifndef ARDUINO
+    bool SaveFile(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << Write();
+        return static_cast<bool>(file);
+    }
+#endif
+
+    // Returns nullptr if there is no message with that ID
+    const DBCMessage *FindMessage(uint32_t id, bool extended_id = false) const
+    {
+        return const_cast<DBCDatabase *>(this)->FindMessage(id, extended_id);
+    }
+
+    DBCMessage *FindMessage(uint32_t id, bool extended_id = false)
+    {
+        for (DBCMessage &message : messages)
+        {
+            if (message.id == id && message.extended_id == extended_id)
+            {
+                return &message;
+            }
+        }
+        return nullptr;
+    }
+
+    // The ID as written in the DBC, with bit 31 set for extended IDs
+    static uint32_t RawID(const DBCMessage &message)
+    {
+        return message.id | (message.extended_id ? 0x80000000u : 0);
+    }
+
+private:
+    enum class TokenType
+    {
+        kIdentifier,
+        kNumber,
+        kString,
+        kPunctuation
+    };
+
+    struct Token
+    {
+        TokenType type{TokenType::kPunctuation};
+        std::string text;
+        double number{0};
+        size_t line{0};
+    };
+
+    const std::string *text_{nullptr};
+    size_t position_{0};
+    size_t line_{1};
+    std::string *error_{nullptr};
+
+    bool Fail(const std::string &message)
+    {
+        if (error_ != nullptr)
+        {
+            *error_ = "line " + std::to_string(line_) + ": " + message;
+        }
+        text_ = nullptr;
+        return false;
+    }
+
+    // The shortest text that reads back as the same double, integers are written without a decimal point
+    static std::string FormatNumber(double value)
+    {
+        char buffer[32];
+        if (value == static_cast<double>(static_cast<int64_t>(value)))
+        {
+            snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value));
+            return buffer;
+        }
+        for (int precision = 1; precision <= 17; precision++)
+        {
+            snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+            if (strtod(buffer, nullptr) == value)
+            {
+                break;
+            }
+        }
+        return buffer;
+    }
+
+    static std::string Escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    DBCSignal *FindSignal(uint32_t raw_id, const std::string &signal_name)
+    {
+        DBCMessage *message = FindMessage(raw_id & 0x1FFFFFFFu, (raw_id & 0x80000000u) != 0);
+        return message == nullptr ? nullptr : message->FindSignal(signal_name);
+    }
+
+    // VAL_ <id> <signal> <value> "<name>" ... ;
+    void ParseValueDescriptions()
+    {
+        Token id;
+        Token name;
+        if (!Next(id) || id.type != TokenType::kNumber || !Next(name))
+        {
+            SkipPast(";");
+            return;
+        }
+        DBCSignal *signal = FindSignal(static_cast<uint32_t>(id.number), name.text);
+        Token value;
+        Token description;
+        while (Next(value) && value.type == TokenType::kNumber && Next(description))
+        {
+            if (signal != nullptr)
+            {
+                signal->value_descriptions.push_back(
+                    std::make_pair(static_cast<int64_t>(value.number), description.text));
+            }
+        }
+        // the loop stops on the ';'
+    }
+
+    // CM_ [BU_ <node> | BO_ <id> | SG_ <id> <signal>] "<comment>";
+    void ParseComment()
+    {
+        Token token;
+        if (Next(token) && token.type == TokenType::kIdentifier)
+        {
+            Token id;
+            if (token.text == "BO_" && Next(id) && Next(token) && token.type == TokenType::kString)
+            {
+                DBCMessage *message = FindMessage(static_cast<uint32_t>(id.number) & 0x1FFFFFFFu,
+                                                  (static_cast<uint32_t>(id.number) & 0x80000000u) != 0);
+                if (message != nullptr)
+                {
+                    message->comment = token.text;
+                }
+            }
+            else if (token.text == "SG_" && Next(id))
+            {
+                Token name;
+                if (Next(name) && Next(token) && token.type == TokenType::kString)
+                {
+                    DBCSignal *signal = FindSignal(static_cast<uint32_t>(id.number), name.text);
+                    if (signal != nullptr)
+                    {
+                        signal->comment = token.text;
+                    }
+                }
+            }
+        }
+        SkipPast(";");
+    }
+
+    static bool IsIdentifierChar(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    // Reads the next token, returns false at the end of the text
+    bool Next(Token &token)
+    {
+        const std::string &text = *text_;
+        while (position_ < text.size()
+               && (text[position_] == ' ' || text[position_] == '\t' || text[position_] == '\r'
+                   || text[position_] == '\n'))
+        {
+            if (text[position_] == '\n')
+            {
+                line_++;
+            }
+            position_++;
+        }
+        if (position_ >= text.size())
+        {
+            return false;
+        }
+        token.line = line_;
+        char c = text[position_];
+        size_t start = position_;
+        if (c == '"')
+        {
+            // the text without its escapes, which Write puts back
+            position_++;
+            token.text.clear();
+            while (position_ < text.size() && text[position_] != '"')
+            {
+                if (text[position_] == '\\' && position_ + 1 < text.size())
+                {
+                    position_++;
+                }
+                if (text[position_] == '\n')
+                {
+                    line_++;
+                }
+                token.text += text[position_++];
+            }
+            token.type = TokenType::kString;
+            position_++;
+            return true;
+        }
+        if (IsDigit(c)
+            || ((c == '-' || c == '+') && position_ + 1 < text.size() && IsDigit(text[position_ + 1])))
+        {
+            char *end = nullptr;
+            token.number = strtod(text.c_str() + position_, &end);
+            position_ = static_cast<size_t>(end - text.c_str());
+            token.type = TokenType::kNumber;
+            token.text = text.substr(start, position_ - start);
+            return true;
+        }
+        if (IsIdentifierChar(c))
+        {
+            while (position_ < text.size() && IsIdentifierChar(text[position_]))
+            {
+                position_++;
+            }
+            token.type = TokenType::kIdentifier;
+            token.text = text.substr(start, position_ - start);
+            return true;
+        }
+        token.type = TokenType::kPunctuation;
+        token.text = std::string(1, c);
+        position_++;
+        return true;
+    }
+
+    // Looks at the next token without consuming it, returns false if it is on a later line
+    bool PeekOnLine(Token &token)
+    {
+        size_t position = position_;
+        size_t line = line_;
+        bool found = Next(token) && token.line == line;
+        position_ = position;
+        line_ = line;
+        return found;
+    }
+
+    bool Expect(const char *punctuation)
+    {
+        Token token;
+        if (!Next(token) || token.text != punctuation)
+        {
+            return Fail(std::string("expected '") + punctuation + "'");
+        }
+        return true;
+    }
+
+    bool ExpectNumber(double &number)
+    {
+        Token token;
+        if (!Next(token) || token.type != TokenType::kNumber)
+        {
+            return Fail("expected a number");
+        }
+        number = token.number;
+        return true;
+    }
+
+    void SkipPast(const char *punctuation)
+    {
+        Token token;
+        while (Next(token) && !(token.type == TokenType::kPunctuation && token.text == punctuation))
+        {
+        }
+    }
+
+    // BO_ <id> <name>: <length> <sender>
+    bool ParseMessage()
+    {
+        DBCMessage message;
+        double id = 0;
+        Token name;
+        double length = 0;
+        Token sender;
+        if (!ExpectNumber(id) || !Next(name) || name.type != TokenType::kIdentifier || !Expect(":")
+            || !ExpectNumber(length) || !Next(sender))
+        {
+            return Fail("malformed BO_");
+        }
+        uint32_t raw_id = static_cast<uint32_t>(id);
+        message.extended_id = (raw_id & 0x80000000u) != 0;
+        message.id = raw_id & 0x1FFFFFFFu;
+        message.name = name.text;
+        message.length = static_cast<uint8_t>(length);
+        message.sender = sender.text;
+        messages.push_back(message);
+        return true;
+    }
+
+    // SG_ <name> [M|m<value>] : <start>|<length>@<order><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <receivers>
+    bool ParseSignal(DBCMessage &message)
+    {
+        DBCSignal signal;
+        Token token;
+        if (!Next(token) || token.type != TokenType::kIdentifier)
+        {
+            return Fail("malformed SG_");
+        }
+        signal.name = token.text;
+        if (!Next(token))
+        {
+            return Fail("malformed SG_");
+        }
+        if (token.type == TokenType::kIdentifier)
+        {
+            if (token.text == "M")
+            {
+                signal.multiplexing = DBCSignal::Multiplexing::kMultiplexor;
+            }
+            else if (token.text[0] == 'm')
+            {
+                signal.multiplexing = DBCSignal::Multiplexing::kMultiplexed;
+                signal.multiplexor_value = static_cast<uint32_t>(strtoul(token.text.c_str() + 1, nullptr, 10));
+            }
+            if (!Expect(":"))
+            {
+                return false;
+            }
+        }
+        else if (token.text != ":")
+        {
+            return Fail("malformed SG_");
+        }
+
+        double start_bit = 0;
+        double length = 0;
+        double order = 0;
+        Token sign;
+        if (!ExpectNumber(start_bit) || !Expect("|") || !ExpectNumber(length) || !Expect("@") || !ExpectNumber(order)
+            || !Next(sign) || (sign.text != "+" && sign.text != "-"))
+        {
+            return Fail("malformed SG_ " + signal.name);
+        }
+        signal.start_bit = static_cast<uint8_t>(start_bit);
+        signal.length = static_cast<uint8_t>(length);
+        signal.little_endian = order == 1;
+        signal.is_signed = sign.text == "-";
+
+        if (!Expect("(") || !ExpectNumber(signal.factor) || !Expect(",") || !ExpectNumber(signal.offset)
+            || !Expect(")") || !Expect("[") || !ExpectNumber(signal.minimum) || !Expect("|")
+            || !ExpectNumber(signal.maximum) || !Expect("]"))
+        {
+            return Fail("malformed SG_ " + signal.name);
+        }
+        if (!Next(token) || token.type != TokenType::kString)
+        {
+            return Fail("expected unit string in SG_ " + signal.name);
+        }
+        signal.unit = token.text;
+        while (PeekOnLine(token) && (token.type == TokenType::kIdentifier || token.text == ","))
+        {
+            Next(token);
+            if (token.type == TokenType::kIdentifier)
+            {
+                signal.receivers.push_back(token.text);
+            }
+        }
+        message.signals.push_back(signal);
+        return true;
+    }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "can_interface.h"
+#include "dbc_database.h"
+
+/**
+ * @brief One signal of a DBCDecodeTable, everything Decode needs precomputed
+ */
+struct DBCDecodeSignal
+{
+    enum Flags : uint8_t
+    {
+        kBigEndian = 1 << 0,
+        kSigned = 1 << 1,
+        kUnityFactor = 1 << 2,  // factor 1 and offset 0, decoded without the float scaling
+        kMultiplexed = 1 << 3,  // only present when the message's multiplexor equals multiplexor_value
+        kInvalid = 1 << 4,      // doesn't fit in 8 bytes or has a factor of 0, always decodes to NaN
+    };
+
+    uint64_t mask;          // the signal's bits in the payload
+    double factor;          // rounded to 32.32 fixed point like CANSignal's template parameters
+    double offset;          // likewise
+    uint32_t multiplexor_value;
+    uint32_t first_value_description;  // index into the table's value descriptions
+    uint16_t value_description_count;
+    uint8_t align_shift;   // left shift that moves the masked (and for big endian byte swapped) bits to the top
+    uint8_t extend_shift;  // right shift from the top back down, arithmetic for signed signals (64 - length)
+    uint8_t flags;
+};
+
+/**
+ * @brief One message of a DBCDecodeTable
+ */
+struct DBCDecodeMessage
+{
+    const DBCMessage *source;
+    uint32_t first_signal;  // index into the table's signals, signals are in the order of source->signals
+    uint16_t signal_count;
+    int16_t multiplexor;  // index of the multiplexor within the message's signals, -1 if not multiplexed
+};
+
+/**
+ * @brief A DBCDatabase compiled into flat decode tables, for decoding buses from a DBC loaded at runtime (instead of
+ * headers generated by docs/dbc_to_h.py) at close to the speed of the template CANSignal path. Messages and signals are
+ * contiguous arrays with the shift, mask and scale of each signal precomputed; standard IDs are found with one array
+ * lookup and extended IDs with a binary search. Values match CANSignal and DBCSignalCodec bit for bit.
+ *
+ * The table points into the database, which must outlive it.
+ */
+class DBCDecodeTable
+{
+public:
+    static constexpr uint16_t kNoMessage{0xFFFF};
+
+    DBCDecodeTable() = default;
+
+    explicit DBCDecodeTable(const DBCDatabase &database)
+    {
+        standard_index_.assign(2048, kNoMessage);
+        for (const DBCMessage &message : database.messages)
+        {
+            if (messages_.size() == kNoMessage)
+            {
+                break;
+            }
+            uint16_t index = static_cast<uint16_t>(messages_.size());
+            if (!message.extended_id && message.id < 2048)
+            {
+                standard_index_[message.id] = index;
+            }
+            else
+            {
+                extended_index_.push_back(std::make_pair(Key(message.id, message.extended_id), index));
+            }
+            DBCDecodeMessage compiled{&message, static_cast<uint32_t>(signals_.size()), 0, -1};
+            for (const DBCSignal &signal : message.signals)
+            {
+                if (signal.multiplexing == DBCSignal::Multiplexing::kMultiplexor)
+                {
+                    compiled.multiplexor = static_cast<int16_t>(compiled.signal_count);
+                }
+                signals_.push_back(Compile(signal));
+                compiled.signal_count++;
+            }
+            max_signal_count_ = std::max<size_t>(max_signal_count_, compiled.signal_count);
+            messages_.push_back(compiled);
+        }
+        std::sort(extended_index_.begin(), extended_index_.end());
+    }
+
+    /**
+     * @brief Finds a message by ID
+     *
+     * @return The message's index, or kNoMessage if it isn't in the DBC
+     */
+    uint16_t FindMessage(uint32_t id, bool extended_id) const
+    {
+        if (!extended_id && id < standard_index_.size())
+        {
+            return standard_index_[id];
+        }
+        uint32_t key = Key(id, extended_id);
+        auto found = std::lower_bound(extended_index_.begin(),
+                                      extended_index_.end(),
+                                      std::make_pair(key, static_cast<uint16_t>(0)));
+        return found != extended_index_.end() && found->first == key ? found->second : kNoMessage;
+    }
+
+    /**
+     * @brief Decodes every signal of a frame
+     *
+     * @param values Receives one value per signal of the message, in the order of its DBC signals; multiplexed signals
+     * the frame doesn't carry are NaN. Must have room for GetMaxSignalCount() values.
+     * @return The message's index, or kNoMessage (and nothing is written) if the frame's ID isn't in the DBC
+     */
+    uint16_t Decode(const CANMessage &frame, double *values) const
+    {
+        uint16_t index = FindMessage(frame.id_, frame.extended_id_);
+        if (index != kNoMessage)
+        {
+            uint64_t payload;
+            memcpy(&payload, frame.data_.data(), sizeof(payload));
+            DecodePayload(index, payload, values);
+        }
+        return index;
+    }
+
+    /**
+     * @brief Decodes every signal of message index from a payload (data bytes 0 to 7 in memory order), see Decode
+     */
+    void DecodePayload(uint16_t index, uint64_t payload, double *values) const
+    {
+        const DBCDecodeMessage &message = messages_[index];
+        const DBCDecodeSignal *signal = &signals_[message.first_signal];
+        int64_t multiplexor_value = message.multiplexor >= 0 ? DecodeRaw(signal[message.multiplexor], payload) : 0;
+        for (uint16_t i = 0; i < message.signal_count; i++, signal++)
+        {
+            if ((signal->flags & DBCDecodeSignal::kInvalid) != 0
+                || ((signal->flags & DBCDecodeSignal::kMultiplexed) != 0
+                    && static_cast<int64_t>(signal->multiplexor_value) != multiplexor_value))
+            {
+                values[i] = NAN;
+                continue;
+            }
+            values[i] = Scale(*signal, DecodeRaw(*signal, payload));
+        }
+    }
+
+    /**
+     * @brief The raw (unscaled) value of a signal in payload, sign extended if the signal is signed
+     */
+    static int64_t DecodeRaw(const DBCDecodeSignal &signal, uint64_t payload)
+    {
+        uint64_t masked = payload & signal.mask;
+        uint64_t aligned = ((signal.flags & DBCDecodeSignal::kBigEndian) != 0 ? bswap<uint64_t>(masked) : masked)
+                           << signal.align_shift;
+        return (signal.flags & DBCDecodeSignal::kSigned) != 0
+                   ? static_cast<int64_t>(aligned) >> signal.extend_shift
+                   : static_cast<int64_t>(aligned >> signal.extend_shift);
+    }
+
+    /**
+     * @brief The physical value of a raw value, with the same float precision as CANSignal
+     */
+    static double Scale(const DBCDecodeSignal &signal, int64_t raw)
+    {
+        bool is_signed = (signal.flags & DBCDecodeSignal::kSigned) != 0;
+        if ((signal.flags & DBCDecodeSignal::kUnityFactor) != 0)
+        {
+            return is_signed ? static_cast<double>(raw) : static_cast<double>(static_cast<uint64_t>(raw));
+        }
+        float raw_float = is_signed ? static_cast<float>(raw) : static_cast<float>(static_cast<uint64_t>(raw));
+        return static_cast<double>(raw_float * signal.factor + signal.offset);
+    }
+
+    /**
+     * @brief The VAL_ description of a raw value of a signal
+     *
+     * @param signal_index The signal's index in the table, GetMessage(message).first_signal + its index in the message
+     *
+     * @return nullptr if the signal has no description for that value
+     */
+    const std::string *GetValueDescription(size_t signal_index, int64_t raw) const
+    {
+        const DBCDecodeSignal &signal = signals_[signal_index];
+        auto begin = value_descriptions_.begin() + signal.first_value_description;
+        auto end = begin + signal.value_description_count;
+        auto found = std::lower_bound(begin,
+                                      end,
+                                      raw,
+                                      [](const std::pair<int64_t, const std::string *> &entry, int64_t value)
+                                      { return entry.first < value; });
+        return found != end && found->first == raw ? found->second : nullptr;
+    }
+
+    size_t GetMessageCount() const { return messages_.size(); }
+    const DBCDecodeMessage &GetMessage(uint16_t index) const { return messages_[index]; }
+    const DBCDecodeSignal &GetSignal(size_t index) const { return signals_[index]; }
+    size_t GetMaxSignalCount() const { return max_signal_count_; }
+
+private:
+    std::vector<DBCDecodeMessage> messages_;
+    std::vector<DBCDecodeSignal> signals_;
+    std::vector<std::pair<int64_t, const std::string *>> value_descriptions_;
+    std::vector<uint16_t> standard_index_;                       // by ID, kNoMessage if not in the DBC
+    std::vector<std::pair<uint32_t, uint16_t>> extended_index_;  // sorted by key
+    size_t max_signal_count_{0};
+
+    static uint32_t Key(uint32_t id, bool extended_id) { return id | (extended_id ? 0x80000000u : 0); }
+
+    DBCDecodeSignal Compile(const DBCSignal &signal)
+    {
+        DBCDecodeSignal compiled{};
+        // CANSignal takes the factor and offset as 32.32 fixed point template parameters, round them the same way
+        compiled.factor = CANTemplateGetFloat(CANTemplateConvertFloat(signal.factor));
+        compiled.offset = CANTemplateGetFloat(CANTemplateConvertFloat(signal.offset));
+        compiled.multiplexor_value = signal.multiplexor_value;
+        compiled.flags = static_cast<uint8_t>((signal.little_endian ? 0 : DBCDecodeSignal::kBigEndian)
+                                              | (signal.is_signed ? DBCDecodeSignal::kSigned : 0)
+                                              | (compiled.factor == 1 && compiled.offset == 0
+                                                     ? DBCDecodeSignal::kUnityFactor
+                                                     : 0)
+                                              | (signal.multiplexing == DBCSignal::Multiplexing::kMultiplexed
+                                                     ? DBCDecodeSignal::kMultiplexed
+                                                     : 0));
+
+        compiled.first_value_description = static_cast<uint32_t>(value_descriptions_.size());
+        for (const std::pair<int64_t, std::string> &description : signal.value_descriptions)
+        {
+            value_descriptions_.push_back(std::make_pair(description.first, &description.second));
+        }
+        std::sort(value_descriptions_.begin() + compiled.first_value_description, value_descriptions_.end());
+        compiled.value_description_count =
+            static_cast<uint16_t>(value_descriptions_.size() - compiled.first_value_description);
+
+        ICANSignal::ByteOrder byte_order =
+            signal.little_endian ? ICANSignal::ByteOrder::kLittleEndian : ICANSignal::ByteOrder::kBigEndian;
+        uint8_t length = signal.length;
+        uint8_t position = 0;
+        if (length != 0 && length <= 64 && signal.start_bit <= 63 && compiled.factor != 0)
+        {
+            position = CANSignal_generate_position(signal.start_bit, length, byte_order, BigEndianPositionType::kDbc);
+        }
+        if (length == 0 || length > 64 || signal.start_bit > 63 || compiled.factor == 0 || position + length > 64)
+        {
+            compiled.flags |= DBCDecodeSignal::kInvalid;
+            return compiled;
+        }
+        compiled.mask = CANSignal_generate_mask(position, length, byte_order);
+        // the same alignment as CANSignal: little endian bits are shifted up past the signal, big endian bits are
+        // byte swapped, which leaves them position bits below the top
+        compiled.align_shift = static_cast<uint8_t>(signal.little_endian ? 64 - (position + length) : position);
+        compiled.extend_shift = static_cast<uint8_t>(64 - length);
+        return compiled;
+    }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "can_interface.h"
+#include "dbc_database.h"
+
+/**
+ * @brief The bits a signal occupies in a frame, bit n of the mask is bit n % 8 of byte n / 8 (little endian bit
+ * numbering). Big endian signals start at their MSB and run down through each byte, then continue at bit 7 of the next.
+ *
+ * @return The mask, or 0 if the signal doesn't fit in 8 bytes
+ */
+inline uint64_t DBCSignalMask(uint8_t start_bit, uint8_t length, bool little_endian)
+{
+    if (length == 0 || length > 64 || start_bit > 63)
+    {
+        return 0;
+    }
+    if (little_endian)
+    {
+        if (start_bit + length > 64)
+        {
+            return 0;
+        }
+        return (length == 64 ? ~0ull : ((1ull << length) - 1)) << start_bit;
+    }
+    uint64_t mask = 0;
+    int bit = start_bit;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        if (bit > 63)
+        {
+            return 0;
+        }
+        mask |= 1ull << bit;
+        bit = bit % 8 == 0 ? bit + 15 : bit - 1;
+    }
+    return mask;
+}
+
+/**
+ * @brief Repacks the signals of a DBC into fewer frames. Periodic, non-multiplexed messages with the same sender and
+ * cycle time form a group, and the group's signals are placed first-fit (longest first, lowest free position, keeping
+ * each signal's byte order) into 8 byte frames. A group keeps its original messages if packing doesn't save a frame.
+ *
+ * All periodic messages then get IDs deadline-monotonically (shortest cycle time first) from the pool of IDs they used
+ * before, so the set of IDs on the bus doesn't grow and the priority of event driven messages relative to the pool is
+ * unchanged. Event driven and multiplexed messages are copied as they are.
+ *
+ * Merged frames are named <sender>_<cycle time>ms_<n>. Signals whose names collide in a merged frame are prefixed with
+ * their original message name.
+ *
+ * @param input The database to repack
+ * @return The repacked database
+ */
+inline DBCDatabase PackDBCSignals(const DBCDatabase &input)
+{
+    struct Frame
+    {
+        DBCMessage message;
+        std::vector<const DBCMessage *> origins;  // the original message of each signal
+        uint64_t used{0};
+        uint32_t first_key{0xFFFFFFFF};  // highest original priority of the signals in it, used to break ties
+    };
+
+    DBCDatabase output;
+    output.nodes = input.nodes;
+
+    // group by sender and cycle time, std::map keeps the output order deterministic
+    std::map<std::pair<std::string, uint32_t>, std::vector<const DBCMessage *>> groups;
+    std::vector<const DBCMessage *> unchanged;
+    for (const DBCMessage &message : input.messages)
+    {
+        bool multiplexed = false;
+        for (const DBCSignal &signal : message.signals)
+        {
+            multiplexed = multiplexed || signal.multiplexing != DBCSignal::Multiplexing::kNone;
+        }
+        if (message.cycle_time_ms == 0 || multiplexed || message.signals.empty())
+        {
+            unchanged.push_back(&message);
+        }
+        else
+        {
+            groups[std::make_pair(message.sender, message.cycle_time_ms)].push_back(&message);
+        }
+    }
+
+    std::vector<Frame> frames;
+    std::vector<std::pair<uint32_t, bool>> id_pool;
+    for (const auto &group : groups)
+    {
+        const std::vector<const DBCMessage *> &messages = group.second;
+        for (const DBCMessage *message : messages)
+        {
+            id_pool.push_back(std::make_pair(message->id, message->extended_id));
+        }
+
+        struct Item
+        {
+            const DBCMessage *message;
+            const DBCSignal *signal;
+        };
+        std::vector<Item> items;
+        for (const DBCMessage *message : messages)
+        {
+            for (const DBCSignal &signal : message->signals)
+            {
+                items.push_back(Item{message, &signal});
+            }
+        }
+        // longest first, ties in original order so related signals stay together
+        std::stable_sort(items.begin(),
+                         items.end(),
+                         [](const Item &a, const Item &b) { return a.signal->length > b.signal->length; });
+
+        std::vector<Frame> packed;
+        bool fits = true;
+        for (const Item &item : items)
+        {
+            const DBCSignal &signal = *item.signal;
+            bool placed = false;
+            for (size_t f = 0; f <= packed.size() && !placed; f++)
+            {
+                if (f == packed.size())
+                {
+                    packed.push_back(Frame{});
+                }
+                Frame &frame = packed[f];
+                // lowest position first: for big endian signals that is the MSB furthest toward byte 0 bit 7
+                for (uint8_t position = 0; position < 64 && !placed; position++)
+                {
+                    uint8_t start_bit =
+                        signal.little_endian ? position : static_cast<uint8_t>((position / 8) * 8 + 7 - position % 8);
+                    uint64_t mask = DBCSignalMask(start_bit, signal.length, signal.little_endian);
+                    if (mask == 0 || (mask & frame.used) != 0)
+                    {
+                        continue;
+                    }
+                    frame.used |= mask;
+                    DBCSignal moved = signal;
+                    moved.start_bit = start_bit;
+                    frame.message.signals.push_back(moved);
+                    frame.origins.push_back(item.message);
+                    frame.first_key =
+                        std::min(frame.first_key, CANArbitrationKey(item.message->id, item.message->extended_id));
+                    placed = true;
+                }
+                if (!placed && frame.message.signals.empty())
+                {
+                    // doesn't fit even in an empty frame
+                    packed.pop_back();
+                    fits = false;
+                    break;
+                }
+            }
+            if (!fits)
+            {
+                break;
+            }
+        }
+
+        if (!fits || packed.size() >= messages.size())
+        {
+            for (const DBCMessage *message : messages)
+            {
+                Frame frame;
+                frame.message = *message;
+                frame.first_key = CANArbitrationKey(message->id, message->extended_id);
+                frames.push_back(frame);
+            }
+            continue;
+        }
+
+        for (size_t f = 0; f < packed.size(); f++)
+        {
+            Frame &frame = packed[f];
+            std::vector<const DBCMessage *> sources;
+            for (const DBCMessage *origin : frame.origins)
+            {
+                if (std::find(sources.begin(), sources.end(), origin) == sources.end())
+                {
+                    sources.push_back(origin);
+                }
+            }
+            if (sources.size() == 1 && sources[0]->signals.size() == frame.message.signals.size())
+            {
+                // a whole message that only moved, keep its name
+                frame.message.name = sources[0]->name;
+                frame.message.comment = sources[0]->comment;
+            }
+            else
+            {
+                frame.message.name =
+                    group.first.first + "_" + std::to_string(group.first.second) + "ms_" + std::to_string(f);
+                frame.message.comment = "Packed from";
+                for (size_t i = 0; i < sources.size(); i++)
+                {
+                    frame.message.comment += (i == 0 ? " " : ", ") + sources[i]->name;
+                }
+            }
+            frame.message.sender = group.first.first;
+            frame.message.cycle_time_ms = group.first.second;
+            uint8_t length = 0;
+            for (uint8_t byte = 0; byte < 8; byte++)
+            {
+                if ((frame.used >> (byte * 8)) & 0xFF)
+                {
+                    length = byte + 1;
+                }
+            }
+            frame.message.length = length;
+
+            // signal names only have to be unique within a message
+            for (size_t i = 0; i < frame.message.signals.size(); i++)
+            {
+                for (size_t j = 0; j < frame.message.signals.size(); j++)
+                {
+                    if (i != j && frame.message.signals[i].name == frame.message.signals[j].name
+                        && frame.origins[i] != frame.origins[j])
+                    {
+                        frame.message.signals[i].name = frame.origins[i]->name + "_" + frame.message.signals[i].name;
+                        break;
+                    }
+                }
+            }
+            frames.push_back(frame);
+        }
+    }
+
+    // deadline monotonic: shortest cycle time gets the highest priority ID from the pool
+    std::stable_sort(frames.begin(),
+                     frames.end(),
+                     [](const Frame &a, const Frame &b)
+                     {
+                         return a.message.cycle_time_ms != b.message.cycle_time_ms
+                                    ? a.message.cycle_time_ms < b.message.cycle_time_ms
+                                    : a.first_key < b.first_key;
+                     });
+    std::sort(id_pool.begin(),
+              id_pool.end(),
+              [](const std::pair<uint32_t, bool> &a, const std::pair<uint32_t, bool> &b)
+              { return CANArbitrationKey(a.first, a.second) < CANArbitrationKey(b.first, b.second); });
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        frames[i].message.id = id_pool[i].first;
+        frames[i].message.extended_id = id_pool[i].second;
+        output.messages.push_back(frames[i].message);
+    }
+    for (const DBCMessage *message : unchanged)
+    {
+        output.messages.push_back(*message);
+    }
+    return output;
+}
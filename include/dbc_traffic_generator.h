@@ -0,0 +1,404 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "can_interface.h"
+#include "dbc_codec.h"
+#include "dbc_database.h"
+
+/**
+ * @brief Generates synthetic traffic for the messages of a DBC, for load and soak testing decoding and logging.
+ *
+ * Every message is produced at its GenMsgCycleTime (event driven ones at sporadic_period_ms), scaled by rate_scale, in
+ * time order. Signals follow deterministic, plausible waveforms within their DBC range: value-described and 1 bit
+ * signals step between their states, others are sines, triangles or random walks (picked per signal from the seed).
+ * Multiplexors cycle through the multiplexed groups of their message. Payloads are encoded with DBCSignalCodec, so
+ * they are bit-identical to what CANSignal produces for the same values.
+ *
+ * Optionally, frames get uniform queuing jitter, a burst of back-to-back frames of one random message is inserted
+ * every burst_period_ms, and a fraction of frames get an error: a flipped payload bit, a wrong length, or an ID that
+ * isn't in the DBC.
+ *
+ * Time is simulated and starts at 0, so the generator runs as fast as the consumer takes frames.
+ */
+class DBCTrafficGenerator
+{
+public:
+    struct Options
+    {
+        double rate_scale{1};              // 2 sends every message twice as often
+        uint32_t sporadic_period_ms{100};  // period of messages without a cycle time, 0 to leave them out
+        uint32_t jitter_us{0};             // each frame is delayed by up to this much
+        uint32_t burst_period_ms{0};       // 0 for no bursts
+        uint32_t burst_frames{0};          // extra frames per burst
+        double error_rate{0};              // fraction of frames with an injected error
+        uint32_t seed{1};
+    };
+
+    enum class Error : uint8_t
+    {
+        kNone,
+        kBitFlip,
+        kWrongLength,
+        kUnknownID
+    };
+
+    explicit DBCTrafficGenerator(const DBCDatabase &database) : DBCTrafficGenerator(database, Options{}) {}
+
+    DBCTrafficGenerator(const DBCDatabase &database, const Options &options) : options_(options), random_{options.seed}
+    {
+        std::vector<uint32_t> used_ids;
+        for (const DBCMessage &message : database.messages)
+        {
+            if (!message.extended_id)
+            {
+                used_ids.push_back(message.id);
+            }
+            uint32_t period_ms = message.cycle_time_ms != 0 ? message.cycle_time_ms : options.sporadic_period_ms;
+            if (message.name == "VECTOR__INDEPENDENT_SIG_MSG" || period_ms == 0 || options.rate_scale <= 0)
+            {
+                continue;
+            }
+            Stream stream;
+            stream.id = message.id;
+            stream.extended_id = message.extended_id;
+            stream.length = std::min<uint8_t>(message.length, 8);
+            stream.period_ns = std::max<uint64_t>(1, static_cast<uint64_t>(period_ms * 1000000.0 / options.rate_scale));
+            for (const DBCSignal &signal : message.signals)
+            {
+                AddSignal(stream, signal);
+            }
+            for (const GeneratedSignal &signal : stream.signals)
+            {
+                if (signal.multiplexed
+                    && std::find(stream.multiplexor_values.begin(),
+                                 stream.multiplexor_values.end(),
+                                 signal.multiplexor_value)
+                           == stream.multiplexor_values.end())
+                {
+                    stream.multiplexor_values.push_back(signal.multiplexor_value);
+                }
+            }
+            if (stream.multiplexor >= 0 && stream.multiplexor_values.empty())
+            {
+                stream.multiplexor_values.push_back(0);
+            }
+            streams_.push_back(stream);
+        }
+        for (size_t i = 0; i < streams_.size(); i++)
+        {
+            // spread the first instances over one period so they don't all collide at time 0
+            streams_[i].nominal_ns = random_() % streams_[i].period_ns;
+            Schedule(i, streams_[i].nominal_ns);
+        }
+        next_burst_ns_ = options.burst_period_ms * 1000000ull;
+
+        unknown_id_ = 0x7FF;
+        while (unknown_id_ > 0 && std::find(used_ids.begin(), used_ids.end(), unknown_id_) != used_ids.end())
+        {
+            unknown_id_--;
+        }
+    }
+
+    /**
+     * @brief Produces the next frame in time order
+     *
+     * @param frame Set to the frame
+     * @param error If not nullptr, set to the error injected into the frame
+     * @return The frame's time in nanoseconds, or UINT64_MAX if the DBC has no messages to generate
+     */
+    uint64_t Next(CANMessage &frame, Error *error = nullptr)
+    {
+        if (streams_.empty())
+        {
+            return UINT64_MAX;
+        }
+        size_t index;
+        if (burst_remaining_ > 0)
+        {
+            burst_remaining_--;
+            index = burst_stream_;
+        }
+        else if (options_.burst_frames > 0 && next_burst_ns_ > 0 && next_burst_ns_ <= queue_.top().first)
+        {
+            time_ns_ = next_burst_ns_;
+            next_burst_ns_ += options_.burst_period_ms * 1000000ull;
+            burst_stream_ = random_() % streams_.size();
+            burst_remaining_ = options_.burst_frames - 1;
+            index = burst_stream_;
+        }
+        else
+        {
+            std::pair<uint64_t, size_t> next = queue_.top();
+            queue_.pop();
+            index = next.second;
+            time_ns_ = next.first;
+            Stream &stream = streams_[index];
+            stream.nominal_ns += stream.period_ns;
+            Schedule(index, stream.nominal_ns);
+        }
+
+        Encode(streams_[index], frame);
+        Error injected = Error::kNone;
+        if (options_.error_rate > 0 && Uniform() < options_.error_rate)
+        {
+            injected = InjectError(frame);
+            errors_injected_++;
+        }
+        if (error != nullptr)
+        {
+            *error = injected;
+        }
+        frames_generated_++;
+        return time_ns_;
+    }
+
+    /**
+     * @brief Sends every frame due before until_ns to can, in time order
+     *
+     * @return The number of frames the endpoint accepted
+     */
+    size_t SendUntil(ICAN &can, uint64_t until_ns)
+    {
+        size_t sent = 0;
+        while (PeekTimeNs() < until_ns)
+        {
+            CANMessage frame;
+            Next(frame);
+            sent += can.SendMessage(frame) ? 1 : 0;
+        }
+        return sent;
+    }
+
+    // The time of the next frame, UINT64_MAX if there is none
+    uint64_t PeekTimeNs() const
+    {
+        if (streams_.empty())
+        {
+            return UINT64_MAX;
+        }
+        if (burst_remaining_ > 0)
+        {
+            return time_ns_;
+        }
+        uint64_t next = queue_.top().first;
+        return options_.burst_frames > 0 && next_burst_ns_ > 0 ? std::min(next, next_burst_ns_) : next;
+    }
+
+    // The time of the last frame
+    uint64_t GetTimeNs() const { return time_ns_; }
+
+    uint64_t GetFramesGenerated() const { return frames_generated_; }
+
+    uint64_t GetErrorsInjected() const { return errors_injected_; }
+
+    size_t GetStreamCount() const { return streams_.size(); }
+
+    // The nominal frame rate without bursts
+    double GetFramesPerSecond() const
+    {
+        double rate = 0;
+        for (const Stream &stream : streams_)
+        {
+            rate += 1e9 / stream.period_ns;
+        }
+        return rate;
+    }
+
+private:
+    enum class Waveform : uint8_t
+    {
+        kStates,  // steps through a list of values
+        kSine,
+        kTriangle,
+        kRandomWalk
+    };
+
+    struct GeneratedSignal
+    {
+        DBCSignalCodec codec;
+        Waveform waveform{Waveform::kSine};
+        bool multiplexed{false};
+        uint32_t multiplexor_value{0};
+        double minimum{0};
+        double maximum{0};
+        double period_s{1};
+        double phase{0};
+        double value{0};  // current value of random walks
+        std::vector<double> states;
+        uint32_t frames_per_state{1};
+    };
+
+    struct Stream
+    {
+        uint32_t id{0};
+        bool extended_id{false};
+        uint8_t length{0};
+        uint64_t period_ns{0};
+        uint64_t nominal_ns{0};
+        uint64_t count{0};
+        int multiplexor{-1};  // index into signals
+        std::vector<uint32_t> multiplexor_values;  // cycled through, one per frame
+        std::vector<GeneratedSignal> signals;
+    };
+
+    using QueueEntry = std::pair<uint64_t, size_t>;
+
+    static constexpr double kTwoPi{6.283185307179586};
+
+    Options options_;
+    std::mt19937 random_;
+    std::vector<Stream> streams_;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> queue_;
+    uint64_t time_ns_{0};
+    uint64_t next_burst_ns_{0};
+    size_t burst_stream_{0};
+    uint32_t burst_remaining_{0};
+    uint32_t unknown_id_{0};
+    uint64_t frames_generated_{0};
+    uint64_t errors_injected_{0};
+
+    double Uniform() { return random_() / 4294967296.0; }
+
+    void Schedule(size_t index, uint64_t nominal_ns)
+    {
+        uint64_t jitter = options_.jitter_us > 0 ? random_() % (options_.jitter_us * 1000ull + 1) : 0;
+        queue_.push(std::make_pair(nominal_ns + jitter, index));
+    }
+
+    void AddSignal(Stream &stream, const DBCSignal &signal)
+    {
+        GeneratedSignal generated;
+        generated.codec = DBCSignalCodec{signal};
+        if (!generated.codec.IsValid())
+        {
+            return;
+        }
+        generated.multiplexed = signal.multiplexing == DBCSignal::Multiplexing::kMultiplexed;
+        generated.multiplexor_value = signal.multiplexor_value;
+
+        // the DBC range if it has one, otherwise the whole raw range
+        double raw_min = signal.is_signed ? -std::ldexp(1.0, signal.length - 1) : 0;
+        double raw_max = signal.is_signed ? std::ldexp(1.0, signal.length - 1) - 1 : std::ldexp(1.0, signal.length) - 1;
+        double low = raw_min * signal.factor + signal.offset;
+        double high = raw_max * signal.factor + signal.offset;
+        generated.minimum = signal.maximum > signal.minimum ? signal.minimum : std::min(low, high);
+        generated.maximum = signal.maximum > signal.minimum ? signal.maximum : std::max(low, high);
+
+        if (signal.multiplexing == DBCSignal::Multiplexing::kMultiplexor)
+        {
+            stream.multiplexor = static_cast<int>(stream.signals.size());
+            generated.waveform = Waveform::kStates;
+        }
+        else if (!signal.value_descriptions.empty() || signal.length == 1)
+        {
+            generated.waveform = Waveform::kStates;
+            for (const std::pair<int64_t, std::string> &description : signal.value_descriptions)
+            {
+                generated.states.push_back(description.first * signal.factor + signal.offset);
+            }
+            if (generated.states.empty())
+            {
+                generated.states = {generated.minimum, generated.maximum};
+            }
+            generated.frames_per_state = 10 + random_() % 90;
+        }
+        else
+        {
+            generated.waveform = static_cast<Waveform>(1 + random_() % 3);
+            generated.period_s = 1 + Uniform() * 9;
+            generated.phase = Uniform();
+            generated.value = (generated.minimum + generated.maximum) / 2;
+        }
+        stream.signals.push_back(generated);
+    }
+
+    double Evaluate(GeneratedSignal &signal, uint64_t count)
+    {
+        double span = signal.maximum - signal.minimum;
+        double cycle = static_cast<double>(time_ns_) * 1e-9 / signal.period_s + signal.phase;
+        switch (signal.waveform)
+        {
+            case Waveform::kStates:
+                return signal.states[(count / signal.frames_per_state) % signal.states.size()];
+            case Waveform::kSine:
+                return signal.minimum + span * (0.5 + 0.5 * std::sin(kTwoPi * cycle));
+            case Waveform::kTriangle:
+            {
+                double fraction = cycle - std::floor(cycle);
+                return signal.minimum + span * (fraction < 0.5 ? 2 * fraction : 2 - 2 * fraction);
+            }
+            case Waveform::kRandomWalk:
+                signal.value += span * 0.01 * (Uniform() - 0.5);
+                signal.value = std::min(signal.maximum, std::max(signal.minimum, signal.value));
+                return signal.value;
+        }
+        return signal.minimum;
+    }
+
+    void Encode(Stream &stream, CANMessage &frame)
+    {
+        frame.id_ = stream.id;
+        frame.extended_id_ = stream.extended_id;
+        frame.len_ = stream.length;
+        uint64_t buffer = 0;
+
+        bool has_multiplexor = stream.multiplexor >= 0;
+        uint32_t multiplexor_value =
+            has_multiplexor ? stream.multiplexor_values[stream.count % stream.multiplexor_values.size()] : 0;
+
+        for (size_t i = 0; i < stream.signals.size(); i++)
+        {
+            GeneratedSignal &signal = stream.signals[i];
+            if (has_multiplexor && static_cast<int>(i) == stream.multiplexor)
+            {
+                signal.codec.Encode(multiplexor_value, &buffer);
+            }
+            else if (!signal.multiplexed || (has_multiplexor && signal.multiplexor_value == multiplexor_value))
+            {
+                signal.codec.Encode(Evaluate(signal, stream.count), &buffer);
+            }
+        }
+        stream.count++;
+        void *data = frame.data_.data();
+        *reinterpret_cast<uint64_t *>(data) = buffer;
+    }
+
+    Error InjectError(CANMessage &frame)
+    {
+        Error error = static_cast<Error>(1 + random_() % 3);
+        if (error == Error::kBitFlip && frame.len_ == 0)
+        {
+            error = Error::kWrongLength;
+        }
+        switch (error)
+        {
+            case Error::kBitFlip:
+            {
+                uint32_t bit = random_() % (frame.len_ * 8u);
+                frame.data_[bit / 8] ^= static_cast<uint8_t>(1u << (bit % 8));
+                break;
+            }
+            case Error::kWrongLength:
+                frame.len_ = static_cast<uint8_t>((frame.len_ + 1 + random_() % 8) % 9);
+                break;
+            case Error::kUnknownID:
+                frame.id_ = unknown_id_;
+                frame.extended_id_ = false;
+                break;
+            case Error::kNone:
+                break;
+        }
+        return error;
+    }
+};
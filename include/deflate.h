@@ -0,0 +1,811 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief Decompresses raw deflate streams (RFC 1951, what zlib writes with negative window bits) held whole in memory.
+ * Back references can only reach into the output buffer, which is the only window (it may start with a preset
+ * dictionary), and the tables live in the object (about 2 KB), so it does no allocation and needs little stack;
+ * CANUpdateDevice uses one to decompress update pages. Decoding is bit by bit, after Mark Adler's puff.
+ */
+class Inflater
+{
+public:
+    /**
+     * @param capacity The output buffer's size, including the dictionary
+     * @param output_size Receives the decompressed size, not including the dictionary
+     * @param dictionary_size The output buffer starts with a preset dictionary of this many bytes (at most 32 KiB, as
+     * the stream was compressed with), which the decompressed data follows
+     * @return false if the stream is corrupt, truncated or doesn't fit in the output
+     */
+    bool Inflate(const uint8_t *input,
+                 size_t input_size,
+                 uint8_t *output,
+                 size_t capacity,
+                 size_t &output_size,
+                 size_t dictionary_size = 0)
+    {
+        if (dictionary_size > capacity)
+        {
+            return false;
+        }
+        in_ = input;
+        in_size_ = input_size;
+        in_pos_ = 0;
+        bit_buffer_ = 0;
+        bit_count_ = 0;
+        error_ = false;
+        out_ = output;
+        out_capacity_ = capacity;
+        out_pos_ = dictionary_size;
+        uint32_t last = 0;
+        do
+        {
+            last = Bits(1);
+            uint32_t type = Bits(2);
+            bool ok = false;
+            if (type == 0)
+            {
+                ok = Stored();
+            }
+            else if (type == 1)
+            {
+                BuildFixed();
+                ok = Codes(fixed_length_code_, fixed_distance_code_);
+            }
+            else if (type == 2)
+            {
+                ok = Dynamic();
+            }
+            if (!ok || error_)
+            {
+                return false;
+            }
+        } while (last == 0);
+        output_size = out_pos_ - dictionary_size;
+        return true;
+    }
+
+private:
+    static constexpr int kMaxBits{15};
+    static constexpr int kMaxLengthCodes{286};
+    static constexpr int kMaxDistanceCodes{30};
+    static constexpr int kFixedLengthCodes{288};
+
+    // a canonical Huffman code: the number of codes of each length and the symbols ordered by code
+    template <size_t symbols>
+    struct Huffman
+    {
+        uint16_t count[kMaxBits + 1];
+        uint16_t symbol[symbols];
+    };
+
+    const uint8_t *in_{nullptr};
+    size_t in_size_{0};
+    size_t in_pos_{0};
+    uint32_t bit_buffer_{0};
+    int bit_count_{0};
+    bool error_{false};
+    uint8_t *out_{nullptr};
+    size_t out_capacity_{0};
+    size_t out_pos_{0};
+
+    uint16_t lengths_[kMaxLengthCodes + kMaxDistanceCodes]{};
+    Huffman<kFixedLengthCodes> length_code_{};
+    Huffman<kMaxDistanceCodes> distance_code_{};
+    Huffman<kFixedLengthCodes> fixed_length_code_{};
+    Huffman<kMaxDistanceCodes> fixed_distance_code_{};
+    bool fixed_built_{false};
+
+    uint32_t Bits(int count)
+    {
+        while (bit_count_ < count)
+        {
+            if (in_pos_ == in_size_)
+            {
+                error_ = true;
+                return 0;
+            }
+            bit_buffer_ |= static_cast<uint32_t>(in_[in_pos_++]) << bit_count_;
+            bit_count_ += 8;
+        }
+        uint32_t value = bit_buffer_ & ((1u << count) - 1);
+        bit_buffer_ >>= count;
+        bit_count_ -= count;
+        return value;
+    }
+
+    bool Stored()
+    {
+        // the rest of the current byte is padding
+        bit_buffer_ = 0;
+        bit_count_ = 0;
+        if (in_size_ - in_pos_ < 4)
+        {
+            return false;
+        }
+        size_t length = in_[in_pos_] | (in_[in_pos_ + 1] << 8);
+        size_t complement = in_[in_pos_ + 2] | (in_[in_pos_ + 3] << 8);
+        in_pos_ += 4;
+        if (length != (~complement & 0xFFFF) || in_size_ - in_pos_ < length || out_capacity_ - out_pos_ < length)
+        {
+            return false;
+        }
+        memcpy(out_ + out_pos_, in_ + in_pos_, length);
+        in_pos_ += length;
+        out_pos_ += length;
+        return true;
+    }
+
+    template <size_t symbols>
+    int Decode(const Huffman<symbols> &code)
+    {
+        int value = 0;  // the bits read so far
+        int first = 0;  // the first code of the current length
+        int index = 0;  // the index of that code's symbol
+        for (int length = 1; length <= kMaxBits; length++)
+        {
+            value |= static_cast<int>(Bits(1));
+            int count = code.count[length];
+            if (value - count < first)
+            {
+                return code.symbol[index + (value - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            value <<= 1;
+            if (error_)
+            {
+                return -1;
+            }
+        }
+        return -1;
+    }
+
+    // Returns 0 for a complete code, more for an incomplete one and less for an over-subscribed one
+    template <size_t symbols>
+    static int Construct(Huffman<symbols> &code, const uint16_t *lengths, int count)
+    {
+        memset(code.count, 0, sizeof(code.count));
+        for (int symbol = 0; symbol < count; symbol++)
+        {
+            code.count[lengths[symbol]]++;
+        }
+        if (code.count[0] == count)
+        {
+            return 0;
+        }
+        int left = 1;
+        for (int length = 1; length <= kMaxBits; length++)
+        {
+            left <<= 1;
+            left -= code.count[length];
+            if (left < 0)
+            {
+                return left;
+            }
+        }
+        uint16_t offsets[kMaxBits + 1];
+        offsets[1] = 0;
+        for (int length = 1; length < kMaxBits; length++)
+        {
+            offsets[length + 1] = offsets[length] + code.count[length];
+        }
+        for (int symbol = 0; symbol < count; symbol++)
+        {
+            if (lengths[symbol] != 0)
+            {
+                code.symbol[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+            }
+        }
+        return left;
+    }
+
+    template <size_t length_symbols, size_t distance_symbols>
+    bool Codes(const Huffman<length_symbols> &length_code, const Huffman<distance_symbols> &distance_code)
+    {
+        static const uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t kDistanceBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,    25,
+                                                   33,   49,   65,   97,   129,  193,   257,   385,   513,   769,
+                                                   1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+        static const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        while (true)
+        {
+            int symbol = Decode(length_code);
+            if (symbol < 0)
+            {
+                return false;
+            }
+            if (symbol < 256)
+            {
+                if (out_pos_ == out_capacity_)
+                {
+                    return false;
+                }
+                out_[out_pos_++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            if (symbol == 256)
+            {
+                return true;
+            }
+            symbol -= 257;
+            if (symbol >= 29)
+            {
+                return false;
+            }
+            size_t length = kLengthBase[symbol] + Bits(kLengthExtra[symbol]);
+            symbol = Decode(distance_code);
+            if (symbol < 0 || symbol >= 30)
+            {
+                return false;
+            }
+            size_t distance = kDistanceBase[symbol] + Bits(kDistanceExtra[symbol]);
+            if (error_ || distance > out_pos_ || length > out_capacity_ - out_pos_)
+            {
+                return false;
+            }
+            // byte by byte, the copy may overlap what it writes
+            for (size_t i = 0; i < length; i++, out_pos_++)
+            {
+                out_[out_pos_] = out_[out_pos_ - distance];
+            }
+        }
+    }
+
+    void BuildFixed()
+    {
+        if (fixed_built_)
+        {
+            return;
+        }
+        for (int symbol = 0; symbol < kFixedLengthCodes; symbol++)
+        {
+            lengths_[symbol] = symbol < 144 ? 8 : (symbol < 256 ? 9 : (symbol < 280 ? 7 : 8));
+        }
+        Construct(fixed_length_code_, lengths_, kFixedLengthCodes);
+        for (int symbol = 0; symbol < kMaxDistanceCodes; symbol++)
+        {
+            lengths_[symbol] = 5;
+        }
+        Construct(fixed_distance_code_, lengths_, kMaxDistanceCodes);
+        fixed_built_ = true;
+    }
+
+    bool Dynamic()
+    {
+        static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        int length_count = static_cast<int>(Bits(5)) + 257;
+        int distance_count = static_cast<int>(Bits(5)) + 1;
+        int code_count = static_cast<int>(Bits(4)) + 4;
+        if (length_count > kMaxLengthCodes || distance_count > kMaxDistanceCodes)
+        {
+            return false;
+        }
+        memset(lengths_, 0, sizeof(lengths_));
+        for (int i = 0; i < code_count; i++)
+        {
+            lengths_[kOrder[i]] = static_cast<uint16_t>(Bits(3));
+        }
+        // the code lengths are themselves Huffman coded, with a code that must be complete
+        if (Construct(length_code_, lengths_, 19) != 0)
+        {
+            return false;
+        }
+        int index = 0;
+        while (index < length_count + distance_count)
+        {
+            int symbol = Decode(length_code_);
+            if (symbol < 0)
+            {
+                return false;
+            }
+            if (symbol < 16)
+            {
+                lengths_[index++] = static_cast<uint16_t>(symbol);
+                continue;
+            }
+            uint16_t length = 0;
+            int repeat = 0;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                {
+                    return false;
+                }
+                length = lengths_[index - 1];
+                repeat = 3 + static_cast<int>(Bits(2));
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + static_cast<int>(Bits(3));
+            }
+            else
+            {
+                repeat = 11 + static_cast<int>(Bits(7));
+            }
+            if (index + repeat > length_count + distance_count)
+            {
+                return false;
+            }
+            while (repeat-- > 0)
+            {
+                lengths_[index++] = length;
+            }
+        }
+        if (error_ || lengths_[256] == 0)
+        {
+            return false;
+        }
+        // incomplete codes are only allowed with a single code
+        int left = Construct(length_code_, lengths_, length_count);
+        if (left < 0 || (left > 0 && length_count - length_code_.count[0] != 1))
+        {
+            return false;
+        }
+        left = Construct(distance_code_, lengths_ + length_count, distance_count);
+        if (left < 0 || (left > 0 && distance_count - distance_code_.count[0] != 1))
+        {
+            return false;
+        }
+        return Codes(length_code_, distance_code_);
+    }
+};
+
+/**
+ * @brief Compresses data into a raw deflate stream, for hosts sending compressed updates (see can_update.h): hash chain
+ * matching with one step of lazy evaluation over a 32 KiB window, and each block of up to 64 KiB of input coded with
+ * its own Huffman codes, the fixed codes or stored, whichever is smallest
+ *
+ * @param output The stream is appended to this
+ * @param dictionary_size The first this many bytes of data are a preset dictionary (at most 32 KiB) that the rest can
+ * refer back to, and aren't themselves compressed; the stream inflates with the same dictionary, e.g. zlib's zdict
+ */
+inline void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &output, size_t dictionary_size = 0)
+{
+    struct Token
+    {
+        uint16_t length;  // 0 for a literal
+        uint16_t value;   // the literal or the distance
+    };
+
+    struct BitWriter
+    {
+        std::vector<uint8_t> &out;
+        uint64_t buffer;
+        int count;
+
+        void Put(uint32_t value, int bits)
+        {
+            buffer |= static_cast<uint64_t>(value) << count;
+            count += bits;
+            while (count >= 8)
+            {
+                out.push_back(static_cast<uint8_t>(buffer));
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        void Align()
+        {
+            if (count > 0)
+            {
+                Put(0, 8 - count);
+            }
+        }
+    };
+
+    static const uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                             31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t kDistanceBase[30] = {1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+                                               33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+                                               1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                               6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    const size_t kWindow = 32768;
+    const size_t kBlockBytes = 65535;
+    const int kMaxChain = 256;
+    const size_t kHashSize = 1 << 15;
+
+    auto length_symbol = [](size_t length)
+    {
+        int symbol = 0;
+        while (symbol < 28 && kLengthBase[symbol + 1] <= length)
+        {
+            symbol++;
+        }
+        return symbol;
+    };
+    // the extra bits of a code length code
+    auto repeat_bits = [](uint8_t symbol) { return symbol == 16 ? 2 : (symbol == 17 ? 3 : (symbol == 18 ? 7 : 0)); };
+    auto distance_symbol = [](size_t distance)
+    {
+        int symbol = 0;
+        while (symbol < 29 && kDistanceBase[symbol + 1] <= distance)
+        {
+            symbol++;
+        }
+        return symbol;
+    };
+
+    // Huffman code lengths of at most max_bits for the symbols' frequencies, halving the frequencies until they fit
+    auto build_lengths = [](const std::vector<uint32_t> &frequencies, int max_bits, std::vector<uint8_t> &lengths)
+    {
+        std::vector<uint32_t> weights = frequencies;
+        lengths.assign(frequencies.size(), 0);
+        while (true)
+        {
+            std::vector<std::pair<uint64_t, int>> nodes;  // (weight, node), leaves first
+            std::vector<int> parent;
+            for (size_t i = 0; i < weights.size(); i++)
+            {
+                if (weights[i] > 0)
+                {
+                    nodes.push_back(std::make_pair(static_cast<uint64_t>(weights[i]), static_cast<int>(i)));
+                }
+            }
+            if (nodes.empty())
+            {
+                return;
+            }
+            if (nodes.size() == 1)
+            {
+                lengths[nodes[0].second] = 1;
+                return;
+            }
+            size_t leaves = nodes.size();
+            std::vector<int> leaf_symbol(leaves);
+            std::vector<std::pair<uint64_t, int>> heap;
+            for (size_t i = 0; i < leaves; i++)
+            {
+                leaf_symbol[i] = nodes[i].second;
+                heap.push_back(std::make_pair(nodes[i].first, static_cast<int>(i)));
+            }
+            parent.assign(2 * leaves - 1, -1);
+            auto greater = [](const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b) { return a > b; };
+            std::make_heap(heap.begin(), heap.end(), greater);
+            int next = static_cast<int>(leaves);
+            while (heap.size() > 1)
+            {
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                std::pair<uint64_t, int> a = heap.back();
+                heap.pop_back();
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                std::pair<uint64_t, int> b = heap.back();
+                heap.pop_back();
+                parent[a.second] = next;
+                parent[b.second] = next;
+                heap.push_back(std::make_pair(a.first + b.first, next++));
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+            bool fits = true;
+            for (size_t i = 0; i < leaves; i++)
+            {
+                int depth = 0;
+                for (int node = static_cast<int>(i); parent[node] >= 0; node = parent[node])
+                {
+                    depth++;
+                }
+                lengths[leaf_symbol[i]] = static_cast<uint8_t>(depth);
+                fits = fits && depth <= max_bits;
+            }
+            if (fits)
+            {
+                return;
+            }
+            for (uint32_t &weight : weights)
+            {
+                weight = weight == 0 ? 0 : (weight + 1) / 2;
+            }
+        }
+    };
+
+    // canonical codes for the lengths, bit reversed since deflate sends Huffman codes most significant bit first
+    auto build_codes = [](const std::vector<uint8_t> &lengths, std::vector<uint16_t> &codes)
+    {
+        uint16_t count[16] = {};
+        for (uint8_t length : lengths)
+        {
+            count[length]++;
+        }
+        count[0] = 0;
+        uint16_t next[16] = {};
+        uint16_t code = 0;
+        for (int bits = 1; bits < 16; bits++)
+        {
+            code = static_cast<uint16_t>((code + count[bits - 1]) << 1);
+            next[bits] = code;
+        }
+        codes.assign(lengths.size(), 0);
+        for (size_t i = 0; i < lengths.size(); i++)
+        {
+            if (lengths[i] == 0)
+            {
+                continue;
+            }
+            uint16_t value = next[lengths[i]]++;
+            uint16_t reversed = 0;
+            for (int bit = 0; bit < lengths[i]; bit++)
+            {
+                reversed = static_cast<uint16_t>((reversed << 1) | ((value >> bit) & 1));
+            }
+            codes[i] = reversed;
+        }
+    };
+
+    std::vector<int32_t> head(kHashSize, -1);
+    std::vector<int32_t> previous(size, -1);
+    auto hash = [data](size_t position)
+    {
+        uint32_t value = data[position] | (data[position + 1] << 8) | (data[position + 2] << 16);
+        return (value * 2654435761u) >> 17;
+    };
+    auto insert = [&](size_t position)
+    {
+        if (position + 2 < size)
+        {
+            uint32_t h = hash(position);
+            previous[position] = head[h];
+            head[h] = static_cast<int32_t>(position);
+        }
+    };
+    // the longest earlier match of up to limit bytes at a position, 0 if there is none of at least 3 bytes
+    auto longest_match = [&](size_t position, size_t limit, size_t &best_distance)
+    {
+        size_t best = 0;
+        if (position + 2 >= size || limit < 3)
+        {
+            return best;
+        }
+        limit = std::min<size_t>(limit, 258);
+        int32_t candidate = head[hash(position)];
+        for (int chain = 0; candidate >= 0 && chain < kMaxChain; chain++, candidate = previous[candidate])
+        {
+            size_t distance = position - static_cast<size_t>(candidate);
+            if (distance > kWindow)
+            {
+                break;
+            }
+            size_t length = 0;
+            while (length < limit && data[candidate + length] == data[position + length])
+            {
+                length++;
+            }
+            if (length > best)
+            {
+                best = length;
+                best_distance = distance;
+                if (length == limit)
+                {
+                    break;
+                }
+            }
+        }
+        return best >= 3 ? best : 0;
+    };
+
+    dictionary_size = std::min(dictionary_size, size);
+    for (size_t position = 0; position < dictionary_size; position++)
+    {
+        insert(position);
+    }
+
+    BitWriter writer{output, 0, 0};
+    size_t block_start = dictionary_size;
+    size_t position = dictionary_size;
+    do
+    {
+        size_t block_end = std::min(size, block_start + kBlockBytes);
+        std::vector<Token> tokens;
+        while (position < block_end)
+        {
+            size_t distance = 0;
+            size_t length = longest_match(position, block_end - position, distance);
+            insert(position);
+            if (length > 0 && position + 1 < block_end)
+            {
+                // a longer match one byte on is worth a literal
+                size_t next_distance = 0;
+                size_t next_length = longest_match(position + 1, block_end - position - 1, next_distance);
+                if (next_length > length)
+                {
+                    tokens.push_back(Token{0, data[position]});
+                    position++;
+                    insert(position);
+                    length = next_length;
+                    distance = next_distance;
+                }
+            }
+            if (length == 0)
+            {
+                tokens.push_back(Token{0, data[position]});
+                position++;
+                continue;
+            }
+            tokens.push_back(Token{static_cast<uint16_t>(length), static_cast<uint16_t>(distance)});
+            for (size_t i = 1; i < length; i++)
+            {
+                insert(position + i);
+            }
+            position += length;
+        }
+
+        std::vector<uint32_t> length_frequencies(286, 0);
+        std::vector<uint32_t> distance_frequencies(30, 0);
+        for (const Token &token : tokens)
+        {
+            if (token.length == 0)
+            {
+                length_frequencies[token.value]++;
+            }
+            else
+            {
+                length_frequencies[257 + length_symbol(token.length)]++;
+                distance_frequencies[distance_symbol(token.value)]++;
+            }
+        }
+        length_frequencies[256] = 1;
+
+        std::vector<uint8_t> length_lengths;
+        std::vector<uint8_t> distance_lengths;
+        build_lengths(length_frequencies, 15, length_lengths);
+        build_lengths(distance_frequencies, 15, distance_lengths);
+        if (std::all_of(distance_lengths.begin(), distance_lengths.end(), [](uint8_t length) { return length == 0; }))
+        {
+            distance_lengths[0] = 1;  // one unused distance code, as zlib sends
+        }
+        int length_count = 286;
+        while (length_count > 257 && length_lengths[length_count - 1] == 0)
+        {
+            length_count--;
+        }
+        int distance_count = 30;
+        while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+        {
+            distance_count--;
+        }
+
+        // run length code the code lengths: (symbol, extra bits value)
+        std::vector<uint8_t> all_lengths(length_lengths.begin(), length_lengths.begin() + length_count);
+        all_lengths.insert(all_lengths.end(), distance_lengths.begin(), distance_lengths.begin() + distance_count);
+        std::vector<std::pair<uint8_t, uint8_t>> runs;
+        for (size_t i = 0; i < all_lengths.size();)
+        {
+            size_t run = 1;
+            while (i + run < all_lengths.size() && all_lengths[i + run] == all_lengths[i])
+            {
+                run++;
+            }
+            if (all_lengths[i] == 0 && run >= 3)
+            {
+                run = std::min<size_t>(run, 138);
+                runs.push_back(run >= 11 ? std::make_pair(uint8_t{18}, static_cast<uint8_t>(run - 11))
+                                         : std::make_pair(uint8_t{17}, static_cast<uint8_t>(run - 3)));
+            }
+            else if (all_lengths[i] != 0 && run >= 4)
+            {
+                run = std::min<size_t>(run, 7);
+                runs.push_back(std::make_pair(all_lengths[i], uint8_t{0}));
+                runs.push_back(std::make_pair(uint8_t{16}, static_cast<uint8_t>(run - 4)));
+            }
+            else
+            {
+                run = 1;
+                runs.push_back(std::make_pair(all_lengths[i], uint8_t{0}));
+            }
+            i += run;
+        }
+        std::vector<uint32_t> code_frequencies(19, 0);
+        for (const std::pair<uint8_t, uint8_t> &run : runs)
+        {
+            code_frequencies[run.first]++;
+        }
+        std::vector<uint8_t> code_lengths;
+        build_lengths(code_frequencies, 7, code_lengths);
+        int code_count = 19;
+        while (code_count > 4 && code_lengths[kOrder[code_count - 1]] == 0)
+        {
+            code_count--;
+        }
+
+        // the sizes of the three ways to code the block, in bits
+        auto data_bits = [&](const std::vector<uint8_t> &lengths, const std::vector<uint8_t> &distances)
+        {
+            uint64_t bits = lengths[256];
+            for (const Token &token : tokens)
+            {
+                if (token.length == 0)
+                {
+                    bits += lengths[token.value];
+                    continue;
+                }
+                int length = length_symbol(token.length);
+                int distance = distance_symbol(token.value);
+                bits += lengths[257 + length] + kLengthExtra[length] + distances[distance] + kDistanceExtra[distance];
+            }
+            return bits;
+        };
+        std::vector<uint8_t> fixed_lengths(288, 8);
+        std::fill(fixed_lengths.begin() + 144, fixed_lengths.begin() + 256, 9);
+        std::fill(fixed_lengths.begin() + 256, fixed_lengths.begin() + 280, 7);
+        std::vector<uint8_t> fixed_distances(30, 5);
+        uint64_t dynamic_bits = 3 + 14 + 3 * code_count + data_bits(length_lengths, distance_lengths);
+        for (const std::pair<uint8_t, uint8_t> &run : runs)
+        {
+            dynamic_bits += code_lengths[run.first] + repeat_bits(run.first);
+        }
+        uint64_t fixed_bits = 3 + data_bits(fixed_lengths, fixed_distances);
+        uint64_t stored_bits = 3 + 7 + 32 + 8 * static_cast<uint64_t>(block_end - block_start);
+
+        uint32_t final_block = block_end == size ? 1 : 0;
+        if (stored_bits <= fixed_bits && stored_bits <= dynamic_bits)
+        {
+            writer.Put(final_block, 1);
+            writer.Put(0, 2);
+            writer.Align();
+            uint32_t length = static_cast<uint32_t>(block_end - block_start);
+            writer.Put(length, 16);
+            writer.Put(~length & 0xFFFF, 16);
+            output.insert(output.end(), data + block_start, data + block_end);
+        }
+        else
+        {
+            bool dynamic = dynamic_bits < fixed_bits;
+            const std::vector<uint8_t> &lengths = dynamic ? length_lengths : fixed_lengths;
+            const std::vector<uint8_t> &distances = dynamic ? distance_lengths : fixed_distances;
+            writer.Put(final_block, 1);
+            writer.Put(dynamic ? 2 : 1, 2);
+            if (dynamic)
+            {
+                std::vector<uint16_t> codes;
+                build_codes(code_lengths, codes);
+                writer.Put(static_cast<uint32_t>(length_count - 257), 5);
+                writer.Put(static_cast<uint32_t>(distance_count - 1), 5);
+                writer.Put(static_cast<uint32_t>(code_count - 4), 4);
+                for (int i = 0; i < code_count; i++)
+                {
+                    writer.Put(code_lengths[kOrder[i]], 3);
+                }
+                for (const std::pair<uint8_t, uint8_t> &run : runs)
+                {
+                    writer.Put(codes[run.first], code_lengths[run.first]);
+                    writer.Put(run.second, repeat_bits(run.first));
+                }
+            }
+            std::vector<uint16_t> length_codes;
+            std::vector<uint16_t> distance_codes;
+            build_codes(lengths, length_codes);
+            build_codes(distances, distance_codes);
+            for (const Token &token : tokens)
+            {
+                if (token.length == 0)
+                {
+                    writer.Put(length_codes[token.value], lengths[token.value]);
+                    continue;
+                }
+                int length = length_symbol(token.length);
+                int distance = distance_symbol(token.value);
+                writer.Put(length_codes[257 + length], lengths[257 + length]);
+                writer.Put(token.length - kLengthBase[length], kLengthExtra[length]);
+                writer.Put(distance_codes[distance], distances[distance]);
+                writer.Put(token.value - kDistanceBase[distance], kDistanceExtra[distance]);
+            }
+            writer.Put(length_codes[256], lengths[256]);
+        }
+        block_start = block_end;
+    } while (block_start < size);
+    writer.Align();
+}
@@ -3,177 +3,231 @@
 #ifdef ARDUINO_ARCH_ESP32
 
 #include <Arduino.h>
-#include <Update.h>
-
-#include <array>
+#include <MD5Builder.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
 
 #include "CAN.h"
+#include "can_update.h"
+
+/**
+ * @brief Writes an update image to the ESP32's next OTA partition, and boots into it once its MD5 checks out and the
+ * node has reported it written. Each page is read back after it is written, and the pages written are kept in NVS
+ * under the image's MD5, so an update that stopped (the host went away, or the node lost power) resumes after them.
+ * Delta updates are made against the running partition.
+ */
+class ESPUpdateTarget : public ICANUpdateTarget
+{
+public:
+    bool Begin(uint32_t size, const char *md5) override
+    {
+        Serial.printf("MD5: %s\n", md5);
+        Serial.printf("Length: %u\n", size);
+        if (!Open(size, md5) || !OpenProgress())
+        {
+            return false;
+        }
+        // the pages first, so they never count towards another image
+        progress_.putUInt("pages", 0);
+        progress_.putUInt("size", size);
+        progress_.putString("md5", md5);
+        written_ = 0;
+        return true;
+    }
 
+    bool Write(const uint8_t *data, size_t size) override
+    {
+        // every page but the last comes whole, and starts a flash sector
+        if (partition_ == nullptr || size > size_ - written_
+            || esp_partition_erase_range(partition_, written_, kCANUpdatePageBytes) != ESP_OK
+            || esp_partition_write(partition_, written_, data, size) != ESP_OK)
+        {
+            Serial.printf("Writing at %u failed\n", written_);
+            return false;
+        }
+        uint8_t check[256];
+        for (size_t offset = 0; offset < size; offset += sizeof(check))
+        {
+            size_t count = std::min(sizeof(check), size - offset);
+            if (esp_partition_read(partition_, written_ + offset, check, count) != ESP_OK
+                || memcmp(check, data + offset, count) != 0)
+            {
+                Serial.printf("Verifying at %u failed\n", written_ + offset);
+                return false;
+            }
+        }
+        written_ += size;
+        progress_.putUInt("pages", written_ / kCANUpdatePageBytes);
+        return true;
+    }
+
+    bool End() override
+    {
+        MD5Builder md5;
+        md5.begin();
+        uint8_t chunk[256];
+        for (uint32_t offset = 0; offset < written_; offset += sizeof(chunk))
+        {
+            uint32_t count = std::min<uint32_t>(sizeof(chunk), written_ - offset);
+            if (esp_partition_read(partition_, offset, chunk, count) != ESP_OK)
+            {
+                break;
+            }
+            md5.add(chunk, count);
+        }
+        md5.calculate();
+        // a complete image starts over whether it checks out or not
+        progress_.clear();
+        if (written_ != size_ || md5.toString() != md5_cstr_)
+        {
+            Serial.printf("Expected MD5: %s\n", md5_cstr_);
+            return false;
+        }
+        esp_err_t err = esp_ota_set_boot_partition(partition_);
+        if (err != ESP_OK)
+        {
+            Serial.printf("Image rejected: %s\n", esp_err_to_name(err));
+            return false;
+        }
+        Serial.println("Update success!");
+        return true;
+    }
+
+    void Restart() override
+    {
+        // the progress that reports the image written may still wait in the TWAI TX queue
+        twai_status_info_t status;
+        uint32_t start = millis();
+        while (twai_get_status_info(&status) == ESP_OK && status.msgs_to_tx > 0 && millis() - start < 100)
+        {
+            delay(1);
+        }
+        ESP.restart();
+    }
+
+    // the pages written stay in NVS for the update to resume
+    void Abort() override { partition_ = nullptr; }
+
+    bool GetWrittenPages(const char *md5, uint32_t &pages) override
+    {
+        if (!OpenProgress())
+        {
+            return false;
+        }
+        pages = progress_.getString("md5") == md5 ? progress_.getUInt("pages", 0) : 0;
+        return true;
+    }
+
+    bool Resume(uint32_t size, const char *md5, uint32_t pages) override
+    {
+        uint32_t held = 0;
+        if (!GetWrittenPages(md5, held) || pages > held || progress_.getUInt("size", 0) != size || !Open(size, md5))
+        {
+            return false;
+        }
+        Serial.printf("Resuming %s after %u pages\n", md5, pages);
+        written_ = pages * kCANUpdatePageBytes;
+        return true;
+    }
+
+    bool GetBase(uint32_t &size, uint8_t *md5) override
+    {
+        // hashed over the running partition on the first call, which takes a moment
+        String digest = ESP.getSketchMD5();
+        if (digest.length() != 32)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < 16; i++)
+        {
+            unsigned byte = 0;
+            if (sscanf(digest.c_str() + 2 * i, "%2x", &byte) != 1)
+            {
+                return false;
+            }
+            md5[i] = static_cast<uint8_t>(byte);
+        }
+        size = ESP.getSketchSize();
+        return size > 0;
+    }
+
+    bool ReadBase(uint32_t offset, uint8_t *data, size_t size) override
+    {
+        const esp_partition_t *running = esp_ota_get_running_partition();
+        return running != nullptr && esp_partition_read(running, offset, data, size) == ESP_OK;
+    }
+
+private:
+    const esp_partition_t *partition_{nullptr};
+    uint32_t size_{0};
+    uint32_t written_{0};
+    char md5_cstr_[33]{};
+    Preferences progress_;
+    bool progress_open_{false};
+
+    bool Open(uint32_t size, const char *md5)
+    {
+        partition_ = esp_ota_get_next_update_partition(nullptr);
+        if (partition_ == nullptr || size > partition_->size)
+        {
+            Serial.println("No OTA partition fits the image");
+            partition_ = nullptr;
+            return false;
+        }
+        size_ = size;
+        snprintf(md5_cstr_, sizeof(md5_cstr_), "%s", md5);
+        return true;
+    }
+
+    // NVS isn't up while globals are constructed
+    bool OpenProgress()
+    {
+        if (!progress_open_)
+        {
+            progress_open_ = progress_.begin("can_update", false);
+        }
+        return progress_open_;
+    }
+};
+
+/**
+ * @brief Lets a host flash the ESP32 over CAN with scripts/esp_can_update.py, see can_update.h for the protocol. Pages
+ * are written to flash by a task of its own, so frames keep being received while a sector erases. Nodes given the same
+ * group ID can be flashed together.
+ */
 class CANUpdate
 {
 public:
-    CANUpdate(uint32_t update_id, ICAN &can_bus, VirtualTimerGroup &timer_group)
-        : kUpdateId{update_id}, can_interface_{can_bus}, timer_group_{timer_group}
+    CANUpdate(uint32_t update_id, ICAN &can_bus, VirtualTimerGroup &timer_group, uint32_t group_id = kCANUpdateNoGroup)
+        : device_{update_id, can_bus, timer_group, target_, kFirmwareVersion, []() { return millis(); }, group_id}
     {
-        fw_version_ = kFirmwareVersion;
-        update_data_message_.SetMask(0x7FF);
-        Update.begin(0, -1);  // initialize Update to set private variables, will be properly started when update info
-                              // message is received
-        Update.abort();  // abort the update so that it can be properly started when update info message is received
-        timer_group_.AddTimer(100,
-                              [this]()
-                              {
-                                  if (update_data_message_.GetTimeSinceLastReceive() >= kUpdateTimeout
-                                      && update_info_message_.GetTimeSinceLastReceive() >= kUpdateTimeout)
-                                  {
-                                      update_started_ = false;
-                                      received_md5_ = false;
-                                      received_len_ = false;
-                                      written_ = false;
-                                      received_md5_arr_.at(0) = false;
-                                      received_md5_arr_.at(1) = false;
-                                      received_md5_arr_.at(2) = false;
-                                      received_md5_arr_.at(3) = false;
-                                      update_block_idx_ = 0;
-                                      Update.abort();
-                                  }
-                              });
+        // without the task, pages are written from the RX path
+        if (xTaskCreate(WriterTask, "can_update_writer", 4096, this, 1, &writer_task_) == pdPASS)
+        {
+            device_.SetWriter([this]() { xTaskNotifyGive(writer_task_); });
+        }
     }
 
 private:
-    const uint32_t kUpdateId;
-    ICAN &can_interface_;
-    VirtualTimerGroup &timer_group_;
+    static void WriterTask(void *update)
+    {
+        CANUpdateDevice &device = static_cast<CANUpdate *>(update)->device_;
+        while (true)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            device.WritePending();
+        }
+    }
 
 #ifdef UNIX_TIMESTAMP
-    const uint32_t kFirmwareVersion{UNIX_TIMESTAMP};
+    static constexpr uint32_t kFirmwareVersion{UNIX_TIMESTAMP};
 #else
-    constexpr uint32_t kFirmwareVersion{0};
+    static constexpr uint32_t kFirmwareVersion{0};
 #endif
 
-    const uint32_t kUpdateTimeout{500};
-
-    enum class MessageType : uint8_t
-    {
-        kUpdateStart = 0,
-        kMd5 = 1
-    };
-    MakeUnsignedCANSignal(MessageType, 0, 8, 1, 0) message_type_{};
-    MakeUnsignedCANSignal(uint32_t, 8, 32, 1, 0) update_length_{};
-    MakeUnsignedCANSignal(uint16_t, 8, 8, 1, 0) update_md5_idx_{};
-    MakeUnsignedCANSignal(uint32_t, 16, 32, 1, 0) update_md5_{};
-
-    MultiplexedSignalGroup<1, MessageType> length_signal_group_{MessageType::kUpdateStart, update_length_};
-    MultiplexedSignalGroup<2, MessageType> md5_signal_group_{MessageType::kMd5, update_md5_idx_, update_md5_};
-
-    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) data_block_index_low_{};
-    MakeUnsignedCANSignal(uint64_t, 8, 56, 1, 0) update_data_{};
-
-    MakeUnsignedCANSignal(uint32_t, 0, 24, 1, 0) update_block_idx_{};
-    MakeUnsignedCANSignal(bool, 24, 1, 1, 0) received_len_{};
-    MakeUnsignedCANSignal(bool, 25, 1, 1, 0) received_md5_{};
-    MakeUnsignedCANSignal(bool, 26, 1, 1, 0) written_{};
-    MakeUnsignedCANSignal(uint32_t, 32, 32, 1, 0) fw_version_{};
-
-    CANTXMessage<5> update_progress_message_{can_interface_,
-                                             kUpdateId + 2,
-                                             8,
-                                             100,
-                                             timer_group_,
-                                             update_block_idx_,
-                                             received_len_,
-                                             received_md5_,
-                                             written_,
-                                             fw_version_};
-
-    bool update_started_ = false;
-    std::array<bool, 4> received_md5_arr_ = {false, false, false, false};
-    std::array<uint32_t, 4> md5_arr_{};
-    char md5_cstr_[33];
-
-    MultiplexedCANRXMessage<2, MessageType> update_info_message_{
-        can_interface_,
-        kUpdateId + 1,
-        [this]()
-        {
-            if (message_type_ == MessageType::kMd5)
-            {
-                received_md5_arr_.at(static_cast<uint8_t>(update_md5_idx_)) = true;
-                md5_arr_[static_cast<uint8_t>(update_md5_idx_)] = update_md5_;
-                if (received_md5_arr_.at(0) && received_md5_arr_.at(1) && received_md5_arr_.at(2)
-                    && received_md5_arr_.at(3))
-                {
-                    received_md5_ = true;
-                }
-            }
-            else if (!update_started_ && message_type_ == MessageType::kUpdateStart)
-            {
-                sprintf(md5_cstr_,
-                        "%08x%08x%08x%08x",
-                        __bswap32(md5_arr_.at(0)),
-                        __bswap32(md5_arr_.at(1)),
-                        __bswap32(md5_arr_.at(2)),
-                        __bswap32(md5_arr_.at(3)));
-                Serial.printf("MD5: %s\n", md5_cstr_);
-                Serial.printf("Length: %u\n", static_cast<uint32_t>(update_length_));
-                if (!Update.begin(update_length_))
-                {
-                    Update.printError(Serial);
-                }
-                else
-                {
-                    Update.setMD5(md5_cstr_);
-                    update_block_idx_ = 0;
-                    received_len_ = true;
-                    update_started_ = true;
-                    written_ = false;
-                    update_progress_message_.EncodeAndSend();
-                }
-            }
-        },
-        message_type_,
-        length_signal_group_,
-        md5_signal_group_};
-
-    CANRXMessage<2> update_data_message_{can_interface_,
-                                         kUpdateId,
-                                         [this]()
-                                         {
-                                             uint64_t data = update_data_;
-                                             uint32_t index = ((update_data_message_.GetID() & 0x1FFFF800/*18 bits of CAN extended ID, not including standard ID*/) >> 3) + data_block_index_low_;
-                                             if (update_started_ && static_cast<uint32_t>(update_block_idx_) == index)
-                                             {
-                                                 if (index * 7 >= update_length_ - 7)
-                                                 {
-                                                     Update.write(reinterpret_cast<uint8_t *>(&data),
-                                                                  update_length_ - (index * 7));
-                                                     written_ = true;
-                                                     update_progress_message_.EncodeAndSend();
-
-                                                     if (Update.end())
-                                                     {
-                                                         Serial.println("Update success!");
-                                                         ESP.restart();
-                                                     }
-                                                     else
-                                                     {
-                                                         Update.printError(Serial);
-                                                         Serial.printf("Expected MD5: %s\n", md5_cstr_);
-                                                         update_started_ = false;
-                                                     }
-                                                 }
-                                                 else
-                                                 {
-                                                     Update.write(reinterpret_cast<uint8_t *>(&data), 7);
-                                                     written_ = true;
-                                                     update_progress_message_.EncodeAndSend();
-                                                     update_block_idx_ += 1;
-                                                     written_ = false;
-                                                     update_progress_message_.EncodeAndSend();
-                                                 }
-                                             }
-                                         },
-                                         data_block_index_low_,
-                                         update_data_};
+    ESPUpdateTarget target_;
+    CANUpdateDevice device_;
+    TaskHandle_t writer_task_{nullptr};
 };
 #endif
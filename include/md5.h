@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief MD5 (RFC 1321), which update images are checked with (see can_update.h), for hosts and tests. Not a secure
+ * hash.
+ *
+ * @param data The bytes to hash
+ * @param size The number of bytes
+ * @param digest Receives the 16 byte digest
+ */
+inline void MD5(const uint8_t *data, size_t size, uint8_t *digest)
+{
+    static const uint32_t kK[64] = {0xD76AA478,
+                                    0xE8C7B756,
+                                    0x242070DB,
+                                    0xC1BDCEEE,
+                                    0xF57C0FAF,
+                                    0x4787C62A,
+                                    0xA8304613,
+                                    0xFD469501,
+                                    0x698098D8,
+                                    0x8B44F7AF,
+                                    0xFFFF5BB1,
+                                    0x895CD7BE,
+                                    0x6B901122,
+                                    0xFD987193,
+                                    0xA679438E,
+                                    0x49B40821,
+                                    0xF61E2562,
+                                    0xC040B340,
+                                    0x265E5A51,
+                                    0xE9B6C7AA,
+                                    0xD62F105D,
+                                    0x02441453,
+                                    0xD8A1E681,
+                                    0xE7D3FBC8,
+                                    0x21E1CDE6,
+                                    0xC33707D6,
+                                    0xF4D50D87,
+                                    0x455A14ED,
+                                    0xA9E3E905,
+                                    0xFCEFA3F8,
+                                    0x676F02D9,
+                                    0x8D2A4C8A,
+                                    0xFFFA3942,
+                                    0x8771F681,
+                                    0x6D9D6122,
+                                    0xFDE5380C,
+                                    0xA4BEEA44,
+                                    0x4BDECFA9,
+                                    0xF6BB4B60,
+                                    0xBEBFBC70,
+                                    0x289B7EC6,
+                                    0xEAA127FA,
+                                    0xD4EF3085,
+                                    0x04881D05,
+                                    0xD9D4D039,
+                                    0xE6DB99E5,
+                                    0x1FA27CF8,
+                                    0xC4AC5665,
+                                    0xF4292244,
+                                    0x432AFF97,
+                                    0xAB9423A7,
+                                    0xFC93A039,
+                                    0x655B59C3,
+                                    0x8F0CCC92,
+                                    0xFFEFF47D,
+                                    0x85845DD1,
+                                    0x6FA87E4F,
+                                    0xFE2CE6E0,
+                                    0xA3014314,
+                                    0x4E0811A1,
+                                    0xF7537E82,
+                                    0xBD3AF235,
+                                    0x2AD7D2BB,
+                                    0xEB86D391};
+    static const uint8_t kShift[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+    uint32_t state[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+    auto compress = [&state](const uint8_t *chunk)
+    {
+        uint32_t words[16];
+        for (size_t i = 0; i < 16; i++)
+        {
+            words[i] = static_cast<uint32_t>(chunk[4 * i]) | (static_cast<uint32_t>(chunk[4 * i + 1]) << 8)
+                       | (static_cast<uint32_t>(chunk[4 * i + 2]) << 16)
+                       | (static_cast<uint32_t>(chunk[4 * i + 3]) << 24);
+        }
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        for (uint32_t i = 0; i < 64; i++)
+        {
+            uint32_t f;
+            uint32_t word;
+            switch (i / 16)
+            {
+                case 0:
+                    f = (b & c) | (~b & d);
+                    word = i;
+                    break;
+                case 1:
+                    f = (d & b) | (~d & c);
+                    word = (5 * i + 1) % 16;
+                    break;
+                case 2:
+                    f = b ^ c ^ d;
+                    word = (3 * i + 5) % 16;
+                    break;
+                default:
+                    f = c ^ (b | ~d);
+                    word = 7 * i % 16;
+                    break;
+            }
+            f += a + kK[i] + words[word];
+            uint8_t shift = kShift[i / 16 * 4 + i % 4];
+            a = d;
+            d = c;
+            c = b;
+            b += (f << shift) | (f >> (32 - shift));
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    };
+
+    size_t whole = size / 64 * 64;
+    for (size_t offset = 0; offset < whole; offset += 64)
+    {
+        compress(data + offset);
+    }
+    // the rest, a 1 bit and the length in bits fill one or two more chunks
+    uint8_t tail[128]{};
+    size_t rest = size - whole;
+    if (rest > 0)
+    {
+        memcpy(tail, data + whole, rest);
+    }
+    tail[rest] = 0x80;
+    size_t tail_size = rest < 56 ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(size) * 8;
+    for (size_t i = 0; i < 8; i++)
+    {
+        tail[tail_size - 8 + i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    for (size_t offset = 0; offset < tail_size; offset += 64)
+    {
+        compress(tail + offset);
+    }
+    for (size_t i = 0; i < 16; i++)
+    {
+        digest[i] = static_cast<uint8_t>(state[i / 4] >> (8 * (i % 4)));
+    }
+}
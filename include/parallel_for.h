@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Runs body(index, thread) for every index in [0, count) on threads worker threads with work stealing: the
+ * indices are dealt out round-robin to per-thread queues, each thread works through its own queue from the front and,
+ * once it is empty, steals from the back of the others'. Uneven work items (e.g. log chunks that decode at different
+ * speeds) therefore keep every thread busy until the end. Returns when every body has finished.
+ *
+ * @param count The number of work items
+ * @param threads The number of worker threads, 0 for one per hardware thread
+ * @param body Called once per index, from the worker thread numbered thread (0 to threads - 1)
+ */
+inline void WorkStealingParallelFor(size_t count, size_t threads, const std::function<void(size_t, size_t)> &body)
+{
+    if (threads == 0)
+    {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min(threads, count));
+    if (threads <= 1)
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            body(index, 0);
+        }
+        return;
+    }
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> indices;
+    };
+    std::vector<Queue> queues(threads);
+    for (size_t index = 0; index < count; index++)
+    {
+        queues[index % threads].indices.push_back(index);
+    }
+
+    auto take = [&queues, threads](size_t thread, size_t &index)
+    {
+        for (size_t offset = 0; offset < threads; offset++)
+        {
+            Queue &queue = queues[(thread + offset) % threads];
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            if (queue.indices.empty())
+            {
+                continue;
+            }
+            if (offset == 0)
+            {
+                index = queue.indices.front();
+                queue.indices.pop_front();
+            }
+            else
+            {
+                index = queue.indices.back();
+                queue.indices.pop_back();
+            }
+            return true;
+        }
+        return false;
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t thread = 0; thread < threads; thread++)
+    {
+        workers.emplace_back(
+            [&take, &body, thread]()
+            {
+                size_t index;
+                while (take(thread, index))
+                {
+                    body(index, thread);
+                }
+            });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/can.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "can_interface.h"
+
+/**
+ * @brief An ICAN on a Linux SocketCAN interface (a USB adapter's can0, or vcan0 to try things out), for native tools.
+ * The bit rate is the interface's, set with ip link, so Initialize only opens the socket. SendMessage doesn't block: it
+ * returns false while the interface's TX queue is full, which paces a sender that retries at the bus rate.
+ */
+class SocketCAN : public ICAN
+{
+public:
+    explicit SocketCAN(const std::string &interface) : interface_{interface} {}
+
+    ~SocketCAN() { Close(); }
+
+    void Initialize(BaudRate baud __attribute__((unused))) override
+    {
+        Close();
+        int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+        if (fd < 0)
+        {
+            error_ = std::string{"socket: "} + strerror(errno);
+            return;
+        }
+        ifreq request{};
+        strncpy(request.ifr_name, interface_.c_str(), IFNAMSIZ - 1);
+        if (ioctl(fd, SIOCGIFINDEX, &request) < 0)
+        {
+            error_ = interface_ + ": " + strerror(errno);
+            close(fd);
+            return;
+        }
+        sockaddr_can address{};
+        address.can_family = AF_CAN;
+        address.can_ifindex = request.ifr_ifindex;
+        if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0
+            || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+        {
+            error_ = interface_ + ": " + strerror(errno);
+            close(fd);
+            return;
+        }
+        socket_ = fd;
+        error_.clear();
+    }
+
+    bool SendMessage(CANMessage &msg) override
+    {
+        if (socket_ < 0)
+        {
+            return false;
+        }
+        can_frame frame{};
+        frame.can_id = msg.extended_id_ ? (msg.id_ & CAN_EFF_MASK) | CAN_EFF_FLAG : msg.id_ & CAN_SFF_MASK;
+        frame.can_dlc = std::min<uint8_t>(msg.len_, 8);
+        memcpy(frame.data, msg.data_.data(), frame.can_dlc);
+        // ENOBUFS or EAGAIN while the queue is full
+        if (write(socket_, &frame, sizeof(frame)) != static_cast<ssize_t>(sizeof(frame)))
+        {
+            return false;
+        }
+        TapFrame(msg, true);
+        return true;
+    }
+
+    void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages_.push_back(&msg); }
+
+    // Reads every frame waiting on the socket
+    void Tick() override
+    {
+        can_frame frame;
+        while (socket_ >= 0 && read(socket_, &frame, sizeof(frame)) == static_cast<ssize_t>(sizeof(frame)))
+        {
+            if ((frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) != 0)
+            {
+                continue;
+            }
+            bool extended_id = (frame.can_id & CAN_EFF_FLAG) != 0;
+            CANMessage message{frame.can_id & (extended_id ? CAN_EFF_MASK : CAN_SFF_MASK),
+                               extended_id,
+                               std::min<uint8_t>(frame.can_dlc, 8),
+                               std::array<uint8_t, 8>{}};
+            memcpy(message.data_.data(), frame.data, message.len_);
+            TapFrame(message, false);
+            for (ICANRXMessage *rx_message : rx_messages_)
+            {
+                rx_message->DecodeSignals(message);
+            }
+        }
+    }
+
+    bool IsOpen() const { return socket_ >= 0; }
+    // Why Initialize failed
+    const std::string &GetError() const { return error_; }
+
+private:
+    std::string interface_;
+    int socket_{-1};
+    std::string error_;
+    std::vector<ICANRXMessage *> rx_messages_;
+
+    void Close()
+    {
+        if (socket_ >= 0)
+        {
+            close(socket_);
+            socket_ = -1;
+        }
+    }
+};
+#endif
@@ -37,6 +37,7 @@ public:
 
 private:
     static std::vector<ICANRXMessage *> rx_messages_;
+    static TeensyCAN *instance_;  // for tapping frames in ProcessMessage
     CAN_message_t message_t{};
 
     static _MB_ptr ProcessMessage;
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "can_interface.h"
+
+/**
+ * @brief The exact number of bits a data frame occupies on the bus: the stuffed SOF-to-CRC section (including the real
+ * CRC-15, since it affects stuffing), the fixed-form CRC delimiter, ACK and EOF fields, and the 3 bit interframe space
+ * (to match CANWorstCaseFrameBits)
+ */
+inline uint32_t CANStuffedFrameBits(const CANMessage &msg)
+{
+    uint8_t bits[128];
+    size_t count = 0;
+    auto push = [&bits, &count](uint32_t value, uint8_t width)
+    {
+        for (int i = width - 1; i >= 0; i--)
+        {
+            bits[count++] = static_cast<uint8_t>((value >> i) & 1);
+        }
+    };
+
+    uint8_t len = std::min<uint8_t>(msg.len_, 8);
+    push(0, 1);  // SOF
+    if (msg.extended_id_)
+    {
+        push(msg.id_ >> 18, 11);
+        push(1, 1);  // SRR
+        push(1, 1);  // IDE
+        push(msg.id_ & 0x3FFFF, 18);
+        push(0, 3);  // RTR, r1, r0
+    }
+    else
+    {
+        push(msg.id_, 11);
+        push(0, 3);  // RTR, IDE, r0
+    }
+    push(len, 4);
+    for (uint8_t i = 0; i < len; i++)
+    {
+        push(msg.data_[i], 8);
+    }
+
+    uint16_t crc = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        bool feedback = (((crc >> 14) & 1) ^ bits[i]) != 0;
+        crc = static_cast<uint16_t>((crc << 1) & 0x7FFF);
+        if (feedback)
+        {
+            crc ^= 0x4599;
+        }
+    }
+    push(crc, 15);
+
+    // after 5 equal bits a complementary stuff bit is inserted, which starts the next run
+    uint32_t stuff_bits = 0;
+    uint8_t run = 1;
+    uint8_t previous = bits[0];
+    for (size_t i = 1; i < count; i++)
+    {
+        if (bits[i] == previous)
+        {
+            run++;
+        }
+        else
+        {
+            run = 1;
+            previous = bits[i];
+        }
+        if (run == 5)
+        {
+            stuff_bits++;
+            previous = static_cast<uint8_t>(!previous);
+            run = 1;
+        }
+    }
+    return static_cast<uint32_t>(count) + stuff_bits + 13;
+}
+
+/**
+ * @brief A deterministic, single-threaded CAN bus for running several nodes' firmware logic against each other on
+ * native. Each node gets an Endpoint, which is an ICAN that can be handed to CANTXMessages and CANRXMessages like a
+ * hardware backend.
+ *
+ * Time is simulated in nanoseconds and only advances in RunFor/RunUntil, which run as fast as the host allows. Frames
+ * queued by SendMessage compete when the bus goes idle: the lowest arbitration key wins, and the frame occupies the bus
+ * for its exact stuffed length at the bus baud rate. It is then copied into the RX queue of every other endpoint, and
+ * registered RX messages see it when that endpoint's Tick() runs, like on the hardware backends.
+ *
+ * Error frames, retransmission after errors and bus-off aren't modeled. Two endpoints sending the same ID at the same
+ * time are counted as a collision and the first attached endpoint wins.
+ */
+class VirtualCANBus
+{
+public:
+    // The order an endpoint offers its queued frames to arbitration
+    enum class TXOrder
+    {
+        kFIFO,     // oldest queued frame first (ESP32 TWAI)
+        kPriority  // highest priority queued frame first (controllers with several TX mailboxes)
+    };
+
+    /**
+     * @brief One node's connection to the bus
+     */
+    class Endpoint : public ICAN
+    {
+    public:
+        /**
+         * @brief Construct a new Endpoint object and attach it to the bus
+         *
+         * @param bus The bus to attach to
+         * @param tx_order The order queued frames are offered to arbitration
+         * @param tx_capacity The number of frames that can wait to be transmitted, SendMessage fails beyond this
+         * @param rx_capacity The number of received frames that can wait for Tick(), newer frames are dropped beyond
+         * this
+         */
+        Endpoint(VirtualCANBus &bus,
+                 TXOrder tx_order = TXOrder::kFIFO,
+                 size_t tx_capacity = 16,
+                 size_t rx_capacity = 64)
+            : bus_{bus}, tx_order_{tx_order}, tx_capacity_{tx_capacity}, rx_capacity_{rx_capacity}
+        {
+            bus_.endpoints_.push_back(this);
+        }
+
+        ~Endpoint()
+        {
+            bus_.endpoints_.erase(std::remove(bus_.endpoints_.begin(), bus_.endpoints_.end(), this),
+                                  bus_.endpoints_.end());
+            if (bus_.in_flight_sender_ == this)
+            {
+                bus_.in_flight_sender_ = nullptr;
+            }
+        }
+
+        Endpoint(const Endpoint &) = delete;
+        Endpoint &operator=(const Endpoint &) = delete;
+
+        // An endpoint with a different baud rate than the bus can neither send nor receive
+        void Initialize(BaudRate baud) override
+        {
+            initialized_ = true;
+            baud_ = baud;
+        }
+
+        bool SendMessage(CANMessage &msg) override
+        {
+            if (!IsConnected() || tx_queue_.size() >= tx_capacity_)
+            {
+                return false;
+            }
+            tx_queue_.push_back(QueuedFrame{msg, bus_.now_ns_});
+            TapFrame(msg, true);
+            return true;
+        }
+
+        void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages_.push_back(&msg); }
+
+        // Hands every received frame to every registered RX message
+        void Tick() override
+        {
+            while (!rx_queue_.empty())
+            {
+                CANMessage msg = rx_queue_.front();
+                rx_queue_.pop_front();
+                TapFrame(msg, false);
+                for (ICANRXMessage *rx_message : rx_messages_)
+                {
+                    rx_message->DecodeSignals(msg);
+                }
+            }
+        }
+
+        bool IsConnected() const { return initialized_ && static_cast<uint32_t>(baud_) == bus_.GetBaudRate(); }
+
+        size_t GetTXQueued() const { return tx_queue_.size(); }
+        size_t GetRXQueued() const { return rx_queue_.size(); }
+        uint32_t GetTransmittedCount() const { return transmitted_count_; }
+        uint32_t GetArbitrationLostCount() const { return arbitration_lost_count_; }
+        uint32_t GetRXOverrunCount() const { return rx_overrun_count_; }
+
+    private:
+        friend class VirtualCANBus;
+
+        struct QueuedFrame
+        {
+            CANMessage msg;
+            uint64_t queued_ns;
+        };
+
+        VirtualCANBus &bus_;
+        const TXOrder tx_order_;
+        const size_t tx_capacity_;
+        const size_t rx_capacity_;
+        bool initialized_{false};
+        BaudRate baud_{BaudRate::kBaud500K};
+        std::deque<QueuedFrame> tx_queue_;
+        std::deque<CANMessage> rx_queue_;
+        std::vector<ICANRXMessage *> rx_messages_;
+        uint32_t transmitted_count_{0};
+        uint32_t arbitration_lost_count_{0};
+        uint32_t rx_overrun_count_{0};
+
+        // The frame this endpoint would send in an arbitration starting at time, or -1 if it has none ready
+        int Candidate(uint64_t time) const
+        {
+            int candidate = -1;
+            for (size_t i = 0; i < tx_queue_.size(); i++)
+            {
+                if (tx_queue_[i].queued_ns > time)
+                {
+                    continue;
+                }
+                if (tx_order_ == TXOrder::kFIFO)
+                {
+                    return static_cast<int>(i);
+                }
+                if (candidate < 0
+                    || CANArbitrationKey(tx_queue_[i].msg.id_, tx_queue_[i].msg.extended_id_)
+                           < CANArbitrationKey(tx_queue_[candidate].msg.id_, tx_queue_[candidate].msg.extended_id_))
+                {
+                    candidate = static_cast<int>(i);
+                }
+            }
+            return candidate;
+        }
+
+        void Receive(const CANMessage &msg)
+        {
+            if (rx_queue_.size() >= rx_capacity_)
+            {
+                rx_overrun_count_++;
+                return;
+            }
+            rx_queue_.push_back(msg);
+        }
+    };
+
+    /**
+     * @brief Called for every frame when it has been received, with the time it was queued by the sender and the time
+     * its end of frame completed
+     */
+    using FrameObserver = std::function<void(const CANMessage &msg, uint64_t queued_ns, uint64_t received_ns)>;
+
+    VirtualCANBus(ICAN::BaudRate baud = ICAN::BaudRate::kBaud500K) : baud_{baud} {}
+
+    uint32_t GetBaudRate() const { return static_cast<uint32_t>(baud_); }
+    uint64_t GetBitTimeNs() const { return 1000000000ull / static_cast<uint32_t>(baud_); }
+
+    uint64_t GetTimeNs() const { return now_ns_; }
+    // For code that takes a get_micros/get_millis function or a VirtualTimerGroup tick time
+    uint32_t GetMicros() const { return static_cast<uint32_t>(now_ns_ / 1000); }
+    uint32_t GetMillis() const { return static_cast<uint32_t>(now_ns_ / 1000000); }
+
+    void SetFrameObserver(FrameObserver observer) { observer_ = observer; }
+
+    /**
+     * @brief Simulates the bus up to a point in time, delivering every frame whose end of frame completes by then
+     */
+    void RunUntil(uint64_t time_ns)
+    {
+        while (true)
+        {
+            if (in_flight_)
+            {
+                if (in_flight_received_ns_ > time_ns)
+                {
+                    break;
+                }
+                Complete();
+                continue;
+            }
+            if (!StartNext(time_ns))
+            {
+                break;
+            }
+        }
+        now_ns_ = std::max(now_ns_, time_ns);
+    }
+
+    void RunFor(uint64_t duration_ns) { RunUntil(now_ns_ + duration_ns); }
+
+    /**
+     * @brief Runs until every queued frame has been received, or the time limit passes
+     *
+     * @return false if frames were still queued at the time limit
+     */
+    bool RunUntilIdle(uint64_t limit_ns = UINT64_MAX)
+    {
+        while (in_flight_ || HasQueuedFrames())
+        {
+            uint64_t next =
+                in_flight_ ? in_flight_received_ns_ : std::max(std::max(now_ns_, idle_at_ns_), EarliestQueuedTime());
+            if (next > limit_ns)
+            {
+                RunUntil(limit_ns);
+                return false;
+            }
+            RunUntil(next);
+        }
+        return true;
+    }
+
+    uint32_t GetFramesTransmitted() const { return frames_transmitted_; }
+    // Time the bus spent transmitting frames (including the interframe space after each)
+    uint64_t GetBusyTimeNs() const { return busy_ns_; }
+    // Arbitrations where two endpoints sent the same ID, which would cause errors on a real bus
+    uint32_t GetCollisionCount() const { return collision_count_; }
+
+private:
+    const ICAN::BaudRate baud_;
+    std::vector<Endpoint *> endpoints_;
+    FrameObserver observer_;
+
+    uint64_t now_ns_{0};
+    uint64_t idle_at_ns_{0};  // when the interframe space after the last frame ends
+
+    bool in_flight_{false};
+    Endpoint *in_flight_sender_{nullptr};
+    CANMessage in_flight_msg_{};
+    uint64_t in_flight_queued_ns_{0};
+    uint64_t in_flight_received_ns_{0};
+
+    uint32_t frames_transmitted_{0};
+    uint64_t busy_ns_{0};
+    uint32_t collision_count_{0};
+
+    bool HasQueuedFrames() const
+    {
+        for (const Endpoint *endpoint : endpoints_)
+        {
+            if (endpoint->IsConnected() && !endpoint->tx_queue_.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint64_t EarliestQueuedTime() const
+    {
+        uint64_t earliest = UINT64_MAX;
+        for (const Endpoint *endpoint : endpoints_)
+        {
+            if (!endpoint->IsConnected())
+            {
+                continue;
+            }
+            for (const Endpoint::QueuedFrame &frame : endpoint->tx_queue_)
+            {
+                earliest = std::min(earliest, frame.queued_ns);
+            }
+        }
+        return earliest;
+    }
+
+    // Starts the arbitration the next frame wins, if it starts by time_ns
+    bool StartNext(uint64_t time_ns)
+    {
+        uint64_t earliest = EarliestQueuedTime();
+        if (earliest == UINT64_MAX)
+        {
+            return false;
+        }
+        uint64_t start = std::max(idle_at_ns_, earliest);
+        if (start > time_ns)
+        {
+            return false;
+        }
+
+        Endpoint *winner = nullptr;
+        int winner_index = -1;
+        uint32_t winner_key = 0;
+        for (Endpoint *endpoint : endpoints_)
+        {
+            if (!endpoint->IsConnected())
+            {
+                continue;
+            }
+            int index = endpoint->Candidate(start);
+            if (index < 0)
+            {
+                continue;
+            }
+            const CANMessage &msg = endpoint->tx_queue_[static_cast<size_t>(index)].msg;
+            uint32_t key = CANArbitrationKey(msg.id_, msg.extended_id_);
+            if (winner == nullptr || key < winner_key)
+            {
+                if (winner != nullptr)
+                {
+                    winner->arbitration_lost_count_++;
+                }
+                winner = endpoint;
+                winner_index = index;
+                winner_key = key;
+            }
+            else
+            {
+                if (key == winner_key)
+                {
+                    collision_count_++;
+                }
+                endpoint->arbitration_lost_count_++;
+            }
+        }
+
+        const Endpoint::QueuedFrame &frame = winner->tx_queue_[static_cast<size_t>(winner_index)];
+        uint64_t bit_ns = GetBitTimeNs();
+        uint64_t frame_ns = CANStuffedFrameBits(frame.msg) * bit_ns;
+        in_flight_ = true;
+        in_flight_sender_ = winner;
+        in_flight_msg_ = frame.msg;
+        in_flight_queued_ns_ = frame.queued_ns;
+        // receivers accept the frame at the end of EOF, before the interframe space
+        in_flight_received_ns_ = start + frame_ns - 3 * bit_ns;
+        idle_at_ns_ = start + frame_ns;
+        busy_ns_ += frame_ns;
+        winner->tx_queue_.erase(winner->tx_queue_.begin() + winner_index);
+        now_ns_ = std::max(now_ns_, start);
+        return true;
+    }
+
+    void Complete()
+    {
+        in_flight_ = false;
+        now_ns_ = std::max(now_ns_, in_flight_received_ns_);
+        frames_transmitted_++;
+        if (in_flight_sender_ != nullptr)
+        {
+            in_flight_sender_->transmitted_count_++;
+        }
+        for (Endpoint *endpoint : endpoints_)
+        {
+            if (endpoint != in_flight_sender_ && endpoint->IsConnected())
+            {
+                endpoint->Receive(in_flight_msg_);
+            }
+        }
+        if (observer_)
+        {
+            observer_(in_flight_msg_, in_flight_queued_ns_, in_flight_received_ns_);
+        }
+    }
+};
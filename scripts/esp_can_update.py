@@ -3,6 +3,8 @@ import sys
 import hashlib
 import time
 import math
+import os
+import zlib
 from os.path import basename
 
 Import("env")
@@ -30,6 +32,150 @@ except ImportError:
 can_update_config = env.GetProjectConfig().items("can_update", as_dict=True)
 db = cantools.database.load_file("esp_can_update.dbc")
 
+# see include/can_update.h
+CAPABILITY_WINDOWED = 1 << 0
+CAPABILITY_DEFLATE = 1 << 1
+CAPABILITY_DELTA = 1 << 2
+CAPABILITY_RESUME = 1 << 3
+CAPABILITY_PAGE_CRC = 1 << 4
+ENCODING_RAW = 0
+ENCODING_DEFLATE_PAGES = 1
+ENCODING_DELTA_PAGES = 2
+PAGE_BYTES = 4096
+DELTA_DICTIONARY_BYTES = 8192
+NO_DICTIONARY = 0xFFFFFFFF
+# start messages a node may turn a delta down for before falling back to a full image
+DELTA_START_ATTEMPTS = 10
+WINDOW = 32
+RETRANSMIT_TIMEOUT = 0.05
+
+
+def send_frame(can_bus, message):
+    # the interface's TX queue fills up at the bus rate, which paces the transfer
+    while True:
+        try:
+            can_bus.send(message)
+            return
+        except can.CanError:
+            time.sleep(0.0002)
+
+
+def deflate(data, dictionary=None):
+    if dictionary is None:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15)
+    else:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15, zdict=dictionary)
+    return compressor.compress(data) + compressor.flush()
+
+
+def build_pages(firmware_bytes, base=None):
+    # one record per page: its raw deflate stream's size, with a base the offset of
+    # the window of it the page was compressed against, the stream and padding to
+    # the end of the 7 byte block (see CANUpdateHost::BuildPages)
+    stream = bytearray()
+    dictionary_size = min(DELTA_DICTIONARY_BYTES, len(base)) if base else 0
+    shift = 0
+    for offset in range(0, len(firmware_bytes), PAGE_BYTES):
+        page = firmware_bytes[offset : offset + PAGE_BYTES]
+        best = deflate(page)
+        best_dictionary = NO_DICTIONARY
+        if dictionary_size > 0:
+            shifts = [shift]
+            for anchor in range(0, len(page) - 15, 1024):
+                center = offset + anchor + shift
+                found = base.find(
+                    page[anchor : anchor + 16],
+                    max(0, center - 32768),
+                    max(0, center + 32768),
+                )
+                if found >= 0:
+                    if found - offset - anchor != shift:
+                        shifts.insert(0, found - offset - anchor)
+                    break
+            for page_shift in shifts:
+                start = offset + page_shift - (DELTA_DICTIONARY_BYTES - PAGE_BYTES) // 2
+                start = max(0, min(start, len(base) - dictionary_size))
+                candidate = deflate(page, base[start : start + dictionary_size])
+                if len(candidate) < len(best):
+                    best = candidate
+                    best_dictionary = start
+                    shift = page_shift
+        record = len(best).to_bytes(2, "little")
+        if base:
+            record += best_dictionary.to_bytes(4, "little")
+        record += best
+        stream += record + bytes(-len(record) % 7)
+    return bytes(stream)
+
+
+def record_offsets(stream, encoding):
+    # where each page's record starts, records are padded to whole blocks
+    header = 6 if encoding == ENCODING_DELTA_PAGES else 2
+    offsets = []
+    offset = 0
+    while offset < len(stream):
+        offsets.append(offset)
+        size = header + int.from_bytes(stream[offset : offset + 2], "little")
+        offset += -(-size // 7) * 7
+    return offsets
+
+
+def add_page_crcs(firmware_bytes, stream, encoding):
+    # each page's record, or its bytes in a raw stream, followed by the CRC-32 of the
+    # page and padding to the end of the block (see CANUpdateHost::AddPageCRCs), and
+    # where each record starts
+    records = None if encoding == ENCODING_RAW else record_offsets(stream, encoding)
+    header = 6 if encoding == ENCODING_DELTA_PAGES else 2
+    crc_stream = bytearray()
+    offsets = []
+    for page, offset in enumerate(range(0, len(firmware_bytes), PAGE_BYTES)):
+        image_page = firmware_bytes[offset : offset + PAGE_BYTES]
+        offsets.append(len(crc_stream))
+        if records is None:
+            record = image_page
+        else:
+            start = records[page]
+            size = header + int.from_bytes(stream[start : start + 2], "little")
+            record = stream[start : start + size]
+        crc_stream += record + zlib.crc32(image_page).to_bytes(4, "little")
+        crc_stream += bytes(-len(crc_stream) % 7)
+    return bytes(crc_stream), offsets
+
+
+def md5_words(digest):
+    return [int.from_bytes(digest[i * 4 : i * 4 + 4], "little") for i in range(4)]
+
+
+def send_base_md5(can_bus, info_message, digest):
+    # the image a delta was made against, for the node to check before it starts
+    for i, word in enumerate(md5_words(digest)):
+        info_message_data = info_message.encode(
+            {"message_type": 2, "base_md5": word, "base_md5_idx": i}
+        )
+        can_bus.send(
+            can.Message(arbitration_id=info_message.frame_id, data=info_message_data)
+        )
+
+
+class Node:
+    # a device's part in an update, see CANUpdateHost::Node
+    def __init__(self, update_id):
+        self.update_id = update_id
+        self.capabilities = 0
+        # the MD5 words and size of the image it runs (0-4) and the pages of this
+        # image it holds (5)
+        self.running = {}
+        self.received_md5 = False
+        self.received_len = False
+        self.done = False
+        self.failed = False
+        self.base = 0
+        self.acked = set()
+        self.send_seq = {}
+        self.acked_seq = 0
+        self.last_write_stalls = 0
+        self.last_progress = time.monotonic()
+
 
 def on_upload(source, target, env):
     firmware_path = str(source[0])
@@ -40,12 +186,22 @@ def on_upload(source, target, env):
         print(hashlib.md5(firmware_bytes).hexdigest())
         firmware.seek(0)
 
+        # several devices are updated at once over a group ID they all listen on,
+        # a single one over its own
+        update_ids = [
+            int(update_id, 0)
+            for update_id in can_update_config.get("update_message_id").split(",")
+        ]
+        if len(update_ids) > 1 and "update_group_id" not in can_update_config:
+            print("Updating several devices needs an update_group_id")
+            env.Exit(1)
+        group_id = int(can_update_config.get("update_group_id", str(update_ids[0])), 0)
         data_message = db.get_message_by_name("update_data_message")
-        data_message.frame_id = int(can_update_config.get("update_message_id"), 0)
+        data_message.frame_id = group_id
         info_message = db.get_message_by_name("update_info_message")
-        info_message.frame_id = data_message.frame_id + 1
+        info_message.frame_id = group_id + 1
         progress_message = db.get_message_by_name("update_progress_message")
-        progress_message.frame_id = data_message.frame_id + 2
+        progress_message.frame_id = update_ids[0] + 2
 
         can_bus = can.interface.Bus(
             "can0",
@@ -90,8 +246,33 @@ def on_upload(source, target, env):
                 bitrate=int(can_update_config.get("update_baud")),
             )
 
-        received_md5 = False
-        while not received_md5:
+        # what each device reported: its capabilities, the MD5 words and size of the
+        # image it runs and the pages of this image it holds from an update that
+        # stopped, and how far its transfer got
+        nodes = [Node(update_id) for update_id in update_ids]
+        reports = {}
+        for node in nodes:
+            reports[node.update_id + 2] = (node, "update_progress_message")
+            reports[node.update_id + 3] = (node, "update_ack_message")
+            reports[node.update_id + 4] = (node, "update_base_message")
+
+        def receive(timeout):
+            # the messages the devices sent, with the device that sent each
+            msg = can_bus.recv(timeout)
+            while msg is not None:
+                if msg.arbitration_id in reports:
+                    node, name = reports[msg.arbitration_id]
+                    yield node, name, db.decode_message(name, msg.data)
+                msg = can_bus.recv(0.00001)
+
+        def active():
+            return [node for node in nodes if not node.failed and not node.done]
+
+        def leave_out(node, reason):
+            node.failed = True
+            print(f"Leaving {node.update_id:#x} out, {reason}")
+
+        while not all(node.received_md5 for node in nodes):
             for i in range(4):
                 info_message_data = info_message.encode(
                     {
@@ -109,42 +290,136 @@ def on_upload(source, target, env):
                     )
                 )
                 time.sleep(0.02)
-            msg = can_bus.recv(0.1)
-            if (msg != None) and msg.arbitration_id == progress_message.frame_id:
-                received_progress_msg = db.decode_message(
-                    "update_progress_message", msg.data
-                )
-                if received_progress_msg["received_md5"]:
-                    received_md5 = True
-            while msg is not None:
-                msg = can_bus.recv(0.00001)
+            # a device reports the image it runs just before the progress
+            for node, name, decoded in receive(0.1):
+                if name == "update_base_message":
+                    node.running[decoded["base_index"]] = decoded["base_value"]
+                elif name == "update_progress_message" and decoded["received_md5"]:
+                    node.received_md5 = True
+                    node.capabilities = decoded["capabilities"]
 
-        info_message_data = info_message.encode(
-            {"message_type": 0, "update_length": len(firmware_bytes)}
-        )
-        received_len = False
+        # the encoding has to suit every device, and a delta needs all of them to run
+        # the same image
+        capabilities = ~0
+        for node in nodes:
+            capabilities &= node.capabilities
+        running = {tuple(node.running.get(i) for i in range(5)) for node in nodes}
+
+        # images sent before are kept by MD5, to send deltas against the one the
+        # devices run
+        cache_dir = os.path.join(env.subst("$PROJECT_WORKSPACE_DIR"), "can_update")
+        base = None
+        node_base = next(iter(running))
+        same_base = len(running) == 1 and None not in node_base
+        if capabilities & CAPABILITY_DELTA and same_base:
+            base_md5 = b"".join(word.to_bytes(4, "little") for word in node_base[:4])
+            base_path = os.path.join(cache_dir, base_md5.hex() + ".bin")
+            if os.path.exists(base_path):
+                with open(base_path, "rb") as base_file:
+                    base = base_file.read()
+                if len(base) != node_base[4] or hashlib.md5(base).digest() != base_md5:
+                    base = None
 
-        while not received_len:
+        # devices that check each page's CRC ask for a corrupt one again
+        page_crc = bool(capabilities & CAPABILITY_PAGE_CRC)
+
+        def select_encoding(allow_delta):
+            # the stream, its encoding and where each page's record starts
+            if allow_delta and base is not None:
+                stream = build_pages(firmware_bytes, base)
+                encoding = ENCODING_DELTA_PAGES
+            elif capabilities & CAPABILITY_DEFLATE:
+                stream = build_pages(firmware_bytes)
+                encoding = ENCODING_DEFLATE_PAGES
+            else:
+                stream = firmware_bytes
+                encoding = ENCODING_RAW
+            if page_crc:
+                stream, offsets = add_page_crcs(firmware_bytes, stream, encoding)
+                return stream, encoding, offsets
+            if encoding == ENCODING_RAW:
+                return stream, encoding, range(0, len(stream), PAGE_BYTES)
+            return stream, encoding, record_offsets(stream, encoding)
+
+        def resume(stream, offsets):
+            # the stream from the first page none of the devices lacks, the last page
+            # is always sent (see CANUpdateHost::SelectEncoding)
+            page_count = (len(firmware_bytes) + PAGE_BYTES - 1) // PAGE_BYTES
+            first_page = 0
+            if capabilities & CAPABILITY_RESUME:
+                held = min(node.running.get(5, 0) for node in nodes if not node.failed)
+                first_page = min(held, page_count - 1, 0xFFFF)
+            return stream[offsets[first_page] :], first_page
+
+        full_stream, encoding, offsets = select_encoding(True)
+        if encoding == ENCODING_DELTA_PAGES:
+            print(
+                f"Sending {len(full_stream)} bytes of changes against {base_md5.hex()}"
+            )
+        elif encoding == ENCODING_DEFLATE_PAGES:
+            print(f"Compressed {len(firmware_bytes)} bytes to {len(full_stream)}")
+        stream, first_page = resume(full_stream, offsets)
+        if first_page > 0:
+            print(f"Resuming after the {first_page} pages the devices hold")
+        delta_starts = 0
+
+        while not all(node.received_len or node.failed for node in nodes):
+            if encoding == ENCODING_DELTA_PAGES:
+                delta_starts += 1
+                if delta_starts > DELTA_START_ATTEMPTS and len(nodes) > 1:
+                    # the others started on the delta already
+                    for node in nodes:
+                        if not node.received_len and not node.failed:
+                            leave_out(node, "it turned the delta down")
+                    continue
+                if delta_starts > DELTA_START_ATTEMPTS:
+                    print("The device turned the delta down, sending the full image")
+                    full_stream, encoding, offsets = select_encoding(False)
+                    stream, first_page = resume(full_stream, offsets)
+                else:
+                    send_base_md5(can_bus, info_message, base_md5)
+            info_message_data = info_message.encode(
+                {
+                    "message_type": 0,
+                    "update_length": len(firmware_bytes),
+                    "update_encoding": encoding,
+                    "update_page_crc": int(page_crc),
+                    "update_first_page": first_page,
+                }
+            )
             can_bus.send(
                 can.Message(
                     arbitration_id=info_message.frame_id, data=info_message_data
                 )
             )
             time.sleep(0.01)
-            msg = can_bus.recv(0.05)
-            if (msg != None) and msg.arbitration_id == progress_message.frame_id:
-                received_progress_msg = db.decode_message(
-                    "update_progress_message", msg.data
-                )
-                if received_progress_msg["received_len"]:
-                    received_len = True
-                    print("Old firmware version: " + hex(received_progress_msg["fw_version"]))
-            while msg is not None:
-                msg = can_bus.recv(0.00001)
+            for node, name, decoded in receive(0.05):
+                if node.failed or node.received_len:
+                    continue
+                if name == "update_base_message":
+                    index = decoded["base_index"]
+                    node.running[index] = decoded["base_value"]
+                    # a device that turned the resumed start down reports what it holds
+                    if index == 5 and decoded["base_value"] < first_page:
+                        if len(nodes) > 1:
+                            leave_out(node, "it doesn't hold the pages")
+                        else:
+                            print("The device doesn't hold the pages, starting over")
+                            stream, first_page = resume(full_stream, offsets)
+                elif name == "update_progress_message" and decoded["received_len"]:
+                    node.received_len = True
+                    print(
+                        f"Old firmware version of {node.update_id:#x}: "
+                        + hex(decoded["fw_version"])
+                    )
+        if not active():
+            can_bus.shutdown()
+            print("Update failed, no device started it")
+            env.Exit(1)
         tqdm._instances.clear()
         bar = tqdm(
             desc="Upload Progress",
-            total=len(firmware_bytes),
+            total=len(stream),
             dynamic_ncols=True,
             unit="B",
             unit_scale=True,
@@ -152,79 +427,208 @@ def on_upload(source, target, env):
             leave=True,
         )
 
-        msgs_in_block = 4
-
-        max_block_written = -1
-        last_update = 0
-        while max_block_written < math.floor((len(firmware_bytes) + 6) / 7) - 1:
-            for j in range(msgs_in_block):
-                data_idx = max_block_written + j + 1
-                if data_idx < math.floor((len(firmware_bytes) + 6) / 7):
-                    data = 0
-                    for b in range(min(7, len(firmware_bytes) - (data_idx * 7))):
-                        data = data + (firmware_bytes[(data_idx * 7) + b] << (8 * b))
-                    data_message_data = data_message.encode(
-                        {
-                            "data_block_index_low": data_idx & 0xFF,
-                            "update_data": data,
-                        }
-                    )
-                    can_bus.send(
-                        can.Message(
-                            arbitration_id=data_message.frame_id
-                            + (
-                                (data_idx << 3) & 0x1FFFF800
-                            ),  # 18 bits of CAN extended ID, not including standard ID
-                            data=data_message_data,
-                        )
-                    )
-                    time.sleep(1 / 3817)
+        block_count = (len(stream) + 6) // 7
+
+        def data_frame(idx, frame_id):
+            data = int.from_bytes(stream[idx * 7 : idx * 7 + 7], "little")
+            # 18 bits of CAN extended ID, not including standard ID
+            return can.Message(
+                arbitration_id=frame_id + ((idx << 3) & 0x1FFFF800),
+                data=data_message.encode(
+                    {"data_block_index_low": idx & 0xFF, "update_data": data}
+                ),
+            )
+
+        if capabilities & CAPABILITY_WINDOWED:
+            # keep WINDOW blocks past the slowest device in flight and resend only the
+            # ones acks show missing: frames arrive in order, so an unacked block sent
+            # before one the device has acked was lost
+            next_block = 0
+            seq = 0
+            retransmitted = 0
+            bad_pages = 0
+            # times the devices' flash writers held reception up
+            write_stalls = 0
+            last_update = 0
+
+            def send_block(idx, to=None):
+                # on the group ID unless only one device is missing it
+                nonlocal seq
+                seq += 1
+                for node in nodes:
+                    if to is None or node is to:
+                        node.send_seq[idx] = seq
+                frame_id = group_id if to is None else to.update_id
+                send_frame(can_bus, data_frame(idx, frame_id))
 
-                msg = can_bus.recv(1 / 3817)
-                while msg is not None:
-                    if msg.arbitration_id == progress_message.frame_id:
-                        received_progress_msg = db.decode_message(
-                            "update_progress_message", msg.data
+            while active():
+                lost = {}
+                for node in active():
+                    for idx in range(node.base, next_block):
+                        if idx in node.acked or node.send_seq[idx] >= node.acked_seq:
+                            continue
+                        lost.setdefault(idx, []).append(node)
+                for idx, missing in sorted(lost.items()):
+                    send_block(idx, missing[0] if len(missing) == 1 else None)
+                    retransmitted += 1
+                window_base = min(node.base for node in active())
+                while next_block < min(window_base + WINDOW, block_count):
+                    send_block(next_block)
+                    next_block += 1
+
+                for node, name, decoded in receive(0.001):
+                    if node.failed or node.done:
+                        continue
+                    if name == "update_ack_message":
+                        # the count of stalls wraps at 64
+                        stalls = decoded["ack_write_stalls"]
+                        write_stalls += (stalls - node.last_write_stalls) % 64
+                        node.last_write_stalls = stalls
+                        ack_base = decoded["ack_base"]
+                        if page_crc and ack_base < node.base:
+                            # the device dropped a corrupt page and the blocks after
+                            # it, the others drop the ones they have
+                            node.base = ack_base
+                            node.acked = set()
+                            node.last_progress = time.monotonic()
+                            next_block = min(next_block, ack_base)
+                            bad_pages += 1
+                            continue
+                        if node.base < ack_base <= next_block:
+                            node.base = ack_base
+                            node.acked_seq = max(
+                                node.acked_seq, node.send_seq[ack_base - 1]
+                            )
+                            node.acked = {idx for idx in node.acked if idx >= ack_base}
+                            node.last_progress = time.monotonic()
+                        if ack_base == node.base:
+                            bitmap = decoded["ack_bitmap"]
+                            for n in range(32):
+                                idx = node.base + 1 + n
+                                if (bitmap >> n) & 1 and idx < next_block:
+                                    node.acked.add(idx)
+                                    node.acked_seq = max(
+                                        node.acked_seq, node.send_seq[idx]
+                                    )
+                    elif name == "update_progress_message":
+                        if not decoded["received_len"]:
+                            if len(nodes) == 1:
+                                bar.close()
+                                can_bus.shutdown()
+                                print("Update failed, the device reset the update")
+                                env.Exit(1)
+                            leave_out(node, "it reset the update")
+                        elif decoded["written"]:
+                            node.base = block_count
+                            node.done = True
+
+                for node in active():
+                    stalled = time.monotonic() - node.last_progress > RETRANSMIT_TIMEOUT
+                    if node.base < next_block and stalled:
+                        # no ack has moved the window, the acks may have been lost
+                        for idx in range(node.base, next_block):
+                            if idx not in node.acked:
+                                send_block(idx, node)
+                                retransmitted += 1
+                        node.last_progress = time.monotonic()
+
+                bases = [node.base for node in nodes if not node.failed]
+                acked = min(bases, default=block_count)
+                if acked - last_update >= 2048 or acked == block_count:
+                    bar.update((acked - last_update) * 7)
+                    last_update = acked
+            print(
+                f"\n{retransmitted} blocks retransmitted, {bad_pages} pages sent "
+                f"again, {write_stalls} write stalls"
+            )
+        elif len(nodes) > 1:
+            bar.close()
+            can_bus.shutdown()
+            print("Updating several devices needs the windowed protocol on all of them")
+            env.Exit(1)
+        else:
+            # devices from before the windowed protocol only take the next block
+            msgs_in_block = 4
+
+            max_block_written = -1
+            last_update = 0
+            while max_block_written < math.floor((len(firmware_bytes) + 6) / 7) - 1:
+                for j in range(msgs_in_block):
+                    data_idx = max_block_written + j + 1
+                    if data_idx < math.floor((len(firmware_bytes) + 6) / 7):
+                        data = 0
+                        for b in range(min(7, len(firmware_bytes) - (data_idx * 7))):
+                            data = data + (firmware_bytes[(data_idx * 7) + b] << (8 * b))
+                        data_message_data = data_message.encode(
+                            {
+                                "data_block_index_low": data_idx & 0xFF,
+                                "update_data": data,
+                            }
                         )
-                        # print(db.decode_message("update_progress_message", data_message_data))
-                        # print(i)
-                        if received_progress_msg["written"] == True:
-                            if (
-                                received_progress_msg["update_block_idx"]
-                                > max_block_written
-                            ):
-                                max_block_written = received_progress_msg[
-                                    "update_block_idx"
-                                ]
-                        else:
-                            if (
-                                received_progress_msg["update_block_idx"] - 1
-                                > max_block_written
-                            ):
-                                max_block_written = (
+                        can_bus.send(
+                            can.Message(
+                                arbitration_id=data_message.frame_id
+                                + (
+                                    (data_idx << 3) & 0x1FFFF800
+                                ),  # 18 bits of CAN extended ID, not including standard ID
+                                data=data_message_data,
+                            )
+                        )
+                        time.sleep(1 / 3817)
+
+                    msg = can_bus.recv(1 / 3817)
+                    while msg is not None:
+                        if msg.arbitration_id == progress_message.frame_id:
+                            received_progress_msg = db.decode_message(
+                                "update_progress_message", msg.data
+                            )
+                            # print(db.decode_message("update_progress_message", data_message_data))
+                            # print(i)
+                            if received_progress_msg["written"] == True:
+                                if (
+                                    received_progress_msg["update_block_idx"]
+                                    > max_block_written
+                                ):
+                                    max_block_written = received_progress_msg[
+                                        "update_block_idx"
+                                    ]
+                            else:
+                                if (
                                     received_progress_msg["update_block_idx"] - 1
-                                )
-                    msg = can_bus.recv(0.000001)
+                                    > max_block_written
+                                ):
+                                    max_block_written = (
+                                        received_progress_msg["update_block_idx"] - 1
+                                    )
+                        msg = can_bus.recv(0.000001)
 
-            if max_block_written - last_update >= 2048:
-                bar.update((max_block_written - last_update) * 7)
-                last_update = max_block_written
-                # time.sleep(0.1)
+                if max_block_written - last_update >= 2048:
+                    bar.update((max_block_written - last_update) * 7)
+                    last_update = max_block_written
+                    # time.sleep(0.1)
         bar.close()
         print()
-        msg = can_bus.recv(1 / 3817)
-        recd = False
-        while not recd:
-            if msg is not None and msg.arbitration_id == progress_message.frame_id:
-                recd = True
-                received_progress_msg = db.decode_message(
-                    "update_progress_message", msg.data
-                )
-                print("New firmware version: " + hex(received_progress_msg["fw_version"]))
-            else:
-                msg = can_bus.recv(1 / 3817)
+        # each device reports the version it boots into
+        updated = [node for node in nodes if not node.failed]
+        while updated:
+            for node, name, decoded in receive(1 / 3817):
+                if name == "update_progress_message" and node in updated:
+                    updated.remove(node)
+                    print(
+                        f"New firmware version of {node.update_id:#x}: "
+                        + hex(decoded["fw_version"])
+                    )
+
+        os.makedirs(cache_dir, exist_ok=True)
+        image_name = hashlib.md5(firmware_bytes).hexdigest() + ".bin"
+        with open(os.path.join(cache_dir, image_name), "wb") as image_file:
+            image_file.write(firmware_bytes)
 
         can_bus.shutdown()
+        failed = [f"{node.update_id:#x}" for node in nodes if node.failed]
+        if failed:
+            print("Update failed on " + ", ".join(failed))
+            env.Exit(1)
 
 
 try:
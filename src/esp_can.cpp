@@ -5,6 +5,7 @@
 
 #include "driver/gpio.h"
 #include "driver/twai.h"
+#include "esp_idf_version.h"
 
 std::vector<ICANRXMessage *> ESPCAN::rx_messages_{};
 
@@ -58,31 +59,35 @@ void ESPCAN::Initialize(BaudRate baud)
     }
 }
 
+// Only uses locals so it can be called from multiple tasks, the TWAI driver serializes access to the hardware (taps
+// then also see frames from several tasks, which CANRawTap allows)
 bool ESPCAN::SendMessage(CANMessage &msg)
 {
-    static twai_status_info_t status;
+    twai_status_info_t status;
     twai_get_status_info(&status);
     if (status.state != TWAI_STATE_RUNNING)
     {
         return false;
     }
 
-    static twai_message_t t_message;
+    twai_message_t t_message{};
     t_message.identifier = msg.id_;
     t_message.extd = msg.extended_id_;
     t_message.data_length_code = msg.len_;
     t_message.rtr = 0;
+    memcpy(t_message.data, msg.data_.data(), sizeof(t_message.data));
 
-    for (int i = 0; i < msg.len_; i++)
+    if (twai_transmit(&t_message, TickType_t(10)) != ESP_OK)
     {
-        t_message.data[i] = msg.data_[i];
+        return false;
     }
-
-    return twai_transmit(&t_message, TickType_t(10)) == ESP_OK;
+    TapFrame(msg, true);
+    return true;
 }
 
 void ESPCAN::Tick()
 {
+    CAN_PROFILE_START(tick);
     const uint8_t kMaxEvents = 100;
     static std::array<uint8_t, 8> msg_data{};
     static CANMessage received_message{0, 8, msg_data};
@@ -90,6 +95,18 @@ void ESPCAN::Tick()
     static twai_status_info_t status;
     twai_get_status_info(&status);
 
+#ifdef CAN_PROFILING
+    CANDriverProfile &profile = CANProfiler::Instance().Driver();
+    profile.rx_queue_high_water.Record(status.msgs_to_rx);
+    profile.rx_missed.store(status.rx_missed_count, std::memory_order_relaxed);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    profile.rx_overruns.store(status.rx_overrun_count, std::memory_order_relaxed);
+#endif
+    profile.tx_failed.store(status.tx_failed_count, std::memory_order_relaxed);
+    profile.bus_errors.store(status.bus_error_count, std::memory_order_relaxed);
+    profile.arbitration_lost.store(status.arb_lost_count, std::memory_order_relaxed);
+#endif
+
     if (status.state == TWAI_STATE_BUS_OFF)
     {
         twai_initiate_recovery();
@@ -104,15 +121,19 @@ void ESPCAN::Tick()
     {
         if (twai_receive(&r_message, TickType_t(100)) == ESP_OK)
         {
+            CAN_PROFILE_START(rx_dispatch);
             received_message.id_ = r_message.identifier;
+            received_message.extended_id_ = r_message.extd;
             received_message.len_ = r_message.data_length_code;
 
             memcpy(received_message.data_.data(), r_message.data, 8);
+            TapFrame(received_message, false);
 
             for (size_t i = 0; i < rx_messages_.size(); i++)
             {
                 rx_messages_[i]->DecodeSignals(received_message);
             }
+            CAN_PROFILE_RECORD(rx_dispatch, CANProfiler::Instance().Driver().rx_dispatch_cycles);
         }
         else
         {
@@ -121,6 +142,7 @@ void ESPCAN::Tick()
         twai_get_status_info(&status);
         events++;
     }
+    CAN_PROFILE_RECORD(tick, CANProfiler::Instance().Driver().tick_cycles);
 }
 
 #endif
\ No newline at end of file
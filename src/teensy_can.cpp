@@ -4,6 +4,9 @@
 template <uint8_t bus_num>
 std::vector<ICANRXMessage *> TeensyCAN<bus_num>::rx_messages_{};
 
+template <uint8_t bus_num>
+TeensyCAN<bus_num> *TeensyCAN<bus_num>::instance_{nullptr};
+
 FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_256> can_bus_1;
 FlexCAN_T4<CAN2, RX_SIZE_256, TX_SIZE_256> can_bus_2;
 FlexCAN_T4<CAN3, RX_SIZE_256, TX_SIZE_256> can_bus_3;
@@ -11,6 +14,7 @@ FlexCAN_T4<CAN3, RX_SIZE_256, TX_SIZE_256> can_bus_3;
 template <uint8_t bus_num>
 void TeensyCAN<bus_num>::Initialize(BaudRate baud)
 {
+    instance_ = this;
     // Repeated code due to limitations of C++11, look into alternatives without repeated code
     if (bus_num == 2)
     {
@@ -41,6 +45,7 @@ void TeensyCAN<bus_num>::Initialize(BaudRate baud)
 template <uint8_t bus_num>
 void TeensyCAN<bus_num>::Tick()
 {
+    CAN_PROFILE_START(tick);
     // Repeated code due to limitations of C++11, look into alternatives without repeated code
     uint8_t remaining = 1;
     const uint8_t kMaxEvents{100};
@@ -58,7 +63,10 @@ void TeensyCAN<bus_num>::Tick()
         {
             remaining = can_bus_1.events();
         }
+        // events() returns how many frames were still queued by the RX interrupt
+        CAN_PROFILE_HIGH_WATER(CANProfiler::Instance().Driver().rx_queue_high_water, remaining);
     }
+    CAN_PROFILE_RECORD(tick, CANProfiler::Instance().Driver().tick_cycles);
 }
 
 template <uint8_t bus_num>
@@ -68,11 +76,7 @@ bool TeensyCAN<bus_num>::SendMessage(CANMessage &msg)
     msg_t.id = msg.id_;
     msg_t.flags.extended = msg.extended_id_;
     msg_t.len = msg.len_;
-
-    for (int i = 0; i < 8; i++)
-    {
-        msg_t.buf[i] = msg.data_[i];
-    }
+    memcpy(msg_t.buf, msg.data_.data(), sizeof(msg_t.buf));
 
     // Repeated code due to limitations of C++11, look into alternatives without repeated code
     if (bus_num == 2)
@@ -88,17 +92,24 @@ bool TeensyCAN<bus_num>::SendMessage(CANMessage &msg)
         can_bus_1.write(msg_t);
     }
 
+    TapFrame(msg, true);
     return true;
 }
 
 template <uint8_t bus_num>
 _MB_ptr TeensyCAN<bus_num>::ProcessMessage = [](const CAN_message_t &msg) {
+    CAN_PROFILE_START(rx_dispatch);
     std::array<uint8_t, 8> msg_data{};
     memcpy(msg_data.data(), msg.buf, 8);
-    CANMessage received_message{static_cast<uint32_t>(msg.id), msg.len, msg_data};
+    CANMessage received_message{static_cast<uint32_t>(msg.id), msg.flags.extended, msg.len, msg_data};
+    if (instance_ != nullptr)
+    {
+        instance_->TapFrame(received_message, false);
+    }
     for (size_t i = 0; i < rx_messages_.size(); i++)
     {
         rx_messages_[i]->DecodeSignals(received_message);
     }
+    CAN_PROFILE_RECORD(rx_dispatch, CANProfiler::Instance().Driver().rx_dispatch_cycles);
 };
 #endif
\ No newline at end of file
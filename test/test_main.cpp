@@ -1,9 +1,33 @@
 #define NATIVE  // to make can interface increment last receive time
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
+#include "can_bus_statistics.h"
+#include "can_columnar.h"
 #include "can_interface.h"
+#include "can_log.h"
+#include "can_log_decoder.h"
+#include "can_log_index.h"
+#include "can_log_replay.h"
+#include "can_raw_tap.h"
+#include "can_resampler.h"
+#include "can_schedulability.h"
+#include "can_tx_queue.h"
+#include "can_update.h"
+#include "dbc_database.h"
+#include "dbc_decode_table.h"
+#include "dbc_packer.h"
+#include "dbc_traffic_generator.h"
+#include "md5.h"
 #include "unity.h"
+#include "virtual_can_bus.h"
 
 void setUp(void)
 {
@@ -363,6 +387,2228 @@ void SafeRawSignalLimitTest(void)
     TEST_ASSERT_EQUAL_HEX8(min_value_signed, test_signal_signed_2);
 }
 
+void CANTXMessageEncodeInPlaceTest(void)
+{
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) tx_signal_0;
+    MakeUnsignedCANSignal(uint16_t, 8, 16, 1, 0) tx_signal_1;
+    MockCAN can{};
+    CANTXMessage<2> tx_msg{can, 0x100, 3, 100, tx_signal_0, tx_signal_1};
+
+    tx_signal_0 = 0xFF;
+    tx_signal_1 = 0xABCD;
+    tx_msg.EncodeAndSend();
+    TEST_ASSERT_EQUAL_HEX32(0x100, can.last_message.id_);
+    TEST_ASSERT_EQUAL_HEX64(0xABCDFF, *reinterpret_cast<uint64_t *>(can.last_message.data_.data()));
+
+    // bits from the previous frame must not leak into the next one now that there is no zeroed temporary buffer
+    tx_signal_0 = 0;
+    tx_signal_1 = 0x0001;
+    tx_msg.EncodeAndSend();
+    TEST_ASSERT_EQUAL_HEX64(0x000100, *reinterpret_cast<uint64_t *>(can.last_message.data_.data()));
+
+    // the transmit timer is part of the interface on native builds too
+    ICANTXMessage &message = tx_msg;
+    TEST_ASSERT_TRUE(&message.GetTransmitTimer() == &tx_msg.GetTransmitTimer());
+}
+
+// Records every frame sent through it, and lets tests deliver received frames to registered messages
+class RecordingCAN : public ICAN
+{
+public:
+    void Initialize(BaudRate baud __attribute__((unused))) override {}
+    bool SendMessage(CANMessage &msg) override
+    {
+        frames.push_back(msg);
+        return true;
+    }
+    void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages.push_back(&msg); }
+    void Tick() override {}
+
+    void Receive(CANMessage msg)
+    {
+        for (ICANRXMessage *rx_message : rx_messages)
+        {
+            rx_message->DecodeSignals(msg);
+        }
+    }
+
+    std::vector<CANMessage> frames;
+    std::vector<ICANRXMessage *> rx_messages;
+};
+
+void CANTXQueueMultiProducerStressTest(void)
+{
+    const uint32_t kFramesPerRun = 1 << 18;
+    for (uint32_t num_producers : {1u, 2u, 4u, 8u})
+    {
+        RecordingCAN can{};
+        can.frames.reserve(kFramesPerRun);
+        CANTXQueue<256> tx_queue{can};
+        const uint32_t frames_per_producer = kFramesPerRun / num_producers;
+        std::atomic<bool> start{false};
+
+        std::vector<std::thread> producers;
+        for (uint32_t producer = 0; producer < num_producers; producer++)
+        {
+            producers.emplace_back(
+                [&, producer]()
+                {
+                    while (!start)
+                    {
+                        std::this_thread::yield();
+                    }
+                    for (uint32_t sequence = 0; sequence < frames_per_producer; sequence++)
+                    {
+                        // second word lets the consumer detect torn or mixed-up payloads
+                        uint32_t check = sequence ^ (producer * 0x9E3779B9u);
+                        std::array<uint8_t, 8> data{};
+                        memcpy(data.data(), &sequence, 4);
+                        memcpy(data.data() + 4, &check, 4);
+                        CANMessage msg{0x100 + producer, 8, data};
+                        while (!tx_queue.SendMessage(msg))
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        start = true;
+        while (can.frames.size() < frames_per_producer * num_producers)
+        {
+            if (tx_queue.Drain() == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        for (std::thread &producer : producers)
+        {
+            producer.join();
+        }
+
+        std::vector<uint32_t> next_sequence(num_producers, 0);
+        uint32_t corrupted = 0;
+        for (CANMessage &frame : can.frames)
+        {
+            uint32_t producer = frame.id_ - 0x100;
+            uint32_t sequence;
+            uint32_t check;
+            memcpy(&sequence, frame.data_.data(), 4);
+            memcpy(&check, frame.data_.data() + 4, 4);
+            if (producer >= num_producers || frame.len_ != 8 || check != (sequence ^ (producer * 0x9E3779B9u))
+                || sequence != next_sequence[producer])
+            {
+                corrupted++;
+                continue;
+            }
+            next_sequence[producer]++;
+        }
+        TEST_ASSERT_EQUAL(0, corrupted);
+        TEST_ASSERT_EQUAL(0, tx_queue.GetQueuedCount());
+        for (uint32_t producer = 0; producer < num_producers; producer++)
+        {
+            TEST_ASSERT_EQUAL(frames_per_producer, next_sequence[producer]);
+        }
+        std::cout << std::dec << "CANTXQueue: " << num_producers << " producer(s), "
+                  << static_cast<uint64_t>(can.frames.size() / seconds) << " frames/s" << std::endl;
+    }
+}
+
+void CANBusStatisticsTest(void)
+{
+    TEST_ASSERT_EQUAL(135, CANWorstCaseFrameBits(8, false));
+    TEST_ASSERT_EQUAL(160, CANWorstCaseFrameBits(8, true));
+    TEST_ASSERT_EQUAL(55, CANWorstCaseFrameBits(0, false));
+
+    RecordingCAN can{};
+    uint32_t now_us = 0;
+    CANBusStatistics<8> statistics{can, [&now_us]() { return now_us; }, 100000};
+    statistics.Initialize(ICAN::BaudRate::kBaud500K);
+    statistics.SetExpectedPeriod(0x400, 10);
+
+    CANMessage tx_msg{0x100, 8, std::array<uint8_t, 8>{}};
+    CANMessage rx_msg{0x400, 4, std::array<uint8_t, 8>{}};
+    // 0x400 arrives every 10 ms, except one 12 ms interval and one gap where 2 frames are missing
+    const uint32_t rx_times_ms[] = {0, 10, 20, 32, 40, 70, 80};
+    for (uint32_t time_ms : rx_times_ms)
+    {
+        now_us = time_ms * 1000;
+        can.Receive(rx_msg);
+        statistics.SendMessage(tx_msg);
+    }
+    TEST_ASSERT_EQUAL(7, can.frames.size());
+
+    const CANBusStatistics<8>::IDStatistics *rx_statistics = statistics.GetIDStatistics(0x400);
+    TEST_ASSERT_NOT_NULL(rx_statistics);
+    TEST_ASSERT_EQUAL(7, rx_statistics->rx_frames);
+    TEST_ASSERT_EQUAL(0, rx_statistics->tx_frames);
+    TEST_ASSERT_EQUAL(28, rx_statistics->rx_bytes);
+    TEST_ASSERT_EQUAL(8000, rx_statistics->min_interval_us);
+    TEST_ASSERT_EQUAL(30000, rx_statistics->max_interval_us);
+    TEST_ASSERT_EQUAL(20000, rx_statistics->max_jitter_us);
+    TEST_ASSERT_EQUAL(2, rx_statistics->missed_frames);
+    TEST_ASSERT_EQUAL(2, statistics.GetTotalMissedFrames());
+
+    const CANBusStatistics<8>::IDStatistics *tx_statistics = statistics.GetIDStatistics(0x100);
+    TEST_ASSERT_NOT_NULL(tx_statistics);
+    TEST_ASSERT_EQUAL(7, tx_statistics->tx_frames);
+    TEST_ASSERT_EQUAL(56, tx_statistics->tx_bytes);
+    TEST_ASSERT_NULL(statistics.GetIDStatistics(0x101));
+
+    // 7 * (135 + 95) bits over 100 ms at 500 kbit/s
+    now_us = 100000;
+    statistics.Tick();
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, 7 * (135 + 95) / 50000.0, statistics.GetBusLoad());
+
+    // more IDs than the table holds are still counted in the totals
+    for (uint32_t id = 0; id < 16; id++)
+    {
+        CANMessage msg{0x200 + id, 8, std::array<uint8_t, 8>{}};
+        can.Receive(msg);
+    }
+    TEST_ASSERT_EQUAL(23, statistics.GetTotalRXFrames());
+    TEST_ASSERT_EQUAL(10, statistics.GetUntrackedFrames());
+}
+
+void DBCDatabaseTest(void)
+{
+    const std::string dbc =
+        "VERSION \"\"\n"
+        "NS_ :\n"
+        "\tCM_\n"
+        "\tBA_\n"
+        "BS_:\n"
+        "BU_: Motor Logger\n"
+        "BO_ 256 Motor_Status: 8 Motor\n"
+        " SG_ Speed : 0|16@1+ (0.5,-100) [-100|1000] \"rpm\" Logger\n"
+        " SG_ Current : 23|12@0- (0.1,0) [-200|200] \"A\" Logger,Motor\n"
+        "BO_ 2147483905 Extended: 2 Logger\n"
+        " SG_ Mode M : 0|8@1+ (1,0) [0|0] \"\" Motor\n"
+        " SG_ Value m3 : 8|8@1+ (1,0) [0|0] \"\" Motor\n"
+        "CM_ BO_ 256 \"a comment; spanning\n lines\";\n"
+        "BA_DEF_ BO_  \"GenMsgCycleTime\" INT 0 10000;\n"
+        "BA_DEF_DEF_  \"GenMsgCycleTime\" 0;\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 256 10;\n";
+
+    DBCDatabase database;
+    std::string error;
+    TEST_ASSERT_TRUE(database.Parse(dbc, &error));
+    TEST_ASSERT_EQUAL(2, database.nodes.size());
+    TEST_ASSERT_EQUAL(2, database.messages.size());
+
+    const DBCMessage *motor = database.FindMessage(256);
+    TEST_ASSERT_NOT_NULL(motor);
+    TEST_ASSERT_EQUAL_STRING("Motor_Status", motor->name.c_str());
+    TEST_ASSERT_EQUAL(8, motor->length);
+    TEST_ASSERT_EQUAL(10, motor->cycle_time_ms);
+    TEST_ASSERT_EQUAL(2, motor->signals.size());
+    TEST_ASSERT_EQUAL(16, motor->signals[0].length);
+    TEST_ASSERT_EQUAL_FLOAT(0.5, motor->signals[0].factor);
+    TEST_ASSERT_EQUAL_FLOAT(-100, motor->signals[0].offset);
+    TEST_ASSERT_EQUAL_STRING("rpm", motor->signals[0].unit.c_str());
+    TEST_ASSERT_FALSE(motor->signals[1].little_endian);
+    TEST_ASSERT_TRUE(motor->signals[1].is_signed);
+    TEST_ASSERT_EQUAL(23, motor->signals[1].start_bit);
+    TEST_ASSERT_EQUAL(2, motor->signals[1].receivers.size());
+
+    const DBCMessage *extended = database.FindMessage(0x101, true);
+    TEST_ASSERT_NOT_NULL(extended);
+    TEST_ASSERT_EQUAL(0, extended->cycle_time_ms);
+    TEST_ASSERT(extended->signals[0].multiplexing == DBCSignal::Multiplexing::kMultiplexor);
+    TEST_ASSERT(extended->signals[1].multiplexing == DBCSignal::Multiplexing::kMultiplexed);
+    TEST_ASSERT_EQUAL(3, extended->signals[1].multiplexor_value);
+
+    TEST_ASSERT_FALSE(database.Parse("BO_ 1 Broken 8 Node\n", &error));
+    TEST_ASSERT_NOT_NULL(strstr(error.c_str(), "line 1"));
+
+    // strings hold their text without escapes, and a save escapes them once
+    DBCDatabase escaped;
+    TEST_ASSERT_TRUE(escaped.Parse("BO_ 256 Motor_Status: 8 Motor\n"
+                                   " SG_ Speed : 0|16@1+ (1,0) [0|0] \"\" Vector__XXX\n"
+                                   "CM_ BO_ 256 \"say \\\"hi\\\" to C:\\\\\";\n"
+                                   "VAL_ 256 Speed 0 \"\\\"stopped\\\"\" ;\n"));
+    const DBCMessage *status = escaped.FindMessage(256, false);
+    TEST_ASSERT_EQUAL_STRING("say \"hi\" to C:\\", status->comment.c_str());
+    TEST_ASSERT_EQUAL_STRING("\"stopped\"", status->signals[0].value_descriptions[0].second.c_str());
+    std::string written = escaped.Write();
+    TEST_ASSERT_NOT_NULL(strstr(written.c_str(), "CM_ BO_ 256 \"say \\\"hi\\\" to C:\\\\\";"));
+    DBCDatabase reread;
+    TEST_ASSERT_TRUE(reread.Parse(written));
+    TEST_ASSERT_EQUAL_STRING(status->comment.c_str(), reread.FindMessage(256, false)->comment.c_str());
+    TEST_ASSERT_EQUAL_STRING(written.c_str(), reread.Write().c_str());
+}
+
+void CANResponseTimeAnalysisTest(void)
+{
+    // at 1M a bit is 1 us and an 8 byte standard frame is 135 us
+    std::vector<CANStreamTiming> streams(2);
+    streams[0].id = 0x100;
+    streams[0].length = 8;
+    streams[0].period_us = 1000;
+    streams[0].deadline_us = 1000;
+    streams[1] = streams[0];
+    streams[1].id = 0x101;
+    streams[1].period_us = 500;
+    streams[1].deadline_us = 500;
+
+    std::vector<CANStreamResult> results = AnalyzeCANResponseTimes(streams, 1000000);
+    TEST_ASSERT_EQUAL(135, results[0].frame_bits);
+    TEST_ASSERT_EQUAL_FLOAT(135, results[0].transmission_us);
+    // the highest priority frame can only be blocked by one lower priority frame
+    TEST_ASSERT_EQUAL_FLOAT(135, results[0].blocking_us);
+    TEST_ASSERT_EQUAL_FLOAT(270, results[0].response_us);
+    // the lowest priority frame waits for one instance of the higher priority frame
+    TEST_ASSERT_EQUAL_FLOAT(0, results[1].blocking_us);
+    TEST_ASSERT_EQUAL_FLOAT(270, results[1].response_us);
+    TEST_ASSERT_TRUE(results[0].schedulable);
+    TEST_ASSERT_TRUE(results[1].schedulable);
+    // 0x100 has the longer deadline but wins arbitration
+    TEST_ASSERT_TRUE(results[0].deadline_monotonic_violation);
+    TEST_ASSERT_FALSE(results[1].deadline_monotonic_violation);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, 0.135 + 0.27, CANBusUtilization(streams, 1000000));
+
+    // at 125k each frame takes 1080 us, more than the 500 us deadline
+    results = AnalyzeCANResponseTimes(streams, 125000);
+    TEST_ASSERT_FALSE(results[1].schedulable);
+
+    // a standard frame beats an extended frame with the same base ID
+    TEST_ASSERT(CANArbitrationKey(0x100, false) < CANArbitrationKey(0x100 << 18, true));
+    TEST_ASSERT(CANArbitrationKey(0xFF << 18, true) < CANArbitrationKey(0x100, false));
+}
+
+void DBCPackerTest(void)
+{
+    TEST_ASSERT_EQUAL_HEX64(0xFFFF00, DBCSignalMask(8, 16, true));
+    TEST_ASSERT_EQUAL_HEX64(0xFFFF, DBCSignalMask(7, 16, false));
+    TEST_ASSERT_EQUAL_HEX64(0xF0FF, DBCSignalMask(7, 12, false));
+    TEST_ASSERT_EQUAL_HEX64(0, DBCSignalMask(56, 16, true));
+    TEST_ASSERT_EQUAL_HEX64(0, DBCSignalMask(63, 16, false));
+
+    const std::string dbc =
+        "BU_: Wheel Dash\n"
+        "BO_ 256 Speed: 4 Wheel\n"
+        " SG_ Speed : 0|16@1+ (0.1,0) [0|0] \"mph\" Dash\n"
+        " SG_ Brake_Temp : 16|16@1+ (0.1,-40) [0|0] \"C\" Dash\n"
+        "BO_ 512 Load: 2 Wheel\n"
+        " SG_ Load : 7|16@0- (1,0) [0|0] \"N\" Dash\n"
+        "BO_ 80 Display: 8 Dash\n"
+        " SG_ Page : 0|8@1+ (1,0) [0|0] \"\" Wheel\n"
+        "BO_ 96 Button: 1 Dash\n"
+        " SG_ Pressed : 0|1@1+ (1,0) [0|0] \"\" Wheel\n"
+        "BA_DEF_ BO_  \"GenMsgCycleTime\" INT 0 10000;\n"
+        "BA_DEF_DEF_  \"GenMsgCycleTime\" 0;\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 256 10;\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 512 10;\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 80 100;\n"
+        "VAL_ 96 Pressed 0 \"Released\" 1 \"Pressed\" ;\n";
+    DBCDatabase input;
+    TEST_ASSERT_TRUE(input.Parse(dbc));
+    DBCDatabase output = PackDBCSignals(input);
+
+    // Speed and Load merge into one 6 byte frame, which takes the highest priority ID because it has the shortest cycle
+    TEST_ASSERT_EQUAL(3, output.messages.size());
+    const DBCMessage *merged = output.FindMessage(80);
+    TEST_ASSERT_NOT_NULL(merged);
+    TEST_ASSERT_EQUAL_STRING("Wheel_10ms_0", merged->name.c_str());
+    TEST_ASSERT_EQUAL(10, merged->cycle_time_ms);
+    TEST_ASSERT_EQUAL(6, merged->length);
+    TEST_ASSERT_EQUAL(3, merged->signals.size());
+    uint64_t used = 0;
+    for (const DBCSignal &signal : merged->signals)
+    {
+        uint64_t mask = DBCSignalMask(signal.start_bit, signal.length, signal.little_endian);
+        TEST_ASSERT(mask != 0);
+        TEST_ASSERT_EQUAL_HEX64(0, used & mask);
+        used |= mask;
+    }
+    TEST_ASSERT_FALSE(merged->signals[2].little_endian);
+
+    const DBCMessage *display = output.FindMessage(256);
+    TEST_ASSERT_NOT_NULL(display);
+    TEST_ASSERT_EQUAL_STRING("Display", display->name.c_str());
+    // event driven messages keep their ID and value descriptions
+    const DBCMessage *button = output.FindMessage(96);
+    TEST_ASSERT_NOT_NULL(button);
+    TEST_ASSERT_EQUAL(2, button->signals[0].value_descriptions.size());
+
+    // the written DBC reads back the same
+    DBCDatabase reread;
+    TEST_ASSERT_TRUE(reread.Parse(output.Write()));
+    TEST_ASSERT_EQUAL_STRING(output.Write().c_str(), reread.Write().c_str());
+}
+
+void VirtualCANBusTest(void)
+{
+    TEST_ASSERT_EQUAL(127, CANStuffedFrameBits(CANMessage{0, 8, std::array<uint8_t, 8>{}}));
+    TEST_ASSERT_EQUAL(75, CANStuffedFrameBits(CANMessage{0x100, 3, std::array<uint8_t, 8>{0xAB, 0xCD, 0xFF}}));
+    CANMessage extended{0x18FF50E5, true, 8, std::array<uint8_t, 8>{1, 2, 3, 4, 5, 6, 7, 8}};
+    TEST_ASSERT_EQUAL(143, CANStuffedFrameBits(extended));
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud500K};
+    VirtualCANBus::Endpoint node_a{bus};
+    VirtualCANBus::Endpoint node_b{bus};
+    VirtualCANBus::Endpoint node_c{bus};
+    node_a.Initialize(ICAN::BaudRate::kBaud500K);
+    node_b.Initialize(ICAN::BaudRate::kBaud500K);
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) tx_signal_0;
+    MakeUnsignedCANSignal(uint16_t, 8, 16, 1, 0) tx_signal_1;
+    CANTXMessage<2> tx_msg{node_a, 0x100, 3, 100, tx_signal_0, tx_signal_1};
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) rx_signal_0;
+    MakeUnsignedCANSignal(uint16_t, 8, 16, 1, 0) rx_signal_1;
+    CANRXMessage<2> rx_msg{node_b, 0x100, [&bus]() { return bus.GetMillis(); }, rx_signal_0, rx_signal_1};
+
+    std::vector<std::pair<uint32_t, uint64_t>> received;
+    bus.SetFrameObserver(
+        [&received](const CANMessage &msg, uint64_t queued_ns __attribute__((unused)), uint64_t received_ns)
+        { received.push_back(std::make_pair(msg.id_, received_ns)); });
+
+    // the frame is accepted at the end of EOF: 75 bits minus the 3 bit interframe space, 2 us per bit
+    tx_signal_0 = 0xAB;
+    tx_signal_1 = 0xFFCD;
+    tx_msg.EncodeAndSend();
+    bus.RunFor(100000);
+    TEST_ASSERT_EQUAL(0, received.size());
+    bus.RunFor(100000);
+    TEST_ASSERT_EQUAL(0, static_cast<uint8_t>(rx_signal_0));
+    node_b.Tick();
+    TEST_ASSERT_EQUAL_HEX8(0xAB, rx_signal_0);
+    TEST_ASSERT_EQUAL_HEX16(0xFFCD, rx_signal_1);
+    TEST_ASSERT_EQUAL(1, received.size());
+    TEST_ASSERT_EQUAL(72 * 2000, received[0].second);
+    TEST_ASSERT_EQUAL(200000, bus.GetTimeNs());
+
+    // lower ID wins arbitration, frames queued while the bus is busy wait for it to go idle
+    received.clear();
+    CANMessage low{0x050, 8, std::array<uint8_t, 8>{}};
+    CANMessage high{0x300, 8, std::array<uint8_t, 8>{}};
+    CANMessage middle{0x200, 1, std::array<uint8_t, 8>{}};
+    uint64_t start = bus.GetTimeNs();
+    TEST_ASSERT_TRUE(node_a.SendMessage(high));
+    TEST_ASSERT_TRUE(node_b.SendMessage(low));
+    bus.RunFor(1000);
+    TEST_ASSERT_TRUE(node_a.SendMessage(middle));
+    TEST_ASSERT_TRUE(bus.RunUntilIdle());
+    TEST_ASSERT_EQUAL(3, received.size());
+    TEST_ASSERT_EQUAL_HEX32(0x050, received[0].first);
+    TEST_ASSERT_EQUAL_HEX32(0x300, received[1].first);  // node_a sends in FIFO order
+    TEST_ASSERT_EQUAL_HEX32(0x200, received[2].first);
+    TEST_ASSERT_EQUAL(start + (CANStuffedFrameBits(low) - 3) * 2000, received[0].second);
+    TEST_ASSERT_EQUAL(start + (CANStuffedFrameBits(low) + CANStuffedFrameBits(high) - 3) * 2000, received[1].second);
+    TEST_ASSERT_EQUAL(1, node_a.GetArbitrationLostCount());
+    TEST_ASSERT_EQUAL(4, bus.GetFramesTransmitted());
+
+    // an endpoint that isn't initialized is off the bus
+    TEST_ASSERT_FALSE(node_c.SendMessage(low));
+    TEST_ASSERT_EQUAL(0, node_c.GetRXQueued());
+
+    // frames beyond the RX queue capacity are dropped and counted
+    VirtualCANBus::Endpoint small_rx{bus, VirtualCANBus::TXOrder::kFIFO, 16, 2};
+    small_rx.Initialize(ICAN::BaudRate::kBaud500K);
+    for (int i = 0; i < 3; i++)
+    {
+        node_a.SendMessage(low);
+    }
+    bus.RunUntilIdle();
+    TEST_ASSERT_EQUAL(2, small_rx.GetRXQueued());
+    TEST_ASSERT_EQUAL(1, small_rx.GetRXOverrunCount());
+}
+
+void DBCTrafficGeneratorTest(void)
+{
+    // the runtime codec must produce the same payloads as the compile-time signals
+    DBCSignal scaled;
+    scaled.start_bit = 4;
+    scaled.length = 12;
+    scaled.factor = 0.1;
+    scaled.offset = -40;
+    DBCSignal big_endian_signed;
+    big_endian_signed.start_bit = 39;
+    big_endian_signed.length = 16;
+    big_endian_signed.little_endian = false;
+    big_endian_signed.is_signed = true;
+    MakeUnsignedCANSignal(float, 4, 12, 0.1, -40) scaled_signal;
+    MakeEndianSignedCANSignal(int16_t, 39, 16, 1, 0, ICANSignal::ByteOrder::kBigEndian) big_endian_signal;
+    DBCSignalCodec scaled_codec{scaled};
+    DBCSignalCodec big_endian_codec{big_endian_signed};
+    const double values[] = {-1000, -40, -12.34, 0, 1.05, 250.5, 369.5, 1e6};
+    for (double value : values)
+    {
+        uint64_t expected = 0;
+        scaled_signal = static_cast<float>(value);
+        scaled_signal.EncodeSignal(&expected);
+        big_endian_signal = static_cast<int16_t>(std::max(-32768.0, std::min(32767.0, value)));
+        big_endian_signal.EncodeSignal(&expected);
+        uint64_t actual = 0;
+        scaled_codec.Encode(value, &actual);
+        big_endian_codec.Encode(std::max(-32768.0, std::min(32767.0, value)), &actual);
+        TEST_ASSERT_EQUAL_HEX64(expected, actual);
+        scaled_signal.DecodeSignal(&actual);
+        big_endian_signal.DecodeSignal(&actual);
+        TEST_ASSERT_EQUAL_FLOAT(scaled_signal, scaled_codec.Decode(&actual));
+        TEST_ASSERT_EQUAL(static_cast<int16_t>(big_endian_signal), big_endian_codec.DecodeRaw(&actual));
+    }
+
+    const std::string dbc =
+        "BU_: A\n"
+        "BO_ 256 Fast: 8 A\n"
+        " SG_ Speed : 0|16@1+ (0.5,0) [0|1000] \"\" A\n"
+        "BO_ 512 Muxed: 8 A\n"
+        " SG_ Page M : 0|8@1+ (1,0) [0|0] \"\" A\n"
+        " SG_ Low m0 : 8|8@1+ (1,0) [0|0] \"\" A\n"
+        " SG_ High m1 : 8|8@1+ (1,0) [0|0] \"\" A\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 256 10;\n"
+        "BA_ \"GenMsgCycleTime\" BO_ 512 100;\n";
+    DBCDatabase database;
+    TEST_ASSERT_TRUE(database.Parse(dbc, nullptr));
+    DBCTrafficGenerator::Options options;
+    options.rate_scale = 2;
+    DBCTrafficGenerator generator{database, options};
+    TEST_ASSERT_EQUAL(2, generator.GetStreamCount());
+    TEST_ASSERT_EQUAL_FLOAT(220, generator.GetFramesPerSecond());
+
+    // one simulated second at twice the rate, in time order, with the multiplexor alternating
+    uint64_t previous_ns = 0;
+    uint32_t fast = 0;
+    uint32_t pages[2] = {0, 0};
+    while (generator.PeekTimeNs() < 1000000000ull)
+    {
+        CANMessage frame;
+        uint64_t time_ns = generator.Next(frame);
+        TEST_ASSERT_TRUE(time_ns >= previous_ns);
+        previous_ns = time_ns;
+        TEST_ASSERT_EQUAL(8, frame.len_);
+        if (frame.id_ == 256)
+        {
+            fast++;
+            uint16_t speed = static_cast<uint16_t>(frame.data_[0] | frame.data_[1] << 8);
+            TEST_ASSERT_TRUE(speed <= 2000);
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL(512, frame.id_);
+            TEST_ASSERT_TRUE(frame.data_[0] < 2);
+            pages[frame.data_[0]]++;
+        }
+    }
+    TEST_ASSERT_EQUAL(200, fast);
+    TEST_ASSERT_EQUAL(10, pages[0]);
+    TEST_ASSERT_EQUAL(10, pages[1]);
+
+    // injected errors are reported, and the unknown ID isn't one of the DBC's
+    options.error_rate = 1;
+    DBCTrafficGenerator faulty{database, options};
+    for (int i = 0; i < 100; i++)
+    {
+        CANMessage frame;
+        DBCTrafficGenerator::Error error;
+        faulty.Next(frame, &error);
+        TEST_ASSERT(error != DBCTrafficGenerator::Error::kNone);
+        if (error == DBCTrafficGenerator::Error::kUnknownID)
+        {
+            TEST_ASSERT_EQUAL(0x7FF, frame.id_);
+        }
+        else if (error == DBCTrafficGenerator::Error::kWrongLength)
+        {
+            TEST_ASSERT(frame.len_ != 8);
+        }
+    }
+    TEST_ASSERT_EQUAL(100, faulty.GetErrorsInjected());
+}
+
+void CANLogTest(void)
+{
+    std::vector<uint8_t> file;
+    CANLogWriter<1024, 2, 16> writer{[&file](const uint8_t *block, size_t size)
+                                    {
+                                        file.insert(file.end(), block, block + size);
+                                        return true;
+                                    }};
+
+    // 20 IDs (more than the writer remembers per block), slowly changing payloads, one timestamp going backwards
+    std::vector<CANLogRecord> written;
+    for (uint32_t i = 0; i < 3000; i++)
+    {
+        CANLogRecord record;
+        record.timestamp_us = 1000000 + i * 125 - (i == 1500 ? 500 : 0);
+        record.frame.id_ = i % 20 == 19 ? 0x18FF50E5 : 0x100 + i % 20;
+        record.frame.extended_id_ = i % 20 == 19;
+        record.frame.len_ = static_cast<uint8_t>(i % 20 == 7 ? 0 : (i % 20 == 3 ? 5 : 8));
+        for (uint8_t byte = 0; byte < record.frame.len_; byte++)
+        {
+            record.frame.data_[byte] = static_cast<uint8_t>(byte == 0 ? i / 20 : byte * 17);
+        }
+        TEST_ASSERT_TRUE(writer.Append(record.frame, record.timestamp_us));
+        written.push_back(record);
+        writer.Flush();
+    }
+    writer.Seal();
+    TEST_ASSERT_EQUAL(1, writer.Flush());
+    TEST_ASSERT_EQUAL(0, file.size() % 1024);
+    // an 8 byte frame with its timestamp is 16 bytes raw, deltas save a good part of that even with small blocks and
+    // some IDs never delta encoded
+    TEST_ASSERT_TRUE(writer.GetBytesLogged() < written.size() * 10);
+
+    std::vector<CANLogRecord> read;
+    for (size_t offset = 0; offset < file.size(); offset += 1024)
+    {
+        TEST_ASSERT_TRUE(DecodeCANLogBlock(file.data() + offset, 1024, read));
+    }
+    TEST_ASSERT_EQUAL(written.size(), read.size());
+    for (size_t i = 0; i < written.size(); i++)
+    {
+        TEST_ASSERT_EQUAL(written[i].timestamp_us, read[i].timestamp_us);
+        TEST_ASSERT_EQUAL(written[i].frame.id_, read[i].frame.id_);
+        TEST_ASSERT_EQUAL(written[i].frame.extended_id_, read[i].frame.extended_id_);
+        TEST_ASSERT_EQUAL(written[i].frame.len_, read[i].frame.len_);
+        TEST_ASSERT_EQUAL_MEMORY(written[i].frame.data_.data(), read[i].frame.data_.data(), written[i].frame.len_);
+    }
+
+    // a flipped bit only loses its own block
+    file[1024 + 100] ^= 0x04;
+    read.clear();
+    TEST_ASSERT_FALSE(DecodeCANLogBlock(file.data() + 1024, 1024, read));
+    TEST_ASSERT_EQUAL(0, read.size());
+    TEST_ASSERT_TRUE(DecodeCANLogBlock(file.data() + 2048, 1024, read));
+
+    // without flushing, frames are dropped once both blocks are full
+    CANLogWriter<512, 2, 16> stalled{[](const uint8_t *, size_t) { return true; }};
+    bool accepted = true;
+    for (uint32_t i = 0; i < 1000 && accepted; i++)
+    {
+        accepted = stalled.Append(written[i].frame, written[i].timestamp_us);
+    }
+    TEST_ASSERT_FALSE(accepted);
+    TEST_ASSERT_EQUAL(1, stalled.GetDroppedFrames());
+    TEST_ASSERT_EQUAL(2, stalled.Flush());
+    TEST_ASSERT_TRUE(stalled.Append(written[0].frame, written[0].timestamp_us));
+}
+
+void CANRawTapTest(void)
+{
+    VirtualCANBus bus{ICAN::BaudRate::kBaud500K};
+    VirtualCANBus::Endpoint sender{bus};
+    VirtualCANBus::Endpoint logger{bus};
+    sender.Initialize(ICAN::BaudRate::kBaud500K);
+    logger.Initialize(ICAN::BaudRate::kBaud500K);
+
+    // the logger's clock wraps around during the test
+    uint32_t clock = 0xFFFFFF00;
+    CANRawTap<4> tap{[&clock]() { return clock += 100; }};
+    CANTXQueue<8> queue{sender};
+    CANRawTap<8> sent_tap{[]() { return 0u; }};
+    TEST_ASSERT_TRUE(logger.AttachTap(tap));
+    TEST_ASSERT_TRUE(queue.AttachTap(sent_tap));  // forwarded to the sender
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) rx_signal;
+    CANRXMessage<1> rx_message{logger, 0x101, []() { return 0u; }, rx_signal};
+
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        CANMessage frame{i == 5 ? 0x18FF0101 : 0x100 + i % 2u, i == 5, 1, std::array<uint8_t, 8>{i}};
+        TEST_ASSERT_TRUE(queue.SendMessage(frame));
+    }
+    queue.Drain();
+    bus.RunUntilIdle();
+    logger.Tick();
+
+    // the tap saw every frame, not just the registered ID, before dispatch; the ring holds 4 so 2 were dropped
+    TEST_ASSERT_EQUAL(3, rx_signal);
+    TEST_ASSERT_EQUAL(4, tap.GetQueuedCount());
+    TEST_ASSERT_EQUAL(2, tap.GetDroppedCount());
+    std::vector<CANTapFrame> frames;
+    TEST_ASSERT_EQUAL(4, tap.Drain([&frames](const CANTapFrame &frame) { frames.push_back(frame); }));
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL(0x100 + i % 2u, frames[i].id);
+        TEST_ASSERT_EQUAL(i, frames[i].data[0]);
+        TEST_ASSERT_EQUAL(0, frames[i].flags);
+        TEST_ASSERT_EQUAL(0xFFFFFF64ull + 100 * i, frames[i].timestamp_us);
+    }
+
+    CANTapFrame frame;
+    uint32_t transmitted = 0;
+    while (sent_tap.Pop(frame))
+    {
+        TEST_ASSERT_TRUE(frame.flags & CANTapFrame::kTransmitted);
+        TEST_ASSERT_EQUAL(transmitted == 5, (frame.flags & CANTapFrame::kExtendedID) != 0);
+        transmitted++;
+    }
+    TEST_ASSERT_EQUAL(6, transmitted);
+    TEST_ASSERT_TRUE(frame.ToMessage().extended_id_);
+    TEST_ASSERT_EQUAL(0x18FF0101, frame.ToMessage().id_);
+
+    for (uint8_t i = 1; i < ICAN::kMaxTaps; i++)
+    {
+        TEST_ASSERT_TRUE(logger.AttachTap(sent_tap));
+    }
+    TEST_ASSERT_FALSE(logger.AttachTap(sent_tap));
+}
+
+void DBCDecodeTableTest(void)
+{
+    DBCDatabase database;
+    TEST_ASSERT_TRUE(database.Parse("BO_ 256 Motor_Status: 8 Motor\n"
+                                    " SG_ Speed : 0|16@1+ (0.5,-100) [-100|1000] \"rpm\" Logger\n"
+                                    " SG_ Current : 23|12@0- (0.1,0) [-200|200] \"A\" Logger\n"
+                                    " SG_ Energy : 39|32@0+ (1,0) [0|0] \"J\" Logger\n"
+                                    "BO_ 2147483905 Extended: 8 Logger\n"
+                                    " SG_ Mode M : 0|8@1+ (1,0) [0|0] \"\" Motor\n"
+                                    " SG_ Value m3 : 8|16@1- (0.01,5) [0|0] \"\" Motor\n"
+                                    " SG_ Flags : 63|8@0+ (1,0) [0|0] \"\" Motor\n"
+                                    "BO_ 768 Counter: 8 Logger\n"
+                                    " SG_ Count : 0|64@1+ (1,0) [0|0] \"\" Motor\n"
+                                    "VAL_ 2147483905 Mode 3 \"Three\" 0 \"Zero\" 7 \"Seven\" ;\n"));
+    DBCDecodeTable table{database};
+    TEST_ASSERT_EQUAL(3, table.GetMessageCount());
+    TEST_ASSERT_EQUAL(3, table.GetMaxSignalCount());
+    TEST_ASSERT_EQUAL(0, table.FindMessage(0x100, false));
+    TEST_ASSERT_EQUAL(1, table.FindMessage(0x101, true));
+    TEST_ASSERT_EQUAL(DBCDecodeTable::kNoMessage, table.FindMessage(0x101, false));
+    TEST_ASSERT_EQUAL(DBCDecodeTable::kNoMessage, table.FindMessage(0x100, true));
+    TEST_ASSERT_EQUAL(DBCDecodeTable::kNoMessage, table.FindMessage(0x7FF, false));
+
+    // the same values as the compile-time signals and the runtime codec for arbitrary payloads
+    MakeUnsignedCANSignal(float, 0, 16, 0.5, -100) speed;
+    MakeEndianSignedCANSignal(float, 23, 12, 0.1, 0, ICANSignal::ByteOrder::kBigEndian) current;
+    MakeEndianUnsignedCANSignal(uint32_t, 39, 32, 1, 0, ICANSignal::ByteOrder::kBigEndian) energy;
+    MakeSignedCANSignal(float, 8, 16, 0.01, 5) value;
+    MakeUnsignedCANSignal(uint64_t, 0, 64, 1, 0) count;
+    std::vector<DBCSignalCodec> codecs;
+    for (const DBCMessage &message : database.messages)
+    {
+        for (const DBCSignal &signal : message.signals)
+        {
+            codecs.emplace_back(signal);
+        }
+    }
+    uint64_t payload = 0x0123456789ABCDEFull;
+    double values[3];
+    for (int i = 0; i < 1000; i++)
+    {
+        payload = payload * 6364136223846793005ull + 1442695040888963407ull;
+        CANMessage frame{0x100, 8, {}};
+        memcpy(frame.data_.data(), &payload, sizeof(payload));
+        TEST_ASSERT_EQUAL(0, table.Decode(frame, values));
+        speed.DecodeSignal(&payload);
+        current.DecodeSignal(&payload);
+        energy.DecodeSignal(&payload);
+        TEST_ASSERT(static_cast<float>(values[0]) == static_cast<float>(speed));
+        TEST_ASSERT(static_cast<float>(values[1]) == static_cast<float>(current));
+        TEST_ASSERT_EQUAL(static_cast<uint32_t>(energy), values[2]);
+        for (int signal = 0; signal < 3; signal++)
+        {
+            TEST_ASSERT(values[signal] == codecs[signal].Decode(&payload));
+        }
+
+        frame = CANMessage{0x101, true, 8, frame.data_};
+        TEST_ASSERT_EQUAL(1, table.Decode(frame, values));
+        TEST_ASSERT_EQUAL(payload & 0xFF, values[0]);
+        TEST_ASSERT_EQUAL(payload >> 56, values[2]);
+        if ((payload & 0xFF) == 3)
+        {
+            value.DecodeSignal(&payload);
+            TEST_ASSERT(static_cast<float>(values[1]) == static_cast<float>(value));
+        }
+        else
+        {
+            TEST_ASSERT_TRUE(std::isnan(values[1]));
+        }
+
+        table.DecodePayload(2, payload, values);
+        count.DecodeSignal(&payload);
+        TEST_ASSERT(static_cast<uint64_t>(values[0]) == static_cast<uint64_t>(static_cast<double>(count)));
+    }
+    payload = 0x0000000000001103ull;
+    table.DecodePayload(1, payload, values);
+    TEST_ASSERT_EQUAL_FLOAT(0x11 * 0.01 + 5, values[1]);
+
+    size_t mode = table.GetMessage(1).first_signal;
+    TEST_ASSERT_EQUAL_STRING("Three", table.GetValueDescription(mode, 3)->c_str());
+    TEST_ASSERT_EQUAL_STRING("Seven", table.GetValueDescription(mode, 7)->c_str());
+    TEST_ASSERT_NULL(table.GetValueDescription(mode, 4));
+    TEST_ASSERT_NULL(table.GetValueDescription(mode + 1, 3));
+}
+
+void CANLogDecoderTest(void)
+{
+    DBCDatabase database;
+    TEST_ASSERT_TRUE(database.Parse("BO_ 256 Motor_Status: 8 Motor\n"
+                                    " SG_ Speed : 0|16@1+ (0.5,-100) [-100|1000] \"rpm\" Logger\n"
+                                    " SG_ Current : 23|12@0- (0.1,0) [-200|200] \"A\" Logger\n"
+                                    "BO_ 2147483905 Extended: 2 Logger\n"
+                                    " SG_ Mode M : 0|8@1+ (1,0) [0|0] \"\" Motor\n"
+                                    " SG_ Value m3 : 8|8@1+ (1,0) [0|0] \"\" Motor\n"));
+
+    // the same frames as a candump log and a binary log, with an unknown ID every 10th frame
+    std::string candump;
+    std::vector<uint8_t> binary;
+    CANLogWriter<512, 2, 16> writer{[&binary](const uint8_t *block, size_t size)
+                                   {
+                                       binary.insert(binary.end(), block, block + size);
+                                       return true;
+                                   }};
+    const uint32_t kFrames = 3000;
+    for (uint32_t i = 0; i < kFrames; i++)
+    {
+        uint64_t timestamp_us = 1700000000000000ull + i * 250;
+        CANMessage frame{i % 10 == 9 ? 0x200u : (i % 2 == 0 ? 0x100u : 0x101u), i % 10 != 9 && i % 2 == 1, 8, {}};
+        frame.data_[0] = static_cast<uint8_t>(i);
+        frame.data_[1] = static_cast<uint8_t>(i >> 8);
+        writer.Append(frame, timestamp_us);
+        writer.Flush();
+        char line[64];
+        snprintf(line,
+                 sizeof(line),
+                 "(%llu.%06llu) can0 %0*X#",
+                 static_cast<unsigned long long>(timestamp_us / 1000000),
+                 static_cast<unsigned long long>(timestamp_us % 1000000),
+                 frame.extended_id_ ? 8 : 3,
+                 static_cast<unsigned>(frame.id_));
+        candump += line;
+        for (uint8_t byte : frame.data_)
+        {
+            snprintf(line, sizeof(line), "%02X", byte);
+            candump += line;
+        }
+        candump += "\n";
+    }
+    writer.Seal();
+    writer.Flush();
+    candump += "garbage\n";
+
+    CANLogDecoder::Options options;
+    options.threads = 4;
+    options.chunk_bytes = 1024;  // many chunks per batch and several batches
+    options.chunks_per_batch = 16;
+    CANLogDecoder decoder{database, options};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const std::vector<uint8_t> text{candump.begin(), candump.end()};
+        const std::vector<uint8_t> &log = pass == 0 ? text : binary;
+        std::vector<CANDecodedFrame> frames;
+        std::vector<double> values;
+        TEST_ASSERT_TRUE(decoder.Decode(
+            log.data(),
+            log.size(),
+            [&frames, &values](const CANDecodedFrame &frame)
+            {
+                frames.push_back(frame);
+                values.push_back(frame.values[0]);
+                values.push_back(frame.values[1]);
+            }));
+        const CANLogDecoder::Stats &stats = decoder.GetStats();
+        TEST_ASSERT_EQUAL(kFrames - kFrames / 10, frames.size());
+        TEST_ASSERT_EQUAL(frames.size(), stats.frames);
+        TEST_ASSERT_EQUAL(kFrames / 10, stats.unknown_frames);
+        TEST_ASSERT_EQUAL(pass == 0 ? 1 : 0, stats.malformed_records);
+        TEST_ASSERT_TRUE(stats.chunks > options.chunks_per_batch);
+        uint64_t thread_frames = 0;
+        for (const CANLogDecoder::ThreadStats &thread : stats.threads)
+        {
+            thread_frames += thread.frames;
+        }
+        TEST_ASSERT_EQUAL(frames.size(), thread_frames);
+
+        // in file order, which is timestamp order, with multiplexed signals only present when selected
+        size_t index = 0;
+        for (uint32_t i = 0; i < kFrames; i++)
+        {
+            if (i % 10 == 9)
+            {
+                continue;
+            }
+            TEST_ASSERT_EQUAL(1700000000000000ull + i * 250, frames[index].timestamp_us);
+            if (i % 2 == 0)
+            {
+                TEST_ASSERT_EQUAL_STRING("Motor_Status", frames[index].message->name.c_str());
+                TEST_ASSERT_EQUAL_FLOAT(i * 0.5f - 100, values[index * 2]);
+            }
+            else
+            {
+                TEST_ASSERT_EQUAL_STRING("Extended", frames[index].message->name.c_str());
+                TEST_ASSERT_EQUAL(i & 0xFF, values[index * 2]);
+                if ((i & 0xFF) == 3)
+                {
+                    TEST_ASSERT_EQUAL((i >> 8) & 0xFF, values[index * 2 + 1]);
+                }
+                else
+                {
+                    TEST_ASSERT_TRUE(std::isnan(values[index * 2 + 1]));
+                }
+            }
+            index++;
+        }
+    }
+
+    const char asc[] =
+        "date Mon Jan 1 00:00:00.000 am 2024\n"
+        "base hex  timestamps absolute\n"
+        "Begin Triggerblock Mon Jan 1 00:00:00.000 am 2024\n"
+        "   0.000000 Start of measurement\n"
+        "   0.010000 1  100             Rx   d 8 58 02 00 00 00 00 00 00\n"
+        "   0.020000 1  101x            Rx   d 2 03 07  Length = 0 BitCount = 0\n"
+        "   0.030000 1  ErrorFrame\n"
+        "End TriggerBlock\n";
+    std::vector<CANDecodedFrame> frames;
+    std::vector<double> values;
+    TEST_ASSERT_TRUE(decoder.Decode(reinterpret_cast<const uint8_t *>(asc),
+                                    sizeof(asc) - 1,
+                                    [&frames, &values](const CANDecodedFrame &frame)
+                                    {
+                                        frames.push_back(frame);
+                                        values.push_back(frame.values[0]);
+                                        values.push_back(frame.values[1]);
+                                    }));
+    TEST_ASSERT_EQUAL(2, frames.size());
+    TEST_ASSERT_EQUAL(10000, frames[0].timestamp_us);
+    TEST_ASSERT_EQUAL_FLOAT(200, values[0]);
+    TEST_ASSERT_EQUAL(20000, frames[1].timestamp_us);
+    TEST_ASSERT_EQUAL(7, values[3]);
+    TEST_ASSERT_FALSE(decoder.Decode(reinterpret_cast<const uint8_t *>("hello"), 5, [](const CANDecodedFrame &) {}));
+}
+
+void CANColumnarTest(void)
+{
+    DBCDatabase database;
+    TEST_ASSERT_TRUE(database.Parse("BO_ 256 Motor_Status: 8 Motor\n"
+                                    " SG_ Speed : 0|16@1+ (0.5,-100) [-100|1000] \"rpm\" Logger\n"
+                                    " SG_ Current : 23|12@0- (0.1,0) [-200|200] \"A\" Logger\n"
+                                    " SG_ Counter : 32|32@1+ (1,0) [0|0] \"\" Logger\n"
+                                    "BO_ 2147483905 Extended: 8 Logger\n"
+                                    " SG_ Mode M : 0|8@1+ (1,0) [0|0] \"\" Motor\n"
+                                    " SG_ Value m3 : 8|16@1- (0.01,5) [0|0] \"\" Motor\n"
+                                    "BO_ 768 Raw: 8 Logger\n"
+                                    " SG_ Everything : 0|64@1- (1,0) [0|0] \"\" Motor\n"));
+    DBCDecodeTable table{database};
+
+    std::vector<uint8_t> file;
+    CANColumnarWriter writer{database,
+                             [&file](const uint8_t *data, size_t size)
+                             {
+                                 file.insert(file.end(), data, data + size);
+                                 return true;
+                             },
+                             100};
+    // slowly changing signals, a counter, a multiplexed signal and random 64 bit values
+    struct Expected
+    {
+        uint64_t timestamp_us;
+        double values[3];
+    };
+    std::vector<Expected> expected[3];
+    uint64_t random = 1;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        random = random * 6364136223846793005ull + 1442695040888963407ull;
+        uint64_t payload;
+        uint32_t id;
+        bool extended = false;
+        if (i % 3 == 0)
+        {
+            id = 0x100;
+            payload = (1000 + i / 10) | static_cast<uint64_t>(0x80 + i % 7) << 16 | static_cast<uint64_t>(i) << 32;
+        }
+        else if (i % 3 == 1)
+        {
+            id = 0x101;
+            extended = true;
+            payload = (i % 2 == 0 ? 3 : 1) | static_cast<uint64_t>(static_cast<uint16_t>(-static_cast<int>(i))) << 8;
+        }
+        else
+        {
+            id = 0x300;
+            payload = random;
+        }
+        CANMessage frame{id, extended, 8, {}};
+        memcpy(frame.data_.data(), &payload, sizeof(payload));
+        Expected row{1000000 + i * 100u, {}};
+        uint16_t index = table.Decode(frame, row.values);
+        expected[index].push_back(row);
+        TEST_ASSERT_TRUE(writer.Append(row.timestamp_us, frame));
+    }
+    TEST_ASSERT_TRUE(writer.Append(0, CANMessage{0x7FF, 8, {}}));
+    TEST_ASSERT_TRUE(writer.Close());
+    TEST_ASSERT_EQUAL(1000, writer.GetRowsWritten());
+    TEST_ASSERT_EQUAL(1, writer.GetUnknownFrames());
+    TEST_ASSERT_EQUAL(file.size(), writer.GetBytesWritten());
+
+    CANColumnarReader reader;
+    std::string error;
+    TEST_ASSERT_TRUE(reader.Open(file.data(), file.size(), &error));
+    TEST_ASSERT_EQUAL(3, reader.GetMessages().size());
+    TEST_ASSERT_EQUAL(0, reader.FindMessage("Motor_Status"));
+    TEST_ASSERT_EQUAL(-1, reader.FindMessage("Missing"));
+    TEST_ASSERT_EQUAL(1, reader.FindSignal(1, "Value"));
+    TEST_ASSERT_EQUAL_STRING("rpm", reader.GetMessages()[0].signals[0].unit.c_str());
+    TEST_ASSERT_TRUE(reader.GetMessages()[1].extended_id);
+    TEST_ASSERT_EQUAL(4, reader.GetMessages()[0].chunks.size());
+    TEST_ASSERT_EQUAL(34, reader.GetMessages()[0].chunks[3].rows);
+
+    std::vector<uint64_t> timestamps;
+    std::vector<double> values;
+    for (size_t message = 0; message < 3; message++)
+    {
+        for (size_t signal = 0; signal < reader.GetMessages()[message].signals.size(); signal++)
+        {
+            TEST_ASSERT_TRUE(reader.ReadSignal(message, signal, timestamps, values));
+            size_t row = 0;
+            for (const Expected &frame : expected[message])
+            {
+                if (std::isnan(frame.values[signal]))
+                {
+                    continue;
+                }
+                TEST_ASSERT_EQUAL(frame.timestamp_us, timestamps[row]);
+                TEST_ASSERT(frame.values[signal] == values[row]);
+                row++;
+            }
+            TEST_ASSERT_EQUAL(row, values.size());
+        }
+    }
+    // only the multiplexed rows with mode 3 (every other frame) have a value
+    TEST_ASSERT_EQUAL(50, reader.GetMessages()[1].chunks[0].columns[1].absent_rows);
+
+    // the statistics give the raw range of every chunk, the counter of chunk 1 covers frames 300 to 597
+    const CANColumnarReader::ColumnChunk &counter = reader.GetMessages()[0].chunks[1].columns[2];
+    TEST_ASSERT_EQUAL(300, counter.min_raw);
+    TEST_ASSERT_EQUAL(597, counter.max_raw);
+    // the counter is delta encoded into a few bits per row, far less than the raw 32
+    TEST_ASSERT_TRUE(counter.size < 20);
+
+    // a time range only decodes the chunks that overlap it
+    TEST_ASSERT_TRUE(reader.ReadSignal(0, 2, timestamps, values, 1000000 + 450 * 100, 1000000 + 459 * 100));
+    TEST_ASSERT_EQUAL(4, values.size());
+    TEST_ASSERT_EQUAL(450, values[0]);
+    file[reader.GetMessages()[0].chunks[0].columns[2].offset] ^= 1;
+    TEST_ASSERT_TRUE(reader.ReadSignal(0, 2, timestamps, values, 1000000 + 450 * 100, 1000000 + 459 * 100));
+    TEST_ASSERT_FALSE(reader.ReadSignal(0, 2, timestamps, values));
+
+    file[file.size() - 20] ^= 1;
+    TEST_ASSERT_FALSE(reader.Open(file.data(), file.size(), &error));
+
+    // straight from the log decoder
+    std::string candump;
+    for (uint32_t i = 0; i < 500; i++)
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "(%u.%06u) can0 100#%04X0000%08X\n", 1 + i / 1000, i % 1000 * 1000, i, i);
+        candump += line;
+    }
+    CANLogDecoder decoder{database};
+    std::vector<uint8_t> decoded_file;
+    CANColumnarWriter decoded_writer{database,
+                                     [&decoded_file](const uint8_t *data, size_t size)
+                                     {
+                                         decoded_file.insert(decoded_file.end(), data, data + size);
+                                         return true;
+                                     }};
+    TEST_ASSERT_TRUE(decoder.Decode(reinterpret_cast<const uint8_t *>(candump.data()),
+                                    candump.size(),
+                                    [&decoded_writer](const CANDecodedFrame &frame) { decoded_writer.Append(frame); }));
+    TEST_ASSERT_TRUE(decoded_writer.Close());
+    TEST_ASSERT_TRUE(reader.Open(decoded_file.data(), decoded_file.size()));
+    TEST_ASSERT_TRUE(reader.ReadSignal(0, 0, timestamps, values));
+    TEST_ASSERT_EQUAL(500, values.size());
+    TEST_ASSERT_EQUAL_FLOAT(0xF301 * 0.5 - 100, values[499]);  // 499 written big endian
+    TEST_ASSERT_EQUAL(1499000, timestamps[499]);
+}
+
+void CANResamplerTest(void)
+{
+    using Resampler = CANResampler<4, 4>;
+    // 100 Hz output, ticks emitted 20 ms late so a 50 Hz signal is always bracketed
+    Resampler resampler{10000, 20000};
+    TEST_ASSERT_EQUAL(0, resampler.AddSignal(Resampler::Interpolation::kZeroOrderHold));
+    TEST_ASSERT_EQUAL(1, resampler.AddSignal(Resampler::Interpolation::kLinear));
+    TEST_ASSERT_EQUAL(2, resampler.AddSignal(Resampler::Interpolation::kZeroOrderHold, 15000));
+    TEST_ASSERT_EQUAL(3, resampler.AddSignal(Resampler::Interpolation::kLinear));
+    TEST_ASSERT_EQUAL(-1, resampler.AddSignal(Resampler::Interpolation::kLinear));
+
+    std::vector<uint64_t> ticks;
+    std::vector<std::array<double, 4>> rows;
+    auto consumer = [&ticks, &rows](uint64_t tick_us, const double *values)
+    {
+        ticks.push_back(tick_us);
+        rows.push_back(std::array<double, 4>{values[0], values[1], values[2], values[3]});
+    };
+    // signal 0 every 15 ms, signal 1 (a ramp) every 20 ms, signal 2 only once, signal 3 never
+    for (uint64_t time_us = 1000005; time_us <= 1100005; time_us += 5000)
+    {
+        if ((time_us - 1000005) % 15000 == 0)
+        {
+            resampler.Push(0, time_us, static_cast<double>(time_us - 1000005) / 15000);
+        }
+        if ((time_us - 1000005) % 20000 == 0)
+        {
+            resampler.Push(1, time_us, static_cast<double>(time_us - 1000005));
+        }
+        if (time_us == 1010005)
+        {
+            resampler.Push(2, time_us, 42);
+        }
+        resampler.Poll(time_us, consumer);
+    }
+    // ticks fall on multiples of the period, from the first one after the first sample up to 20 ms before the end
+    TEST_ASSERT_EQUAL(8, ticks.size());
+    TEST_ASSERT_EQUAL(1010000, ticks[0]);
+    TEST_ASSERT_EQUAL(1080000, ticks[7]);
+    for (size_t i = 0; i < ticks.size(); i++)
+    {
+        double since_first = static_cast<double>(ticks[i] - 1000005);
+        TEST_ASSERT_EQUAL_FLOAT(std::floor(since_first / 15000), rows[i][0]);
+        TEST_ASSERT_EQUAL_FLOAT(since_first, rows[i][1]);
+        TEST_ASSERT_TRUE(std::isnan(rows[i][3]));
+    }
+    // signal 2 has no sample before the first tick, then goes stale 15 ms after its only one
+    TEST_ASSERT_TRUE(std::isnan(rows[0][2]));
+    TEST_ASSERT_EQUAL_FLOAT(42, rows[1][2]);
+    TEST_ASSERT_EQUAL_FLOAT(42, rows[2][2]);
+    TEST_ASSERT_TRUE(std::isnan(rows[3][2]));
+    TEST_ASSERT_EQUAL(0, resampler.GetDroppedSamples());
+
+    // without a delay the newest sample is held instead, out of order samples and ring overflows are dropped
+    Resampler eager{10000};
+    eager.AddSignal(Resampler::Interpolation::kLinear);
+    eager.Push(0, 10000, 1);
+    eager.Push(0, 5000, 0);
+    eager.Push(0, 15000, 2);
+    ticks.clear();
+    rows.clear();
+    TEST_ASSERT_EQUAL(1, eager.Poll(15000, consumer));
+    TEST_ASSERT_EQUAL(10000, ticks[0]);
+    TEST_ASSERT_EQUAL_FLOAT(1, rows[0][0]);
+    TEST_ASSERT_EQUAL(1, eager.GetDroppedSamples());
+    for (uint64_t time_us = 16000; time_us < 20000; time_us += 1000)
+    {
+        eager.Push(0, time_us, 3);
+    }
+    TEST_ASSERT_EQUAL(3, eager.GetDroppedSamples());
+    TEST_ASSERT_EQUAL(1, eager.Poll(29999, consumer));
+    TEST_ASSERT_EQUAL_FLOAT(3, rows[1][0]);
+}
+
+void CANLogReplayTest(void)
+{
+    // 0x100, 0x101 and 0x300 every 1 ms, as a candump log and a binary log
+    std::string candump;
+    std::vector<uint8_t> binary;
+    CANLogWriter<512, 2, 16> writer{[&binary](const uint8_t *block, size_t size)
+                                   {
+                                       binary.insert(binary.end(), block, block + size);
+                                       return true;
+                                   }};
+    const uint64_t kStartUs = 1700000000000000ull;
+    for (uint32_t i = 0; i < 12; i++)
+    {
+        CANMessage frame{i % 3 == 2 ? 0x300u : 0x100u + i % 3, 1, std::array<uint8_t, 8>{static_cast<uint8_t>(i)}};
+        writer.Append(frame, kStartUs + i * 1000);
+        char line[64];
+        snprintf(line, sizeof(line), "(1700000000.%06u) can0 %03X#%02X\n", i * 1000, frame.id_, i);
+        candump += line;
+    }
+    writer.Seal();
+    writer.Flush();
+    candump += "garbage\n";
+
+    uint64_t clock = 5000;
+    CANLogReplay::Options options;
+    options.filter = [](uint32_t id, bool extended_id __attribute__((unused))) { return id != 0x300; };
+    CANLogReplay replay{options, [&clock]() { return clock; }};
+    TEST_ASSERT_FALSE(replay.Load(reinterpret_cast<const uint8_t *>("nothing"), 7));
+    TEST_ASSERT_TRUE(replay.Load(binary.data(), binary.size()));
+    TEST_ASSERT_EQUAL(8, replay.GetFrameCount());
+    TEST_ASSERT_EQUAL(0, replay.GetStats().malformed_records);
+    TEST_ASSERT_TRUE(replay.Load(reinterpret_cast<const uint8_t *>(candump.data()), candump.size()));
+    TEST_ASSERT_EQUAL(8, replay.GetFrameCount());
+    TEST_ASSERT_EQUAL(1, replay.GetStats().malformed_records);
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) rx_signal;
+    CANRXMessage<1> rx_message{
+        replay, 0x100, [&replay]() { return static_cast<uint32_t>(replay.GetLogTimeUs() / 1000); }, rx_signal};
+    CANRawTap<16> tap{[&clock]() { return static_cast<uint32_t>(clock); }};
+    TEST_ASSERT_TRUE(replay.AttachTap(tap));
+
+    // real time: frames are due at their original spacing from the first Tick
+    replay.Tick();
+    TEST_ASSERT_EQUAL(1, replay.GetStats().frames);
+    TEST_ASSERT_EQUAL(0, rx_signal);
+    clock += 3500;
+    replay.Tick();
+    TEST_ASSERT_EQUAL(3, replay.GetStats().frames);
+    TEST_ASSERT_EQUAL(3, rx_signal);
+    TEST_ASSERT_EQUAL(kStartUs + 3000, replay.GetLogTimeUs());
+    TEST_ASSERT_EQUAL(3, tap.GetQueuedCount());
+    clock += 100000;
+    replay.Tick();
+    TEST_ASSERT_EQUAL(8, replay.GetStats().frames);
+    TEST_ASSERT_EQUAL(9, rx_signal);
+    TEST_ASSERT_EQUAL(103500 - 4000, replay.GetStats().max_lag_us);  // frame 4, due at 4 ms
+    TEST_ASSERT_TRUE(replay.IsFinished());
+    TEST_ASSERT_EQUAL(1, replay.GetStats().loops);
+
+    // frames the node sends are tapped, not replayed
+    CANMessage sent{0x100, 1, std::array<uint8_t, 8>{0xAA}};
+    TEST_ASSERT_TRUE(replay.SendMessage(sent));
+    TEST_ASSERT_EQUAL(1, replay.GetStats().sent_frames);
+    TEST_ASSERT_EQUAL(9, rx_signal);
+    TEST_ASSERT_EQUAL(9, tap.GetQueuedCount());
+
+    // twice as fast
+    options.speed = 2;
+    CANLogReplay fast{options, [&clock]() { return clock; }};
+    TEST_ASSERT_TRUE(fast.Load(binary.data(), binary.size()));
+    fast.Tick();
+    clock += 2000;
+    fast.Tick();
+    TEST_ASSERT_EQUAL(4, fast.GetStats().frames);
+
+    // as fast as possible, looping forever: a pass per Tick, or max_frames_per_tick frames
+    options.speed = 0;
+    options.loops = 0;
+    CANLogReplay looping{options, [&clock]() { return clock; }};
+    TEST_ASSERT_TRUE(looping.Load(binary.data(), binary.size()));
+    for (int i = 0; i < 3; i++)
+    {
+        looping.Tick();
+    }
+    TEST_ASSERT_EQUAL(24, looping.GetStats().frames);
+    TEST_ASSERT_EQUAL(3, looping.GetStats().loops);
+    TEST_ASSERT_FALSE(looping.IsFinished());
+    // the next pass starts one average frame interval (10 ms / 7) after the last frame
+    TEST_ASSERT_EQUAL(kStartUs + 2 * (10000 + 10000 / 7) + 10000, looping.GetLogTimeUs());
+    options.max_frames_per_tick = 5;
+    CANLogReplay limited{options, [&clock]() { return clock; }};
+    TEST_ASSERT_TRUE(limited.Load(binary.data(), binary.size()));
+    limited.Tick();
+    limited.Tick();
+    TEST_ASSERT_EQUAL(10, limited.GetStats().frames);
+    TEST_ASSERT_EQUAL(1, limited.GetStats().loops);
+}
+
+void CANLogIndexTest(void)
+{
+    // 8 IDs every 100 us, an extended ID every 1000 frames and a rare ID once, with an index block every 4 blocks
+    std::vector<uint8_t> file;
+    CANLogWriter<512, 2, 16, 4> writer{[&file](const uint8_t *block, size_t size)
+                                       {
+                                           file.insert(file.end(), block, block + size);
+                                           return true;
+                                       }};
+    const uint32_t kFrames = 20000;
+    auto timestamp = [](uint32_t i) { return 1000 + i * 100ull; };
+    for (uint32_t i = 0; i < kFrames; i++)
+    {
+        CANMessage frame{i == 12345 ? 0x7FFu : (i % 1000 == 500 ? 0x18FF0000u : 0x100u + i % 8),
+                         i % 1000 == 500,
+                         2,
+                         std::array<uint8_t, 8>{static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)}};
+        TEST_ASSERT_TRUE(writer.Append(frame, timestamp(i)));
+        writer.Flush();
+    }
+    writer.Seal();
+    writer.Flush();
+    uint64_t data_blocks = writer.GetBlocksWritten();
+    TEST_ASSERT_EQUAL(data_blocks / 4, writer.GetIndexBlocksWritten());
+    TEST_ASSERT_EQUAL((data_blocks + data_blocks / 4) * 512, file.size());
+
+    const char *path = "can_log_index_test.canlog";
+    auto write_file = [path](const std::vector<uint8_t> &data)
+    {
+        FILE *out = fopen(path, "wb");
+        TEST_ASSERT_NOT_NULL(out);
+        TEST_ASSERT_EQUAL(data.size(), fwrite(data.data(), 1, data.size(), out));
+        fclose(out);
+    };
+    write_file(file);
+
+    // readers of the frames skip the index blocks
+    CANLogReader plain;
+    TEST_ASSERT_TRUE(plain.Open(path));
+    CANLogRecord record;
+    uint32_t count = 0;
+    while (plain.Next(record))
+    {
+        count++;
+    }
+    TEST_ASSERT_EQUAL(kFrames, count);
+    TEST_ASSERT_EQUAL(0, plain.GetCorruptBlocks());
+    plain.Close();
+
+    const std::vector<uint8_t> intact = file;
+    for (int pass = 0; pass < 5; pass++)
+    {
+        file = intact;
+        if (pass == 1)
+        {
+            // a corrupt index block only loses the index of its blocks
+            file[512 * 4 + 100] ^= 0x01;
+            write_file(file);
+        }
+        else if (pass == 2)
+        {
+            // so does one whose complete flag is flipped, which its CRC covers
+            file[512 * 4 + 36] ^= 0x01;
+            write_file(file);
+        }
+        else if (pass == 3)
+        {
+            // a first block claiming the wrong interval (with a CRC to match) has every group scanned whole
+            file[36] = 5;
+            uint16_t used = CANLogGet16(&file[14]);
+            CANLogPut32(&file[32], CRC32(&file[kCANLogBlockHeaderSize], used, CANLogHeaderCRC(&file[0])));
+            write_file(file);
+        }
+        else if (pass == 4)
+        {
+            // without an index every header is read and IDs can't rule blocks out
+            file.clear();
+            CANLogWriter<512, 2, 16, 0> unindexed{[&file](const uint8_t *block, size_t size)
+                                                  {
+                                                      file.insert(file.end(), block, block + size);
+                                                      return true;
+                                                  }};
+            for (uint32_t i = 0; i < kFrames; i++)
+            {
+                CANMessage frame{i == 12345 ? 0x7FFu : 0x100u + i % 8, 2, std::array<uint8_t, 8>{}};
+                unindexed.Append(frame, timestamp(i));
+                unindexed.Flush();
+            }
+            unindexed.Seal();
+            unindexed.Flush();
+            TEST_ASSERT_EQUAL(0, unindexed.GetIndexBlocksWritten());
+            data_blocks = unindexed.GetBlocksWritten();
+            TEST_ASSERT_EQUAL(data_blocks * 512, file.size());
+            write_file(file);
+        }
+        CANLogIndexedReader reader;
+        TEST_ASSERT_TRUE(reader.Open(path));
+        TEST_ASSERT_EQUAL(data_blocks, reader.GetBlockCount());
+        uint64_t indexed = data_blocks / 4 * 4;
+        bool index_lost = pass == 1 || pass == 2;
+        TEST_ASSERT_EQUAL(pass == 0 ? indexed : (index_lost ? indexed - 4 : 0), reader.GetIndexedBlockCount());
+
+        // a 10 ms window only decodes the blocks around it
+        std::vector<CANLogRecord> read;
+        reader.Read(timestamp(10000), timestamp(10099), [&read](const CANLogRecord &r) { read.push_back(r); });
+        TEST_ASSERT_EQUAL(100, read.size());
+        for (uint32_t i = 0; i < read.size(); i++)
+        {
+            TEST_ASSERT_EQUAL(timestamp(10000 + i), read[i].timestamp_us);
+        }
+        TEST_ASSERT_TRUE(reader.GetBlocksRead() <= 3);
+
+        // the rare ID is in one block, the blocks after the last index block and those of the corrupt one can't be
+        // ruled out
+        uint64_t blocks_read = reader.GetBlocksRead();
+        read.clear();
+        reader.Read(0, UINT64_MAX, 0x7FF, false, [&read](const CANLogRecord &r) { read.push_back(r); });
+        TEST_ASSERT_EQUAL(1, read.size());
+        TEST_ASSERT_EQUAL(timestamp(12345), read[0].timestamp_us);
+        TEST_ASSERT_EQUAL(pass >= 3 ? data_blocks : 1 + data_blocks % 4 + (index_lost ? 4 : 0),
+                          reader.GetBlocksRead() - blocks_read);
+        if (pass == 3)
+        {
+            uint64_t frames = 0;
+            reader.Read(0, UINT64_MAX, [&frames](const CANLogRecord &) { frames++; });
+            TEST_ASSERT_EQUAL(kFrames, frames);
+            TEST_ASSERT_EQUAL(0, reader.GetCorruptBlocks());
+        }
+    }
+    std::vector<size_t> blocks;
+    CANLogIndexedReader reader;
+    TEST_ASSERT_TRUE(reader.Open(path));
+    reader.FindBlocks(timestamp(kFrames), UINT64_MAX, blocks);
+    TEST_ASSERT_EQUAL(1, blocks.size());  // only the last block may reach past the last frame
+    reader.FindBlocks(0, 999, blocks);
+    TEST_ASSERT_EQUAL(0, blocks.size());
+    remove(path);
+}
+
+// Keeps an update image in memory, accepting it at End if it matches the expected one, and with resumable set keeps
+// what was written for a later update of the same image
+class MemoryUpdateTarget : public ICANUpdateTarget
+{
+public:
+    explicit MemoryUpdateTarget(const std::vector<uint8_t> &expected) : expected_{expected} {}
+
+    bool Begin(uint32_t size, const char *md5) override
+    {
+        image.clear();
+        size_ = size;
+        this->md5 = md5;
+        held_md5_ = md5;
+        begins++;
+        return true;
+    }
+
+    bool Write(const uint8_t *data, size_t size) override
+    {
+        image.insert(image.end(), data, data + size);
+        return image.size() <= size_;
+    }
+
+    bool End() override
+    {
+        held_md5_.clear();
+        return image == expected_;
+    }
+
+    void Abort() override { aborts++; }
+
+    bool GetBase(uint32_t &size, uint8_t *md5) override
+    {
+        size = static_cast<uint32_t>(base.size());
+        memcpy(md5, base_md5.data(), base_md5.size());
+        return !base.empty();
+    }
+
+    bool ReadBase(uint32_t offset, uint8_t *data, size_t size) override
+    {
+        if (offset > base.size() || size > base.size() - offset)
+        {
+            return false;
+        }
+        memcpy(data, base.data() + offset, size);
+        return true;
+    }
+
+    bool GetWrittenPages(const char *md5, uint32_t &pages) override
+    {
+        pages = held_md5_ == md5 ? static_cast<uint32_t>(image.size() / kCANUpdatePageBytes) : 0;
+        return resumable;
+    }
+
+    bool Resume(uint32_t size, const char *md5, uint32_t pages) override
+    {
+        if (!resumable || held_md5_ != md5 || size != size_ || pages > image.size() / kCANUpdatePageBytes)
+        {
+            return false;
+        }
+        image.resize(pages * kCANUpdatePageBytes);
+        resumes++;
+        return true;
+    }
+
+    std::vector<uint8_t> image;
+    std::string md5;
+    uint32_t begins{0};
+    uint32_t aborts{0};
+    uint32_t resumes{0};
+    // the running image, none by default
+    std::vector<uint8_t> base;
+    std::array<uint8_t, 16> base_md5{};
+    bool resumable{false};
+
+private:
+    const std::vector<uint8_t> &expected_;
+    uint32_t size_{0};
+    std::string held_md5_;  // of the image being written, until it ends
+};
+
+// Drops every nth extended frame an endpoint receives, like a node whose RX queue overflows, and flips a bit in the
+// copies of an update block it receives
+class DroppingCAN : public ICAN, private ICANRXMessage
+{
+public:
+    DroppingCAN(ICAN &can, uint32_t drop_every) : can_{can}, drop_every_{drop_every} { can_.RegisterRXMessage(*this); }
+
+    void Initialize(BaudRate baud) override { can_.Initialize(baud); }
+    bool SendMessage(CANMessage &msg) override { return can_.SendMessage(msg); }
+    void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages_.push_back(&msg); }
+    void Tick() override { can_.Tick(); }
+
+    uint32_t dropped{0};
+    uint32_t corrupt_block{0xFFFFFFFF};
+    uint32_t corrupt_copies{1};
+    uint32_t corrupted{0};
+
+private:
+    ICAN &can_;
+    uint32_t drop_every_;
+    uint32_t extended_frames_{0};
+    std::vector<ICANRXMessage *> rx_messages_;
+
+    uint32_t GetID() override { return 0; }
+    void DecodeSignals(CANMessage message) override
+    {
+        if (message.extended_id_ && ++extended_frames_ % drop_every_ == 0)
+        {
+            dropped++;
+            return;
+        }
+        if (message.extended_id_ && ((message.id_ & 0x1FFFF800) >> 3) + message.data_[0] == corrupt_block
+            && corrupted < corrupt_copies)
+        {
+            message.data_[4] ^= 0x10;
+            corrupted++;
+        }
+        for (ICANRXMessage *rx_message : rx_messages_)
+        {
+            rx_message->DecodeSignals(message);
+        }
+    }
+};
+
+void DeflateTest(void)
+{
+    std::vector<std::vector<uint8_t>> inputs(5);
+    inputs[1].push_back(42);
+    uint32_t state = 1;
+    for (int i = 0; i < 5000; i++)
+    {
+        state = state * 1103515245 + 12345;
+        inputs[2].push_back(static_cast<uint8_t>(state >> 16));  // incompressible, stored
+    }
+    inputs[3].assign(10000, 0);  // one long overlapping match
+    const char *words[] = {"speed ", "torque ", "inverter ", "fault ", "0x1A2 ", "\n"};
+    while (inputs[4].size() < 100000)  // more than one block
+    {
+        state = state * 1103515245 + 12345;
+        const char *word = words[(state >> 16) % 6];
+        inputs[4].insert(inputs[4].end(), word, word + strlen(word));
+    }
+    Inflater inflater;
+    for (const std::vector<uint8_t> &input : inputs)
+    {
+        std::vector<uint8_t> compressed;
+        Deflate(input.data(), input.size(), compressed);
+        std::vector<uint8_t> output(input.size() + 1);
+        size_t output_size = 0;
+        TEST_ASSERT_TRUE(
+            inflater.Inflate(compressed.data(), compressed.size(), output.data(), output.size(), output_size));
+        TEST_ASSERT_EQUAL(input.size(), output_size);
+        TEST_ASSERT_TRUE(std::equal(input.begin(), input.end(), output.begin()));
+        // truncated streams and outputs that don't fit are errors
+        TEST_ASSERT_FALSE(
+            inflater.Inflate(compressed.data(), compressed.size() - 1, output.data(), output.size(), output_size));
+        if (!input.empty())
+        {
+            TEST_ASSERT_FALSE(inflater.Inflate(
+                compressed.data(), compressed.size(), output.data(), input.size() - 1, output_size));
+        }
+    }
+    std::vector<uint8_t> compressed;
+    Deflate(inputs[4].data(), inputs[4].size(), compressed);
+    TEST_ASSERT_TRUE(compressed.size() < inputs[4].size() / 4);
+    compressed.clear();
+    Deflate(inputs[2].data(), inputs[2].size(), compressed);
+    TEST_ASSERT_EQUAL(inputs[2].size() + 5, compressed.size());  // one stored block
+
+    // with a preset dictionary, noise seen in the dictionary costs almost nothing
+    std::vector<uint8_t> dictionary_input(inputs[2].begin(), inputs[2].begin() + 4000);
+    dictionary_input.insert(dictionary_input.end(), inputs[2].begin() + 1000, inputs[2].begin() + 3000);
+    compressed.clear();
+    Deflate(dictionary_input.data(), dictionary_input.size(), compressed, 4000);
+    TEST_ASSERT_TRUE(compressed.size() < 40);
+    std::vector<uint8_t> output(dictionary_input.begin(), dictionary_input.begin() + 4000);
+    output.resize(dictionary_input.size());
+    size_t output_size = 0;
+    TEST_ASSERT_TRUE(
+        inflater.Inflate(compressed.data(), compressed.size(), output.data(), output.size(), output_size, 4000));
+    TEST_ASSERT_EQUAL(2000, output_size);
+    TEST_ASSERT_TRUE(output == dictionary_input);
+    // without the dictionary the references reach before the output
+    TEST_ASSERT_FALSE(
+        inflater.Inflate(compressed.data(), compressed.size(), output.data(), output.size(), output_size));
+}
+
+void CANUpdateTest(void)
+{
+    // half text, half noise, which compresses to about half
+    std::vector<uint8_t> image(20000);
+    uint32_t state = 1;
+    const char kText[] = "CANUpdateDevice writes the image to its target ";
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        state = state * 1103515245 + 12345;
+        image[i] = i % 64 < 32 ? static_cast<uint8_t>(kText[i % 64 % (sizeof(kText) - 1)])
+                               : static_cast<uint8_t>(state >> 16);
+    }
+    uint8_t md5[16];
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        md5[i] = static_cast<uint8_t>(i * 17);
+    }
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint host_endpoint{bus};
+    VirtualCANBus::Endpoint node_endpoint{bus};
+    host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    node_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    DroppingCAN node_can{node_endpoint, 50};
+    VirtualTimerGroup node_timers;
+    std::vector<uint8_t> expected = image;
+    MemoryUpdateTarget target{expected};
+    CANUpdateDevice device{0x530, node_can, node_timers, target, 0x12345678, [&bus]() { return bus.GetMillis(); }};
+    CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }};
+
+    // the node runs its loop every millisecond, the host every 100 us
+    auto run = [&](CANUpdateHost &host, uint64_t limit_ms)
+    {
+        for (uint32_t step = 0; step < limit_ms * 10 && host.GetState() != CANUpdateHost::State::kDone
+                                && host.GetState() != CANUpdateHost::State::kFailed;
+             step++)
+        {
+            bus.RunFor(100000);
+            if (step % 10 == 0)
+            {
+                node_can.Tick();
+                node_timers.Tick(bus.GetMillis());
+            }
+            host_endpoint.Tick();
+            host.Tick();
+        }
+    };
+
+    host.Start(image.data(), image.size(), md5);
+    run(host, 100);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kTransferring);
+    uint64_t start_ns = bus.GetTimeNs();
+    run(host, 5000);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_EQUAL_STRING("00112233445566778899aabbccddeeff", target.md5.c_str());
+    TEST_ASSERT_TRUE(target.image == image);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, host.GetFirmwareVersion());
+    TEST_ASSERT_EQUAL(kCANUpdateCapabilityWindowed | kCANUpdateCapabilityDeflate | kCANUpdateCapabilityPageCRC,
+                      host.GetCapabilities());
+    TEST_ASSERT_TRUE(host.GetEncoding() == CANUpdateEncoding::kDeflatePages);
+    TEST_ASSERT_EQUAL(host.GetBlockCount(), host.GetAckedBlocks());
+    TEST_ASSERT_TRUE(host.GetBlockCount() < (image.size() + 6) / 7 * 2 / 3);
+
+    // only the dropped blocks are sent again, and the bus stays close to saturated
+    TEST_ASSERT_TRUE(node_can.dropped > 0);
+    TEST_ASSERT_TRUE(host.GetRetransmittedBlocks() >= node_can.dropped);
+    TEST_ASSERT_TRUE(host.GetRetransmittedBlocks() <= node_can.dropped * 2);
+    CANMessage data_frame{0x530, true, 8, std::array<uint8_t, 8>{}};
+    uint64_t wire_ns = host.GetFramesSent() * CANStuffedFrameBits(data_frame) * bus.GetBitTimeNs();
+    uint64_t elapsed_ns = bus.GetTimeNs() - start_ns;
+    printf("update: %u blocks for %u bytes in %.1f ms, %.1f ms of data frames on the wire, %u retransmitted, %u acks\n",
+           host.GetBlockCount(),
+           static_cast<unsigned>(image.size()),
+           elapsed_ns / 1e6,
+           wire_ns / 1e6,
+           host.GetRetransmittedBlocks(),
+           device.GetAcksSent());
+    TEST_ASSERT_TRUE(elapsed_ns < wire_ns * 5 / 4);
+
+    // without compression or page CRCs the image is sent as is
+    CANUpdateHost::Options raw_options;
+    raw_options.compress = false;
+    raw_options.page_crc = false;
+    CANUpdateHost raw_host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }, raw_options};
+    raw_host.Start(image.data(), image.size(), md5);
+    run(raw_host, 5000);
+    TEST_ASSERT_TRUE(raw_host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(raw_host.GetEncoding() == CANUpdateEncoding::kRaw);
+    TEST_ASSERT_EQUAL((image.size() + 6) / 7, raw_host.GetAckedBlocks());
+    TEST_ASSERT_TRUE(target.image == image);
+
+    // paced, the data frames go out one per interval and leave the rest of the bus free
+    CANUpdateHost::Options paced_options;
+    paced_options.frame_interval_us = 400;
+    CANUpdateHost paced_host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }, paced_options};
+    paced_host.Start(image.data(), image.size(), md5);
+    run(paced_host, 100);
+    TEST_ASSERT_TRUE(paced_host.GetState() == CANUpdateHost::State::kTransferring);
+    start_ns = bus.GetTimeNs();
+    uint64_t frames_before = paced_host.GetFramesSent();
+    run(paced_host, 10000);
+    TEST_ASSERT_TRUE(paced_host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(target.image == image);
+    uint64_t paced_ns = (paced_host.GetFramesSent() - frames_before) * 400000;
+    elapsed_ns = bus.GetTimeNs() - start_ns;
+    printf("paced update: %.1f ms for %.1f ms of frame intervals\n", elapsed_ns / 1e6, paced_ns / 1e6);
+    TEST_ASSERT_TRUE(elapsed_ns >= paced_ns - 4 * 400000);
+    TEST_ASSERT_TRUE(elapsed_ns < paced_ns * 9 / 8);
+
+    // an image that fails its check ends the update
+    expected[0] ^= 1;
+    host.Start(image.data(), image.size(), md5);
+    run(host, 5000);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kFailed);
+    TEST_ASSERT_FALSE(device.IsUpdating());
+}
+
+void MD5Test(void)
+{
+    const char *kInputs[] = {"", "abc", "The quick brown fox jumps over the lazy dog"};
+    const char *kDigests[] = {"d41d8cd98f00b204e9800998ecf8427e",
+                              "900150983cd24fb0d6963f7d28e17f72",
+                              "9e107d9d372bb6826bd81d3542a419d6"};
+    for (size_t i = 0; i < 3; i++)
+    {
+        uint8_t digest[16];
+        MD5(reinterpret_cast<const uint8_t *>(kInputs[i]), strlen(kInputs[i]), digest);
+        char hex[33];
+        for (size_t j = 0; j < 16; j++)
+        {
+            snprintf(hex + 2 * j, 3, "%02x", digest[j]);
+        }
+        TEST_ASSERT_EQUAL_STRING(kDigests[i], hex);
+    }
+    // the padding spills into a second chunk from 56 bytes
+    std::vector<uint8_t> long_input(120, 'a');
+    uint8_t digest[16];
+    MD5(long_input.data(), 56, digest);
+    TEST_ASSERT_EQUAL_HEX8(0x3b, digest[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x18, digest[15]);
+    MD5(long_input.data(), long_input.size(), digest);
+    TEST_ASSERT_EQUAL_HEX8(0x5f, digest[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x37, digest[15]);
+}
+
+// Thrown where a node reboots, which never returns to its caller
+struct NodeReboot
+{
+};
+
+// An image in memory that survives the node rebooting into it, once it is reported written
+class RebootingUpdateTarget : public MemoryUpdateTarget
+{
+public:
+    RebootingUpdateTarget(const std::vector<uint8_t> &expected, VirtualCANBus &bus)
+        : MemoryUpdateTarget{expected}, bus_{bus}
+    {
+    }
+
+    VirtualCANBus::Endpoint *endpoint{nullptr};
+    uint32_t restarts{0};
+
+    // Waits for the node's TX queue as ESPUpdateTarget does, a reboot drops what is still in it
+    void Restart() override
+    {
+        while (endpoint->GetTXQueued() > 0)
+        {
+            bus_.RunFor(100000);
+        }
+        restarts++;
+        throw NodeReboot{};
+    }
+
+private:
+    VirtualCANBus &bus_;
+};
+
+void CANUpdateRestartTest(void)
+{
+    std::vector<uint8_t> image(10000);
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        image[i] = static_cast<uint8_t>(i * 7 + i / 256);
+    }
+    uint8_t md5[16]{};
+    md5[0] = 3;
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint host_endpoint{bus};
+    host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    RebootingUpdateTarget target{image, bus};
+    // everything but the flash starts over when the node reboots
+    struct Node
+    {
+        Node(VirtualCANBus &bus, RebootingUpdateTarget &target, uint32_t firmware_version)
+            : endpoint{bus},
+              device{0x530, endpoint, timers, target, firmware_version, [&bus]() { return bus.GetMillis(); }}
+        {
+            endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+            target.endpoint = &endpoint;
+        }
+
+        VirtualCANBus::Endpoint endpoint;
+        VirtualTimerGroup timers;
+        CANUpdateDevice device;
+    };
+    std::unique_ptr<Node> node{new Node{bus, target, 1}};
+    CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }};
+
+    host.Start(image.data(), image.size(), md5);
+    for (uint32_t step = 0; step < 50000 && host.GetFirmwareVersion() != 2; step++)
+    {
+        bus.RunFor(100000);
+        if (step % 10 == 0)
+        {
+            try
+            {
+                node->endpoint.Tick();
+                node->timers.Tick(bus.GetMillis());
+            }
+            catch (const NodeReboot &)
+            {
+                node.reset();
+                node.reset(new Node{bus, target, 2});
+            }
+        }
+        host_endpoint.Tick();
+        host.Tick();
+    }
+    // the node reported the image written before it rebooted, and reports its new firmware after
+    TEST_ASSERT_EQUAL(1, target.restarts);
+    TEST_ASSERT_TRUE(target.image == image);
+    TEST_ASSERT_EQUAL(2, host.GetFirmwareVersion());
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(host.GetNodeState(0) == CANUpdateHost::State::kDone);
+}
+
+void CANUpdateDeltaTest(void)
+{
+    // the running image, and a new one with a few bytes inserted, a few changed and some added at the end
+    std::vector<uint8_t> base(30000);
+    uint32_t state = 7;
+    for (uint8_t &byte : base)
+    {
+        state = state * 1103515245 + 12345;
+        byte = static_cast<uint8_t>(state >> 16);
+    }
+    std::vector<uint8_t> image = base;
+    image.insert(image.begin() + 10000, 40, 0x5A);
+    image[20000] ^= 0xFF;
+    image[20001] ^= 0xFF;
+    image.insert(image.end(), 300, 0xA5);
+    uint8_t md5[16]{};
+    md5[0] = 1;
+    std::array<uint8_t, 16> base_md5{};
+    base_md5[0] = 2;
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint host_endpoint{bus};
+    VirtualCANBus::Endpoint node_endpoint{bus};
+    host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    node_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    VirtualTimerGroup node_timers;
+    MemoryUpdateTarget target{image};
+    target.base = base;
+    target.base_md5 = base_md5;
+    CANUpdateDevice device{0x530, node_endpoint, node_timers, target, 1, [&bus]() { return bus.GetMillis(); }};
+    CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }};
+
+    auto run = [&](CANUpdateHost &host)
+    {
+        for (uint32_t step = 0; step < 50000 && host.GetState() != CANUpdateHost::State::kDone
+                                && host.GetState() != CANUpdateHost::State::kFailed;
+             step++)
+        {
+            bus.RunFor(100000);
+            if (step % 10 == 0)
+            {
+                node_endpoint.Tick();
+                node_timers.Tick(bus.GetMillis());
+            }
+            host_endpoint.Tick();
+            host.Tick();
+        }
+    };
+
+    // the node runs the base, so only what changed is sent
+    host.SetBase(base.data(), base.size(), base_md5.data());
+    host.Start(image.data(), image.size(), md5);
+    run(host);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(host.NodeRunsBase());
+    TEST_ASSERT_TRUE((host.GetCapabilities() & kCANUpdateCapabilityDelta) != 0);
+    TEST_ASSERT_TRUE(host.GetEncoding() == CANUpdateEncoding::kDeltaPages);
+    TEST_ASSERT_TRUE(target.image == image);
+    printf("delta update: %u blocks for %u bytes\n", host.GetBlockCount(), static_cast<unsigned>(image.size()));
+    TEST_ASSERT_TRUE(host.GetBlockCount() * 20 < (image.size() + 6) / 7);
+
+    // a base the node doesn't run falls back to the full image
+    std::array<uint8_t, 16> other_md5 = base_md5;
+    other_md5[15] ^= 1;
+    host.SetBase(base.data(), base.size(), other_md5.data());
+    host.Start(image.data(), image.size(), md5);
+    run(host);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_FALSE(host.NodeRunsBase());
+    TEST_ASSERT_TRUE(host.GetEncoding() == CANUpdateEncoding::kDeflatePages);
+    TEST_ASSERT_TRUE(target.image == image);
+}
+
+void CANUpdateWriterTest(void)
+{
+    std::vector<uint8_t> image(40000);
+    uint32_t state = 3;
+    const char kText[] = "pages are written while frames keep coming ";
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        state = state * 1103515245 + 12345;
+        image[i] = i % 64 < 32 ? static_cast<uint8_t>(kText[i % 64 % (sizeof(kText) - 1)])
+                               : static_cast<uint8_t>(state >> 16);
+    }
+    uint8_t md5[16]{};
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint host_endpoint{bus};
+    VirtualCANBus::Endpoint node_endpoint{bus};
+    host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    node_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    VirtualTimerGroup node_timers;
+    MemoryUpdateTarget target{image};
+    CANUpdateDevice device{0x530, node_endpoint, node_timers, target, 1, [&bus]() { return bus.GetMillis(); }};
+    CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }};
+
+    // a flash that takes 80 ms per page, slower than compressed pages arrive, and holds on to the last pages for
+    // hold_last_ms once the host has nothing left to send
+    device.SetWriter([]() {});
+    auto update = [&](const std::function<void(void)> &write_pending, uint32_t hold_last_ms)
+    {
+        uint64_t flash_busy_until_ms = 0;
+        bool held = false;
+        host.Start(image.data(), image.size(), md5);
+        for (uint32_t step = 0; step < 50000 && host.GetState() != CANUpdateHost::State::kDone
+                                && host.GetState() != CANUpdateHost::State::kFailed;
+             step++)
+        {
+            bus.RunFor(100000);
+            if (step % 10 == 0)
+            {
+                node_endpoint.Tick();
+                uint32_t queued = device.GetQueuedPages();
+                if (queued > 0 && bus.GetMillis() >= flash_busy_until_ms)
+                {
+                    if (!held && hold_last_ms > 0 && host.GetAckedBlocks() == host.GetBlockCount())
+                    {
+                        held = true;
+                        flash_busy_until_ms = bus.GetMillis() + hold_last_ms;
+                    }
+                    else
+                    {
+                        write_pending();
+                        flash_busy_until_ms = bus.GetMillis() + 80 * queued;
+                    }
+                }
+                node_timers.Tick(bus.GetMillis());
+            }
+            host_endpoint.Tick();
+            host.Tick();
+        }
+        return held;
+    };
+
+    update([&device]() { device.WritePending(); }, 0);
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(target.image == image);
+    printf("writer: %u stalls, %u retransmitted\n", device.GetWriteStalls(), host.GetRetransmittedBlocks());
+    TEST_ASSERT_TRUE(device.GetWriteStalls() > 0);
+    TEST_ASSERT_EQUAL(device.GetWriteStalls(), host.GetWriteStalls());
+    TEST_ASSERT_EQUAL(kCANUpdateWriteBuffers, host.GetMaxQueuedPages());
+    TEST_ASSERT_EQUAL(0, device.GetQueuedPages());
+
+    // and a writer thread, which the node's loop hands each write to and waits for, so the run is the same every time
+    std::mutex writer_mutex;
+    std::condition_variable writer_turn_changed;
+    bool writer_turn = false;
+    bool stop = false;
+    std::thread writer{[&]()
+                       {
+                           std::unique_lock<std::mutex> lock{writer_mutex};
+                           while (true)
+                           {
+                               writer_turn_changed.wait(lock, [&]() { return writer_turn || stop; });
+                               if (stop)
+                               {
+                                   return;
+                               }
+                               device.WritePending();
+                               writer_turn = false;
+                               writer_turn_changed.notify_all();
+                           }
+                       }};
+    auto write_on_thread = [&]()
+    {
+        std::unique_lock<std::mutex> lock{writer_mutex};
+        writer_turn = true;
+        writer_turn_changed.notify_all();
+        writer_turn_changed.wait(lock, [&]() { return !writer_turn; });
+    };
+    update(write_on_thread, 0);
+    bool threaded_done = host.GetState() == CANUpdateHost::State::kDone && target.image == image;
+
+    // the last pages are written well past the update timeout after the last frame, and the update still ends
+    bool held = update(write_on_thread, 3 * 500);
+    bool held_done = host.GetState() == CANUpdateHost::State::kDone && target.image == image;
+    {
+        std::lock_guard<std::mutex> lock{writer_mutex};
+        stop = true;
+    }
+    writer_turn_changed.notify_all();
+    writer.join();
+    TEST_ASSERT_TRUE(threaded_done);
+    TEST_ASSERT_TRUE(held);
+    TEST_ASSERT_TRUE(held_done);
+}
+
+void CANUpdateResumeTest(void)
+{
+    std::vector<uint8_t> image(40000);
+    uint32_t state = 5;
+    const char kText[] = "the update goes on where it stopped ";
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        state = state * 1103515245 + 12345;
+        image[i] = i % 64 < 32 ? static_cast<uint8_t>(kText[i % 64 % (sizeof(kText) - 1)])
+                               : static_cast<uint8_t>(state >> 16);
+    }
+    uint8_t md5[16]{};
+    md5[0] = 3;
+    MemoryUpdateTarget target{image};
+    target.resumable = true;
+
+    for (bool compress : {true, false})
+    {
+        uint32_t full_blocks = 0;
+        uint32_t held_pages = 0;
+        // the first host goes away once a few pages are written, then the node is power cycled and a new host
+        // sends the rest
+        for (int boot = 0; boot < 2; boot++)
+        {
+            VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+            VirtualCANBus::Endpoint host_endpoint{bus};
+            VirtualCANBus::Endpoint node_endpoint{bus};
+            host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+            node_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+            VirtualTimerGroup node_timers;
+            CANUpdateDevice device{0x530, node_endpoint, node_timers, target, 1, [&bus]() { return bus.GetMillis(); }};
+            CANUpdateHost::Options options;
+            options.compress = compress;
+            CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }, options};
+            host.Start(image.data(), image.size(), md5);
+            for (uint32_t step = 0; step < 50000 && host.GetState() != CANUpdateHost::State::kDone
+                                    && host.GetState() != CANUpdateHost::State::kFailed
+                                    && (boot > 0 || host.GetState() != CANUpdateHost::State::kTransferring
+                                        || target.image.size() < 3 * kCANUpdatePageBytes);
+                 step++)
+            {
+                bus.RunFor(100000);
+                if (step % 10 == 0)
+                {
+                    node_endpoint.Tick();
+                    node_timers.Tick(bus.GetMillis());
+                }
+                host_endpoint.Tick();
+                host.Tick();
+            }
+            if (boot == 0)
+            {
+                TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kTransferring);
+                TEST_ASSERT_EQUAL(0, host.GetFirstPage());
+                full_blocks = host.GetBlockCount();
+                for (int ms = 0; ms < 1000; ms++)
+                {
+                    bus.RunFor(1000000);
+                    node_endpoint.Tick();
+                    node_timers.Tick(bus.GetMillis());
+                }
+                TEST_ASSERT_FALSE(device.IsUpdating());
+                held_pages = static_cast<uint32_t>(target.image.size() / kCANUpdatePageBytes);
+                continue;
+            }
+            TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+            TEST_ASSERT_TRUE(target.image == image);
+            TEST_ASSERT_TRUE((host.GetCapabilities() & kCANUpdateCapabilityResume) != 0);
+            TEST_ASSERT_TRUE(held_pages >= 3);
+            TEST_ASSERT_EQUAL(held_pages, host.GetFirstPage());
+            printf("resumed update: from page %u, %u of %u blocks\n",
+                   host.GetFirstPage(),
+                   host.GetBlockCount(),
+                   full_blocks);
+            TEST_ASSERT_TRUE(host.GetBlockCount() < full_blocks - full_blocks / 4);
+        }
+    }
+    TEST_ASSERT_EQUAL(2, target.resumes);
+    TEST_ASSERT_EQUAL(2, target.begins);
+    uint32_t pages = 0;
+    TEST_ASSERT_TRUE(target.GetWrittenPages(target.md5.c_str(), pages));
+    TEST_ASSERT_EQUAL(0, pages);  // an image that ended starts over
+}
+
+void CANUpdatePageCRCTest(void)
+{
+    std::vector<uint8_t> image(30000);
+    uint32_t state = 5;
+    const char kText[] = "a page that fails its CRC is sent again ";
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        state = state * 1103515245 + 12345;
+        image[i] = i % 64 < 32 ? static_cast<uint8_t>(kText[i % 64 % (sizeof(kText) - 1)])
+                               : static_cast<uint8_t>(state >> 16);
+    }
+    uint8_t md5[16]{};
+    md5[0] = 5;
+
+    MemoryUpdateTarget target{image};
+
+    // each update on a bus of its own, which the host and the node are gone from before it goes
+    struct Run
+    {
+        bool done;
+        bool used_page_crc;
+        uint32_t host_bad_pages;
+        uint32_t device_bad_pages;
+        uint32_t corrupted;
+        bool updating;
+    };
+    auto update = [&](bool compress, bool page_crc, uint32_t corrupt_copies)
+    {
+        VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+        VirtualCANBus::Endpoint host_endpoint{bus};
+        VirtualCANBus::Endpoint node_endpoint{bus};
+        host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+        node_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+        DroppingCAN node_can{node_endpoint, 100000};
+        VirtualTimerGroup node_timers;
+        CANUpdateDevice device{0x530, node_can, node_timers, target, 1, [&bus]() { return bus.GetMillis(); }};
+        CANUpdateHost::Options options;
+        options.compress = compress;
+        options.page_crc = page_crc;
+        CANUpdateHost host{host_endpoint, 0x530, [&bus]() { return bus.GetMicros(); }, options};
+        // a block a few pages in arrives corrupt, past anything the CAN CRC would catch
+        node_can.corrupt_block = compress ? 700 : 1300;
+        node_can.corrupt_copies = corrupt_copies;
+        host.Start(image.data(), image.size(), md5);
+        for (uint32_t step = 0; step < 50000 && host.GetState() != CANUpdateHost::State::kDone
+                                && host.GetState() != CANUpdateHost::State::kFailed;
+             step++)
+        {
+            bus.RunFor(100000);
+            if (step % 10 == 0)
+            {
+                node_can.Tick();
+                node_timers.Tick(bus.GetMillis());
+            }
+            host_endpoint.Tick();
+            host.Tick();
+        }
+        return Run{host.GetState() == CANUpdateHost::State::kDone,
+                   host.UsesPageCRC(),
+                   host.GetBadPages(),
+                   device.GetBadPages(),
+                   node_can.corrupted,
+                   device.IsUpdating()};
+    };
+
+    for (bool compress : {false, true})
+    {
+        // the page is sent again from its first block, and the update goes on
+        Run run = update(compress, true, 1);
+        TEST_ASSERT_TRUE(run.done);
+        TEST_ASSERT_TRUE(run.used_page_crc);
+        TEST_ASSERT_EQUAL(1, run.host_bad_pages);
+        TEST_ASSERT_EQUAL(1, run.device_bad_pages);
+        TEST_ASSERT_EQUAL(1, run.corrupted);
+        TEST_ASSERT_TRUE(target.image == image);
+
+        // a page that keeps arriving corrupt ends the update
+        run = update(compress, true, 100);
+        TEST_ASSERT_FALSE(run.done);
+        TEST_ASSERT_EQUAL(kCANUpdatePageAttempts, run.corrupted);
+        TEST_ASSERT_EQUAL(kCANUpdatePageAttempts, run.device_bad_pages);
+        TEST_ASSERT_FALSE(run.updating);
+    }
+    // without page CRCs a raw block's corruption only shows in the MD5 once the whole image is sent
+    Run run = update(false, false, 1);
+    TEST_ASSERT_FALSE(run.done);
+    TEST_ASSERT_FALSE(run.used_page_crc);
+    TEST_ASSERT_EQUAL(1, run.corrupted);
+    TEST_ASSERT_TRUE(target.image.size() == image.size());
+}
+
+void CANUpdateGroupTest(void)
+{
+    std::vector<uint8_t> image(20000);
+    uint32_t state = 9;
+    const char kText[] = "every node in the group takes the same frames ";
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        state = state * 1103515245 + 12345;
+        image[i] = i % 64 < 32 ? static_cast<uint8_t>(kText[i % 64 % (sizeof(kText) - 1)])
+                               : static_cast<uint8_t>(state >> 16);
+    }
+    uint8_t md5[16]{};
+    md5[0] = 4;
+
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint host_endpoint{bus};
+    host_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    // three nodes, two of which drop frames, on their own update IDs and a shared group ID
+    const uint32_t kGroupId = 0x5F0;
+    const std::vector<uint32_t> kUpdateIds{0x530, 0x540, 0x550};
+    std::vector<uint8_t> third_expected = image;
+    std::vector<std::unique_ptr<VirtualCANBus::Endpoint>> endpoints;
+    std::vector<std::unique_ptr<DroppingCAN>> node_cans;
+    std::vector<std::unique_ptr<VirtualTimerGroup>> node_timers;
+    std::vector<std::unique_ptr<MemoryUpdateTarget>> targets;
+    std::vector<std::unique_ptr<CANUpdateDevice>> devices;
+    for (size_t i = 0; i < kUpdateIds.size(); i++)
+    {
+        endpoints.emplace_back(new VirtualCANBus::Endpoint{bus});
+        endpoints.back()->Initialize(ICAN::BaudRate::kBaud1M);
+        uint32_t drop_every = static_cast<uint32_t>(i == 0 ? 100000 : 40 + 30 * i);
+        node_cans.emplace_back(new DroppingCAN{*endpoints.back(), drop_every});
+        node_timers.emplace_back(new VirtualTimerGroup);
+        targets.emplace_back(new MemoryUpdateTarget{i == 2 ? third_expected : image});
+        devices.emplace_back(new CANUpdateDevice{kUpdateIds[i],
+                                                 *node_cans.back(),
+                                                 *node_timers.back(),
+                                                 *targets.back(),
+                                                 static_cast<uint32_t>(i),
+                                                 [&bus]() { return bus.GetMillis(); },
+                                                 kGroupId});
+    }
+    CANUpdateHost host{host_endpoint, kGroupId, kUpdateIds, [&bus]() { return bus.GetMicros(); }};
+
+    auto run = [&]()
+    {
+        for (uint32_t step = 0; step < 50000 && host.GetState() != CANUpdateHost::State::kDone
+                                && host.GetState() != CANUpdateHost::State::kFailed;
+             step++)
+        {
+            bus.RunFor(100000);
+            if (step % 10 == 0)
+            {
+                for (size_t i = 0; i < devices.size(); i++)
+                {
+                    node_cans[i]->Tick();
+                    node_timers[i]->Tick(bus.GetMillis());
+                }
+            }
+            host_endpoint.Tick();
+            host.Tick();
+        }
+    };
+
+    host.Start(image.data(), image.size(), md5);
+    run();
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(host.GetEncoding() == CANUpdateEncoding::kDeflatePages);
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        TEST_ASSERT_TRUE(targets[i]->image == image);
+        TEST_ASSERT_EQUAL(i, host.GetFirmwareVersion(i));
+    }
+    // the stream goes out once, with only the blocks some node missed again
+    uint32_t dropped = node_cans[1]->dropped + node_cans[2]->dropped;
+    printf("group update: %u blocks to %u nodes in %llu frames, %u dropped, %u retransmitted\n",
+           host.GetBlockCount(),
+           static_cast<unsigned>(devices.size()),
+           static_cast<unsigned long long>(host.GetFramesSent()),
+           dropped,
+           host.GetRetransmittedBlocks());
+    TEST_ASSERT_TRUE(dropped > 0);
+    TEST_ASSERT_TRUE(host.GetRetransmittedBlocks() >= dropped / 2);
+    TEST_ASSERT_TRUE(host.GetFramesSent() < host.GetBlockCount() + dropped * 2);
+
+    // a node whose image fails its check is left out, the others are updated
+    third_expected[0] ^= 1;
+    host.Start(image.data(), image.size(), md5);
+    run();
+    TEST_ASSERT_TRUE(host.GetState() == CANUpdateHost::State::kFailed);
+    TEST_ASSERT_TRUE(host.GetNodeState(0) == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(host.GetNodeState(1) == CANUpdateHost::State::kDone);
+    TEST_ASSERT_TRUE(host.GetNodeState(2) == CANUpdateHost::State::kFailed);
+}
+
 int runUnityTests(void)
 {
     UNITY_BEGIN();
@@ -377,6 +2623,31 @@ int runUnityTests(void)
     RUN_TEST(MultiplexedCANMessageTest);
     RUN_TEST(IVTBigEndianCanSignalTest);
     RUN_TEST(SafeRawSignalLimitTest);
+    RUN_TEST(CANTXMessageEncodeInPlaceTest);
+    RUN_TEST(CANTXQueueMultiProducerStressTest);
+    RUN_TEST(CANBusStatisticsTest);
+    RUN_TEST(DBCDatabaseTest);
+    RUN_TEST(CANResponseTimeAnalysisTest);
+    RUN_TEST(DBCPackerTest);
+    RUN_TEST(VirtualCANBusTest);
+    RUN_TEST(DBCTrafficGeneratorTest);
+    RUN_TEST(CANLogTest);
+    RUN_TEST(CANRawTapTest);
+    RUN_TEST(DBCDecodeTableTest);
+    RUN_TEST(CANLogDecoderTest);
+    RUN_TEST(CANColumnarTest);
+    RUN_TEST(CANResamplerTest);
+    RUN_TEST(CANLogReplayTest);
+    RUN_TEST(CANLogIndexTest);
+    RUN_TEST(DeflateTest);
+    RUN_TEST(CANUpdateTest);
+    RUN_TEST(CANUpdateRestartTest);
+    RUN_TEST(MD5Test);
+    RUN_TEST(CANUpdateDeltaTest);
+    RUN_TEST(CANUpdateWriterTest);
+    RUN_TEST(CANUpdateResumeTest);
+    RUN_TEST(CANUpdatePageCRCTest);
+    RUN_TEST(CANUpdateGroupTest);
     return UNITY_END();
 }
 
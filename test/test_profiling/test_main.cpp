@@ -0,0 +1,87 @@
+// The CAN_PROFILING build, in a binary of its own so the main suite tests the default one
+#define NATIVE  // to make can interface increment last receive time
+#define CAN_PROFILING
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+
+#include "can_interface.h"
+#include "can_profiling.h"
+#include "unity.h"
+
+void setUp(void)
+{
+    // set stuff up here
+}
+
+void tearDown(void)
+{
+    // clean stuff up here
+}
+
+void CANProfilingTest(void)
+{
+    CANProfileHistogram histogram{};
+    histogram.Record(0);
+    histogram.Record(1);
+    histogram.Record(100);
+    histogram.Record(1000);
+    TEST_ASSERT_EQUAL(4, histogram.GetCount());
+    TEST_ASSERT_EQUAL(1000, histogram.GetMax());
+    TEST_ASSERT_EQUAL(1, histogram.GetBucket(0));
+    TEST_ASSERT_EQUAL(1, histogram.GetBucket(1));
+    TEST_ASSERT_EQUAL(1, histogram.GetBucket(7));
+    TEST_ASSERT_EQUAL(1, histogram.GetBucket(10));
+    TEST_ASSERT_EQUAL(127, histogram.GetPercentile(50));
+    TEST_ASSERT_EQUAL(1000, histogram.GetPercentile(99));
+
+    MockCAN can{};
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) rx_signal;
+    uint32_t callbacks = 0;
+    {
+        CANRXMessage<1> rx_msg{can, 0x123, []() { return 0; }, [&callbacks]() { callbacks++; }, rx_signal};
+        rx_msg.DecodeSignals(CANMessage{0x123, 1, std::array<uint8_t, 8>{42}});
+        rx_msg.DecodeSignals(CANMessage{0x124, 1, std::array<uint8_t, 8>{43}});
+        TEST_ASSERT_EQUAL(1, callbacks);
+
+        CANMessageProfile *profile = nullptr;
+        for (size_t i = 0; i < CANProfiler::kMaxMessages; i++)
+        {
+            CANMessageProfile *candidate = CANProfiler::Instance().GetMessage(i);
+            if (candidate != nullptr && candidate->GetID() == 0x123)
+            {
+                profile = candidate;
+            }
+        }
+        TEST_ASSERT_NOT_NULL(profile);
+        // only the matching frame is profiled
+        TEST_ASSERT_EQUAL(1, profile->decode_cycles.GetCount());
+        TEST_ASSERT_EQUAL(1, profile->callback_cycles.GetCount());
+
+        char report[4096]{};
+        FILE *out = tmpfile();
+        CANProfiler::Instance().Report(out);
+        rewind(out);
+        TEST_ASSERT(fread(report, 1, sizeof(report) - 1, out) > 0);
+        fclose(out);
+        std::cout << report;
+        TEST_ASSERT_NOT_NULL(strstr(report, "0x123"));
+        TEST_ASSERT_NOT_NULL(strstr(report, "callback"));
+    }
+    // destroyed messages are removed from the report
+    for (size_t i = 0; i < CANProfiler::kMaxMessages; i++)
+    {
+        CANMessageProfile *candidate = CANProfiler::Instance().GetMessage(i);
+        TEST_ASSERT(candidate == nullptr || candidate->GetID() != 0x123);
+    }
+}
+
+int runUnityTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(CANProfilingTest);
+    return UNITY_END();
+}
+
+int main(void) { return runUnityTests(); }
@@ -0,0 +1,560 @@
+// Native benchmarks of the signal codecs, message encode/decode and RX dispatch.
+//
+// Usage: bench [--dbc <file.dbc>] [--min-time-ms <ms>] [--output <file.json>]
+//
+// micro: encode and decode of one signal of each flavor
+// meso:  CANRXMessage and MultiplexedCANRXMessage decode, the same message decoded by a DBCDecodeTable, CANTXMessage
+//        encode
+// macro: one second of the DBC's traffic dispatched to N registered RX messages or decoded by a DBCDecodeTable of the
+//        whole DBC, binary log append and decode, and TX encode -> VirtualCANBus -> RX decode latency percentiles
+//        (host time, and simulated bus time with every message sent at its cycle time)
+//
+// Each benchmark runs 5 times for at least --min-time-ms (default 100) and the median is reported, as JSON on stdout
+// (or --output) and as a table on stderr.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "can_interface.h"
+#include "can_log.h"
+#include "dbc_database.h"
+#include "dbc_decode_table.h"
+#include "virtual_can_bus.h"
+
+struct BenchResult
+{
+    std::string group;
+    std::string name;
+    double ns_per_op;
+    uint64_t iterations;
+};
+
+static std::vector<BenchResult> results;
+static uint32_t min_time_ms = 100;
+
+template <typename T>
+static inline void DoNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Hides the dynamic type of a signal so calls stay virtual, like they are from inside a message
+template <typename T>
+static inline T *Launder(T *pointer)
+{
+    asm volatile("" : "+r"(pointer));
+    return pointer;
+}
+
+static uint64_t NowNs()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+/**
+ * @brief Times body(iterations), scaling the iteration count until one run takes at least min_time_ms, then reports
+ * the median of 5 runs
+ */
+template <typename Body>
+static void Bench(const char *group, const char *name, Body body)
+{
+    uint64_t iterations = 1000;
+    while (true)
+    {
+        uint64_t start = NowNs();
+        body(iterations);
+        uint64_t elapsed = NowNs() - start;
+        if (elapsed >= min_time_ms * 1000000ull / 2)
+        {
+            break;
+        }
+        iterations *= elapsed < 1000000 ? 10 : 2;
+    }
+    std::vector<double> samples;
+    for (int run = 0; run < 5; run++)
+    {
+        uint64_t start = NowNs();
+        body(iterations);
+        samples.push_back(static_cast<double>(NowNs() - start) / static_cast<double>(iterations));
+    }
+    std::sort(samples.begin(), samples.end());
+    results.push_back(BenchResult{group, name, samples[samples.size() / 2], iterations});
+    fprintf(stderr, "%-6s %-40s %10.2f ns/op\n", group, name, samples[samples.size() / 2]);
+}
+
+template <typename Signal, typename Value>
+static void BenchSignal(const char *flavor, Signal &signal, Value value)
+{
+    ICANSignal *signal_pointer = Launder<ICANSignal>(&signal);
+    std::string encode_name = std::string("encode/") + flavor;
+    std::string decode_name = std::string("decode/") + flavor;
+    Bench("micro",
+          encode_name.c_str(),
+          [&](uint64_t iterations)
+          {
+              uint64_t buffer = 0;
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  signal = static_cast<Value>(value + static_cast<Value>(i & 0x7));
+                  signal_pointer->EncodeSignal(&buffer);
+                  DoNotOptimize(buffer);
+              }
+          });
+    Bench("micro",
+          decode_name.c_str(),
+          [&](uint64_t iterations)
+          {
+              uint64_t buffer = 0x0123456789ABCDEFull;
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  buffer += i;
+                  signal_pointer->DecodeSignal(&buffer);
+                  DoNotOptimize(signal.value_ref());
+              }
+          });
+}
+
+static void MicroBenchmarks()
+{
+    MakeUnsignedCANSignal(uint16_t, 8, 16, 1, 0) unity;
+    BenchSignal("unity_u16", unity, static_cast<uint16_t>(1234));
+    MakeUnsignedCANSignal(float, 8, 16, 0.1, -40) scaled;
+    BenchSignal("scaled_u16", scaled, 12.5f);
+    MakeSignedCANSignal(int16_t, 4, 12, 1, 0) signed_unity;
+    BenchSignal("signed_i12", signed_unity, static_cast<int16_t>(-300));
+    MakeSignedCANSignal(float, 4, 12, 0.5, 0) signed_scaled;
+    BenchSignal("signed_scaled_i12", signed_scaled, -150.5f);
+    MakeEndianUnsignedCANSignal(uint16_t, 7, 16, 1, 0, ICANSignal::ByteOrder::kBigEndian) big_endian;
+    BenchSignal("big_endian_u16", big_endian, static_cast<uint16_t>(1234));
+    MakeEndianUnsignedCANSignal(uint32_t, 23, 32, 1, 0, ICANSignal::ByteOrder::kBigEndian) big_endian_32;
+    BenchSignal("big_endian_u32", big_endian_32, static_cast<uint32_t>(0xF7F7B5B5));
+    MakeKvaserEndianUnsignedCANSignal(uint16_t, 8, 16, 1, 0, ICANSignal::ByteOrder::kBigEndian) kvaser;
+    BenchSignal("kvaser_big_endian_u16", kvaser, static_cast<uint16_t>(1234));
+    MakeUnsignedCANSignal(uint64_t, 0, 64, 1, 0) unity_64;
+    BenchSignal("unity_u64", unity_64, static_cast<uint64_t>(0x0123456789ABCDEF));
+    MakeUnsignedCANSignal(double, 0, 64, 0.001, 0) scaled_64;
+    BenchSignal("scaled_u64", scaled_64, 123456.789);
+}
+
+// Accepts everything and drops it
+class NullCAN : public ICAN
+{
+public:
+    void Initialize(BaudRate baud __attribute__((unused))) override {}
+    bool SendMessage(CANMessage &msg) override
+    {
+        DoNotOptimize(msg.data_);
+        return true;
+    }
+    void RegisterRXMessage(ICANRXMessage &msg __attribute__((unused))) override {}
+    void Tick() override {}
+};
+
+static void MesoBenchmarks()
+{
+    NullCAN can;
+    CANMessage frame{0x100, 8, std::array<uint8_t, 8>{1, 2, 3, 4, 5, 6, 7, 8}};
+
+    MakeUnsignedCANSignal(uint16_t, 0, 16, 1, 0) rx_0;
+    MakeUnsignedCANSignal(float, 16, 16, 0.1, -40) rx_1;
+    MakeSignedCANSignal(int16_t, 32, 16, 1, 0) rx_2;
+    MakeEndianUnsignedCANSignal(uint16_t, 55, 16, 1, 0, ICANSignal::ByteOrder::kBigEndian) rx_3;
+    CANRXMessage<4> rx_message{can, 0x100, []() { return 0u; }, rx_0, rx_1, rx_2, rx_3};
+    ICANRXMessage *rx_pointer = Launder<ICANRXMessage>(&rx_message);
+    Bench("meso",
+          "CANRXMessage<4>/decode",
+          [&](uint64_t iterations)
+          {
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  frame.data_[0] = static_cast<uint8_t>(i);
+                  rx_pointer->DecodeSignals(frame);
+              }
+              DoNotOptimize(rx_0.value_ref());
+          });
+    // the same message decoded from a DBC loaded at runtime
+    DBCDatabase rx_database;
+    rx_database.Parse("BO_ 256 Bench: 8 Node\n"
+                      " SG_ S0 : 0|16@1+ (1,0) [0|0] \"\" Node\n"
+                      " SG_ S1 : 16|16@1+ (0.1,-40) [0|0] \"\" Node\n"
+                      " SG_ S2 : 32|16@1- (1,0) [0|0] \"\" Node\n"
+                      " SG_ S3 : 55|16@0+ (1,0) [0|0] \"\" Node\n");
+    DBCDecodeTable rx_table{rx_database};
+    const DBCDecodeTable *rx_table_pointer = Launder<const DBCDecodeTable>(&rx_table);
+    Bench("meso",
+          "DBCDecodeTable/decode_4_signals",
+          [&](uint64_t iterations)
+          {
+              double values[4];
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  frame.data_[0] = static_cast<uint8_t>(i);
+                  rx_table_pointer->Decode(frame, values);
+                  DoNotOptimize(values);
+              }
+          });
+    Bench("meso",
+          "CANRXMessage<4>/reject_other_id",
+          [&](uint64_t iterations)
+          {
+              CANMessage other{0x101, 8, frame.data_};
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  other.data_[0] = static_cast<uint8_t>(i);
+                  rx_pointer->DecodeSignals(other);
+              }
+          });
+
+    MakeUnsignedCANSignal(uint8_t, 0, 8, 1, 0) multiplexor;
+    MakeSignedCANSignal(int32_t, 8, 32, 1, 0) group_0_0;
+    MakeSignedCANSignal(int16_t, 40, 16, 1, 0) group_0_1;
+    MultiplexedSignalGroup<2> group_0{0, group_0_0, group_0_1};
+    MakeSignedCANSignal(int32_t, 8, 32, 1, 0) group_1_0;
+    MakeSignedCANSignal(int16_t, 40, 16, 1, 0) group_1_1;
+    MultiplexedSignalGroup<2> group_1{1, group_1_0, group_1_1};
+    MultiplexedCANRXMessage<2, uint8_t> multiplexed{can, 0x200, []() { return 0u; }, multiplexor, group_0, group_1};
+    ICANRXMessage *multiplexed_pointer = Launder<ICANRXMessage>(&multiplexed);
+    Bench("meso",
+          "MultiplexedCANRXMessage<2>/decode",
+          [&](uint64_t iterations)
+          {
+              CANMessage muxed{0x200, 8, frame.data_};
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  muxed.data_[0] = static_cast<uint8_t>(i & 1);
+                  multiplexed_pointer->DecodeSignals(muxed);
+              }
+              DoNotOptimize(group_1_0.value_ref());
+          });
+
+    MakeUnsignedCANSignal(uint16_t, 0, 16, 1, 0) tx_0;
+    MakeUnsignedCANSignal(float, 16, 16, 0.1, -40) tx_1;
+    MakeSignedCANSignal(int16_t, 32, 16, 1, 0) tx_2;
+    MakeEndianUnsignedCANSignal(uint16_t, 55, 16, 1, 0, ICANSignal::ByteOrder::kBigEndian) tx_3;
+    CANTXMessage<4> tx_message{can, 0x100, 8, 10, tx_0, tx_1, tx_2, tx_3};
+    ICANTXMessage *tx_pointer = Launder<ICANTXMessage>(&tx_message);
+    Bench("meso",
+          "CANTXMessage<4>/encode_and_send",
+          [&](uint64_t iterations)
+          {
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  tx_0 = static_cast<uint16_t>(i);
+                  tx_pointer->EncodeAndSend();
+              }
+          });
+}
+
+// A generic 4 x 16 bit message, enough to give every DBC message a realistic decode cost
+struct RXNode
+{
+    RXNode(ICAN &can, uint32_t id, std::function<void(void)> callback)
+        : message{can, id, []() { return 0u; }, callback, signal_0, signal_1, signal_2, signal_3}
+    {
+    }
+    MakeUnsignedCANSignal(uint16_t, 0, 16, 1, 0) signal_0;
+    MakeUnsignedCANSignal(float, 16, 16, 0.1, -40) signal_1;
+    MakeSignedCANSignal(int16_t, 32, 16, 1, 0) signal_2;
+    MakeUnsignedCANSignal(uint16_t, 48, 16, 1, 0) signal_3;
+    CANRXMessage<4> message;
+};
+
+struct TXNode
+{
+    TXNode(ICAN &can, const DBCMessage &dbc_message)
+        : message{can, dbc_message.id, dbc_message.extended_id, dbc_message.length, dbc_message.cycle_time_ms,
+                  signal_0, signal_1, signal_2, signal_3}
+    {
+    }
+    MakeUnsignedCANSignal(uint16_t, 0, 16, 1, 0) signal_0;
+    MakeUnsignedCANSignal(float, 16, 16, 0.1, -40) signal_1;
+    MakeSignedCANSignal(int16_t, 32, 16, 1, 0) signal_2;
+    MakeUnsignedCANSignal(uint16_t, 48, 16, 1, 0) signal_3;
+    CANTXMessage<4> message;
+};
+
+// Captures registrations so dispatch can be driven exactly like the hardware backends do it
+class DispatchCAN : public NullCAN
+{
+public:
+    void RegisterRXMessage(ICANRXMessage &msg) override { rx_messages.push_back(&msg); }
+    std::vector<ICANRXMessage *> rx_messages;
+};
+
+struct Percentiles
+{
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+static Percentiles GetPercentiles(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double fraction)
+    { return samples[std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()))]; };
+    return Percentiles{at(0.5), at(0.9), at(0.99), samples.back()};
+}
+
+// One second of traffic: every periodic message at its cycle time, event driven ones every 100 ms
+static std::vector<CANMessage> OneSecondOfTraffic(const std::vector<DBCMessage> &messages)
+{
+    std::mt19937 random{12345};
+    std::vector<std::pair<uint32_t, CANMessage>> timed;
+    for (const DBCMessage &message : messages)
+    {
+        uint32_t period = message.cycle_time_ms != 0 ? message.cycle_time_ms : 100;
+        for (uint32_t time = 0; time < 1000; time += period)
+        {
+            CANMessage frame{message.id, message.extended_id, message.length, std::array<uint8_t, 8>{}};
+            for (uint8_t &byte : frame.data_)
+            {
+                byte = static_cast<uint8_t>(random());
+            }
+            timed.push_back(std::make_pair(time, frame));
+        }
+    }
+    std::stable_sort(timed.begin(),
+                     timed.end(),
+                     [](const std::pair<uint32_t, CANMessage> &a, const std::pair<uint32_t, CANMessage> &b)
+                     { return a.first < b.first; });
+    std::vector<CANMessage> frames;
+    for (const std::pair<uint32_t, CANMessage> &entry : timed)
+    {
+        frames.push_back(entry.second);
+    }
+    return frames;
+}
+
+static std::string latency_json;
+
+static void MacroBenchmarks(const DBCDatabase &database)
+{
+    std::vector<DBCMessage> messages;
+    for (const DBCMessage &message : database.messages)
+    {
+        if (message.name != "VECTOR__INDEPENDENT_SIG_MSG")
+        {
+            messages.push_back(message);
+        }
+    }
+    std::vector<CANMessage> traffic = OneSecondOfTraffic(messages);
+
+    // RX dispatch with N registered messages, the backends hand every frame to every registered message
+    std::vector<size_t> registered_counts{1, 16, messages.size()};
+    for (size_t registered : registered_counts)
+    {
+        DispatchCAN can;
+        std::vector<std::unique_ptr<RXNode>> nodes;
+        for (size_t i = 0; i < registered && i < messages.size(); i++)
+        {
+            nodes.emplace_back(new RXNode(can, messages[i].id, nullptr));
+        }
+        std::string name = "dispatch/" + std::to_string(registered) + "_registered_per_frame";
+        Bench("macro",
+              name.c_str(),
+              [&](uint64_t iterations)
+              {
+                  for (uint64_t i = 0; i < iterations; i++)
+                  {
+                      const CANMessage &frame = traffic[i % traffic.size()];
+                      for (ICANRXMessage *rx_message : can.rx_messages)
+                      {
+                          rx_message->DecodeSignals(frame);
+                      }
+                  }
+              });
+    }
+
+    // Decoding the same traffic against the whole DBC loaded at runtime, every frame looked up and fully decoded
+    DBCDecodeTable table{database};
+    std::vector<double> values(table.GetMaxSignalCount());
+    Bench("macro",
+          "decode_table/all_messages_per_frame",
+          [&](uint64_t iterations)
+          {
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  table.Decode(traffic[i % traffic.size()], values.data());
+                  DoNotOptimize(values[0]);
+              }
+          });
+
+    // Binary logging of the same traffic, 8 frames per ms is a fully loaded 1M bus
+    std::vector<uint8_t> log;
+    CANLogWriter<4096, 2> writer{[&log](const uint8_t *block, size_t size)
+                                 {
+                                     if (log.size() < (1u << 22))
+                                     {
+                                         log.insert(log.end(), block, block + size);
+                                     }
+                                     return true;
+                                 }};
+    Bench("macro",
+          "log/append_per_frame",
+          [&](uint64_t iterations)
+          {
+              for (uint64_t i = 0; i < iterations; i++)
+              {
+                  writer.Append(traffic[i % traffic.size()], i * 125);
+                  writer.Flush();
+              }
+          });
+    std::vector<CANLogRecord> records;
+    Bench("macro",
+          "log/decode_per_frame",
+          [&](uint64_t iterations)
+          {
+              size_t offset = 0;
+              for (uint64_t i = 0; i < iterations; i += records.size())
+              {
+                  records.clear();
+                  DecodeCANLogBlock(log.data() + offset, 4096, records);
+                  offset = offset + 4096 < log.size() ? offset + 4096 : 0;
+              }
+          });
+
+    // End to end through the virtual bus at 1M
+    VirtualCANBus bus{ICAN::BaudRate::kBaud1M};
+    VirtualCANBus::Endpoint tx_endpoint{bus, VirtualCANBus::TXOrder::kPriority, 64};
+    VirtualCANBus::Endpoint rx_endpoint{bus, VirtualCANBus::TXOrder::kFIFO, 16, 256};
+    tx_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    rx_endpoint.Initialize(ICAN::BaudRate::kBaud1M);
+    uint64_t received_host_ns = 0;
+    std::vector<std::unique_ptr<TXNode>> tx_nodes;
+    std::vector<std::unique_ptr<RXNode>> rx_nodes;
+    for (const DBCMessage &message : messages)
+    {
+        tx_nodes.emplace_back(new TXNode(tx_endpoint, message));
+        rx_nodes.emplace_back(
+            new RXNode(rx_endpoint, message.id, [&received_host_ns]() { received_host_ns = NowNs(); }));
+    }
+
+    std::vector<double> host_latency;
+    for (int round = 0; round < 200; round++)
+    {
+        for (std::unique_ptr<TXNode> &node : tx_nodes)
+        {
+            node->signal_0 = static_cast<uint16_t>(round);
+            uint64_t start = NowNs();
+            node->message.EncodeAndSend();
+            bus.RunUntilIdle();
+            rx_endpoint.Tick();
+            host_latency.push_back(static_cast<double>(received_host_ns - start));
+        }
+    }
+
+    // Bus latency with every message queued at its cycle time for 10 s, so frames contend like on the car
+    std::vector<double> bus_latency;
+    bus.SetFrameObserver([&bus_latency](const CANMessage &msg __attribute__((unused)), uint64_t queued_ns,
+                                        uint64_t received_ns)
+                         { bus_latency.push_back(static_cast<double>(received_ns - queued_ns) / 1000.0); });
+    uint64_t simulation_start = NowNs();
+    for (uint32_t ms = 0; ms < 10000; ms++)
+    {
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            uint32_t period = messages[i].cycle_time_ms != 0 ? messages[i].cycle_time_ms : 100;
+            if (ms % period == 0)
+            {
+                tx_nodes[i]->message.EncodeAndSend();
+            }
+        }
+        bus.RunFor(1000000);
+        rx_endpoint.Tick();
+    }
+    double simulation_ms = static_cast<double>(NowNs() - simulation_start) / 1000000.0;
+
+    Percentiles host = GetPercentiles(host_latency);
+    Percentiles simulated = GetPercentiles(bus_latency);
+    char buffer[512];
+    snprintf(buffer,
+             sizeof(buffer),
+             "{\"host_ns\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f}, "
+             "\"bus_us_at_1M\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+             "\"simulated_seconds_per_host_second\": %.1f}",
+             host.p50, host.p90, host.p99, host.max,
+             simulated.p50, simulated.p90, simulated.p99, simulated.max,
+             10000.0 / simulation_ms);
+    latency_json = buffer;
+    fprintf(stderr,
+            "macro  end_to_end host ns p50 %.0f p90 %.0f p99 %.0f max %.0f\n"
+            "macro  end_to_end bus us at 1M p50 %.1f p90 %.1f p99 %.1f max %.1f (%.1fx real time)\n",
+            host.p50, host.p90, host.p99, host.max,
+            simulated.p50, simulated.p90, simulated.p99, simulated.max,
+            10000.0 / simulation_ms);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dbc_path = "docs/full_bus.dbc";
+    const char *output_path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--dbc") == 0 && i + 1 < argc)
+        {
+            dbc_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc)
+        {
+            min_time_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: bench [--dbc <file.dbc>] [--min-time-ms <ms>] [--output <file.json>]\n");
+            return 2;
+        }
+    }
+
+    DBCDatabase database;
+    std::string error;
+    if (!database.LoadFile(dbc_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", dbc_path, error.c_str());
+        return 2;
+    }
+
+    MicroBenchmarks();
+    MesoBenchmarks();
+    MacroBenchmarks(database);
+
+    FILE *out = output_path != nullptr ? fopen(output_path, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "could not open %s\n", output_path);
+        return 2;
+    }
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        fprintf(out,
+                "    {\"group\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.3f, \"iterations\": %llu}%s\n",
+                results[i].group.c_str(),
+                results[i].name.c_str(),
+                results[i].ns_per_op,
+                static_cast<unsigned long long>(results[i].iterations),
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"end_to_end_latency\": %s\n}\n", latency_json.c_str());
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
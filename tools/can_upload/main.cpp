@@ -0,0 +1,461 @@
+// Uploads an image to nodes running CANUpdate (see CANUpdateHost in can_update.h), as scripts/esp_can_update.py does.
+//
+// Usage: can_upload <image> --id <update id>[,<update id>...] [--group <id>] [--interface <name> | --virtual-bus <bps>]
+//                   [--bitrate <bps>] [--bus-load <percent>] [--base <image>] [--no-compress] [--no-delta]
+//                   [--no-resume] [--no-page-crc] [--timeout-s <s>]
+//
+// Several update IDs need the --group ID their nodes were given, and are updated at once. On --interface (default
+// can0), a SocketCAN interface already up at the bus's --bitrate (default 500000). With --virtual-bus, the nodes are
+// simulated on a VirtualCANBus at that bit rate instead, each a CANUpdateDevice writing to memory and running --base,
+// and the times printed are simulated. --base is the image the nodes are expected to run, to send deltas against (the
+// script keeps every image it uploaded in .pio/can_update/<md5>.bin). --bus-load paces the data frames to that share
+// of the bus, which leaves the rest to other traffic; by default they go as fast as the interface takes them. Prints
+// the encoding, the progress and the transfer rate to stderr.
+//
+// Exit codes: 0 on success, 1 if the update failed on a node or no block was acked for --timeout-s (default 10), 2 on
+// a usage, read or interface error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "can_update.h"
+#include "md5.h"
+#include "socket_can.h"
+#include "virtual_can_bus.h"
+
+struct UploadOptions
+{
+    uint32_t group_id{kCANUpdateNoGroup};
+    std::vector<uint32_t> update_ids;
+    CANUpdateHost::Options host;
+    uint64_t timeout_us{10000000};
+};
+
+static bool ReadFile(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    uint8_t chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+static bool ParseIds(const char *list, std::vector<uint32_t> &ids)
+{
+    while (*list != '\0')
+    {
+        char *end;
+        unsigned long id = strtoul(list, &end, 0);
+        if (end == list || id > 0x7FF)
+        {
+            return false;
+        }
+        ids.push_back(static_cast<uint32_t>(id));
+        list = *end == ',' ? end + 1 : end;
+    }
+    return !ids.empty();
+}
+
+static bool ParseBaud(uint32_t bps, ICAN::BaudRate &baud)
+{
+    switch (bps)
+    {
+        case 125000:
+            baud = ICAN::BaudRate::kBaud125k;
+            return true;
+        case 250000:
+            baud = ICAN::BaudRate::kBaud250K;
+            return true;
+        case 500000:
+            baud = ICAN::BaudRate::kBaud500K;
+            return true;
+        case 1000000:
+            baud = ICAN::BaudRate::kBaud1M;
+            return true;
+    }
+    return false;
+}
+
+static const char *EncodingName(CANUpdateEncoding encoding)
+{
+    switch (encoding)
+    {
+        case CANUpdateEncoding::kDeflatePages:
+            return "compressed";
+        case CANUpdateEncoding::kDeltaPages:
+            return "delta";
+        default:
+            return "raw";
+    }
+}
+
+// A node simulated on the virtual bus: keeps the image in memory and accepts it if its MD5 checks out
+class MemoryTarget : public ICANUpdateTarget
+{
+public:
+    explicit MemoryTarget(const std::vector<uint8_t> &base) : base_{base}
+    {
+        if (!base_.empty())
+        {
+            MD5(base_.data(), base_.size(), base_md5_);
+        }
+    }
+
+    bool Begin(uint32_t size, const char *md5) override
+    {
+        image_.clear();
+        size_ = size;
+        md5_ = md5;
+        return true;
+    }
+
+    bool Write(const uint8_t *data, size_t size) override
+    {
+        image_.insert(image_.end(), data, data + size);
+        return image_.size() <= size_;
+    }
+
+    bool End() override
+    {
+        uint8_t digest[16];
+        MD5(image_.data(), image_.size(), digest);
+        char hex[33];
+        for (size_t i = 0; i < 16; i++)
+        {
+            snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+        }
+        return image_.size() == size_ && md5_ == hex;
+    }
+
+    void Abort() override {}
+
+    bool GetBase(uint32_t &size, uint8_t *md5) override
+    {
+        size = static_cast<uint32_t>(base_.size());
+        memcpy(md5, base_md5_, sizeof(base_md5_));
+        return !base_.empty();
+    }
+
+    bool ReadBase(uint32_t offset, uint8_t *data, size_t size) override
+    {
+        if (offset > base_.size() || size > base_.size() - offset)
+        {
+            return false;
+        }
+        memcpy(data, base_.data() + offset, size);
+        return true;
+    }
+
+private:
+    const std::vector<uint8_t> &base_;
+    uint8_t base_md5_[16]{};
+    std::vector<uint8_t> image_;
+    uint32_t size_{0};
+    std::string md5_;
+};
+
+/**
+ * @brief Runs an update over any ICAN until every node is done or failed, or no block was acked for the timeout
+ *
+ * @param service Called between host ticks to move the bus along, e.g. reading the interface or simulating the bus
+ * @return The exit code
+ */
+static int Upload(ICAN &can_bus,
+                  const std::function<void(void)> &service,
+                  const std::function<uint64_t(void)> &get_micros,
+                  const std::vector<uint8_t> &image,
+                  const std::vector<uint8_t> &base,
+                  const UploadOptions &options)
+{
+    uint8_t md5[16];
+    MD5(image.data(), image.size(), md5);
+    CANUpdateHost host{can_bus,
+                       options.group_id != kCANUpdateNoGroup ? options.group_id : options.update_ids[0],
+                       options.update_ids,
+                       get_micros,
+                       options.host};
+    if (!base.empty())
+    {
+        uint8_t base_md5[16];
+        MD5(base.data(), base.size(), base_md5);
+        host.SetBase(base.data(), static_cast<uint32_t>(base.size()), base_md5);
+    }
+    host.Start(image.data(), static_cast<uint32_t>(image.size()), md5);
+
+    CANUpdateHost::State state = host.GetState();
+    uint32_t acked = 0;
+    uint64_t last_progress_us = get_micros();
+    uint64_t last_print_us = last_progress_us;
+    uint64_t transfer_start_us = last_progress_us;
+    while (host.GetState() != CANUpdateHost::State::kDone && host.GetState() != CANUpdateHost::State::kFailed)
+    {
+        service();
+        host.Tick();
+        uint64_t now_us = get_micros();
+        if (host.GetState() != state || host.GetAckedBlocks() != acked)
+        {
+            last_progress_us = now_us;
+        }
+        if (host.GetState() == CANUpdateHost::State::kTransferring && state != CANUpdateHost::State::kTransferring)
+        {
+            transfer_start_us = now_us;
+            fprintf(stderr,
+                    "sending %u blocks %s, from page %u\n",
+                    host.GetBlockCount(),
+                    EncodingName(host.GetEncoding()),
+                    host.GetFirstPage());
+            for (size_t i = 0; i < options.update_ids.size(); i++)
+            {
+                fprintf(stderr,
+                        "%#x: old firmware version %#x\n",
+                        options.update_ids[i],
+                        host.GetFirmwareVersion(i));
+            }
+        }
+        state = host.GetState();
+        acked = host.GetAckedBlocks();
+        if (state == CANUpdateHost::State::kTransferring && now_us - last_print_us >= 1000000)
+        {
+            fprintf(stderr, "\r%u/%u blocks", acked, host.GetBlockCount());
+            last_print_us = now_us;
+        }
+        if (now_us - last_progress_us >= options.timeout_us)
+        {
+            fprintf(stderr, "\nno progress for %.1f s, giving up\n", options.timeout_us * 1e-6);
+            return 1;
+        }
+    }
+
+    double transfer_s = (get_micros() - transfer_start_us) * 1e-6;
+    uint64_t sent_bytes = image.size() - std::min<uint64_t>(image.size(), host.GetFirstPage() * kCANUpdatePageBytes);
+    fprintf(stderr,
+            "\r%u blocks in %.2f s (%.1f KiB/s of image), %llu frames, %u retransmitted, %u pages sent again, %u "
+            "write stalls\n",
+            host.GetBlockCount(),
+            transfer_s,
+            transfer_s > 0 ? sent_bytes / 1024.0 / transfer_s : 0.0,
+            static_cast<unsigned long long>(host.GetFramesSent()),
+            host.GetRetransmittedBlocks(),
+            host.GetBadPages(),
+            host.GetWriteStalls());
+    int result = 0;
+    for (size_t i = 0; i < options.update_ids.size(); i++)
+    {
+        if (host.GetNodeState(i) == CANUpdateHost::State::kDone)
+        {
+            fprintf(stderr, "%#x: updated\n", options.update_ids[i]);
+        }
+        else
+        {
+            fprintf(stderr, "%#x: update failed\n", options.update_ids[i]);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    const char *image_path = nullptr;
+    const char *base_path = nullptr;
+    const char *interface = "can0";
+    uint32_t bitrate = 500000;
+    uint32_t virtual_bus_bps = 0;
+    double bus_load = 0;
+    UploadOptions options;
+    bool usage_error = false;
+    for (int i = 1; i < argc && !usage_error; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--id") == 0 && has_value)
+        {
+            usage_error = !ParseIds(argv[++i], options.update_ids);
+        }
+        else if (strcmp(argv[i], "--group") == 0 && has_value)
+        {
+            options.group_id = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+            usage_error = options.group_id > 0x7FF;
+        }
+        else if (strcmp(argv[i], "--interface") == 0 && has_value)
+        {
+            interface = argv[++i];
+        }
+        else if (strcmp(argv[i], "--virtual-bus") == 0 && has_value)
+        {
+            virtual_bus_bps = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--bitrate") == 0 && has_value)
+        {
+            bitrate = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--bus-load") == 0 && has_value)
+        {
+            bus_load = strtod(argv[++i], nullptr);
+            usage_error = bus_load <= 0 || bus_load > 100;
+        }
+        else if (strcmp(argv[i], "--base") == 0 && has_value)
+        {
+            base_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-compress") == 0)
+        {
+            options.host.compress = false;
+        }
+        else if (strcmp(argv[i], "--no-delta") == 0)
+        {
+            options.host.delta = false;
+        }
+        else if (strcmp(argv[i], "--no-resume") == 0)
+        {
+            options.host.resume = false;
+        }
+        else if (strcmp(argv[i], "--no-page-crc") == 0)
+        {
+            options.host.page_crc = false;
+        }
+        else if (strcmp(argv[i], "--timeout-s") == 0 && has_value)
+        {
+            options.timeout_us = static_cast<uint64_t>(strtod(argv[++i], nullptr) * 1e6);
+        }
+        else if (argv[i][0] != '-' && image_path == nullptr)
+        {
+            image_path = argv[i];
+        }
+        else
+        {
+            usage_error = true;
+        }
+    }
+    ICAN::BaudRate baud = ICAN::BaudRate::kBaud500K;
+    if (virtual_bus_bps != 0)
+    {
+        bitrate = virtual_bus_bps;
+    }
+    if (usage_error || image_path == nullptr || options.update_ids.empty()
+        || (options.update_ids.size() > 1 && options.group_id == kCANUpdateNoGroup) || !ParseBaud(bitrate, baud))
+    {
+        fprintf(stderr,
+                "usage: can_upload <image> --id <update id>[,<update id>...] [--group <id>] "
+                "[--interface <name> | --virtual-bus <125000|250000|500000|1000000>] [--bitrate <bps>] "
+                "[--bus-load <percent>] [--base <image>] [--no-compress] [--no-delta] [--no-resume] "
+                "[--no-page-crc] [--timeout-s <s>]\n");
+        return 2;
+    }
+    if (bus_load > 0)
+    {
+        // data frames are 8 byte extended frames
+        options.host.frame_interval_us =
+            static_cast<uint32_t>(CANWorstCaseFrameBits(8, true) * 1e6 / bitrate / (bus_load / 100));
+    }
+
+    std::vector<uint8_t> image;
+    std::vector<uint8_t> base;
+    if (!ReadFile(image_path, image) || image.empty())
+    {
+        fprintf(stderr, "could not read %s\n", image_path);
+        return 2;
+    }
+    if (base_path != nullptr && !ReadFile(base_path, base))
+    {
+        fprintf(stderr, "could not read %s\n", base_path);
+        return 2;
+    }
+
+    if (virtual_bus_bps != 0)
+    {
+        VirtualCANBus bus{baud};
+        VirtualCANBus::Endpoint host_endpoint{bus};
+        host_endpoint.Initialize(baud);
+        struct SimulatedNode
+        {
+            SimulatedNode(VirtualCANBus &bus, ICAN::BaudRate baud, const std::vector<uint8_t> &base)
+                : endpoint{bus}, target{base}
+            {
+                endpoint.Initialize(baud);
+            }
+
+            VirtualCANBus::Endpoint endpoint;
+            VirtualTimerGroup timers;
+            MemoryTarget target;
+            std::unique_ptr<CANUpdateDevice> device;
+        };
+        std::vector<std::unique_ptr<SimulatedNode>> nodes;
+        for (uint32_t update_id : options.update_ids)
+        {
+            nodes.emplace_back(new SimulatedNode{bus, baud, base});
+            SimulatedNode &node = *nodes.back();
+            node.device.reset(new CANUpdateDevice{update_id,
+                                                  node.endpoint,
+                                                  node.timers,
+                                                  node.target,
+                                                  0,
+                                                  [&bus]() { return bus.GetMillis(); },
+                                                  options.group_id});
+        }
+        // the nodes tick every millisecond, the host every 100 us
+        uint32_t step = 0;
+        return Upload(
+            host_endpoint,
+            [&]()
+            {
+                bus.RunFor(100000);
+                if (step++ % 10 == 0)
+                {
+                    for (std::unique_ptr<SimulatedNode> &node : nodes)
+                    {
+                        node->endpoint.Tick();
+                        node->timers.Tick(bus.GetMillis());
+                    }
+                }
+                host_endpoint.Tick();
+            },
+            [&bus]() { return bus.GetTimeNs() / 1000; },
+            image,
+            base,
+            options);
+    }
+
+    SocketCAN can_bus{interface};
+    can_bus.Initialize(baud);
+    if (!can_bus.IsOpen())
+    {
+        fprintf(stderr, "could not open %s\n", can_bus.GetError().c_str());
+        return 2;
+    }
+    auto start = std::chrono::steady_clock::now();
+    return Upload(
+        can_bus,
+        [&can_bus]()
+        {
+            can_bus.Tick();
+            // well under a frame time, so pacing and the window stay full
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        },
+        [start]()
+        {
+            return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+                    .count());
+        },
+        image,
+        base,
+        options);
+}
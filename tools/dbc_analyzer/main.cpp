@@ -0,0 +1,226 @@
+// Offline schedulability and bus-load analysis of a DBC file.
+//
+// Usage: dbc_analyzer <file.dbc> [--baud <bps>] [--sporadic-period-ms <ms>] [--strict] [--output <file.json>]
+//
+// Writes a JSON report (to stdout unless --output is given) with the worst-case frame time, response time and
+// deadline-monotonic check of every message at 125k, 250k, 500k and 1M, and the total utilization at each rate. A short
+// summary goes to stderr.
+//
+// Exit codes: 0 if every message meets its deadline at --baud (default 500000), 1 if not (or, with --strict, if the
+// priority order isn't deadline monotonic), 2 on a usage or parse error.
+//
+// Messages without a GenMsgCycleTime are event driven. By default they only add blocking, use --sporadic-period-ms to
+// treat them as sporadic with that minimum inter-arrival time (and deadline) instead.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "can_schedulability.h"
+#include "dbc_database.h"
+
+static const uint32_t kBaudRates[] = {125000, 250000, 500000, 1000000};
+
+static std::string JSONString(const std::string &text)
+{
+    std::string escaped = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+static std::string JSONNumber(double value)
+{
+    if (isinf(value))
+    {
+        return "null";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+            "usage: dbc_analyzer <file.dbc> [--baud <bps>] [--sporadic-period-ms <ms>] [--strict] "
+            "[--output <file.json>]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *dbc_path = nullptr;
+    const char *output_path = nullptr;
+    uint32_t baud = 500000;
+    uint32_t sporadic_period_ms = 0;
+    bool strict = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+        {
+            baud = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--sporadic-period-ms") == 0 && i + 1 < argc)
+        {
+            sporadic_period_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--strict") == 0)
+        {
+            strict = true;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && dbc_path == nullptr)
+        {
+            dbc_path = argv[i];
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+    if (dbc_path == nullptr || baud == 0)
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    DBCDatabase database;
+    std::string error;
+    if (!database.LoadFile(dbc_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", dbc_path, error.c_str());
+        return 2;
+    }
+
+    std::vector<const DBCMessage *> messages;
+    std::vector<CANStreamTiming> streams = CANStreamTimings(database, sporadic_period_ms, &messages);
+
+    std::vector<uint32_t> baud_rates(kBaudRates, kBaudRates + sizeof(kBaudRates) / sizeof(kBaudRates[0]));
+    if (std::find(baud_rates.begin(), baud_rates.end(), baud) == baud_rates.end())
+    {
+        baud_rates.push_back(baud);
+    }
+    std::vector<std::vector<CANStreamResult>> results;
+    for (uint32_t rate : baud_rates)
+    {
+        results.push_back(AnalyzeCANResponseTimes(streams, rate));
+    }
+    const size_t selected = static_cast<size_t>(std::find(baud_rates.begin(), baud_rates.end(), baud)
+                                                - baud_rates.begin());
+
+    size_t unschedulable = 0;
+    size_t deadline_monotonic_violations = 0;
+    size_t event_driven = 0;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        unschedulable += results[selected][i].schedulable ? 0 : 1;
+        deadline_monotonic_violations += results[selected][i].deadline_monotonic_violation ? 1 : 0;
+        event_driven += streams[i].period_us > 0 ? 0 : 1;
+    }
+
+    std::string json = "{\n";
+    json += "  \"dbc\": " + JSONString(dbc_path) + ",\n";
+    json += "  \"baud\": " + std::to_string(baud) + ",\n";
+    json += "  \"schedulable\": " + std::string(unschedulable == 0 ? "true" : "false") + ",\n";
+    json += "  \"unschedulable_messages\": " + std::to_string(unschedulable) + ",\n";
+    json += "  \"deadline_monotonic_violations\": " + std::to_string(deadline_monotonic_violations) + ",\n";
+    json += "  \"event_driven_messages\": " + std::to_string(event_driven) + ",\n";
+    json += "  \"baud_rates\": [\n";
+    for (size_t b = 0; b < baud_rates.size(); b++)
+    {
+        size_t failures = 0;
+        for (const CANStreamResult &result : results[b])
+        {
+            failures += result.schedulable ? 0 : 1;
+        }
+        json += "    {\"baud\": " + std::to_string(baud_rates[b])
+                + ", \"utilization\": " + JSONNumber(CANBusUtilization(streams, baud_rates[b]))
+                + ", \"schedulable\": " + (failures == 0 ? "true" : "false")
+                + ", \"unschedulable_messages\": " + std::to_string(failures) + "}"
+                + (b + 1 < baud_rates.size() ? ",\n" : "\n");
+    }
+    json += "  ],\n";
+    json += "  \"messages\": [\n";
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        const CANStreamResult &result = results[selected][i];
+        json += "    {\"id\": " + std::to_string(streams[i].id)
+                + ", \"extended_id\": " + (streams[i].extended_id ? "true" : "false")
+                + ", \"name\": " + JSONString(messages[i]->name) + ", \"sender\": " + JSONString(messages[i]->sender)
+                + ", \"length\": " + std::to_string(streams[i].length)
+                + ", \"period_ms\": " + (streams[i].period_us > 0 ? JSONNumber(streams[i].period_us / 1000) : "null")
+                + ", \"frame_bits\": " + std::to_string(result.frame_bits)
+                + ", \"deadline_monotonic_violation\": " + (result.deadline_monotonic_violation ? "true" : "false")
+                + ", \"response_us\": {";
+        for (size_t b = 0; b < baud_rates.size(); b++)
+        {
+            json += JSONString(std::to_string(baud_rates[b])) + ": " + JSONNumber(results[b][i].response_us)
+                    + (b + 1 < baud_rates.size() ? ", " : "");
+        }
+        json += "}, \"schedulable\": " + std::string(result.schedulable ? "true" : "false") + "}"
+                + (i + 1 < streams.size() ? ",\n" : "\n");
+    }
+    json += "  ]\n}\n";
+
+    FILE *out = stdout;
+    if (output_path != nullptr)
+    {
+        out = fopen(output_path, "w");
+        if (out == nullptr)
+        {
+            fprintf(stderr, "could not open %s\n", output_path);
+            return 2;
+        }
+    }
+    fputs(json.c_str(), out);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    for (size_t b = 0; b < baud_rates.size(); b++)
+    {
+        fprintf(stderr,
+                "%7u bps: utilization %6.2f %%\n",
+                static_cast<unsigned>(baud_rates[b]),
+                CANBusUtilization(streams, baud_rates[b]) * 100);
+    }
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        const CANStreamResult &result = results[selected][i];
+        if (!result.schedulable)
+        {
+            fprintf(stderr, "0x%X %s misses its deadline at %u bps\n", static_cast<unsigned>(streams[i].id),
+                    messages[i]->name.c_str(), static_cast<unsigned>(baud));
+        }
+        if (result.deadline_monotonic_violation)
+        {
+            fprintf(stderr, "0x%X %s (%u ms) has a higher priority than a message with a shorter period\n",
+                    static_cast<unsigned>(streams[i].id), messages[i]->name.c_str(),
+                    static_cast<unsigned>(streams[i].period_us / 1000));
+        }
+    }
+    fprintf(stderr, "%zu messages (%zu event driven), %zu unschedulable at %u bps, %zu deadline-monotonic violations\n",
+            streams.size(), event_driven, unschedulable, static_cast<unsigned>(baud), deadline_monotonic_violations);
+
+    if (unschedulable != 0 || (strict && deadline_monotonic_violations != 0))
+    {
+        return 1;
+    }
+    return 0;
+}
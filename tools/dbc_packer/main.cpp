@@ -0,0 +1,149 @@
+// Proposes a repacked layout of a DBC: signals of periodic messages with the same sender and cycle time are merged into
+// fewer full frames, and periodic messages get IDs in deadline-monotonic order (see PackDBCSignals in dbc_packer.h).
+//
+// Usage: dbc_packer <in.dbc> <out.dbc> [--baud <bps>]
+//
+// Writes the new layout to out.dbc (which docs/dbc_to_h.py can turn into a header directly) and prints the mapping from
+// new frames to original messages, and the frame rate, bus utilization and schedulability at --baud (default 500000)
+// before and after.
+//
+// Exit codes: 0 on success, 2 on a usage, parse or write error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "can_schedulability.h"
+#include "dbc_database.h"
+#include "dbc_packer.h"
+
+struct BusSummary
+{
+    size_t periodic_frames{0};
+    double frames_per_second{0};
+    double utilization{0};
+    size_t unschedulable{0};
+    size_t deadline_monotonic_violations{0};
+};
+
+static BusSummary Summarize(const DBCDatabase &database, uint32_t baud)
+{
+    BusSummary summary;
+    std::vector<CANStreamTiming> streams = CANStreamTimings(database);
+    std::vector<CANStreamResult> results = AnalyzeCANResponseTimes(streams, baud);
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        if (streams[i].period_us > 0)
+        {
+            summary.periodic_frames++;
+            summary.frames_per_second += 1000000.0 / streams[i].period_us;
+        }
+        summary.unschedulable += results[i].schedulable ? 0 : 1;
+        summary.deadline_monotonic_violations += results[i].deadline_monotonic_violation ? 1 : 0;
+    }
+    summary.utilization = CANBusUtilization(streams, baud);
+    return summary;
+}
+
+int main(int argc, char **argv)
+{
+    const char *input_path = nullptr;
+    const char *output_path = nullptr;
+    uint32_t baud = 500000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+        {
+            baud = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argv[i][0] != '-' && input_path == nullptr)
+        {
+            input_path = argv[i];
+        }
+        else if (argv[i][0] != '-' && output_path == nullptr)
+        {
+            output_path = argv[i];
+        }
+        else
+        {
+            input_path = nullptr;
+            break;
+        }
+    }
+    if (input_path == nullptr || output_path == nullptr || baud == 0)
+    {
+        fprintf(stderr, "usage: dbc_packer <in.dbc> <out.dbc> [--baud <bps>]\n");
+        return 2;
+    }
+
+    DBCDatabase input;
+    std::string error;
+    if (!input.LoadFile(input_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", input_path, error.c_str());
+        return 2;
+    }
+    DBCDatabase output = PackDBCSignals(input);
+    if (!output.SaveFile(output_path))
+    {
+        fprintf(stderr, "could not write %s\n", output_path);
+        return 2;
+    }
+
+    for (const DBCMessage &message : output.messages)
+    {
+        if (message.cycle_time_ms == 0)
+        {
+            continue;
+        }
+        printf("0x%03X %-24s %4u ms %u bytes:",
+               static_cast<unsigned>(message.id),
+               message.name.c_str(),
+               static_cast<unsigned>(message.cycle_time_ms),
+               static_cast<unsigned>(message.length));
+        const DBCMessage *original = nullptr;
+        for (const DBCMessage &candidate : input.messages)
+        {
+            original = candidate.name == message.name ? &candidate : original;
+        }
+        if (original != nullptr && original->signals.size() == message.signals.size())
+        {
+            bool same_layout = true;
+            for (size_t i = 0; i < message.signals.size(); i++)
+            {
+                same_layout = same_layout && original->signals[i].start_bit == message.signals[i].start_bit;
+            }
+            if (same_layout)
+            {
+                printf(" same layout, was 0x%03X\n", static_cast<unsigned>(original->id));
+                continue;
+            }
+        }
+        for (const DBCSignal &signal : message.signals)
+        {
+            printf(" %s@%u", signal.name.c_str(), static_cast<unsigned>(signal.start_bit));
+        }
+        printf("\n");
+    }
+
+    BusSummary before = Summarize(input, baud);
+    BusSummary after = Summarize(output, baud);
+    printf("\n%-32s %12s %12s\n", "", "before", "after");
+    printf("%-32s %12zu %12zu\n", "periodic frames", before.periodic_frames, after.periodic_frames);
+    printf("%-32s %12.0f %12.0f\n", "frames per second", before.frames_per_second, after.frames_per_second);
+    printf("%-32s %11.2f%% %11.2f%%\n", "utilization", before.utilization * 100, after.utilization * 100);
+    printf("%-32s %12zu %12zu\n", "unschedulable messages", before.unschedulable, after.unschedulable);
+    printf("%-32s %12zu %12zu\n",
+           "deadline-monotonic violations",
+           before.deadline_monotonic_violations,
+           after.deadline_monotonic_violations);
+    printf("\nbus load saved at %u bps: %.2f percentage points (%.1f%% of the original load)\n",
+           static_cast<unsigned>(baud),
+           (before.utilization - after.utilization) * 100,
+           before.utilization > 0 ? (before.utilization - after.utilization) / before.utilization * 100 : 0.0);
+    return 0;
+}
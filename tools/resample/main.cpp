@@ -0,0 +1,215 @@
+// Resamples signals of a decoded CAN log onto one fixed-rate time base (see CANResampler in can_resampler.h).
+//
+// Usage: resample <dbc> <log> --rate-hz <n> --signal <Message.Signal> [--signal ...] [--linear] [--max-age-ms <n>]
+//                 [--delay-ms <n>] [--output <file.csv>]
+//
+// Decodes the log like log_decode and writes a "timestamp_us,<Message.Signal>,..." CSV row per tick, to stdout unless
+// --output is given. Signals are held between samples unless --linear is given; with --max-age-ms a signal whose newest
+// sample is older than that at a tick is left empty. --delay-ms (default 100) must cover the period of the slowest
+// linearly interpolated signal for every tick to be bracketed.
+//
+// Exit codes: 0 on success, 2 on a usage, parse, read or write error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "can_log_decoder.h"
+#include "can_resampler.h"
+#include "dbc_database.h"
+
+// 1024 samples per signal covers the default delay for signals up to 10 kHz
+using Resampler = CANResampler<64, 1024>;
+
+static bool FindSignal(const DBCDatabase &database, const std::string &name, size_t &message, size_t &signal)
+{
+    size_t dot = name.find('.');
+    if (dot == std::string::npos)
+    {
+        return false;
+    }
+    for (message = 0; message < database.messages.size(); message++)
+    {
+        const DBCMessage &candidate = database.messages[message];
+        if (candidate.name.compare(0, std::string::npos, name, 0, dot) != 0)
+        {
+            continue;
+        }
+        for (signal = 0; signal < candidate.signals.size(); signal++)
+        {
+            if (candidate.signals[signal].name == name.substr(dot + 1))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dbc_path = nullptr;
+    const char *log_path = nullptr;
+    const char *output_path = nullptr;
+    std::vector<std::string> signal_names;
+    double rate_hz = 0;
+    bool linear = false;
+    uint32_t max_age_us = 0;
+    uint32_t delay_us = 100000;
+    bool usage_error = false;
+    for (int i = 1; i < argc && !usage_error; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--rate-hz") == 0 && has_value)
+        {
+            rate_hz = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--signal") == 0 && has_value)
+        {
+            signal_names.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--linear") == 0)
+        {
+            linear = true;
+        }
+        else if (strcmp(argv[i], "--max-age-ms") == 0 && has_value)
+        {
+            max_age_us = static_cast<uint32_t>(strtod(argv[++i], nullptr) * 1000);
+        }
+        else if (strcmp(argv[i], "--delay-ms") == 0 && has_value)
+        {
+            delay_us = static_cast<uint32_t>(strtod(argv[++i], nullptr) * 1000);
+        }
+        else if (strcmp(argv[i], "--output") == 0 && has_value)
+        {
+            output_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && dbc_path == nullptr)
+        {
+            dbc_path = argv[i];
+        }
+        else if (argv[i][0] != '-' && log_path == nullptr)
+        {
+            log_path = argv[i];
+        }
+        else
+        {
+            usage_error = true;
+        }
+    }
+    if (usage_error || log_path == nullptr || !(rate_hz > 0 && rate_hz <= 1e6) || signal_names.empty()
+        || signal_names.size() > 64)
+    {
+        fprintf(stderr,
+                "usage: resample <dbc> <log> --rate-hz <n> --signal <Message.Signal> [--signal ...] [--linear] "
+                "[--max-age-ms <n>] [--delay-ms <n>] [--output <file.csv>]\n");
+        return 2;
+    }
+
+    DBCDatabase database;
+    std::string error;
+    if (!database.LoadFile(dbc_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", dbc_path, error.c_str());
+        return 2;
+    }
+
+    Resampler resampler{static_cast<uint32_t>(1e6 / rate_hz + 0.5), delay_us};
+    // for each DBC message, the (signal index, resampler column) pairs to push from its frames
+    std::vector<std::vector<std::pair<size_t, size_t>>> columns(database.messages.size());
+    for (const std::string &name : signal_names)
+    {
+        size_t message;
+        size_t signal;
+        if (!FindSignal(database, name, message, signal))
+        {
+            fprintf(stderr, "%s: no signal %s\n", dbc_path, name.c_str());
+            return 2;
+        }
+        int column = resampler.AddSignal(
+            linear ? Resampler::Interpolation::kLinear : Resampler::Interpolation::kZeroOrderHold, max_age_us);
+        columns[message].push_back(std::make_pair(signal, static_cast<size_t>(column)));
+    }
+
+    FILE *out = stdout;
+    if (output_path != nullptr)
+    {
+        out = fopen(output_path, "w");
+        if (out == nullptr)
+        {
+            fprintf(stderr, "could not open %s\n", output_path);
+            return 2;
+        }
+    }
+    fprintf(out, "timestamp_us");
+    for (const std::string &name : signal_names)
+    {
+        fprintf(out, ",%s", name.c_str());
+    }
+    fprintf(out, "\n");
+
+    size_t rows = 0;
+    auto write_row = [out, &resampler, &rows](uint64_t tick_us, const double *values)
+    {
+        fprintf(out, "%llu", static_cast<unsigned long long>(tick_us));
+        for (size_t i = 0; i < resampler.GetSignalCount(); i++)
+        {
+            if (std::isnan(values[i]))
+            {
+                fprintf(out, ",");
+            }
+            else
+            {
+                fprintf(out, ",%.10g", values[i]);
+            }
+        }
+        fprintf(out, "\n");
+        rows++;
+    };
+
+    uint64_t last_timestamp_us = 0;
+    CANLogDecoder decoder{database};
+    bool decoded = decoder.DecodeFile(
+        log_path,
+        [&](const CANDecodedFrame &frame)
+        {
+            for (const std::pair<size_t, size_t> &column : columns[frame.message - database.messages.data()])
+            {
+                if (!std::isnan(frame.values[column.first]))
+                {
+                    resampler.Push(column.second, frame.timestamp_us, frame.values[column.first]);
+                }
+            }
+            // frames arrive in timestamp order, so every tick more than the delay before this one is complete
+            resampler.Poll(frame.timestamp_us, write_row);
+            last_timestamp_us = frame.timestamp_us;
+        },
+        &error);
+    if (decoded)
+    {
+        resampler.Poll(last_timestamp_us + delay_us, write_row);
+    }
+    if (output_path != nullptr && fclose(out) != 0 && decoded)
+    {
+        fprintf(stderr, "could not write %s\n", output_path);
+        return 2;
+    }
+    if (!decoded)
+    {
+        fprintf(stderr, "%s: %s\n", log_path, error.c_str());
+        return 2;
+    }
+    fprintf(stderr,
+            "%zu rows of %zu signals at %g Hz, %lu samples dropped\n",
+            rows,
+            resampler.GetSignalCount(),
+            rate_hz,
+            static_cast<unsigned long>(resampler.GetDroppedSamples()));
+    return 0;
+}
@@ -0,0 +1,291 @@
+// Generates synthetic traffic for the messages of a DBC (see DBCTrafficGenerator in dbc_traffic_generator.h).
+//
+// Usage: traffic_gen <dbc> [--duration-s <s>] [--rate-scale <x>] [--sporadic-period-ms <ms>] [--jitter-us <us>]
+//                    [--burst-period-ms <ms> --burst-frames <n>] [--error-rate <fraction>] [--seed <n>]
+//                    [--output <file> [--format candump|canlog]] [--virtual-bus <bps>]
+//
+// With --output, writes --duration-s (default 10) seconds of simulated traffic as a candump log ("(seconds) can0
+// ID#DATA" lines), or with --format canlog in the binary log format of can_log.h. With --virtual-bus, sends it through
+// a VirtualCANBus at that bit rate instead and reports how much of it the bus carried. Otherwise the frames are
+// dropped, which measures the generator itself. Prints the frame count, the simulated and host time, and the sustained
+// generation rate to stderr.
+//
+// Exit codes: 0 on success, 2 on a usage, parse or write error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "can_log.h"
+#include "dbc_database.h"
+#include "dbc_traffic_generator.h"
+#include "virtual_can_bus.h"
+
+static uint64_t NowNs()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+// candump -l format, the hex digits are written by hand since printing them is most of the cost
+static size_t FormatCandumpLine(char *out, uint64_t time_ns, const CANMessage &frame)
+{
+    static const char kHex[] = "0123456789ABCDEF";
+    char *p = out;
+    p += sprintf(p,
+                 "(%llu.%06llu) can0 ",
+                 static_cast<unsigned long long>(time_ns / 1000000000ull),
+                 static_cast<unsigned long long>(time_ns % 1000000000ull / 1000));
+    int digits = frame.extended_id_ ? 8 : 3;
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        *p++ = kHex[(frame.id_ >> (i * 4)) & 0xF];
+    }
+    *p++ = '#';
+    for (uint8_t i = 0; i < frame.len_ && i < 8; i++)
+    {
+        *p++ = kHex[frame.data_[i] >> 4];
+        *p++ = kHex[frame.data_[i] & 0xF];
+    }
+    *p++ = '\n';
+    return static_cast<size_t>(p - out);
+}
+
+static bool ParseBaud(uint32_t bps, ICAN::BaudRate &baud)
+{
+    switch (bps)
+    {
+        case 125000:
+            baud = ICAN::BaudRate::kBaud125k;
+            return true;
+        case 250000:
+            baud = ICAN::BaudRate::kBaud250K;
+            return true;
+        case 500000:
+            baud = ICAN::BaudRate::kBaud500K;
+            return true;
+        case 1000000:
+            baud = ICAN::BaudRate::kBaud1M;
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dbc_path = nullptr;
+    const char *output_path = nullptr;
+    double duration_s = 10;
+    uint32_t virtual_bus_bps = 0;
+    bool binary = false;
+    DBCTrafficGenerator::Options options;
+    bool usage_error = false;
+    for (int i = 1; i < argc && !usage_error; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--duration-s") == 0 && has_value)
+        {
+            duration_s = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--rate-scale") == 0 && has_value)
+        {
+            options.rate_scale = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--sporadic-period-ms") == 0 && has_value)
+        {
+            options.sporadic_period_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--jitter-us") == 0 && has_value)
+        {
+            options.jitter_us = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--burst-period-ms") == 0 && has_value)
+        {
+            options.burst_period_ms = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--burst-frames") == 0 && has_value)
+        {
+            options.burst_frames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--error-rate") == 0 && has_value)
+        {
+            options.error_rate = strtod(argv[++i], nullptr);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+        {
+            options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--output") == 0 && has_value)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--format") == 0 && has_value)
+        {
+            i++;
+            binary = strcmp(argv[i], "canlog") == 0;
+            usage_error = !binary && strcmp(argv[i], "candump") != 0;
+        }
+        else if (strcmp(argv[i], "--virtual-bus") == 0 && has_value)
+        {
+            virtual_bus_bps = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argv[i][0] != '-' && dbc_path == nullptr)
+        {
+            dbc_path = argv[i];
+        }
+        else
+        {
+            usage_error = true;
+        }
+    }
+    ICAN::BaudRate baud = ICAN::BaudRate::kBaud500K;
+    if (usage_error || dbc_path == nullptr || duration_s <= 0 || (output_path != nullptr && virtual_bus_bps != 0)
+        || (virtual_bus_bps != 0 && !ParseBaud(virtual_bus_bps, baud)))
+    {
+        fprintf(stderr,
+                "usage: traffic_gen <dbc> [--duration-s <s>] [--rate-scale <x>] [--sporadic-period-ms <ms>] "
+                "[--jitter-us <us>] [--burst-period-ms <ms> --burst-frames <n>] [--error-rate <fraction>] "
+                "[--seed <n>] [--output <file> [--format candump|canlog] "
+                "| --virtual-bus <125000|250000|500000|1000000>]\n");
+        return 2;
+    }
+
+    DBCDatabase database;
+    std::string error;
+    if (!database.LoadFile(dbc_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", dbc_path, error.c_str());
+        return 2;
+    }
+    DBCTrafficGenerator generator{database, options};
+    const uint64_t end_ns = static_cast<uint64_t>(duration_s * 1e9);
+
+    uint64_t start = NowNs();
+    if (virtual_bus_bps != 0)
+    {
+        VirtualCANBus bus{baud};
+        VirtualCANBus::Endpoint sender{bus, VirtualCANBus::TXOrder::kPriority, 64};
+        VirtualCANBus::Endpoint receiver{bus};
+        sender.Initialize(baud);
+        receiver.Initialize(baud);
+        uint64_t offered = 0;
+        uint64_t accepted = 0;
+        while (generator.PeekTimeNs() < end_ns)
+        {
+            uint64_t next_ns = generator.PeekTimeNs();
+            bus.RunUntil(next_ns);
+            receiver.Tick();
+            // the generator's clock and the bus's are the same simulated time
+            while (generator.PeekTimeNs() <= next_ns)
+            {
+                CANMessage frame;
+                generator.Next(frame);
+                offered++;
+                accepted += sender.SendMessage(frame) ? 1 : 0;
+            }
+        }
+        bus.RunUntil(end_ns);
+        receiver.Tick();
+        fprintf(stderr,
+                "virtual bus at %u bps: %llu frames offered, %llu dropped by a full TX queue, %llu carried, "
+                "%.2f%% busy\n",
+                static_cast<unsigned>(virtual_bus_bps),
+                static_cast<unsigned long long>(offered),
+                static_cast<unsigned long long>(offered - accepted),
+                static_cast<unsigned long long>(bus.GetFramesTransmitted()),
+                100.0 * bus.GetBusyTimeNs() / end_ns);
+    }
+    else if (binary && output_path != nullptr)
+    {
+        FILE *out = fopen(output_path, "wb");
+        if (out == nullptr)
+        {
+            fprintf(stderr, "could not open %s\n", output_path);
+            return 2;
+        }
+        CANLogWriter<4096, 2> writer{[out](const uint8_t *block, size_t size)
+                                     { return fwrite(block, 1, size, out) == size; }};
+        while (generator.PeekTimeNs() < end_ns)
+        {
+            CANMessage frame;
+            uint64_t time_ns = generator.Next(frame);
+            writer.Append(frame, time_ns / 1000);
+            writer.Flush();
+        }
+        writer.Seal();
+        writer.Flush();
+        if (fclose(out) != 0 || writer.GetWriteErrors() != 0 || writer.GetDroppedFrames() != 0)
+        {
+            fprintf(stderr, "could not write %s\n", output_path);
+            return 2;
+        }
+        fprintf(stderr,
+                "%llu blocks, %.2f record bytes per frame\n",
+                static_cast<unsigned long long>(writer.GetBlocksWritten()),
+                static_cast<double>(writer.GetBytesLogged()) / writer.GetFramesLogged());
+    }
+    else
+    {
+        FILE *out = nullptr;
+        if (output_path != nullptr && (out = fopen(output_path, "w")) == nullptr)
+        {
+            fprintf(stderr, "could not open %s\n", output_path);
+            return 2;
+        }
+        std::vector<char> buffer(1 << 20);
+        size_t used = 0;
+        volatile uint64_t sink = 0;
+        while (generator.PeekTimeNs() < end_ns)
+        {
+            CANMessage frame;
+            uint64_t time_ns = generator.Next(frame);
+            if (out == nullptr)
+            {
+                // keep the frame from being optimized away
+                sink = frame.data_[0];
+                continue;
+            }
+            if (used + 64 > buffer.size())
+            {
+                if (fwrite(buffer.data(), 1, used, out) != used)
+                {
+                    fprintf(stderr, "could not write %s\n", output_path);
+                    fclose(out);
+                    return 2;
+                }
+                used = 0;
+            }
+            used += FormatCandumpLine(buffer.data() + used, time_ns, frame);
+        }
+        (void)sink;
+        if (out != nullptr)
+        {
+            bool written = fwrite(buffer.data(), 1, used, out) == used;
+            if (fclose(out) != 0 || !written)
+            {
+                fprintf(stderr, "could not write %s\n", output_path);
+                return 2;
+            }
+        }
+    }
+    double host_s = (NowNs() - start) * 1e-9;
+
+    fprintf(stderr,
+            "%llu frames (%zu messages, nominal %.0f frames/s, %llu with injected errors) in %.3f simulated s, "
+            "generated in %.3f s: %.2f million frames/s, %.0fx real time\n",
+            static_cast<unsigned long long>(generator.GetFramesGenerated()),
+            generator.GetStreamCount(),
+            generator.GetFramesPerSecond(),
+            static_cast<unsigned long long>(generator.GetErrorsInjected()),
+            duration_s,
+            host_s,
+            generator.GetFramesGenerated() / host_s / 1e6,
+            duration_s / host_s);
+    return 0;
+}